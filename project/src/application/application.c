@@ -7,6 +7,12 @@
 
 #include "application.h"
 
+/**
+ * Shared cache and memory budget of the images switched to with "open"
+ */
+#define APP_CACHE_SECTORS 4096
+#define APP_MOUNT_BUDGET ((size_t)64 << 20)
+
 /**
  * Initialize the Application structure
  * @param app Pointer to the Application structure
@@ -18,6 +24,7 @@ int application_init(Application* app, Middleware* middleware) {
 
     app->middleware = middleware;
     app->running = false;
+    app->mount_manager_ready = false;
     if (-1 != middleware_init(middleware)) {
         app->running = true;
         return 0;
@@ -37,6 +44,13 @@ int application_init(Application* app, Middleware* middleware) {
 int application_denit(Application* app) {
     if (!app) return -1;
 
+    /* The manager may only go once the middleware released its volume */
+    if (app->mount_manager_ready) {
+        if (app->middleware) middleware_denit(app->middleware);
+        mount_manager_deinit(&app->mount_manager);
+        app->mount_manager_ready = false;
+    }
+
     app->middleware = NULL;
     app->running = false;
 
@@ -199,7 +213,35 @@ int application_process_command(Application* app, const char* command) {
 
     /* Handle the commands */
     if (strcmp(cmd, "ls") == 0) {
-        return middleware_ls(app->middleware);
+        /* Directory order by default, -n by name, -S largest first, -t newest first, -r reverses */
+        FatSortKey order = FAT_SORT_NAME;
+        bool sorted = false;
+        bool reverse = false;
+        char* option;
+        while ((option = strtok(NULL, " ")) != NULL) {
+            if (option[0] != '-' || option[1] == '\0') {
+                print_error("ls: invalid option: %s\n", option);
+                return -1;
+            }
+            for (const char* flag = option + 1; *flag; flag++) {
+                if (*flag == 'n') {
+                    order = FAT_SORT_NAME;
+                } else if (*flag == 'S') {
+                    order = FAT_SORT_SIZE;
+                } else if (*flag == 't') {
+                    order = FAT_SORT_MTIME;
+                } else if (*flag == 'r') {
+                    reverse = true;
+                } else {
+                    print_error("ls: invalid option: -%c\n", *flag);
+                    return -1;
+                }
+                sorted = true;
+            }
+        }
+        /* Size and time list the largest and the newest first */
+        if (order != FAT_SORT_NAME) reverse = !reverse;
+        return middleware_ls(app->middleware, sorted, order, reverse);
     } else if (strcmp(cmd, "cd") == 0) {
         char* path = strtok(NULL, " ");
         if (!path) {
@@ -207,15 +249,77 @@ int application_process_command(Application* app, const char* command) {
             return -1;
         }
         return middleware_cd(app->middleware, path);
+    } else if (strcmp(cmd, "stat") == 0) {
+        char* args[32];
+        int count = 0;
+        char* arg;
+        while (count < 32 && (arg = strtok(NULL, " ")) != NULL) {
+            args[count++] = arg;
+        }
+        if (count == 0) {
+            print_error("stat: missing operand\n");
+            return -1;
+        }
+        return middleware_stat(app->middleware, count, args);
     } else if (strcmp(cmd, "cat") == 0) {
+        char* args[32];
+        int count = 0;
+        char* arg;
+        while (count < 32 && (arg = strtok(NULL, " ")) != NULL) {
+            args[count++] = arg;
+        }
+        if (count == 0) {
+            print_error("cat: missing operand\n");
+            return -1;
+        }
+        return middleware_cat(app->middleware, count, args);
+    } else if (strcmp(cmd, "open") == 0) {
         char* path = strtok(NULL, " ");
         if (!path) {
-            print_error("cat: missing operand\n");
+            print_error("open: missing operand\n");
+            return -1;
+        }
+        return application_open(app, path);
+    } else if (strcmp(cmd, "export") == 0) {
+        char* path = strtok(NULL, " ");
+        char* host_directory = strtok(NULL, " ");
+        if (!path || !host_directory) {
+            print_error("export: usage: export <path> <host directory>\n");
+            return -1;
+        }
+        return middleware_export(app->middleware, path, host_directory);
+    } else if (strcmp(cmd, "import") == 0) {
+        char* host_path = strtok(NULL, " ");
+        char* path = strtok(NULL, " ");
+        if (!host_path || !path) {
+            print_error("import: usage: import <host path> <directory>\n");
             return -1;
         }
-        return middleware_cat(app->middleware, path);
+        return middleware_import(app->middleware, host_path, path);
     } else if (strcmp(cmd, "evidence") == 0) {
         return middleware_evidence(app->middleware);
+    } else if (strcmp(cmd, "refresh") == 0) {
+        return middleware_refresh(app->middleware);
+    } else if (strcmp(cmd, "check") == 0) {
+        return middleware_check(app->middleware);
+    } else if (strcmp(cmd, "defrag") == 0) {
+        return middleware_defrag(app->middleware);
+    } else if (strcmp(cmd, "find") == 0) {
+        char* args[32];
+        int count = 0;
+        char* arg;
+        while (count < 32 && (arg = strtok(NULL, " ")) != NULL) {
+            args[count++] = arg;
+        }
+        return middleware_find(app->middleware, count, args);
+    } else if (strcmp(cmd, "grep") == 0) {
+        char* args[32];
+        int count = 0;
+        char* arg;
+        while (count < 32 && (arg = strtok(NULL, " ")) != NULL) {
+            args[count++] = arg;
+        }
+        return middleware_grep(app->middleware, count, args);
     } else if (strcmp(cmd, "cls") == 0 || strcmp(cmd, "clear") == 0) {
         system("clear");
         return 0;
@@ -240,10 +344,22 @@ void application_show_help(Application* app) {
     (void)app; /* Avoid unused parameter warning */
 
     printf("Available commands:\n");
-    printf("  ls                  List files and directories\n");
+    printf("  ls [-n|-S|-t] [-r]  List files and directories in directory order, or by name,\n");
+    printf("                      size or time\n");
     printf("  cd <path>           Change directory\n");
-    printf("  cat <file>          Display file content\n");
+    printf("  cat <file>...       Display file content, files read together\n");
+    printf("  stat <path>...      Show type, size, first cluster and modification time\n");
+    printf("  open <img_file>     Switch to another image, kept mounted while memory allows\n");
+    printf("  export <path> <dir> Copy a file or directory tree to a host directory\n");
+    printf("  import <host> <dir> Copy a host file or directory tree into a directory (read-write)\n");
     printf("  evidence            Show file system information\n");
+    printf("  refresh             Reload directories changed by another program\n");
+    printf("  check               Check the volume for damaged chains\n");
+    printf("  defrag              Rewrite fragmented files contiguously (read-write)\n");
+    printf("  find [path] [opts]  Search by -name, -path, -type f|d, -size [+|-]N[k|M],\n");
+    printf("                      -newer/-older YYYY-MM-DD[THH:MM], -maxdepth N\n");
+    printf("  grep [-d dir] [-name glob] <text>...\n");
+    printf("                      Search file contents, print path:offset: line\n");
     printf("  cls, clear          Clear the screen\n");
     printf("  help                Show this help message\n");
     printf("  exit, quit          Exit the program\n");
@@ -260,6 +376,29 @@ void application_stop(Application* app) {
     print_info("Exiting...\n");
 }
 
+/**
+ * Switch to another image. The mount manager is set up on first use with the
+ * mount options of the command line
+ * @param app Pointer to the Application structure
+ * @param img_path Path to the image file
+ * @return 0 if successful, -1 if failed
+ */
+int application_open(Application* app, const char* img_path) {
+    if (!app || !app->middleware || !img_path) return -1;
+
+    if (!app->mount_manager_ready) {
+        if (mount_manager_init(&app->mount_manager, APP_CACHE_SECTORS, APP_MOUNT_BUDGET) != 0) {
+            print_error("Failed to initialize the mount manager\n");
+            return -1;
+        }
+        app->mount_manager.fat_run_index = app->middleware->fat_run_index;
+        app->mount_manager.mount_index = app->middleware->mount_index;
+        app->mount_manager_ready = true;
+    }
+
+    return middleware_open(app->middleware, &app->mount_manager, img_path);
+}
+
 /**
  * Main function
  * @param argc Argument count
@@ -269,17 +408,28 @@ void application_stop(Application* app) {
 int main(int argc, char* argv[]) {
     /* Check the command line arguments */
     if (argc < 2) {
-        print_warning("Usage: %s <img_file> [mode]\n", argv[0]);
+        print_warning("Usage: %s <img_file> [mode] [--run-index] [--mount-index]\n", argv[0]);
+        print_warning("       %s <img_file> format <size>[k|M|G] [fat12|fat16|fat32] [cluster size]\n", argv[0]);
         print_info("  <img_file>: Path to the image file\n");
         print_info("  [mode]: Optional, 'read-only' (default) or 'read-write'\n");
+        print_info("  --run-index: Build the FAT run index at mount (faster chain walks, slower mount)\n");
+        print_info("  --mount-index: Read-only mounts load and save the tree in <img_file>.idx\n");
+        print_info("  format: Create the image with an empty file system, then exit\n");
         return 1;
     }
+    
+    /* Format creates the image instead of opening it */
+    if (argc >= 3 && strcmp(argv[2], "format") == 0) {
+        return middleware_format(argv[1], argc - 3, argv + 3) == 0 ? 0 : 1;
+    }
 
     const char* img_path = argv[1];
     FileSystemMode mode = MODE_READ_ONLY; /* Default to read-only mode */
 
     /* Handle the mode argument if it exists */
-    if (argc >= 3) {
+    int option = 2;
+    if (argc >= 3 && strncmp(argv[2], "--", 2) != 0) {
+        option = 3;
         if (strcmp(argv[2], "read-write") == 0) {
             mode = MODE_READ_WRITE;
         } else if (strcmp(argv[2], "read-only") == 0) {
@@ -291,6 +441,20 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    /* Handle the options */
+    bool fat_run_index = false;
+    bool mount_index = false;
+    for (; option < argc; option++) {
+        if (strcmp(argv[option], "--run-index") == 0) {
+            fat_run_index = true;
+        } else if (strcmp(argv[option], "--mount-index") == 0) {
+            mount_index = true;
+        } else {
+            print_error("Invalid option: %s\n", argv[option]);
+            return 1;
+        }
+    }
+
     /* Initialize and run the application */
     Application app;
     Middleware middleware = {
@@ -299,7 +463,9 @@ int main(int argc, char* argv[]) {
         .fat_driver = NULL,
         .current_directory = NULL,
         .current_path = "/", /* Current directory is root */
-        .is_root_mode = false
+        .is_root_mode = false,
+        .fat_run_index = fat_run_index,
+        .mount_index = mount_index
     };
 
     if (application_init(&app, &middleware) != 0) {
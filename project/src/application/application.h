@@ -23,6 +23,8 @@ typedef struct {
     Middleware* middleware;
     char env_path[500];
     bool running;
+    MountManager mount_manager;
+    bool mount_manager_ready;
 } Application;
 
 /**
@@ -99,5 +101,13 @@ void application_show_help(Application* app);
  */
 void application_stop(Application* app);
 
+/**
+ * @brief Switch to another image through the application's mount manager
+ * @param app Pointer to Application structure
+ * @param img_path Path to image file
+ * @return 0 if success, -1 if fail
+ */
+int application_open(Application* app, const char* img_path);
+
 #endif // APPLICATION_H
 
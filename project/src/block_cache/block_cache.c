@@ -0,0 +1,593 @@
+/**
+ * @file block_cache.c
+ * @author Le Duc Son
+ * @date 2026-10-18
+ * @brief Block cache implementation
+ */
+
+#include "block_cache.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Maximum number of adjacent sectors written back with one request
+ */
+#define BLOCK_CACHE_FLUSH_RUN_SECTORS 64
+
+/* Local functions */
+static uint32_t block_cache_hash(const BlockCache* cache, const HAL* volume, uint32_t sector);
+static BlockCacheEntry* block_cache_find(const BlockCache* cache, const HAL* volume, uint32_t sector);
+static BlockCacheEntry* block_cache_lookup(BlockCache* cache, HAL* volume, uint32_t sector);
+static BlockCacheEntry* block_cache_get(BlockCache* cache, HAL* volume, uint32_t sector, bool count);
+static BlockCacheEntry* block_cache_victim(BlockCache* cache, bool clean_only);
+static void block_cache_assign(BlockCache* cache, BlockCacheEntry* entry, HAL* volume, uint32_t sector);
+static int block_cache_write_back(BlockCache* cache, BlockCacheEntry* entry);
+static void block_cache_lru_remove(BlockCache* cache, BlockCacheEntry* entry);
+static void block_cache_lru_push_front(BlockCache* cache, BlockCacheEntry* entry);
+static void block_cache_hash_remove(BlockCache* cache, BlockCacheEntry* entry);
+static int block_cache_compare_sector(const void* a, const void* b);
+
+/**
+ * Initialize a block cache
+ * @param cache Pointer to BlockCache structure
+ * @param capacity Number of sectors the cache can hold
+ * @param sector_size Size of one sector
+ * @return 0 if success, -1 if failed
+ */
+int block_cache_init(BlockCache* cache, uint32_t capacity, uint32_t sector_size) {
+    if (!cache || capacity == 0 || sector_size == 0) return -1;
+
+    memset(cache, 0, sizeof(BlockCache));
+    if (pthread_mutex_init(&cache->lock, NULL) != 0) return -1;
+    if (pthread_cond_init(&cache->idle, NULL) != 0) {
+        pthread_mutex_destroy(&cache->lock);
+        return -1;
+    }
+    if (pthread_mutex_init(&cache->flush_lock, NULL) != 0) {
+        pthread_cond_destroy(&cache->idle);
+        pthread_mutex_destroy(&cache->lock);
+        return -1;
+    }
+    cache->capacity = capacity;
+    cache->sector_size = sector_size;
+    cache->flush_run_sectors = capacity < BLOCK_CACHE_FLUSH_RUN_SECTORS ? capacity : BLOCK_CACHE_FLUSH_RUN_SECTORS;
+
+    /* Twice as many buckets as slots keeps chains short */
+    cache->bucket_count = 1;
+    while (cache->bucket_count < capacity * 2) {
+        cache->bucket_count <<= 1;
+    }
+
+    cache->entries = calloc(capacity, sizeof(BlockCacheEntry));
+    cache->data = malloc((size_t)capacity * sector_size);
+    cache->buckets = calloc(cache->bucket_count, sizeof(BlockCacheEntry*));
+    cache->flush_slots = malloc(capacity * sizeof(BlockCacheEntry*));
+    cache->flush_run = malloc((size_t)cache->flush_run_sectors * sector_size);
+    if (!cache->entries || !cache->data || !cache->buckets || !cache->flush_slots || !cache->flush_run) {
+        block_cache_deinit(cache);
+        return -1;
+    }
+
+    /* All slots start free, linked in LRU order */
+    for (uint32_t i = 0; i < capacity; i++) {
+        cache->entries[i].data = cache->data + (size_t)i * sector_size;
+        block_cache_lru_push_front(cache, &cache->entries[i]);
+    }
+
+    return 0;
+}
+
+/**
+ * Deinitialize a block cache and release its memory
+ * @param cache Pointer to BlockCache structure
+ */
+void block_cache_deinit(BlockCache* cache) {
+    if (!cache) return;
+
+    free(cache->entries);
+    free(cache->data);
+    free(cache->buckets);
+    free(cache->flush_slots);
+    free(cache->flush_run);
+    pthread_mutex_destroy(&cache->flush_lock);
+    pthread_cond_destroy(&cache->idle);
+    pthread_mutex_destroy(&cache->lock);
+    memset(cache, 0, sizeof(BlockCache));
+}
+
+/**
+ * Read a whole sector through the cache
+ * @param cache Pointer to BlockCache structure
+ * @param volume HAL of the volume to read from
+ * @param sector Sector number
+ * @param buffer Buffer of at least one sector
+ * @return Number of bytes read if success, -1 if failed
+ */
+int block_cache_read(BlockCache* cache, HAL* volume, uint32_t sector, void* buffer) {
+    if (!cache || !volume || !buffer) return -1;
+
+    if (block_cache_read_bytes(cache, volume, sector, 0, buffer, cache->sector_size) != 0) {
+        return -1;
+    }
+
+    return (int)cache->sector_size;
+}
+
+/**
+ * Read part of a sector through the cache
+ * @param cache Pointer to BlockCache structure
+ * @param volume HAL of the volume to read from
+ * @param sector Sector number
+ * @param offset Byte offset inside the sector
+ * @param buffer Destination buffer
+ * @param length Number of bytes to read (offset + length <= sector size)
+ * @return 0 if success, -1 if failed
+ */
+int block_cache_read_bytes(BlockCache* cache, HAL* volume, uint32_t sector,
+                           uint32_t offset, void* buffer, uint32_t length) {
+    if (!cache || !volume || !buffer || offset + length > cache->sector_size) return -1;
+
+    pthread_mutex_lock(&cache->lock);
+    BlockCacheEntry* entry = block_cache_get(cache, volume, sector, true);
+    if (entry) {
+        memcpy(buffer, entry->data + offset, length);
+    }
+    pthread_mutex_unlock(&cache->lock);
+    if (entry) return 0;
+
+    /* Every slot is pinned or busy, read around the cache */
+    int result = -1;
+    uint8_t* temp = malloc(cache->sector_size);
+    if (temp && hal_read_sector(volume, sector, temp) == (int)cache->sector_size) {
+        memcpy(buffer, temp + offset, length);
+        result = 0;
+    }
+    free(temp);
+    return result;
+}
+
+/**
+ * Modify part of a sector in the cache. The sector is written back to the
+ * volume when it is evicted or flushed.
+ * @param cache Pointer to BlockCache structure
+ * @param volume HAL of the volume to write to
+ * @param sector Sector number
+ * @param offset Byte offset inside the sector
+ * @param buffer Source data
+ * @param length Number of bytes to write (offset + length <= sector size)
+ * @return 0 if success, -1 if failed
+ */
+int block_cache_write_bytes(BlockCache* cache, HAL* volume, uint32_t sector,
+                            uint32_t offset, const void* buffer, uint32_t length) {
+    if (!cache || !volume || !buffer || offset + length > cache->sector_size) return -1;
+
+    pthread_mutex_lock(&cache->lock);
+    BlockCacheEntry* entry = block_cache_get(cache, volume, sector, true);
+    if (entry) {
+        memcpy(entry->data + offset, buffer, length);
+        entry->dirty = true;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    if (entry) return 0;
+
+    /* Every slot is pinned or busy, write through */
+    int result = -1;
+    uint8_t* temp = malloc(cache->sector_size);
+    if (temp && hal_read_sector(volume, sector, temp) == (int)cache->sector_size) {
+        memcpy(temp + offset, buffer, length);
+        if (hal_write_sector(volume, sector, temp) == (int)cache->sector_size) {
+            result = 0;
+        }
+    }
+    free(temp);
+    return result;
+}
+
+/**
+ * Write every dirty sector of a volume back, in LBA order with adjacent
+ * sectors merged into single writes of at most flush_run_sectors
+ * @param cache Pointer to BlockCache structure
+ * @param volume HAL of the volume
+ * @return 0 if success, -1 if failed
+ */
+int block_cache_flush(BlockCache* cache, HAL* volume) {
+    if (!cache || !volume) return -1;
+
+    pthread_mutex_lock(&cache->flush_lock);
+    BlockCacheEntry** dirty = cache->flush_slots;
+
+    /* Take the dirty slots busy, so their data stays put while written unlocked */
+    pthread_mutex_lock(&cache->lock);
+    uint32_t dirty_count = 0;
+    for (uint32_t i = 0; i < cache->capacity; i++) {
+        BlockCacheEntry* entry = &cache->entries[i];
+        while (entry->volume == volume && entry->busy) {
+            pthread_cond_wait(&cache->idle, &cache->lock);
+        }
+        if (entry->volume == volume && entry->dirty) {
+            entry->busy = true;
+            dirty[dirty_count++] = entry;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    qsort(dirty, dirty_count, sizeof(BlockCacheEntry*), block_cache_compare_sector);
+
+    int result = 0;
+    uint32_t i = 0;
+    while (i < dirty_count) {
+        /* Gather a run of adjacent sectors into one write */
+        uint32_t first = dirty[i]->sector;
+        uint32_t count = 1;
+        while (i + count < dirty_count && count < cache->flush_run_sectors &&
+               dirty[i + count]->sector == first + count) {
+            count++;
+        }
+
+        /* A single sector is written from its slot */
+        const uint8_t* run = dirty[i]->data;
+        if (count > 1) {
+            for (uint32_t j = 0; j < count; j++) {
+                memcpy(cache->flush_run + (size_t)j * cache->sector_size, dirty[i + j]->data, cache->sector_size);
+            }
+            run = cache->flush_run;
+        }
+
+        bool written = hal_write_sectors(volume, first, count, run) == (int)(count * cache->sector_size);
+        if (!written) result = -1;
+
+        /* Hand the run back at once, the rest of the flush does not need it */
+        pthread_mutex_lock(&cache->lock);
+        for (uint32_t j = 0; j < count; j++) {
+            dirty[i + j]->busy = false;
+            if (written) dirty[i + j]->dirty = false;
+        }
+        pthread_cond_broadcast(&cache->idle);
+        pthread_mutex_unlock(&cache->lock);
+
+        i += count;
+    }
+
+    pthread_mutex_unlock(&cache->flush_lock);
+    return result;
+}
+
+/**
+ * Read consecutive sectors into the cache with one request
+ * @param cache Pointer to BlockCache structure
+ * @param volume HAL of the volume
+ * @param sector First sector
+ * @param count Number of sectors, at most the cache capacity is loaded
+ * @return 0 if success, -1 if failed
+ */
+int block_cache_prefetch(BlockCache* cache, HAL* volume, uint32_t sector, uint32_t count) {
+    if (!cache || !volume || count == 0) return -1;
+    if (count > cache->capacity) count = cache->capacity;
+
+    uint8_t* run = malloc((size_t)count * cache->sector_size);
+    BlockCacheEntry** slots = calloc(count, sizeof(BlockCacheEntry*));
+    if (!run || !slots) {
+        free(run);
+        free(slots);
+        return -1;
+    }
+
+    /* Reserve busy slots for the sectors not cached yet. Resident sectors may
+       be newer than the disk, keep them; dirty slots are not written back here */
+    pthread_mutex_lock(&cache->lock);
+    for (uint32_t i = 0; i < count; i++) {
+        if (block_cache_lookup(cache, volume, sector + i)) continue;
+
+        BlockCacheEntry* entry = block_cache_victim(cache, true);
+        if (!entry) break;
+        block_cache_assign(cache, entry, volume, sector + i);
+        entry->busy = true;
+        slots[i] = entry;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    int result = -1;
+    if (hal_read_sectors(volume, sector, count, run) == (int)(count * cache->sector_size)) {
+        result = 0;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    for (uint32_t i = 0; i < count; i++) {
+        BlockCacheEntry* entry = slots[i];
+        if (!entry) continue;
+
+        if (result == 0) {
+            memcpy(entry->data, run + (size_t)i * cache->sector_size, cache->sector_size);
+        } else {
+            block_cache_hash_remove(cache, entry);
+            entry->volume = NULL;
+        }
+        entry->busy = false;
+    }
+    pthread_cond_broadcast(&cache->idle);
+    pthread_mutex_unlock(&cache->lock);
+
+    free(slots);
+    free(run);
+    return result;
+}
+
+/**
+ * Mark a range of sectors clean after the caller wrote them to the volume
+ * @param cache Pointer to BlockCache structure
+ * @param volume HAL of the volume
+ * @param sector First sector
+ * @param count Number of sectors
+ */
+void block_cache_mark_clean(BlockCache* cache, HAL* volume, uint32_t sector, uint32_t count) {
+    if (!cache || !volume) return;
+
+    pthread_mutex_lock(&cache->lock);
+    if (count <= cache->capacity) {
+        for (uint32_t i = 0; i < count; i++) {
+            BlockCacheEntry* entry = block_cache_find(cache, volume, sector + i);
+            if (entry) entry->dirty = false;
+        }
+    } else {
+        /* A range larger than the cache is cheaper to match slot by slot */
+        for (uint32_t i = 0; i < cache->capacity; i++) {
+            BlockCacheEntry* entry = &cache->entries[i];
+            if (entry->volume == volume && entry->sector >= sector && entry->sector - sector < count) {
+                entry->dirty = false;
+            }
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * Pin a sector so it stays resident until unpinned
+ * @param cache Pointer to BlockCache structure
+ * @param volume HAL of the volume
+ * @param sector Sector number
+ * @return 0 if success, -1 if failed
+ */
+int block_cache_pin(BlockCache* cache, HAL* volume, uint32_t sector) {
+    if (!cache || !volume) return -1;
+
+    pthread_mutex_lock(&cache->lock);
+
+    BlockCacheEntry* entry = block_cache_get(cache, volume, sector, false);
+    if (entry) {
+        entry->pin_count++;
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+    return entry ? 0 : -1;
+}
+
+/**
+ * Release one pin on a sector
+ * @param cache Pointer to BlockCache structure
+ * @param volume HAL of the volume
+ * @param sector Sector number
+ */
+void block_cache_unpin(BlockCache* cache, HAL* volume, uint32_t sector) {
+    if (!cache || !volume) return;
+
+    pthread_mutex_lock(&cache->lock);
+    BlockCacheEntry* entry = block_cache_lookup(cache, volume, sector);
+    if (entry && entry->pin_count > 0) {
+        entry->pin_count--;
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * Drop every cached sector of a volume
+ * @param cache Pointer to BlockCache structure
+ * @param volume HAL of the volume
+ */
+void block_cache_invalidate(BlockCache* cache, HAL* volume) {
+    if (!cache || !volume) return;
+
+    pthread_mutex_lock(&cache->lock);
+    for (uint32_t i = 0; i < cache->capacity; i++) {
+        BlockCacheEntry* entry = &cache->entries[i];
+        while (entry->volume == volume && entry->busy) {
+            pthread_cond_wait(&cache->idle, &cache->lock);
+        }
+        if (entry->volume != volume) continue;
+
+        block_cache_hash_remove(cache, entry);
+        entry->volume = NULL;
+        entry->pin_count = 0;
+        entry->dirty = false;
+
+        /* Free slots are reused first */
+        block_cache_lru_remove(cache, entry);
+        entry->lru_prev = cache->lru_tail;
+        entry->lru_next = NULL;
+        if (cache->lru_tail) {
+            cache->lru_tail->lru_next = entry;
+        } else {
+            cache->lru_head = entry;
+        }
+        cache->lru_tail = entry;
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/** Internal function to hash a (volume, sector) key */
+static uint32_t block_cache_hash(const BlockCache* cache, const HAL* volume, uint32_t sector) {
+    uint64_t key = ((uint64_t)(uintptr_t)volume >> 4) * 0x9E3779B97F4A7C15ULL ^ sector;
+    key ^= key >> 29;
+    key *= 0xBF58476D1CE4E5B9ULL;
+    key ^= key >> 32;
+    return (uint32_t)key & (cache->bucket_count - 1);
+}
+
+/** Internal function to find a cached sector, leaving the LRU order as it is */
+static BlockCacheEntry* block_cache_find(const BlockCache* cache, const HAL* volume, uint32_t sector) {
+    BlockCacheEntry* entry = cache->buckets[block_cache_hash(cache, volume, sector)];
+    while (entry) {
+        if (entry->volume == volume && entry->sector == sector) return entry;
+        entry = entry->hash_next;
+    }
+    return NULL;
+}
+
+/** Internal function to find a cached sector and mark it most recently used */
+static BlockCacheEntry* block_cache_lookup(BlockCache* cache, HAL* volume, uint32_t sector) {
+    BlockCacheEntry* entry = block_cache_find(cache, volume, sector);
+    if (entry) {
+        block_cache_lru_remove(cache, entry);
+        block_cache_lru_push_front(cache, entry);
+    }
+    return entry;
+}
+
+/**
+ * Internal function to get a sector resident and not busy, called with the
+ * lock held. A missing sector is read into the least recently used free
+ * slot; the lock is dropped during the read and during the write back of a
+ * dirty victim. Returns NULL if no slot can be used or the I/O fails.
+ */
+static BlockCacheEntry* block_cache_get(BlockCache* cache, HAL* volume, uint32_t sector, bool count) {
+    for (;;) {
+        BlockCacheEntry* entry = block_cache_lookup(cache, volume, sector);
+        if (entry && entry->busy) {
+            /* Being loaded or written back by another thread, look again after */
+            pthread_cond_wait(&cache->idle, &cache->lock);
+            continue;
+        }
+        if (entry) {
+            if (count) cache->hits++;
+            return entry;
+        }
+
+        BlockCacheEntry* victim = block_cache_victim(cache, false);
+        if (!victim) return NULL;
+        if (victim->volume && victim->dirty) {
+            /* Write back before reuse, keep the slot if that fails */
+            if (block_cache_write_back(cache, victim) != 0) return NULL;
+            continue;
+        }
+
+        if (count) cache->misses++;
+        block_cache_assign(cache, victim, volume, sector);
+        victim->busy = true;
+
+        pthread_mutex_unlock(&cache->lock);
+        int read_bytes = hal_read_sector(volume, sector, victim->data);
+        pthread_mutex_lock(&cache->lock);
+
+        victim->busy = false;
+        pthread_cond_broadcast(&cache->idle);
+        if (read_bytes != (int)cache->sector_size) {
+            /* Give the slot back as free */
+            block_cache_hash_remove(cache, victim);
+            victim->volume = NULL;
+            return NULL;
+        }
+        return victim;
+    }
+}
+
+/**
+ * Internal function to pick the slot to reuse: the oldest clean one so dirty
+ * data can build up until flush, else the oldest dirty one unless clean_only.
+ * Pinned and busy slots are never picked.
+ */
+static BlockCacheEntry* block_cache_victim(BlockCache* cache, bool clean_only) {
+    BlockCacheEntry* victim = cache->lru_tail;
+    while (victim && (victim->pin_count > 0 || victim->busy || (victim->volume && victim->dirty))) {
+        victim = victim->lru_prev;
+    }
+    if (!victim && !clean_only) {
+        victim = cache->lru_tail;
+        while (victim && (victim->pin_count > 0 || victim->busy)) {
+            victim = victim->lru_prev;
+        }
+    }
+    return victim;
+}
+
+/** Internal function to rekey a clean or free slot to a sector, its data is left to the caller */
+static void block_cache_assign(BlockCache* cache, BlockCacheEntry* entry, HAL* volume, uint32_t sector) {
+    if (entry->volume) {
+        block_cache_hash_remove(cache, entry);
+    }
+    entry->volume = volume;
+    entry->sector = sector;
+    entry->dirty = false;
+
+    uint32_t bucket = block_cache_hash(cache, volume, sector);
+    entry->hash_next = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+
+    block_cache_lru_remove(cache, entry);
+    block_cache_lru_push_front(cache, entry);
+}
+
+/** Internal function to write a dirty slot back with the lock dropped, the slot is busy meanwhile */
+static int block_cache_write_back(BlockCache* cache, BlockCacheEntry* entry) {
+    entry->busy = true;
+
+    pthread_mutex_unlock(&cache->lock);
+    int written = hal_write_sector(entry->volume, entry->sector, entry->data);
+    pthread_mutex_lock(&cache->lock);
+
+    entry->busy = false;
+    pthread_cond_broadcast(&cache->idle);
+    if (written != (int)cache->sector_size) return -1;
+
+    entry->dirty = false;
+    return 0;
+}
+
+/** Internal function to unlink a slot from the LRU list */
+static void block_cache_lru_remove(BlockCache* cache, BlockCacheEntry* entry) {
+    if (entry->lru_prev) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        cache->lru_head = entry->lru_next;
+    }
+
+    if (entry->lru_next) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        cache->lru_tail = entry->lru_prev;
+    }
+
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+/** Internal function to insert a slot at the head of the LRU list */
+static void block_cache_lru_push_front(BlockCache* cache, BlockCacheEntry* entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = cache->lru_head;
+
+    if (cache->lru_head) {
+        cache->lru_head->lru_prev = entry;
+    } else {
+        cache->lru_tail = entry;
+    }
+    cache->lru_head = entry;
+}
+
+/** Internal function to unlink a slot from its hash bucket */
+static void block_cache_hash_remove(BlockCache* cache, BlockCacheEntry* entry) {
+    BlockCacheEntry** link = &cache->buckets[block_cache_hash(cache, entry->volume, entry->sector)];
+    while (*link) {
+        if (*link == entry) {
+            *link = entry->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    entry->hash_next = NULL;
+}
+
+/** Internal function to order slots by sector for qsort */
+static int block_cache_compare_sector(const void* a, const void* b) {
+    uint32_t sa = (*(BlockCacheEntry* const*)a)->sector;
+    uint32_t sb = (*(BlockCacheEntry* const*)b)->sector;
+    return (sa > sb) - (sa < sb);
+}
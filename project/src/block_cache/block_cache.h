@@ -0,0 +1,165 @@
+/**
+ * @file block_cache.h
+ * @author Le Duc Son
+ * @date 2026-10-18
+ * @brief Sector cache between FAT Driver and HAL
+ * @details Fixed-size LRU cache of sectors keyed by (volume, sector). The
+ *          volume is identified by its HAL instance. All functions may be
+ *          called from several threads. The lock only guards the slots and
+ *          lists: a slot being read from or written back to the HAL is
+ *          marked busy and the I/O runs unlocked, so one volume's reads do
+ *          not stall the others. Threads that need a busy slot wait for it.
+ */
+
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "../common/common_types.h"
+#include "../hal/hal.h"
+
+/**
+ * Cache slot
+ */
+typedef struct BlockCacheEntry {
+    HAL* volume;                        /**< Volume owning the sector, NULL if slot is free */
+    uint32_t sector;                    /**< Sector number */
+    uint8_t* data;                      /**< Sector data */
+    uint32_t pin_count;                 /**< Pinned slots are never evicted */
+    bool dirty;                         /**< Modified since read, written back on eviction or flush */
+    bool busy;                          /**< HAL I/O on the data in progress, the slot may not be used */
+    struct BlockCacheEntry* hash_next;  /**< Next slot in the same hash bucket */
+    struct BlockCacheEntry* lru_prev;   /**< More recently used slot */
+    struct BlockCacheEntry* lru_next;   /**< Less recently used slot */
+} BlockCacheEntry;
+
+/**
+ * Block cache structure
+ */
+typedef struct {
+    BlockCacheEntry* entries;           /**< Slot array */
+    uint8_t* data;                      /**< Backing memory for all slots */
+    uint32_t capacity;                  /**< Number of slots */
+    uint32_t sector_size;               /**< Size of one sector */
+    BlockCacheEntry** buckets;          /**< Hash buckets */
+    uint32_t bucket_count;              /**< Number of hash buckets (power of two) */
+    BlockCacheEntry* lru_head;          /**< Most recently used slot */
+    BlockCacheEntry* lru_tail;          /**< Least recently used slot */
+    uint64_t hits;                      /**< Lookups served from the cache */
+    uint64_t misses;                    /**< Lookups that went to the HAL */
+    pthread_mutex_t lock;               /**< Serializes access to slots and lists, not held across I/O */
+    pthread_cond_t idle;                /**< Signaled when a slot stops being busy */
+    pthread_mutex_t flush_lock;         /**< Serializes flushes, which share the buffers below */
+    BlockCacheEntry** flush_slots;      /**< Dirty slots of the flush in progress */
+    uint8_t* flush_run;                 /**< Adjacent sectors gathered for one write */
+    uint32_t flush_run_sectors;         /**< Size of flush_run in sectors */
+} BlockCache;
+
+/**
+ * Initialize a block cache
+ * @param cache Pointer to BlockCache structure
+ * @param capacity Number of sectors the cache can hold
+ * @param sector_size Size of one sector
+ * @return 0 if success, -1 if failed
+ */
+int block_cache_init(BlockCache* cache, uint32_t capacity, uint32_t sector_size);
+
+/**
+ * Deinitialize a block cache and release its memory
+ * @param cache Pointer to BlockCache structure
+ */
+void block_cache_deinit(BlockCache* cache);
+
+/**
+ * Read a whole sector through the cache
+ * @param cache Pointer to BlockCache structure
+ * @param volume HAL of the volume to read from
+ * @param sector Sector number
+ * @param buffer Buffer of at least one sector
+ * @return Number of bytes read if success, -1 if failed
+ */
+int block_cache_read(BlockCache* cache, HAL* volume, uint32_t sector, void* buffer);
+
+/**
+ * Read part of a sector through the cache
+ * @param cache Pointer to BlockCache structure
+ * @param volume HAL of the volume to read from
+ * @param sector Sector number
+ * @param offset Byte offset inside the sector
+ * @param buffer Destination buffer
+ * @param length Number of bytes to read (offset + length <= sector size)
+ * @return 0 if success, -1 if failed
+ */
+int block_cache_read_bytes(BlockCache* cache, HAL* volume, uint32_t sector,
+                           uint32_t offset, void* buffer, uint32_t length);
+
+/**
+ * Modify part of a sector in the cache. The sector is written back to the
+ * volume when it is evicted or flushed.
+ * @param cache Pointer to BlockCache structure
+ * @param volume HAL of the volume to write to
+ * @param sector Sector number
+ * @param offset Byte offset inside the sector
+ * @param buffer Source data
+ * @param length Number of bytes to write (offset + length <= sector size)
+ * @return 0 if success, -1 if failed
+ */
+int block_cache_write_bytes(BlockCache* cache, HAL* volume, uint32_t sector,
+                            uint32_t offset, const void* buffer, uint32_t length);
+
+/**
+ * Write every dirty sector of a volume back, in LBA order with adjacent
+ * sectors merged into single writes of at most flush_run_sectors
+ * @param cache Pointer to BlockCache structure
+ * @param volume HAL of the volume
+ * @return 0 if success, -1 if failed
+ */
+int block_cache_flush(BlockCache* cache, HAL* volume);
+
+/**
+ * Read consecutive sectors into the cache with one request. Sectors already
+ * cached are kept as they are.
+ * @param cache Pointer to BlockCache structure
+ * @param volume HAL of the volume
+ * @param sector First sector
+ * @param count Number of sectors, at most the cache capacity is loaded
+ * @return 0 if success, -1 if failed
+ */
+int block_cache_prefetch(BlockCache* cache, HAL* volume, uint32_t sector, uint32_t count);
+
+/**
+ * Mark a range of sectors clean after the caller wrote them to the volume
+ * @param cache Pointer to BlockCache structure
+ * @param volume HAL of the volume
+ * @param sector First sector
+ * @param count Number of sectors
+ */
+void block_cache_mark_clean(BlockCache* cache, HAL* volume, uint32_t sector, uint32_t count);
+
+/**
+ * Pin a sector so it stays resident until unpinned
+ * @param cache Pointer to BlockCache structure
+ * @param volume HAL of the volume
+ * @param sector Sector number
+ * @return 0 if success, -1 if failed
+ */
+int block_cache_pin(BlockCache* cache, HAL* volume, uint32_t sector);
+
+/**
+ * Release one pin on a sector
+ * @param cache Pointer to BlockCache structure
+ * @param volume HAL of the volume
+ * @param sector Sector number
+ */
+void block_cache_unpin(BlockCache* cache, HAL* volume, uint32_t sector);
+
+/**
+ * Drop every cached sector of a volume, dirty data is discarded
+ * @param cache Pointer to BlockCache structure
+ * @param volume HAL of the volume
+ */
+void block_cache_invalidate(BlockCache* cache, HAL* volume);
+
+#endif // BLOCK_CACHE_H
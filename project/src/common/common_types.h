@@ -63,6 +63,14 @@ typedef enum {
     DIR_NAME_LEN_64 = 64
 } DirNameLength;
 
+/**
+ * In-memory representation of the FAT
+ */
+typedef enum {
+    FAT_TABLE_PAGED,    /**< FAT sectors paged in through the block cache */
+    FAT_TABLE_RUNS      /**< Run index of chain segments built at mount */
+} FatTableMode;
+
 /**
  * Max length of file name
  */
@@ -79,6 +87,10 @@ typedef struct {
     SectorSize sector_size;
     CacheSize cache_size;
     DirNameLength dir_name_len;
+    FatTableMode fat_table_mode;
+    uint32_t worker_threads;
+    bool prefetch_tree;
+    bool mount_index;
 } FileSystemConfig;
 
 /**
@@ -9,11 +9,83 @@
 #include <stdlib.h>
 #include <string.h>
 
+/**
+ * Progress of a directory scan across sectors
+ */
+typedef struct {
+    FileNodeArena* arena;       /**< Node arena, NULL for malloc */
+    FileNode* children;         /**< Children found so far (prepended) */
+    uint32_t slot_count;        /**< Slots seen so far */
+    uint8_t lfn_slots;          /**< LFN slots right before the current slot */
+    bool end_reached;           /**< The 0x00 end marker was seen */
+    uint64_t hash;              /**< Content hash of the sectors read and clusters visited */
+} FatScanState;
+
+/**
+ * Walk over a cluster chain one run of contiguous clusters at a time
+ */
+typedef struct {
+    FatChainIterator chain;     /**< Walk over the clusters */
+    uint32_t cluster;           /**< First cluster of the next run, if pending */
+    bool pending;               /**< cluster was taken from the chain but not returned yet */
+} FatRunIterator;
+
 /* Local functions */
+static int fat_driver_init_hal(FATDriver* driver, const FileSystemConfig config);
+static size_t fat_driver_node_memory(const FileNode* node);
 static int fat_driver_load_fat_table(FATDriver* driver);
 static int fat_driver_load_root_directory(FATDriver* driver);
 static int fat_driver_build_directory_tree(FATDriver* driver);
 static void fat_driver_parse_boot_sector(FATDriver* driver, const uint8_t* boot_sector_buffer);
+static int fat_driver_load_fs_info(FATDriver* driver);
+static int fat_driver_write_fs_info(FATDriver* driver, uint32_t sector);
+static void fat_driver_pin_fat_sector(FATDriver* driver, uint32_t cluster);
+static int fat_driver_scan_entries(FATDriver* driver, FileNode* directory, FileNodeArena* arena,
+                                   bool through_cache, FileNode** children);
+static void fat_driver_track_cluster(FileNode* directory, uint32_t cluster);
+static int fat_driver_parse_directory_sector(FATDriver* driver, FileNode* directory, const uint8_t* buffer,
+                                             uint32_t sector_size, FatScanState* state);
+static void fat_driver_track_free_slots(FileNode* directory, FatScanState* state, uint32_t count);
+static void fat_driver_build_task(void* arg, uint32_t worker);
+static void fat_driver_build_subdirectories(FATDriver* driver, FileNode* directory);
+static void fat_driver_level_task(void* arg, uint32_t worker);
+static int fat_driver_build_tree_by_level(FATDriver* driver);
+static FileNode** fat_driver_collect_subdirectories(FileNode** directories, uint32_t count, uint32_t* result_count);
+static void fat_driver_collect_directory_sectors(FATDriver* driver, uint32_t first_cluster, uint32_t** sectors,
+                                                 uint32_t* count, uint32_t* capacity);
+static void fat_driver_prefetch_sectors(FATDriver* driver, uint32_t* sectors, uint32_t count);
+static int fat_driver_compare_level_dir(const void* a, const void* b);
+static int fat_driver_compare_sector(const void* a, const void* b);
+static FileNode* fat_driver_alloc_node(FileNodeArena* arena);
+static void fat_driver_start_workers(FATDriver* driver);
+static void fat_driver_stop_workers(FATDriver* driver);
+static int fat_driver_hash_directory(FATDriver* driver, FileNode* directory, uint64_t* hash);
+static int fat_driver_refresh_directory(FATDriver* driver, FileNode* directory, uint32_t* rescanned);
+static int fat_driver_rescan_directory(FATDriver* driver, FileNode* directory);
+static void fat_driver_drop_node(FATDriver* driver, FileNode* node);
+static int fat_driver_compare_node_name(const void* a, const void* b);
+static int fat_driver_refresh_unlocked(FATDriver* driver, uint32_t* rescanned);
+static int fat_driver_read_file_unlocked(FATDriver* driver, FileNode* file, void* buffer, uint32_t size);
+static void fat_driver_run_begin(FatRunIterator* runs, FATDriver* driver, uint32_t first_cluster);
+static uint32_t fat_driver_run_next(FatRunIterator* runs, uint32_t max_clusters, uint32_t needed, uint32_t* first);
+
+/**
+ * Argument of a parallel tree build task
+ */
+typedef struct {
+    FATDriver* driver;
+    FileNode* directory;
+} FatBuildTask;
+
+/**
+ * Directory of one level of the prefetched tree build
+ */
+typedef struct {
+    FileNode* node;
+    uint32_t first_sector;      /**< LBA of the first directory sector */
+    uint32_t first_index;       /**< Position of its sectors in the level array */
+    uint32_t sector_count;      /**< Number of directory sectors */
+} FatLevelDir;
 
 /**
  * Initialize the FATDriver with the given configuration.
@@ -29,6 +101,54 @@ static void fat_driver_parse_boot_sector(FATDriver* driver, const uint8_t* boot_
  *         during the process.
  */
 int fat_driver_init(FATDriver* driver, const FileSystemConfig config) {
+    if (fat_driver_init_hal(driver, config) != 0) {
+        return -1;
+    }
+    
+    /* Allocate memory for cache */
+    driver->cache_size = (uint32_t)config.cache_size;
+    driver->cache = malloc(sizeof(BlockCache));
+    if (!driver->cache) return -1;
+    if (block_cache_init(driver->cache, driver->cache_size, hal_get_sector_size(driver->hal)) != 0) {
+        free(driver->cache);
+        driver->cache = NULL;
+        return -1;
+    }
+    
+    return 0;
+}
+
+/**
+ * Initializes the FATDriver on a block cache owned by the caller.
+ * 
+ * Sectors of every volume on the cache compete for the same slots. FAT
+ * sectors are not pinned, so no volume can hold slots while idle.
+ * 
+ * @param driver Pointer to the FATDriver structure to initialize.
+ * @param config The configuration of the file system (cache_size is not used).
+ * @param cache Initialized block cache with the sector size of the image.
+ * @return 0 if the initialization is successful, -1 if there is any failure 
+ *         during the process.
+ */
+int fat_driver_init_shared(FATDriver* driver, const FileSystemConfig config, BlockCache* cache) {
+    if (!cache || fat_driver_init_hal(driver, config) != 0) {
+        return -1;
+    }
+    if (cache->sector_size != hal_get_sector_size(driver->hal)) {
+        hal_deinit(driver->hal);
+        return -1;
+    }
+    
+    /* A cache_size of 0 leaves nothing to pin */
+    driver->cache_size = 0;
+    driver->cache = cache;
+    driver->shared_cache = true;
+    
+    return 0;
+}
+
+/** Internal function to open the image and reset the driver */
+static int fat_driver_init_hal(FATDriver* driver, const FileSystemConfig config) {
     /* Allocate memory for HAL */
     HAL* hal = malloc(sizeof(HAL));
     if (hal_init(hal, config.img_path, SECTOR_SIZE_512) != 0) {
@@ -40,11 +160,10 @@ int fat_driver_init(FATDriver* driver, const FileSystemConfig config) {
     memset(driver, 0, sizeof(FATDriver));
     driver->hal = hal;
     driver->config = config;
-    
-    /* Allocate memory for cache */
-    driver->cache_size = (uint32_t)config.cache_size;
-    driver->cache = malloc(driver->cache_size * hal_get_sector_size(hal));
-    if (!driver->cache) return -1;
+    pthread_rwlock_init(&driver->lock, NULL);
+    pthread_mutex_init(&driver->sort_lock, NULL);
+    pthread_mutex_init(&driver->name_lock, NULL);
+    atomic_init(&driver->epoch, 1);
     
     return 0;
 }
@@ -63,6 +182,11 @@ int fat_driver_deinit(FATDriver* driver) {
     if (!driver || !driver->hal) return -1;
     
     hal_deinit(driver->hal);
+    free(driver->hal);
+    driver->hal = NULL;
+    pthread_rwlock_destroy(&driver->lock);
+    pthread_mutex_destroy(&driver->sort_lock);
+    pthread_mutex_destroy(&driver->name_lock);
     
     return 0;
 }
@@ -139,11 +263,33 @@ int fat_driver_mount(FATDriver* driver) {
     driver->total_clusters = driver->data_sectors / 
                             driver->boot_sector.sectors_per_cluster;
     
-    /* Load bảng FAT */
+    /* Đọc FSInfo (chỉ FAT32) để lấy số cluster trống và gợi ý cluster trống */
+    if (fat_driver_load_fs_info(driver) != 0) {
+        return -1;
+    }
+    
+    /* Chuẩn bị truy cập bảng FAT qua cache */
     if (fat_driver_load_fat_table(driver) != 0) {
         return -1;
     }
     
+    /* Xây dựng chỉ mục run nếu được cấu hình, lỗi thì dùng FAT phân trang */
+    if (driver->config.fat_table_mode == FAT_TABLE_RUNS) {
+        fat_driver_build_run_index(driver);
+    }
+    
+    /* Khởi động pool worker để quét các thư mục con song song */
+    fat_driver_start_workers(driver);
+    
+    /* Mount chỉ đọc: dùng cây thư mục trong file chỉ mục nếu khóa còn khớp */
+    FatIndexKey index_key;
+    bool use_index = driver->config.mount_index && driver->config.mode == MODE_READ_ONLY &&
+                     fat_driver_index_key(driver, &index_key) == 0;
+    if (use_index && fat_driver_index_load(driver, &index_key) == 0) {
+        driver->current_directory = driver->root_directory;
+        return 0;
+    }
+    
     /* Load thư mục gốc */
     if (fat_driver_load_root_directory(driver) != 0) {
         return -1;
@@ -151,9 +297,15 @@ int fat_driver_mount(FATDriver* driver) {
     
     /* Xây dựng cây thư mục */
     if (fat_driver_build_directory_tree(driver) != 0) {
+        threadpool_wait(driver->pool);
         return -1;
     }
     
+    /* Ghi lại file chỉ mục cho lần mount sau, lỗi ghi không ảnh hưởng mount */
+    if (use_index) {
+        fat_driver_index_save(driver, &index_key);
+    }
+    
     /* Đặt thư mục hiện tại là thư mục gốc */
     driver->current_directory = driver->root_directory;
     
@@ -174,25 +326,124 @@ int fat_driver_mount(FATDriver* driver) {
 void fat_driver_unmount(FATDriver* driver) {
     if (!driver) return;
     
+    /* Ghi lại FSInfo trước khi giải phóng */
+    fat_driver_sync_unlocked(driver);
+    
     /* Giải phóng bộ nhớ */
-    if (driver->fat_table) {
-        free(driver->fat_table);
-        driver->fat_table = NULL;
-    }
+    fat_driver_free_run_index(driver);
+    fat_driver_free_dirty_ranges(driver);
     
-    if (driver->cache) {
+    if (driver->cache && driver->shared_cache) {
+        /* Cache dùng chung: chỉ bỏ các sector của volume này, HAL sắp bị đóng */
+        block_cache_invalidate(driver->cache, driver->hal);
+        driver->cache = NULL;
+    } else if (driver->cache) {
+        block_cache_deinit(driver->cache);
         free(driver->cache);
         driver->cache = NULL;
     }
+    driver->pinned_fat_count = 0;
     
-    /* Giải phóng cây thư mục */
+    /* Giải phóng cây thư mục và các node đã gỡ khỏi cây */
+    fat_driver_free_retired(driver);
     if (driver->root_directory) {
         fat_driver_free_file_node(driver->root_directory);
         driver->root_directory = NULL;
     }
+    fat_driver_index_release(driver);
+    driver->index_state = FAT_INDEX_UNUSED;
+    
+    /* Dừng pool worker và giải phóng arena của các node */
+    fat_driver_stop_workers(driver);
     
+    /* Handle còn mở không được giữ node đã giải phóng */
     driver->current_directory = NULL;
+    for (FatHandle* handle = driver->handles; handle; handle = handle->next) {
+        handle->current_directory = NULL;
+    }
+}
+
+/**
+ * Brings the mounted tree up to date after another program changed the image.
+ * 
+ * Cached sectors, the run index and FSInfo are reloaded first. Then every
+ * directory is hashed the way the last scan hashed it (sectors up to the end
+ * marker and the clusters visited) and only directories whose hash differs
+ * are scanned again. Their entries are matched to the old children by name,
+ * type and first cluster, so the subtrees below matching subdirectories are
+ * kept; new subdirectories are scanned in full. The children of a rescanned
+ * directory are replaced by new nodes, published at once, and the old ones
+ * are freed when no path lookup can still see them.
+ * 
+ * Path lookups may run during a refresh on any mount. Every other call waits
+ * for it on the driver lock, so nothing reads the run index or the FAT cache
+ * while they are rebuilt.
+ * 
+ * @param driver Pointer to the FATDriver structure.
+ * @param rescanned Pointer to store the number of directories scanned again (may be NULL).
+ * @return 0 if successful, -1 if failed (a changed boot sector needs a remount).
+ */
+int fat_driver_refresh(FATDriver* driver, uint32_t* rescanned) {
+    if (!driver || !driver->hal || !driver->root_directory) return -1;
+    
+    fat_driver_write_lock(driver);
+    int result = fat_driver_refresh_unlocked(driver, rescanned);
+    fat_driver_write_unlock(driver);
+    
+    return result;
+}
+
+/** Internal function of fat_driver_refresh(), called with the write lock held */
+static int fat_driver_refresh_unlocked(FATDriver* driver, uint32_t* rescanned) {
+    if (rescanned) *rescanned = 0;
+    
+    /* Ghi các thay đổi của chính mình trước khi đọc lại ảnh đĩa */
+    if (driver->config.mode == MODE_READ_WRITE && fat_driver_sync_unlocked(driver) != 0) {
+        return -1;
+    }
+    
+    /* Geometry that changed under the mount needs a full remount */
+    uint8_t* buffer = malloc(hal_get_sector_size(driver->hal));
+    if (!buffer) return -1;
+    uint32_t read_bytes = hal_read_sector(driver->hal, 0, buffer);
+    if (read_bytes != hal_get_sector_size(driver->hal)) {
+        free(buffer);
+        return -1;
+    }
+    FATDriver probe;
+    memset(&probe, 0, sizeof(probe));
+    fat_driver_parse_boot_sector(&probe, buffer);
+    free(buffer);
+    if (memcmp(&probe.boot_sector, &driver->boot_sector, sizeof(BootSector)) != 0) {
+        return -1;
+    }
+    
+    /* Mọi sector trong cache và chỉ mục run đều có thể đã cũ */
+    block_cache_invalidate(driver->cache, driver->hal);
+    fat_driver_free_run_index(driver);
+    if (fat_driver_load_fs_info(driver) != 0 || fat_driver_load_fat_table(driver) != 0) {
+        return -1;
+    }
+    if (driver->config.fat_table_mode == FAT_TABLE_RUNS) {
+        fat_driver_build_run_index(driver);
+    }
+    
+    uint32_t count = 0;
+    int result = fat_driver_refresh_directory(driver, driver->root_directory, &count);
+    if (rescanned) *rescanned = count;
+    fat_driver_reclaim(driver);
+    
+    /* Ghi lại file chỉ mục theo khóa mới của ảnh đĩa */
+    if (result == 0 && driver->config.mount_index && driver->config.mode == MODE_READ_ONLY) {
+        FatIndexKey index_key;
+        if (fat_driver_index_key(driver, &index_key) == 0) {
+            fat_driver_index_save(driver, &index_key);
+        }
+    }
+    
+    return result;
 }
+
 /**
  * Gets the root directory of the FAT file system.
  * 
@@ -218,7 +469,7 @@ FileNode* fat_driver_get_root_directory(FATDriver* driver) {
 FileNode* fat_driver_get_current_directory(FATDriver* driver) {
     if (!driver) return NULL;
     
-    return driver->current_directory;
+    return FAT_LOAD_LINK(driver->current_directory);
 }
 
 /**
@@ -236,7 +487,44 @@ int fat_driver_set_current_directory(FATDriver* driver, FileNode* directory) {
         return -1;
     }
     
-    driver->current_directory = directory;
+    fat_driver_write_lock(driver);
+    FAT_PUBLISH_LINK(driver->current_directory, directory);
+    fat_driver_write_unlock(driver);
+    return 0;
+}
+
+/**
+ * Builds the absolute path of a node.
+ * 
+ * Names are written from the end of the buffer towards the front while
+ * walking up the parent links, then moved to the start.
+ * 
+ * @param node Node in the mounted tree.
+ * @param buffer Buffer to store the path.
+ * @param size Size of the buffer.
+ * @return 0 if successful, -1 if failed or the path does not fit.
+ */
+int fat_driver_get_path(const FileNode* node, char* buffer, size_t size) {
+    if (!node || !buffer || size < 2) return -1;
+    
+    size_t position = size - 1;
+    buffer[position] = '\0';
+    
+    for (const FileNode* current = node; current->parent; current = current->parent) {
+        size_t length = strlen(current->name);
+        if (length + 1 > position) return -1;
+        
+        position -= length;
+        memcpy(buffer + position, current->name, length);
+        buffer[--position] = '/';
+    }
+    
+    /* The root itself */
+    if (position == size - 1) {
+        buffer[--position] = '/';
+    }
+    
+    memmove(buffer, buffer + position, size - position);
     return 0;
 }
 
@@ -244,7 +532,8 @@ int fat_driver_set_current_directory(FATDriver* driver, FileNode* directory) {
  * Finds a path in the FAT file system.
  * 
  * This function takes a path and returns a pointer to the FileNode if successful
- * or NULL if failed.
+ * or NULL if failed. Relative paths start at the driver's current directory.
+ * The lookup runs in a read section and never waits for writers.
  * 
  * @param driver Pointer to the FATDriver structure.
  * @param path Path to find.
@@ -253,6 +542,23 @@ int fat_driver_set_current_directory(FATDriver* driver, FileNode* directory) {
 FileNode* fat_driver_find_path(FATDriver* driver, const char* path) {
     if (!driver || !path) return NULL;
     
+    int token = fat_driver_read_begin(driver);
+    FileNode* node = fat_driver_resolve_path(driver, FAT_LOAD_LINK(driver->current_directory), path);
+    fat_driver_read_end(driver, token);
+    
+    return node;
+}
+
+/**
+ * Resolves a path from the root or, for a relative path, from current.
+ * Called in a read section or with the lock held.
+ * 
+ * @param driver Pointer to the FATDriver structure.
+ * @param current Directory relative paths start at.
+ * @param path Path to find.
+ * @return Pointer to the FileNode if successful, NULL if failed.
+ */
+FileNode* fat_driver_resolve_path(FATDriver* driver, FileNode* current, const char* path) {
     /* Handle absolute path */
     if (path[0] == '/') {
         if (path[1] == '\0') {
@@ -260,13 +566,10 @@ FileNode* fat_driver_find_path(FATDriver* driver, const char* path) {
         }
         
         /* Skip the leading '/' character */
-        path++;
-        FileNode* current = driver->root_directory;
-        return fat_driver_find_path_recursive(current, path);
+        return fat_driver_find_path_recursive(driver->root_directory, path + 1);
     }
     
     /* Handle relative path */
-    FileNode* current = driver->current_directory;
     return fat_driver_find_path_recursive(current, path);
 }
 
@@ -310,8 +613,9 @@ FileNode* fat_driver_find_path_recursive(FileNode* current, const char* path) {
     if (strcmp(component, ".") == 0) {
         return fat_driver_find_path_recursive(current, next_path);
     } else if (strcmp(component, "..") == 0) {
-        if (current->parent) {
-            return fat_driver_find_path_recursive(current->parent, next_path);
+        FileNode* parent = FAT_LOAD_LINK(current->parent);
+        if (parent) {
+            return fat_driver_find_path_recursive(parent, next_path);
         } else {
             return fat_driver_find_path_recursive(current, next_path);
         }
@@ -320,7 +624,7 @@ FileNode* fat_driver_find_path_recursive(FileNode* current, const char* path) {
     /**
      * Search in the children list.
      */
-    FileNode* child = current->children;
+    FileNode* child = FAT_LOAD_LINK(current->children);
     while (child) {
         if (strcmp(child->name, component) == 0) {
             if (*next_path == '\0') {
@@ -331,7 +635,7 @@ FileNode* fat_driver_find_path_recursive(FileNode* current, const char* path) {
                 return NULL; /* Cannot navigate into a file */
             }
         }
-        child = child->next;
+        child = FAT_LOAD_LINK(child->next);
     }
 
     return NULL; /* Not found */
@@ -349,13 +653,23 @@ FileNode* fat_driver_find_path_recursive(FileNode* current, const char* path) {
  * @param file Pointer to the FileNode structure of the file to read.
  * @param buffer Buffer to store the file content.
  * @param size Size of the buffer.
- * @return The number of bytes read if successful, -1 if failed.
+ * @return The number of bytes read if successful, -1 if failed or if the
+ *         cluster chain loops.
  */
 int fat_driver_read_file(FATDriver* driver, FileNode* file, void* buffer, uint32_t size) {
     if (!driver || !file || !buffer || file->type != FILE_TYPE_REGULAR) {
         return -1;
     }
     
+    fat_driver_read_lock(driver);
+    int result = fat_driver_read_file_unlocked(driver, file, buffer, size);
+    fat_driver_read_unlock(driver);
+    
+    return result;
+}
+
+/** Internal function of fat_driver_read_file(), called with the lock held */
+static int fat_driver_read_file_unlocked(FATDriver* driver, FileNode* file, void* buffer, uint32_t size) {
     /* Check mode */
     if (driver->config.mode == MODE_READ_ONLY || driver->config.mode == MODE_READ_WRITE) {
         uint32_t bytes_to_read = size;
@@ -364,17 +678,17 @@ int fat_driver_read_file(FATDriver* driver, FileNode* file, void* buffer, uint32
         }
         
         uint32_t bytes_read = 0;
-        uint32_t current_cluster = file->first_cluster;
+        uint32_t current_cluster;
         uint32_t sector_size = hal_get_sector_size(driver->hal);
         uint32_t sectors_per_cluster = driver->boot_sector.sectors_per_cluster;
         uint8_t* temp_buffer = malloc(sector_size);
         
         if (!temp_buffer) return -1;
         
-        while (bytes_read < bytes_to_read && current_cluster != 0 && 
-               current_cluster != FAT12_EOC && 
-               current_cluster != FAT16_EOC && 
-               current_cluster != FAT32_EOC) {
+        /** A short chain gives a short read, a looping one an error */
+        FatChainIterator chain;
+        fat_driver_chain_begin(&chain, driver, file->first_cluster);
+        while (bytes_read < bytes_to_read && fat_driver_chain_next(&chain, &current_cluster)) {
             
             uint32_t first_sector_of_cluster = fat_driver_cluster_to_sector(driver, current_cluster);
             
@@ -393,18 +707,169 @@ int fat_driver_read_file(FATDriver* driver, FileNode* file, void* buffer, uint32
                 memcpy((uint8_t*)buffer + bytes_read, temp_buffer, bytes_to_copy);
                 bytes_read += bytes_to_copy;
             }
-            
-            /** Get the next cluster */
-            current_cluster = fat_driver_get_next_cluster(driver, current_cluster);
         }
         
         free(temp_buffer);
+        if (chain.status == FAT_CHAIN_CYCLE || chain.status == FAT_CHAIN_TOO_LONG) return -1;
         return bytes_read;
     }
     
     return -1;
 }
 
+/**
+ * Reads a whole file in pieces.
+ *
+ * The cluster chain is walked once and each run of contiguous clusters, up to
+ * the size of the buffer, is read with a single multi-sector read instead of
+ * one read per sector. The pieces are handed to the callback in file order,
+ * the last one cut to the file size. The read lock is held for the whole
+ * file, callback included, so the callback should not take long.
+ *
+ * @param driver Pointer to the FATDriver structure.
+ * @param file Pointer to the FileNode structure of the file to read.
+ * @param buffer Work buffer, at least one cluster.
+ * @param size Size of the buffer, the largest piece handed to the callback.
+ * @param callback Function called with each piece.
+ * @param user_data Value passed to the callback.
+ * @return The number of bytes handed to the callback if successful (less than
+ *         the file size if the callback stopped the read or the chain is
+ *         short), -1 if failed or if the cluster chain loops.
+ */
+int fat_driver_read_file_chunks(FATDriver* driver, FileNode* file, void* buffer, uint32_t size,
+                                FatChunkCallback callback, void* user_data) {
+    if (!driver || !file || !buffer || !callback || file->type != FILE_TYPE_REGULAR) {
+        return -1;
+    }
+
+    uint32_t sector_size = hal_get_sector_size(driver->hal);
+    uint32_t cluster_size = sector_size * driver->boot_sector.sectors_per_cluster;
+    if (cluster_size == 0 || size < cluster_size) return -1;
+
+    fat_driver_read_lock(driver);
+
+    uint32_t offset = 0;
+    uint32_t start;
+    uint32_t count;
+    int result = 0;
+    FatRunIterator runs;
+    fat_driver_run_begin(&runs, driver, file->first_cluster);
+
+    /** Never take more clusters than the buffer holds or the file still needs */
+    while (offset < file->size &&
+           (count = fat_driver_run_next(&runs, size / cluster_size,
+                                        (file->size - offset + cluster_size - 1) / cluster_size, &start)) > 0) {
+        uint32_t length = count * cluster_size;
+        if (length > file->size - offset) length = file->size - offset;
+        uint32_t sectors = (length + sector_size - 1) / sector_size;
+
+        int read_bytes = hal_read_sectors(driver->hal, fat_driver_cluster_to_sector(driver, start), sectors, buffer);
+        if (read_bytes < 0 || (uint32_t)read_bytes != sectors * sector_size) {
+            result = -1;
+            break;
+        }
+
+        int stop = callback((const uint8_t*)buffer, length, offset, user_data);
+        offset += length;
+        if (stop != 0) break;
+    }
+
+    if (runs.chain.status == FAT_CHAIN_CYCLE || runs.chain.status == FAT_CHAIN_TOO_LONG) result = -1;
+
+    fat_driver_read_unlock(driver);
+
+    return (result == 0) ? (int)offset : -1;
+}
+
+/**
+ * Copies a whole file into a host file.
+ *
+ * Each run of contiguous clusters is handed to the HAL as one copy between
+ * the image and the destination, which the kernel carries out without
+ * bringing the data into user space when both files allow it. The read lock
+ * is held for the whole file.
+ *
+ * @param driver Pointer to the FATDriver structure.
+ * @param file Pointer to the FileNode structure of the file to copy.
+ * @param fd Destination file descriptor, opened for writing. The file is
+ *        written from offset 0.
+ * @return The number of bytes copied if successful, -1 if failed, if the
+ *         cluster chain loops or if it is shorter than the file.
+ */
+int64_t fat_driver_export_file(FATDriver* driver, FileNode* file, int fd) {
+    if (!driver || !file || fd < 0 || file->type != FILE_TYPE_REGULAR) {
+        return -1;
+    }
+
+    uint32_t cluster_size = hal_get_sector_size(driver->hal) * driver->boot_sector.sectors_per_cluster;
+    if (cluster_size == 0) return -1;
+
+    fat_driver_read_lock(driver);
+
+    uint64_t offset = 0;
+    uint32_t start;
+    uint32_t count;
+    int result = 0;
+    FatRunIterator runs;
+    fat_driver_run_begin(&runs, driver, file->first_cluster);
+
+    while (offset < file->size &&
+           (count = fat_driver_run_next(&runs, UINT32_MAX,
+                                        (uint32_t)((file->size - offset + cluster_size - 1) / cluster_size),
+                                        &start)) > 0) {
+        uint64_t length = (uint64_t)count * cluster_size;
+        if (length > file->size - offset) length = file->size - offset;
+
+        int64_t copied = hal_copy_to_fd(driver->hal, fat_driver_cluster_to_sector(driver, start), length, fd, offset);
+        if (copied < 0 || (uint64_t)copied != length) {
+            result = -1;
+            break;
+        }
+        offset += length;
+    }
+
+    if (runs.chain.status == FAT_CHAIN_CYCLE || runs.chain.status == FAT_CHAIN_TOO_LONG) result = -1;
+
+    fat_driver_read_unlock(driver);
+
+    return (result == 0 && offset == file->size) ? (int64_t)offset : -1;
+}
+
+/** Starts a walk over the runs of a cluster chain */
+static void fat_driver_run_begin(FatRunIterator* runs, FATDriver* driver, uint32_t first_cluster) {
+    fat_driver_chain_begin(&runs->chain, driver, first_cluster);
+    runs->pending = fat_driver_chain_next(&runs->chain, &runs->cluster);
+}
+
+/**
+ * Takes the next run of contiguous clusters, at most max_clusters long. The
+ * chain is not read past needed clusters, so a run that ends the file does
+ * not look up the cluster after it.
+ *
+ * @return Number of clusters in the run, 0 at the end of the chain.
+ */
+static uint32_t fat_driver_run_next(FatRunIterator* runs, uint32_t max_clusters, uint32_t needed, uint32_t* first) {
+    if (!runs->pending) return 0;
+
+    uint32_t limit = (needed < max_clusters) ? needed : max_clusters;
+    uint32_t count = 1;
+    *first = runs->cluster;
+    runs->pending = false;
+
+    while (count < limit) {
+        if (!fat_driver_chain_next(&runs->chain, &runs->cluster)) return count;
+        if (runs->cluster != *first + count) {
+            runs->pending = true;
+            return count;
+        }
+        count++;
+    }
+
+    /** The run stopped at a limit, the next run starts with the next cluster */
+    if (count < needed) runs->pending = fat_driver_chain_next(&runs->chain, &runs->cluster);
+    return count;
+}
+
 /**
  * Writes a file to the file system.
  * 
@@ -476,13 +941,34 @@ int fat_driver_get_filesystem_info(FATDriver* driver, uint64_t* total_size, uint
     *total_size = (uint64_t)driver->total_clusters * cluster_size;
     
     /**
-     * Counts the number of free clusters.
+     * Counts the number of free clusters, only when FSInfo did not give a
+     * trusted value. The result is kept so the scan runs at most once; the
+     * write lock makes concurrent callers wait for the first one.
      */
-    uint32_t free_clusters = 0;
-    for (uint32_t i = 2; i < driver->total_clusters + 2; i++) {
-        if (fat_driver_get_fat_entry(driver, i) == 0) {
-            free_clusters++;
+    fat_driver_read_lock(driver);
+    bool counted = driver->free_count_valid;
+    uint32_t free_clusters = driver->free_clusters;
+    fat_driver_read_unlock(driver);
+    
+    if (!counted) {
+        fat_driver_write_lock(driver);
+        if (!driver->free_count_valid) {
+            uint32_t count = 0;
+            for (uint32_t i = 2; i < driver->total_clusters + 2; i++) {
+                if (fat_driver_get_fat_entry(driver, i) == 0) {
+                    count++;
+                }
+            }
+            driver->free_clusters = count;
+            driver->free_count_valid = true;
+            
+            /* Let the next mount skip the scan */
+            if (driver->fs_info_valid) {
+                driver->fs_info_dirty = true;
+            }
         }
+        free_clusters = driver->free_clusters;
+        fat_driver_write_unlock(driver);
     }
     
     *free_size = (uint64_t)free_clusters * cluster_size;
@@ -490,6 +976,107 @@ int fat_driver_get_filesystem_info(FATDriver* driver, uint64_t* total_size, uint
     return 0;
 }
 
+/**
+ * Estimates the heap memory held by a mounted volume.
+ * 
+ * The tree is walked under the read lock. Sectors in a shared cache are not
+ * counted, they belong to the cache's owner.
+ * 
+ * @param driver Pointer to the FATDriver structure.
+ * @return Number of bytes, 0 if the driver is NULL.
+ */
+size_t fat_driver_memory_usage(FATDriver* driver) {
+    if (!driver) return 0;
+    
+    size_t bytes = sizeof(FATDriver) + sizeof(HAL);
+    
+    fat_driver_read_lock(driver);
+    bytes += fat_driver_node_memory(driver->root_directory);
+    bytes += (size_t)driver->fat_run_capacity * sizeof(FatRun);
+    bytes += (size_t)driver->fat_dirty_capacity * sizeof(FatDirtyRange);
+    fat_driver_read_unlock(driver);
+    
+    if (driver->cache && !driver->shared_cache) {
+        bytes += sizeof(BlockCache) + (size_t)driver->cache->capacity *
+                 (driver->cache->sector_size + sizeof(BlockCacheEntry) + sizeof(BlockCacheEntry*));
+    }
+    
+    return bytes;
+}
+
+/**
+ * Memory of a node, its free-slot index and its subtree
+ */
+static size_t fat_driver_node_memory(const FileNode* node) {
+    if (!node) return 0;
+    
+    size_t bytes = sizeof(FileNode);
+    if (node->slot_index) {
+        const FatSlotIndex* index = node->slot_index;
+        bytes += sizeof(FatSlotIndex) + (size_t)index->slot_capacity * 4 * sizeof(uint32_t) +
+                 (size_t)index->name_capacity * sizeof(FileNode*) +
+                 (size_t)index->cluster_capacity * sizeof(uint32_t);
+    }
+    for (const FileNode* child = node->children; child; child = child->next) {
+        bytes += fat_driver_node_memory(child);
+    }
+    
+    return bytes;
+}
+
+/**
+ * Writes cached metadata back to the image.
+ * 
+ * Modified FAT sectors are written to every FAT copy in LBA order, then the
+ * remaining dirty cached sectors are flushed. The free cluster count and
+ * next-free hint are kept in memory while mounted and written to the FSInfo
+ * sector (and its backup copy) last. Nothing is written for read-only mounts.
+ * 
+ * @param driver Pointer to the FATDriver structure.
+ * @return 0 if successful, -1 if failed.
+ */
+int fat_driver_sync(FATDriver* driver) {
+    if (!driver || !driver->hal) return -1;
+    
+    fat_driver_write_lock(driver);
+    int result = fat_driver_sync_unlocked(driver);
+    fat_driver_write_unlock(driver);
+    
+    return result;
+}
+
+/** Internal function of fat_driver_sync(), called with the write lock held */
+int fat_driver_sync_unlocked(FATDriver* driver) {
+    if (driver->config.mode != MODE_READ_WRITE) {
+        return 0;
+    }
+    
+    if (fat_driver_flush_fat(driver) != 0) {
+        return -1;
+    }
+    
+    if (driver->cache && block_cache_flush(driver->cache, driver->hal) != 0) {
+        return -1;
+    }
+    
+    if (!driver->fs_info_valid || !driver->fs_info_dirty) {
+        return 0;
+    }
+    
+    if (fat_driver_write_fs_info(driver, driver->boot_sector.fs_info) != 0) {
+        return -1;
+    }
+    
+    /* The backup FSInfo follows the backup boot sector */
+    uint16_t backup = driver->boot_sector.backup_boot_sector;
+    if (backup != 0 && backup != 0xFFFF) {
+        fat_driver_write_fs_info(driver, backup + 1);
+    }
+    
+    driver->fs_info_dirty = false;
+    return 0;
+}
+
 /**
  * Converts a cluster number to a sector number.
  * 
@@ -526,7 +1113,11 @@ void fat_driver_free_file_node(FileNode* node) {
     }
     
     /** Free the current node */
-    free(node);
+    fat_driver_slot_index_free(node->slot_index);
+    fat_driver_sort_free(node->sort_cache);
+    if (!node->in_arena) {
+        free(node);
+    }
 }
 
 /** Internal function to parse the boot sector */
@@ -578,67 +1169,198 @@ static void fat_driver_parse_boot_sector(FATDriver* driver, const uint8_t* boot_
 
 /**
  * Internal function to load the FAT table.
+ * 
+ * The FAT is not copied into memory. Its sectors are faulted in on demand
+ * through the block cache, so mount cost and resident memory do not depend
+ * on the volume size. Only the hot region is pinned here: the FAT sectors
+ * covering the root directory chain and the next-free hint.
  */
 static int fat_driver_load_fat_table(FATDriver* driver) {
-    if (!driver) return -1;
+    if (!driver || !driver->cache) return -1;
     
-    uint32_t fat_size;
     if (driver->boot_sector.fat_size_16 != 0) {
-        fat_size = driver->boot_sector.fat_size_16;
+        driver->fat_size = driver->boot_sector.fat_size_16;
     } else {
-        fat_size = driver->boot_sector.fat_size_32;
+        driver->fat_size = driver->boot_sector.fat_size_32;
+    }
+    if (driver->fat_size == 0) return -1;
+    
+    /* The FAT must be readable, check its first sector */
+    uint8_t media;
+    if (fat_driver_read_fat_bytes(driver, 0, &media, 1) != 0) {
+        return -1;
     }
     
-    uint32_t fat_size_bytes = fat_size * driver->boot_sector.bytes_per_sector;
-    driver->fat_table = malloc(fat_size_bytes);
-    if (!driver->fat_table) return -1;
+    driver->pinned_fat_count = 0;
+    fat_driver_pin_fat_sector(driver, fat_driver_get_fat_type(driver) == FAT_TYPE_32 ?
+                                      driver->boot_sector.root_cluster : 2);
+    fat_driver_pin_fat_sector(driver, driver->next_free_cluster);
     
+    return 0;
+}
+
+/**
+ * Reads bytes of FAT #1 through the cache. The range may cross a sector
+ * boundary (FAT12 entries can).
+ */
+int fat_driver_read_fat_bytes(FATDriver* driver, uint32_t offset, uint8_t* buffer, uint32_t length) {
     uint32_t sector_size = hal_get_sector_size(driver->hal);
-    uint8_t* buffer = malloc(sector_size);
-    if (!buffer) {
-        free(driver->fat_table);
-        driver->fat_table = NULL;
+    
+    if ((uint64_t)offset + length > (uint64_t)driver->fat_size * sector_size) {
         return -1;
     }
     
-    for (uint32_t i = 0; i < fat_size; i++) {
-        uint32_t read_bytes = hal_read_sector(driver->hal, driver->first_fat_sector + i, buffer);
-        if (read_bytes != sector_size) {
-            free(buffer);
-            free(driver->fat_table);
-            driver->fat_table = NULL;
+    while (length > 0) {
+        uint32_t sector = driver->first_fat_sector + offset / sector_size;
+        uint32_t in_sector = offset % sector_size;
+        uint32_t chunk = sector_size - in_sector;
+        if (chunk > length) chunk = length;
+        
+        if (block_cache_read_bytes(driver->cache, driver->hal, sector, in_sector, buffer, chunk) != 0) {
             return -1;
         }
         
-        memcpy((uint8_t*)driver->fat_table + i * sector_size, buffer, sector_size);
+        buffer += chunk;
+        offset += chunk;
+        length -= chunk;
     }
     
-    free(buffer);
     return 0;
 }
 
 /**
- * Internal function to load the root directory.
+ * Internal function to pin the FAT sector that holds the entry of a cluster.
+ * At most a quarter of the cache is ever pinned.
  */
-static int fat_driver_load_root_directory(FATDriver* driver) {
-    if (!driver) return -1;
-    
-    /* Create node for the root directory */
-    driver->root_directory = malloc(sizeof(FileNode));
-    if (!driver->root_directory) return -1;
+static void fat_driver_pin_fat_sector(FATDriver* driver, uint32_t cluster) {
+    if (driver->pinned_fat_count >= FAT_PINNED_SECTORS_MAX ||
+        driver->pinned_fat_count >= driver->cache_size / 4) {
+        return;
+    }
     
-    memset(driver->root_directory, 0, sizeof(FileNode));
-    strcpy(driver->root_directory->name, "/");
-    driver->root_directory->type = FILE_TYPE_DIRECTORY;
-    driver->root_directory->attributes.directory = true; /* FAT_ATTR_DIRECTORY; */
+    uint32_t offset = fat_driver_fat_offset(driver, cluster);
+    uint32_t sector = driver->first_fat_sector + offset / hal_get_sector_size(driver->hal);
+    if (sector >= driver->first_fat_sector + driver->fat_size) return;
     
-    if (fat_driver_get_fat_type(driver) == FAT_TYPE_32) {
-        driver->root_directory->first_cluster = driver->boot_sector.root_cluster;
-    } else {
-        driver->root_directory->first_cluster = 0; /* Root directory in FAT12/16 is not in the data area */
+    for (uint32_t i = 0; i < driver->pinned_fat_count; i++) {
+        if (driver->pinned_fat_sectors[i] == sector) return;
     }
     
-    return 0;
+    if (block_cache_pin(driver->cache, driver->hal, sector) == 0) {
+        driver->pinned_fat_sectors[driver->pinned_fat_count++] = sector;
+    }
+}
+
+/**
+ * Internal function to load the FSInfo sector.
+ * 
+ * On FAT32 the free cluster count and next-free hint are taken from FSInfo
+ * when its three signatures match and the values are in range. Otherwise the
+ * free count is left unknown and computed by a FAT scan on first use.
+ */
+static int fat_driver_load_fs_info(FATDriver* driver) {
+    if (!driver) return -1;
+    
+    driver->fs_info_valid = false;
+    driver->fs_info_dirty = false;
+    driver->free_count_valid = false;
+    driver->free_clusters = 0;
+    driver->next_free_cluster = 2;
+    
+    uint16_t fs_info_sector = driver->boot_sector.fs_info;
+    if (fat_driver_get_fat_type(driver) != FAT_TYPE_32 || 
+        fs_info_sector == 0 || fs_info_sector == 0xFFFF ||
+        fs_info_sector >= driver->boot_sector.reserved_sectors) {
+        return 0;
+    }
+    
+    uint32_t sector_size = hal_get_sector_size(driver->hal);
+    uint8_t* buffer = malloc(sector_size);
+    if (!buffer) return -1;
+    
+    uint32_t read_bytes = hal_read_sector(driver->hal, fs_info_sector, buffer);
+    if (read_bytes != sector_size) {
+        free(buffer);
+        return 0; /* Unreadable FSInfo is not fatal, fall back to scanning */
+    }
+    
+    FSInfo* info = &driver->fs_info;
+    info->lead_signature = *(uint32_t*)(buffer + 0);
+    info->struct_signature = *(uint32_t*)(buffer + 484);
+    info->free_count = *(uint32_t*)(buffer + 488);
+    info->next_free = *(uint32_t*)(buffer + 492);
+    info->trail_signature = *(uint32_t*)(buffer + 508);
+    free(buffer);
+    
+    if (info->lead_signature != FSINFO_LEAD_SIGNATURE ||
+        info->struct_signature != FSINFO_STRUCT_SIGNATURE ||
+        info->trail_signature != FSINFO_TRAIL_SIGNATURE) {
+        return 0;
+    }
+    
+    driver->fs_info_valid = true;
+    
+    if (info->free_count != FSINFO_UNKNOWN && info->free_count <= driver->total_clusters) {
+        driver->free_clusters = info->free_count;
+        driver->free_count_valid = true;
+    }
+    
+    if (info->next_free >= 2 && info->next_free < driver->total_clusters + 2) {
+        driver->next_free_cluster = info->next_free;
+    }
+    
+    return 0;
+}
+
+/**
+ * Internal function to write the in-memory free count and hint to an FSInfo
+ * sector, leaving the rest of the sector untouched.
+ */
+static int fat_driver_write_fs_info(FATDriver* driver, uint32_t sector) {
+    uint32_t sector_size = hal_get_sector_size(driver->hal);
+    uint8_t* buffer = malloc(sector_size);
+    if (!buffer) return -1;
+    
+    if (hal_read_sector(driver->hal, sector, buffer) != (int)sector_size ||
+        *(uint32_t*)(buffer + 0) != FSINFO_LEAD_SIGNATURE ||
+        *(uint32_t*)(buffer + 484) != FSINFO_STRUCT_SIGNATURE) {
+        free(buffer);
+        return -1;
+    }
+    
+    driver->fs_info.free_count = driver->free_count_valid ? driver->free_clusters : FSINFO_UNKNOWN;
+    driver->fs_info.next_free = driver->next_free_cluster;
+    *(uint32_t*)(buffer + 488) = driver->fs_info.free_count;
+    *(uint32_t*)(buffer + 492) = driver->fs_info.next_free;
+    
+    int written = hal_write_sector(driver->hal, sector, buffer);
+    free(buffer);
+    
+    return written == (int)sector_size ? 0 : -1;
+}
+
+/**
+ * Internal function to load the root directory.
+ */
+static int fat_driver_load_root_directory(FATDriver* driver) {
+    if (!driver) return -1;
+    
+    /* Create node for the root directory */
+    driver->root_directory = malloc(sizeof(FileNode));
+    if (!driver->root_directory) return -1;
+    
+    memset(driver->root_directory, 0, sizeof(FileNode));
+    strcpy(driver->root_directory->name, "/");
+    driver->root_directory->type = FILE_TYPE_DIRECTORY;
+    driver->root_directory->attributes.directory = true; /* FAT_ATTR_DIRECTORY; */
+    
+    if (fat_driver_get_fat_type(driver) == FAT_TYPE_32) {
+        driver->root_directory->first_cluster = driver->boot_sector.root_cluster;
+    } else {
+        driver->root_directory->first_cluster = 0; /* Root directory in FAT12/16 is not in the data area */
+    }
+    
+    return 0;
 }
 
 /**
@@ -647,193 +1369,726 @@ static int fat_driver_load_root_directory(FATDriver* driver) {
 static int fat_driver_build_directory_tree(FATDriver* driver) {
     if (!driver || !driver->root_directory) return -1;
     
+    /**
+     * Process the root directory. In FAT32 it is a cluster chain, in
+     * FAT12/16 it is at a fixed location.
+     */
+    if (fat_driver_scan_directory(driver, driver->root_directory, NULL, false) != 0) {
+        return -1;
+    }
+    
+    /* Process the subdirectories, in parallel when the pool is running */
+    if (!driver->config.prefetch_tree || fat_driver_build_tree_by_level(driver) != 0) {
+        fat_driver_build_subdirectories(driver, driver->root_directory);
+        threadpool_wait(driver->pool);
+    }
+    
+    return 0;
+}
+
+/* Recursive function to build the directory tree */
+int fat_driver_build_directory_tree_recursive(FATDriver* driver, FileNode* directory) {
+    if (fat_driver_scan_directory(driver, directory, NULL, false) != 0) {
+        return -1;
+    }
+    
+    /* Process the subdirectories */
+    FileNode* current = directory->children;
+    while (current) {
+        if (current->type == FILE_TYPE_DIRECTORY) {
+            fat_driver_build_directory_tree_recursive(driver, current);
+        }
+        current = current->next;
+    }
+    
+    return 0;
+}
+
+/**
+ * Reads one directory and attaches its entries as children.
+ * 
+ * Entries are classified a group at a time and reading stops at the first
+ * 0x00 end-of-directory marker. When the directory has a free-slot index the
+ * rest of its clusters are still walked, without reading them, so the index
+ * covers every slot. Nodes come from the given arena, or from malloc when it
+ * is NULL. Each directory is scanned by exactly one caller, so the children
+ * list is built privately and attached with a single store, without locking
+ * the parent.
+ * 
+ * @param driver Pointer to the FATDriver structure.
+ * @param directory Directory node to read.
+ * @param arena Node arena of the calling worker, NULL for malloc.
+ * @param through_cache Read the sectors through the block cache (prefetched).
+ * @return 0 if successful, -1 if failed (entries read so far are attached).
+ */
+int fat_driver_scan_directory(FATDriver* driver, FileNode* directory, FileNodeArena* arena, bool through_cache) {
+    if (!driver || !directory || directory->type != FILE_TYPE_DIRECTORY) {
+        return -1;
+    }
+    
+    FileNode* children = NULL;
+    int result = fat_driver_scan_entries(driver, directory, arena, through_cache, &children);
+    directory->children = children;
+    
+    return result;
+}
+
+/**
+ * Reads the entries of one directory into a list that is not attached yet,
+ * and sets the directory's free-slot index and content hash.
+ * 
+ * @return 0 if successful, -1 if failed (children holds the entries read so far).
+ */
+static int fat_driver_scan_entries(FATDriver* driver, FileNode* directory, FileNodeArena* arena,
+                                   bool through_cache, FileNode** children) {
     uint32_t sector_size = hal_get_sector_size(driver->hal);
     uint8_t* buffer = malloc(sector_size);
     if (!buffer) return -1;
     
-    /**
-     * Process the root directory
-     */
-    if (fat_driver_get_fat_type(driver) == FAT_TYPE_32) {
-        /* In FAT32, the root directory is a cluster chain */
-        uint32_t current_cluster = driver->root_directory->first_cluster;
+    if (driver->config.mode == MODE_READ_WRITE) {
+        directory->slot_index = fat_driver_slot_index_create();
+    }
+    
+    FatScanState state;
+    memset(&state, 0, sizeof(state));
+    state.arena = arena;
+    state.hash = FAT_HASH_SEED;
+    
+    bool failed = false;
+    bool fixed_root = (directory == driver->root_directory && fat_driver_get_fat_type(driver) != FAT_TYPE_32);
+    uint32_t cluster = 0;
+    uint32_t sectors_per_cluster = fixed_root ? driver->root_dir_sectors : driver->boot_sector.sectors_per_cluster;
+    FatChainIterator chain;
+    
+    fat_driver_chain_begin(&chain, driver, fixed_root ? 0 : directory->first_cluster);
+    while (!failed) {
+        uint32_t first_sector;
+        if (fixed_root) {
+            first_sector = driver->first_root_dir_sector;
+        } else {
+            if (!fat_driver_chain_next(&chain, &cluster)) break;
+            fat_driver_track_cluster(directory, cluster);
+            first_sector = fat_driver_cluster_to_sector(driver, cluster);
+        }
         
-        while (current_cluster != 0 && 
-               current_cluster != FAT32_EOC) {
-            
-            uint32_t first_sector_of_cluster = fat_driver_cluster_to_sector(driver, current_cluster);
+        /* Past the end marker only the free-slot index needs the chain */
+        if (state.end_reached && !directory->slot_index) break;
+        if (!fixed_root) state.hash = fat_driver_hash_bytes(state.hash, &cluster, sizeof(cluster));
+        
+        for (uint32_t i = 0; !failed && i < sectors_per_cluster; i++) {
+            if (state.end_reached) {
+                fat_driver_track_free_slots(directory, &state, sector_size / 32);
+                continue;
+            }
             
-            for (uint32_t i = 0; i < driver->boot_sector.sectors_per_cluster; i++) {
-                uint32_t read_bytes = hal_read_sector(driver->hal, first_sector_of_cluster + i, buffer);
-                if (read_bytes != sector_size) {
-                    free(buffer);
-                    return -1;
-                }
-                
-                /* Process the entries in the sector */
-                for (uint32_t j = 0; j < sector_size; j += 32) {
-                    FATDirEntry* entry = (FATDirEntry*)(buffer + j);
-                    
-                    /* Check for empty or deleted entries */
-                    if (entry->name[0] == 0x00 || entry->name[0] == (uint8_t)0xE5) {
-                        continue;
-                    }
-                    
-                    /* Skip volume label entries */
-                    if (entry->attributes & FAT_ATTR_VOLUME_ID) {
-                        continue;
-                    }
-                    
-                    /* Create a new node */
-                    FileNode* node = malloc(sizeof(FileNode));
-                    if (!node) {
-                        free(buffer);
-                        return -1;
-                    }
-                    
-                    /* Fill in the node */
-                    fat_driver_fill_file_node(driver, node, entry);
-                    
-                    /* Add the node to the root directory */
-                    node->parent = driver->root_directory;
-                    node->next = driver->root_directory->children;
-                    driver->root_directory->children = node;
+            uint32_t read_bytes = through_cache ?
+                block_cache_read(driver->cache, driver->hal, first_sector + i, buffer) :
+                hal_read_sector(driver->hal, first_sector + i, buffer);
+            if (read_bytes != sector_size ||
+                fat_driver_parse_directory_sector(driver, directory, buffer, sector_size, &state) != 0) {
+                failed = true;
+            }
+            state.hash = fat_driver_hash_bytes(state.hash, buffer, sector_size);
+        }
+        
+        if (fixed_root) break;
+    }
+    
+    fat_driver_slot_index_finish(directory->slot_index);
+    *children = state.children;
+    directory->content_hash = failed ? 0 : state.hash;
+    
+    free(buffer);
+    return failed ? -1 : 0;
+}
+
+/**
+ * Turns the live entries of one directory sector into nodes.
+ * 
+ * @return 0 if successful, -1 if a node could not be allocated.
+ */
+static int fat_driver_parse_directory_sector(FATDriver* driver, FileNode* directory, const uint8_t* buffer,
+                                             uint32_t sector_size, FatScanState* state) {
+    uint32_t entries_per_sector = sector_size / 32;
+    
+    for (uint32_t base = 0; base < entries_per_sector; base += FAT_SCAN_GROUP) {
+        uint32_t count = entries_per_sector - base;
+        if (count > FAT_SCAN_GROUP) count = FAT_SCAN_GROUP;
+        
+        const uint8_t* group = buffer + base * 32;
+        FatEntryMask mask;
+        fat_driver_classify_entries(group, count, &mask);
+        
+        /* Free-slot index: free slots and everything from the end marker on */
+        if (directory->slot_index) {
+            for (uint32_t i = 0; i < count; i++) {
+                bool is_end = (i >= mask.end);
+                bool is_free = is_end || (mask.free & (1u << i));
+                if (fat_driver_slot_index_add_slot(directory->slot_index, is_free, is_end) != 0) {
+                    fat_driver_slot_index_free(directory->slot_index);
+                    directory->slot_index = NULL;
+                    break;
                 }
             }
+        }
+        
+        for (uint32_t i = 0; i < mask.end; i++) {
+            uint32_t bit = 1u << i;
+            uint32_t slot = state->slot_count + i;
+            
+            /* LFN entries belong to the short entry that follows them */
+            if (mask.lfn & bit) {
+                if (state->lfn_slots < UINT8_MAX) state->lfn_slots++;
+                continue;
+            }
+            if (!(mask.live & bit)) {
+                state->lfn_slots = 0;
+                continue;
+            }
+            
+            /* Create a new node */
+            FileNode* node = fat_driver_alloc_node(state->arena);
+            if (!node) return -1;
+            
+            /* Fill in the node */
+            fat_driver_fill_file_node(driver, node, (const FATDirEntry*)(group + i * 32));
+            node->in_arena = (state->arena != NULL);
+            node->entry_slot = slot;
+            node->lfn_slots = state->lfn_slots;
+            state->lfn_slots = 0;
             
-            /* Get the next cluster */
-            current_cluster = fat_driver_get_next_cluster(driver, current_cluster);
+            /* Add the node to the directory */
+            node->parent = directory;
+            node->next = state->children;
+            state->children = node;
         }
-    } else {
-        /* In FAT12/16, the root directory is at a fixed location */
-        for (uint32_t i = 0; i < driver->root_dir_sectors; i++) {
-            uint32_t read_bytes = hal_read_sector(driver->hal, driver->first_root_dir_sector + i, buffer);
-            if (read_bytes != sector_size) {
-                free(buffer);
-                return -1;
+        
+        state->slot_count += count;
+        if (mask.end < count) {
+            state->end_reached = true;
+            
+            /* The rest of the sector is past the end marker */
+            uint32_t rest = entries_per_sector - base - count;
+            if (rest > 0) fat_driver_track_free_slots(directory, state, rest);
+            break;
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * Adds slots past the end-of-directory marker to the free-slot index
+ * without reading them.
+ */
+static void fat_driver_track_free_slots(FileNode* directory, FatScanState* state, uint32_t count) {
+    state->slot_count += count;
+    if (!directory->slot_index) return;
+    
+    for (uint32_t i = 0; i < count; i++) {
+        if (fat_driver_slot_index_add_slot(directory->slot_index, true, true) != 0) {
+            fat_driver_slot_index_free(directory->slot_index);
+            directory->slot_index = NULL;
+            return;
+        }
+    }
+}
+
+/**
+ * Task of the parallel tree build: scans one directory and submits a task
+ * for each of its subdirectories.
+ */
+static void fat_driver_build_task(void* arg, uint32_t worker) {
+    FatBuildTask* task = (FatBuildTask*)arg;
+    FATDriver* driver = task->driver;
+    
+    fat_driver_scan_directory(driver, task->directory, &driver->node_arenas[worker], false);
+    fat_driver_build_subdirectories(driver, task->directory);
+    
+    free(task);
+}
+
+/**
+ * Task of the prefetched tree build: scans one directory of the current
+ * level from the cache. Subdirectories wait for the next level.
+ */
+static void fat_driver_level_task(void* arg, uint32_t worker) {
+    FatBuildTask* task = (FatBuildTask*)arg;
+    
+    fat_driver_scan_directory(task->driver, task->directory, &task->driver->node_arenas[worker], true);
+    free(task);
+}
+
+/**
+ * Builds the tree below the root breadth first with LBA-ordered prefetch.
+ * 
+ * For each level the cluster chains of all its directories are collected
+ * first. Directories are then taken in order of their first sector and
+ * grouped so that a group fits in the cache; the sectors of a group are
+ * sorted, adjacent sectors are merged and every run is read into the cache
+ * with one request before the group is parsed. The children found become the
+ * next level.
+ * 
+ * @param driver Pointer to the FATDriver structure.
+ * @return 0 if successful, -1 if failed.
+ */
+static int fat_driver_build_tree_by_level(FATDriver* driver) {
+    uint32_t level_count = 0;
+    FileNode** level = fat_driver_collect_subdirectories(&driver->root_directory, 1, &level_count);
+    
+    /* Keep room for the FAT sectors the chain walks need */
+    uint32_t budget = (driver->cache->capacity - driver->pinned_fat_count) / 2;
+    if (budget == 0) budget = 1;
+    
+    uint32_t* group_sectors = malloc(budget * sizeof(uint32_t));
+    if (!group_sectors) {
+        free(level);
+        return -1;
+    }
+    
+    while (level && level_count > 0) {
+        FatLevelDir* dirs = malloc(level_count * sizeof(FatLevelDir));
+        if (!dirs) {
+            /* Finish the remaining subtrees without prefetch */
+            for (uint32_t i = 0; i < level_count; i++) {
+                fat_driver_build_directory_tree_recursive(driver, level[i]);
+            }
+            break;
+        }
+        
+        /* Collect the sectors of every directory of the level */
+        uint32_t* sectors = NULL;
+        uint32_t sector_count = 0;
+        uint32_t sector_capacity = 0;
+        for (uint32_t i = 0; i < level_count; i++) {
+            dirs[i].node = level[i];
+            dirs[i].first_index = sector_count;
+            fat_driver_collect_directory_sectors(driver, level[i]->first_cluster,
+                                                 &sectors, &sector_count, &sector_capacity);
+            dirs[i].sector_count = sector_count - dirs[i].first_index;
+            dirs[i].first_sector = dirs[i].sector_count ? sectors[dirs[i].first_index] : 0;
+        }
+        qsort(dirs, level_count, sizeof(FatLevelDir), fat_driver_compare_level_dir);
+        
+        /* Prefetch and parse one cache-sized group at a time */
+        uint32_t start = 0;
+        while (start < level_count) {
+            uint32_t end = start;
+            uint32_t group_count = 0;
+            while (end < level_count && group_count + dirs[end].sector_count <= budget) {
+                memcpy(group_sectors + group_count, sectors + dirs[end].first_index,
+                       dirs[end].sector_count * sizeof(uint32_t));
+                group_count += dirs[end].sector_count;
+                end++;
+            }
+            if (end == start) {
+                /* A directory larger than the budget is prefetched in part */
+                group_count = budget;
+                memcpy(group_sectors, sectors + dirs[start].first_index, budget * sizeof(uint32_t));
+                end = start + 1;
             }
             
-            /* Process the entries in the sector */
-            for (uint32_t j = 0; j < sector_size; j += 32) {
-                FATDirEntry* entry = (FATDirEntry*)(buffer + j);
-                
-                /* Check for empty or deleted entries */
-                if (entry->name[0] == 0x00 || entry->name[0] == (uint8_t)0xE5) {
-                    continue;
-                }
-                
-                /* Skip volume label entries */
-                if (entry->attributes & FAT_ATTR_VOLUME_ID) {
-                    continue;
-                }
-                
-                /* Create a new node */
-                FileNode* node = malloc(sizeof(FileNode));
-                if (!node) {
-                    free(buffer);
-                    return -1;
+            fat_driver_prefetch_sectors(driver, group_sectors, group_count);
+            
+            for (uint32_t i = start; i < end; i++) {
+                FatBuildTask* task = driver->pool ? malloc(sizeof(FatBuildTask)) : NULL;
+                if (task) {
+                    task->driver = driver;
+                    task->directory = dirs[i].node;
+                    if (threadpool_submit(driver->pool, fat_driver_level_task, task)) continue;
+                    free(task);
                 }
-                
-                /* Fill in the node */
-                fat_driver_fill_file_node(driver, node, entry);
-                
-                /* Add the node to the root directory */
-                node->parent = driver->root_directory;
-                node->next = driver->root_directory->children;
-                driver->root_directory->children = node;
+                fat_driver_scan_directory(driver, dirs[i].node, NULL, true);
             }
+            threadpool_wait(driver->pool);
+            
+            start = end;
+        }
+        
+        free(sectors);
+        free(dirs);
+        
+        /* The subdirectories found form the next level */
+        FileNode** next = fat_driver_collect_subdirectories(level, level_count, &level_count);
+        free(level);
+        level = next;
+    }
+    
+    free(group_sectors);
+    free(level);
+    return 0;
+}
+
+/**
+ * Returns the subdirectories of a set of directories as a new array.
+ */
+static FileNode** fat_driver_collect_subdirectories(FileNode** directories, uint32_t count, uint32_t* result_count) {
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        for (FileNode* child = directories[i]->children; child; child = child->next) {
+            if (child->type == FILE_TYPE_DIRECTORY) total++;
         }
     }
     
-    /* Process the subdirectories */
-    FileNode* current = driver->root_directory->children;
-    while (current) {
-        if (current->type == FILE_TYPE_DIRECTORY) {
-            fat_driver_build_directory_tree_recursive(driver, current);
+    *result_count = 0;
+    if (total == 0) return NULL;
+    
+    FileNode** result = malloc(total * sizeof(FileNode*));
+    if (!result) return NULL;
+    
+    for (uint32_t i = 0; i < count; i++) {
+        for (FileNode* child = directories[i]->children; child; child = child->next) {
+            if (child->type == FILE_TYPE_DIRECTORY) result[(*result_count)++] = child;
         }
-        current = current->next;
     }
     
-    free(buffer);
-    return 0;
+    return result;
 }
 
-/* Recursive function to build the directory tree */
-int fat_driver_build_directory_tree_recursive(FATDriver* driver, FileNode* directory) {
-    if (!driver || !directory || directory->type != FILE_TYPE_DIRECTORY) {
-        return -1;
+/**
+ * Appends the sectors of a directory cluster chain to a growing array.
+ */
+static void fat_driver_collect_directory_sectors(FATDriver* driver, uint32_t first_cluster, uint32_t** sectors,
+                                                 uint32_t* count, uint32_t* capacity) {
+    uint32_t sectors_per_cluster = driver->boot_sector.sectors_per_cluster;
+    FatChainIterator chain;
+    uint32_t cluster;
+    
+    fat_driver_chain_begin(&chain, driver, first_cluster);
+    while (fat_driver_chain_next(&chain, &cluster)) {
+        if (*count + sectors_per_cluster > *capacity) {
+            uint32_t grown = *capacity ? *capacity * 2 : 64;
+            while (grown < *count + sectors_per_cluster) grown *= 2;
+            uint32_t* array = realloc(*sectors, grown * sizeof(uint32_t));
+            if (!array) return;
+            *sectors = array;
+            *capacity = grown;
+        }
+        
+        uint32_t first_sector = fat_driver_cluster_to_sector(driver, cluster);
+        for (uint32_t i = 0; i < sectors_per_cluster; i++) {
+            (*sectors)[(*count)++] = first_sector + i;
+        }
+    }
+}
+
+/**
+ * Sorts sectors by LBA and reads each run of adjacent sectors into the cache
+ * with one request.
+ */
+static void fat_driver_prefetch_sectors(FATDriver* driver, uint32_t* sectors, uint32_t count) {
+    qsort(sectors, count, sizeof(uint32_t), fat_driver_compare_sector);
+    
+    uint32_t i = 0;
+    while (i < count) {
+        uint32_t run = 1;
+        while (i + run < count && sectors[i + run] <= sectors[i] + run) {
+            run++;
+        }
+        /* Duplicates make the run shorter than its span */
+        uint32_t span = sectors[i + run - 1] - sectors[i] + 1;
+        block_cache_prefetch(driver->cache, driver->hal, sectors[i], span);
+        i += run;
+    }
+}
+
+/* Orders level directories by their first sector */
+static int fat_driver_compare_level_dir(const void* a, const void* b) {
+    uint32_t sa = ((const FatLevelDir*)a)->first_sector;
+    uint32_t sb = ((const FatLevelDir*)b)->first_sector;
+    return (sa > sb) - (sa < sb);
+}
+
+/* Orders sector numbers */
+static int fat_driver_compare_sector(const void* a, const void* b) {
+    uint32_t sa = *(const uint32_t*)a;
+    uint32_t sb = *(const uint32_t*)b;
+    return (sa > sb) - (sa < sb);
+}
+
+/**
+ * Builds the subtrees of every subdirectory of a directory, as pool tasks
+ * when the driver has a pool, recursively otherwise.
+ */
+static void fat_driver_build_subdirectories(FATDriver* driver, FileNode* directory) {
+    for (FileNode* current = directory->children; current; current = current->next) {
+        if (current->type != FILE_TYPE_DIRECTORY) continue;
+        
+        FatBuildTask* task = driver->pool ? malloc(sizeof(FatBuildTask)) : NULL;
+        if (task) {
+            task->driver = driver;
+            task->directory = current;
+            if (threadpool_submit(driver->pool, fat_driver_build_task, task)) continue;
+            free(task);
+        }
+        
+        fat_driver_build_directory_tree_recursive(driver, current);
+    }
+}
+
+/**
+ * Hands out a node from an arena, or from malloc when arena is NULL.
+ */
+static FileNode* fat_driver_alloc_node(FileNodeArena* arena) {
+    if (!arena) return malloc(sizeof(FileNode));
+    
+    if (!arena->chunks || arena->chunks->used == FAT_NODE_ARENA_CHUNK) {
+        FileNodeArenaChunk* chunk = malloc(sizeof(FileNodeArenaChunk));
+        if (!chunk) return NULL;
+        chunk->used = 0;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+    
+    return &arena->chunks->nodes[arena->chunks->used++];
+}
+
+/**
+ * Starts the worker pool and its node arenas. Without them the tree is built
+ * on the calling thread.
+ */
+static void fat_driver_start_workers(FATDriver* driver) {
+    uint32_t workers = driver->config.worker_threads;
+    if (workers <= 1) return;
+    
+    driver->pool = malloc(sizeof(ThreadPool));
+    driver->node_arenas = calloc(workers, sizeof(FileNodeArena));
+    if (!driver->pool || !driver->node_arenas || !threadpool_init(driver->pool, workers)) {
+        free(driver->pool);
+        free(driver->node_arenas);
+        driver->pool = NULL;
+        driver->node_arenas = NULL;
+    }
+}
+
+/**
+ * Stops the worker pool and releases the node arenas. Must run after the
+ * tree is freed.
+ */
+static void fat_driver_stop_workers(FATDriver* driver) {
+    if (driver->pool) {
+        uint32_t workers = driver->pool->worker_count;
+        threadpool_deinit(driver->pool);
+        free(driver->pool);
+        driver->pool = NULL;
+        
+        for (uint32_t i = 0; driver->node_arenas && i < workers; i++) {
+            FileNodeArenaChunk* chunk = driver->node_arenas[i].chunks;
+            while (chunk) {
+                FileNodeArenaChunk* next = chunk->next;
+                free(chunk);
+                chunk = next;
+            }
+        }
     }
     
+    free(driver->node_arenas);
+    driver->node_arenas = NULL;
+}
+
+/**
+ * Hashes a directory exactly like fat_driver_scan_directory() does, without
+ * building nodes: the clusters it visits and the sectors it reads up to the
+ * sector holding the end marker. Read-write mounts follow the rest of the
+ * chain too, as the scan does for the free-slot index.
+ */
+static int fat_driver_hash_directory(FATDriver* driver, FileNode* directory, uint64_t* hash) {
     uint32_t sector_size = hal_get_sector_size(driver->hal);
     uint8_t* buffer = malloc(sector_size);
     if (!buffer) return -1;
     
-    uint32_t current_cluster = directory->first_cluster;
-    
-    while (current_cluster != 0 && 
-           current_cluster != FAT12_EOC && 
-           current_cluster != FAT16_EOC && 
-           current_cluster != FAT32_EOC) {
+    bool failed = false;
+    bool end_reached = false;
+    bool fixed_root = (directory == driver->root_directory && fat_driver_get_fat_type(driver) != FAT_TYPE_32);
+    uint32_t cluster = 0;
+    uint32_t sectors_per_cluster = fixed_root ? driver->root_dir_sectors : driver->boot_sector.sectors_per_cluster;
+    FatChainIterator chain;
+    
+    *hash = FAT_HASH_SEED;
+    fat_driver_chain_begin(&chain, driver, fixed_root ? 0 : directory->first_cluster);
+    while (!failed) {
+        uint32_t first_sector;
+        if (fixed_root) {
+            first_sector = driver->first_root_dir_sector;
+        } else {
+            if (!fat_driver_chain_next(&chain, &cluster)) break;
+            first_sector = fat_driver_cluster_to_sector(driver, cluster);
+        }
         
-        uint32_t first_sector_of_cluster = fat_driver_cluster_to_sector(driver, current_cluster);
+        if (end_reached && driver->config.mode != MODE_READ_WRITE) break;
+        if (!fixed_root) *hash = fat_driver_hash_bytes(*hash, &cluster, sizeof(cluster));
         
-        for (uint32_t i = 0; i < driver->boot_sector.sectors_per_cluster; i++) {
-            uint32_t read_bytes = hal_read_sector(driver->hal, first_sector_of_cluster + i, buffer);
+        for (uint32_t i = 0; !failed && !end_reached && i < sectors_per_cluster; i++) {
+            uint32_t read_bytes = block_cache_read(driver->cache, driver->hal, first_sector + i, buffer);
             if (read_bytes != sector_size) {
-                free(buffer);
-                return -1;
+                failed = true;
+                break;
             }
+            *hash = fat_driver_hash_bytes(*hash, buffer, sector_size);
             
-            /* Process the entries in the sector */
-            for (uint32_t j = 0; j < sector_size; j += 32) {
-                FATDirEntry* entry = (FATDirEntry*)(buffer + j);
+            for (uint32_t base = 0; base < sector_size / 32; base += FAT_SCAN_GROUP) {
+                uint32_t count = sector_size / 32 - base;
+                if (count > FAT_SCAN_GROUP) count = FAT_SCAN_GROUP;
                 
-                /* Check for empty or deleted entries */
-                if (entry->name[0] == 0x00 || entry->name[0] == (uint8_t)0xE5) {
-                    continue;
+                FatEntryMask mask;
+                fat_driver_classify_entries(buffer + base * 32, count, &mask);
+                if (mask.end < count) {
+                    end_reached = true;
+                    break;
                 }
-                
-                /* Skip volume label entries and . and .. entries */
-                if ((entry->attributes & FAT_ATTR_VOLUME_ID) ||
-                    (entry->name[0] == '.' && entry->name[1] == ' ') ||
-                    (entry->name[0] == '.' && entry->name[1] == '.' && entry->name[2] == ' ')) {
-                    continue;
-                }
-                
-                /* Create a new node */
-                FileNode* node = malloc(sizeof(FileNode));
-                if (!node) {
-                    free(buffer);
-                    return -1;
-                }
-                
-                /* Fill in the node */
-                fat_driver_fill_file_node(driver, node, entry);
-                
-                /* Add the node to the current directory */
-                node->parent = directory;
-                node->next = directory->children;
-                directory->children = node;
             }
         }
         
-        /* Get the next cluster */
-        current_cluster = fat_driver_get_next_cluster(driver, current_cluster);
+        if (fixed_root) break;
     }
     
-    /* Process the subdirectories */
-    FileNode* current = directory->children;
-    while (current) {
-        if (current->type == FILE_TYPE_DIRECTORY) {
-            fat_driver_build_directory_tree_recursive(driver, current);
+    free(buffer);
+    return failed ? -1 : 0;
+}
+
+/**
+ * Refreshes one directory and then its subdirectories
+ */
+static int fat_driver_refresh_directory(FATDriver* driver, FileNode* directory, uint32_t* rescanned) {
+    uint64_t hash;
+    if (fat_driver_hash_directory(driver, directory, &hash) != 0) return -1;
+    
+    if (hash != directory->content_hash) {
+        if (fat_driver_rescan_directory(driver, directory) != 0) return -1;
+        (*rescanned)++;
+    }
+    
+    int result = 0;
+    for (FileNode* child = directory->children; child; child = child->next) {
+        if (child->type == FILE_TYPE_DIRECTORY &&
+            fat_driver_refresh_directory(driver, child, rescanned) != 0) {
+            result = -1;
         }
-        current = current->next;
     }
     
-    free(buffer);
+    return result;
+}
+
+/**
+ * Scans a directory again and replaces its child list. The new list is built
+ * aside: a new entry with the name, type and first cluster of an old
+ * subdirectory takes over that subdirectory's children, then the list is
+ * published with one store and the old children are retired.
+ */
+static int fat_driver_rescan_directory(FATDriver* driver, FileNode* directory) {
+    FileNode* old_children = directory->children;
+    FatSlotIndex* old_slots = directory->slot_index;
+    uint64_t old_hash = directory->content_hash;
+    FileNode* fresh_children = NULL;
+    
+    directory->slot_index = NULL;
+    if (fat_driver_scan_entries(driver, directory, NULL, false, &fresh_children) != 0) {
+        while (fresh_children) {
+            FileNode* next = fresh_children->next;
+            fat_driver_free_file_node(fresh_children);
+            fresh_children = next;
+        }
+        fat_driver_slot_index_free(directory->slot_index);
+        directory->slot_index = old_slots;
+        directory->content_hash = old_hash;
+        return -1;
+    }
+    fat_driver_slot_index_free(old_slots);
+    
+    /* Old children sorted by name for lookup */
+    uint32_t old_count = 0;
+    for (FileNode* node = old_children; node; node = node->next) old_count++;
+    
+    FileNode** old_sorted = malloc((old_count ? old_count : 1) * sizeof(FileNode*));
+    FileNode** successor = calloc(old_count ? old_count : 1, sizeof(FileNode*));
+    if (!old_sorted || !successor) {
+        /* Keep the fresh list, the old nodes go away without matching */
+        free(old_sorted);
+        free(successor);
+        FAT_PUBLISH_LINK(directory->children, fresh_children);
+        fat_driver_sort_invalidate(driver, directory);
+        while (old_children) {
+            FileNode* next = old_children->next;
+            fat_driver_drop_node(driver, old_children);
+            old_children = next;
+        }
+        return 0;
+    }
+    
+    uint32_t index = 0;
+    for (FileNode* node = old_children; node; node = node->next) {
+        old_sorted[index++] = node;
+    }
+    qsort(old_sorted, old_count, sizeof(FileNode*), fat_driver_compare_node_name);
+    
+    for (FileNode* fresh = fresh_children; fresh; fresh = fresh->next) {
+        FileNode** found = old_count ? bsearch(&fresh, old_sorted, old_count, sizeof(FileNode*),
+                                               fat_driver_compare_node_name) : NULL;
+        FileNode* old = found ? *found : NULL;
+        if (!old || successor[found - old_sorted] ||
+            old->type != fresh->type || old->first_cluster != fresh->first_cluster) {
+            continue;
+        }
+        successor[found - old_sorted] = fresh;
+        if (fresh->type != FILE_TYPE_DIRECTORY) continue;
+        
+        /* The new version of the subdirectory adopts its subtree */
+        fresh->children = old->children;
+        fresh->slot_index = old->slot_index;
+        fresh->content_hash = old->content_hash;
+        old->slot_index = NULL;
+        for (FileNode* child = fresh->children; child; child = child->next) {
+            FAT_PUBLISH_LINK(child->parent, fresh);
+        }
+    }
+    
+    FAT_PUBLISH_LINK(directory->children, fresh_children);
+    fat_driver_sort_invalidate(driver, directory);
+    
+    /* Working directories move to the new versions, then the old ones retire */
+    for (uint32_t i = 0; i < old_count; i++) {
+        if (!successor[i]) {
+            fat_driver_drop_node(driver, old_sorted[i]);
+            continue;
+        }
+        
+        if (old_sorted[i]->type == FILE_TYPE_DIRECTORY) {
+            fat_driver_replace_directory(driver, old_sorted[i], successor[i]);
+        }
+        fat_driver_retire_node(driver, old_sorted[i], false);
+    }
+    
+    free(old_sorted);
+    free(successor);
     return 0;
 }
 
+/**
+ * Retires a removed subtree. Working directories inside it move to the root.
+ */
+static void fat_driver_drop_node(FATDriver* driver, FileNode* node) {
+    fat_driver_forget_subtree(driver, node, driver->root_directory);
+    fat_driver_retire_node(driver, node, true);
+}
+
+/**
+ * qsort/bsearch comparator for node pointers by name
+ */
+static int fat_driver_compare_node_name(const void* a, const void* b) {
+    return strcmp((*(FileNode* const*)a)->name, (*(FileNode* const*)b)->name);
+}
+
+/**
+ * Records a directory cluster in the directory's free-slot index.
+ */
+static void fat_driver_track_cluster(FileNode* directory, uint32_t cluster) {
+    if (directory->slot_index && fat_driver_slot_index_add_cluster(directory->slot_index, cluster) != 0) {
+        /* Without a complete index the directory only refuses new entries */
+        fat_driver_slot_index_free(directory->slot_index);
+        directory->slot_index = NULL;
+    }
+}
+
 /**
  * Fills in the node from the entry.
  */
@@ -922,13 +2177,26 @@ void fat_driver_fill_file_node(FATDriver* driver, FileNode* node, const FATDirEn
 
 /* Function to get the value of an entry in the FAT table */
 uint32_t fat_driver_get_fat_entry(FATDriver* driver, uint32_t cluster) {
-    if (!driver || !driver->fat_table) return 0;
+    if (!driver) return 0;
+    
+    if (driver->fat_runs) {
+        return fat_driver_run_index_lookup(driver, cluster);
+    }
+    
+    return fat_driver_read_fat_entry(driver, cluster);
+}
+
+/* Function to read an entry of FAT #1, paged in through the cache */
+uint32_t fat_driver_read_fat_entry(FATDriver* driver, uint32_t cluster) {
+    if (!driver || !driver->cache) return 0;
     
     FatType fat_type = fat_driver_get_fat_type(driver);
     
     if (fat_type == FAT_TYPE_12) {
-        uint32_t fat_offset = cluster + (cluster / 2);
-        uint16_t fat_entry = *(uint16_t*)((uint8_t*)driver->fat_table + fat_offset);
+        uint32_t fat_offset = fat_driver_fat_offset(driver, cluster);
+        uint8_t bytes[2];
+        if (fat_driver_read_fat_bytes(driver, fat_offset, bytes, 2) != 0) return 0;
+        uint16_t fat_entry = (uint16_t)(bytes[0] | (bytes[1] << 8));
         
         if (cluster & 0x1) {
             /* Odd cluster */
@@ -939,15 +2207,58 @@ uint32_t fat_driver_get_fat_entry(FATDriver* driver, uint32_t cluster) {
         }
     } else if (fat_type == FAT_TYPE_16) {
         uint32_t fat_offset = cluster * 2;
-        return *(uint16_t*)((uint8_t*)driver->fat_table + fat_offset);
+        uint16_t fat_entry;
+        if (fat_driver_read_fat_bytes(driver, fat_offset, (uint8_t*)&fat_entry, 2) != 0) return 0;
+        return fat_entry;
     } else if (fat_type == FAT_TYPE_32) {
         uint32_t fat_offset = cluster * 4;
-        return *(uint32_t*)((uint8_t*)driver->fat_table + fat_offset) & 0x0FFFFFFF;
+        uint32_t fat_entry;
+        if (fat_driver_read_fat_bytes(driver, fat_offset, (uint8_t*)&fat_entry, 4) != 0) return 0;
+        return fat_entry & 0x0FFFFFFF;
     }
     
     return 0;
 }
 
+/**
+ * Records a change in the number of free clusters.
+ * 
+ * Called by code that allocates (negative delta) or releases (positive delta)
+ * clusters, so the free count stays exact without rescanning the FAT.
+ * 
+ * @param driver Pointer to the FATDriver structure.
+ * @param delta Change in the number of free clusters.
+ * @param next_free New next-free hint, or 0 to keep the current one.
+ */
+void fat_driver_adjust_free_clusters(FATDriver* driver, int32_t delta, uint32_t next_free) {
+    if (!driver) return;
+    
+    if (driver->free_count_valid) {
+        driver->free_clusters = (uint32_t)((int64_t)driver->free_clusters + delta);
+    }
+    
+    if (next_free >= 2 && next_free < driver->total_clusters + 2) {
+        driver->next_free_cluster = next_free;
+    }
+    
+    driver->fs_info_dirty = true;
+}
+
+/**
+ * Gets the byte offset of a cluster's entry inside a FAT copy.
+ * 
+ * @param driver Pointer to the FATDriver structure.
+ * @param cluster Cluster number.
+ * @return Byte offset of the entry.
+ */
+uint32_t fat_driver_fat_offset(FATDriver* driver, uint32_t cluster) {
+    switch (fat_driver_get_fat_type(driver)) {
+        case FAT_TYPE_12: return cluster + (cluster / 2);
+        case FAT_TYPE_16: return cluster * 2;
+        default:          return cluster * 4;
+    }
+}
+
 /**
  * Gets the next cluster in the cluster chain.
  * 
@@ -11,6 +11,16 @@
 #include "../hal/hal.h"
 #include "fat_driver_types.h"
 
+/**
+ * Tree links that fat_driver_find_path() follows without a lock (children,
+ * next, parent and the working directories). Writers build a node completely,
+ * then publish the link to it; readers load links with acquire so they never
+ * see a half-built node. Walks of the tree outside the driver load them the
+ * same way, inside a read section.
+ */
+#define FAT_LOAD_LINK(link) __atomic_load_n(&(link), __ATOMIC_ACQUIRE)
+#define FAT_PUBLISH_LINK(link, value) __atomic_store_n(&(link), (value), __ATOMIC_RELEASE)
+
 /**
  * Initialize FAT Driver
  * @param driver Pointer to FATDriver structure
@@ -19,6 +29,17 @@
  */
 int fat_driver_init(FATDriver* driver, const FileSystemConfig config);
 
+/**
+ * Initialize FAT Driver on a block cache shared with other volumes. The cache
+ * is keyed by volume, so its capacity is spent on whichever volume is busy;
+ * unmount drops only this volume's sectors and leaves the cache to its owner
+ * @param driver Pointer to FATDriver structure
+ * @param config File system configuration (cache_size is not used)
+ * @param cache Initialized cache with the sector size of the image
+ * @return 0 if successful, -1 if failed
+ */
+int fat_driver_init_shared(FATDriver* driver, const FileSystemConfig config, BlockCache* cache);
+
 /**
  * Deinitialize FAT Driver
  * @param driver Pointer to FATDriver structure
@@ -62,11 +83,52 @@ FileNode* fat_driver_get_current_directory(FATDriver* driver);
 int fat_driver_set_current_directory(FATDriver* driver, FileNode* directory);
 
 /**
- * Find a path
+ * Open a handle with its own working directory, starting at the root. Threads
+ * sharing a mount each use their own handle for relative paths. Close every
+ * handle before the driver is deinitialized.
  * @param driver Pointer to FATDriver structure
+ * @param handle Pointer to the handle to open
+ * @return 0 if successful, -1 if failed
+ */
+int fat_driver_open_handle(FATDriver* driver, FatHandle* handle);
+
+/**
+ * Close a handle
+ * @param handle Pointer to the handle
+ */
+void fat_driver_close_handle(FatHandle* handle);
+
+/**
+ * Find a path, relative paths starting at the handle's working directory
+ * @param handle Pointer to the handle
  * @param path Path to find
  * @return Pointer to the node if found, NULL if not found
  */
+FileNode* fat_driver_handle_find_path(FatHandle* handle, const char* path);
+
+/**
+ * Change the working directory of a handle
+ * @param handle Pointer to the handle
+ * @param path Absolute or relative path of a directory
+ * @return 0 if successful, -1 if the path is not a directory
+ */
+int fat_driver_handle_change_directory(FatHandle* handle, const char* path);
+
+/**
+ * Get the working directory of a handle
+ * @param handle Pointer to the handle
+ * @return Pointer to the directory, NULL if the handle is not open
+ */
+FileNode* fat_driver_handle_get_directory(FatHandle* handle);
+
+/**
+ * Find a path without blocking, even while another thread changes the tree
+ * @param driver Pointer to FATDriver structure
+ * @param path Path to find
+ * @return Pointer to the node if found, NULL if not found. A node removed by
+ *         a concurrent delete or refresh is freed after the lookup returns
+ *         unless the caller holds a read section, see fat_driver_read_begin()
+ */
 FileNode* fat_driver_find_path(FATDriver* driver, const char* path);
 
 /**
@@ -77,6 +139,89 @@ FileNode* fat_driver_find_path(FATDriver* driver, const char* path);
  */
 FileNode* fat_driver_find_path_recursive(FileNode* current, const char* path);
 
+/**
+ * Look up many paths in one call. Paths are resolved in sorted order so a
+ * directory shared by several paths is resolved once, and every directory
+ * visited is hashed once, so each distinct component costs one probe
+ * @param driver Pointer to FATDriver structure
+ * @param paths Paths to look up, relative ones start at the current directory
+ * @param count Number of paths
+ * @param results Array of count records, filled in the order of paths
+ * @return Number of paths found, -1 if failed
+ */
+int fat_driver_stat_many(FATDriver* driver, const char* const* paths, uint32_t count, FatStat* results);
+
+/**
+ * Open a directory for reading straight from its clusters. The stream keeps
+ * one sector in memory whatever the size of the directory and does not use
+ * the tree, so it works on directories the tree has not been built for
+ * @param driver Pointer to FATDriver structure
+ * @param first_cluster First cluster of the directory, 0 for the root
+ * @return Directory stream, NULL if failed
+ */
+FatDir* fat_driver_opendir(FATDriver* driver, uint32_t first_cluster);
+
+/**
+ * Read the next entry of a directory stream
+ * @param dir Directory stream
+ * @param entry Pointer to store the entry
+ * @return 1 if an entry was read, 0 at the end of the directory, -1 if failed
+ */
+int fat_driver_readdir(FatDir* dir, FatDirent* entry);
+
+/**
+ * Read up to max entries of a directory stream in one call
+ * @param dir Directory stream
+ * @param entries Array of max entries
+ * @param max Number of entries wanted
+ * @return Number of entries read, 0 at the end of the directory, -1 if failed
+ */
+int fat_driver_readdir_batch(FatDir* dir, FatDirent* entries, uint32_t max);
+
+/**
+ * Close a directory stream
+ * @param dir Directory stream, may be NULL
+ */
+void fat_driver_closedir(FatDir* dir);
+
+/**
+ * List the children of a directory sorted by name, size or modification
+ * time. Each order is sorted once and kept until the directory changes
+ * @param driver Pointer to FATDriver structure
+ * @param directory Directory to list
+ * @param key Ordering, ties are listed by name
+ * @param reverse List from the last key to the first, ties still by name
+ * @param nodes Pointer to store the children, release with free()
+ * @param count Pointer to store the number of children
+ * @return 0 if successful, -1 if failed
+ */
+int fat_driver_list_sorted(FATDriver* driver, FileNode* directory, FatSortKey key, bool reverse,
+                           FileNode*** nodes, uint32_t* count);
+
+/**
+ * Pack a date and time into an integer with the same order, as used by the
+ * time ordering of fat_driver_list_sorted()
+ * @param time Date and time to pack
+ * @return Packed value, 7 significant bytes
+ */
+uint64_t fat_driver_time_key(const DateTime* time);
+
+/**
+ * Enter a read section: nodes reached from the tree inside it stay allocated
+ * until fat_driver_read_end(), whatever writers unlink meanwhile. Sections
+ * never wait for writers and may nest
+ * @param driver Pointer to FATDriver structure
+ * @return Token to pass to fat_driver_read_end()
+ */
+int fat_driver_read_begin(FATDriver* driver);
+
+/**
+ * Leave a read section
+ * @param driver Pointer to FATDriver structure
+ * @param token Token returned by fat_driver_read_begin()
+ */
+void fat_driver_read_end(FATDriver* driver, int token);
+
 /**
  * Read file content
  * @param driver Pointer to FATDriver structure
@@ -87,6 +232,86 @@ FileNode* fat_driver_find_path_recursive(FileNode* current, const char* path);
  */
 int fat_driver_read_file(FATDriver* driver, FileNode* file, void* buffer, uint32_t size);
 
+/**
+ * Read a whole file in pieces, each run of contiguous clusters with one read
+ * @param driver Pointer to FATDriver structure
+ * @param file Pointer to the file to read
+ * @param buffer Work buffer, at least one cluster
+ * @param size Size of the buffer, the largest piece handed to the callback
+ * @param callback Function called with each piece, in file order
+ * @param user_data Value passed to the callback
+ * @return Number of bytes handed to the callback, -1 if failed
+ */
+int fat_driver_read_file_chunks(FATDriver* driver, FileNode* file, void* buffer, uint32_t size,
+                                FatChunkCallback callback, void* user_data);
+
+/**
+ * Copy a whole file into a host file, each run of contiguous clusters with
+ * one kernel-side copy when the kernel supports it
+ * @param driver Pointer to FATDriver structure
+ * @param file Pointer to the file to copy
+ * @param fd Destination file descriptor, written from offset 0
+ * @return Number of bytes copied if successful, -1 if failed
+ */
+int64_t fat_driver_export_file(FATDriver* driver, FileNode* file, int fd);
+
+/**
+ * Start an I/O engine for asynchronous requests. Size it like the
+ * worker_threads of the mounts it serves
+ * @param engine Pointer to FatIoEngine structure
+ * @param threads Number of threads, 0 for one per processor
+ * @return 0 if successful, -1 if failed
+ */
+int fat_driver_io_init(FatIoEngine* engine, uint32_t threads);
+
+/**
+ * Wait for every request in flight and stop the engine. Completed requests
+ * not reaped yet are dropped from the queue
+ * @param engine Pointer to FatIoEngine structure
+ */
+void fat_driver_io_deinit(FatIoEngine* engine);
+
+/**
+ * Read a file without waiting. request->user_data is left as the caller set it
+ * @param engine Pointer to FatIoEngine structure
+ * @param request Request to fill and submit
+ * @param driver Pointer to FATDriver structure
+ * @param file Pointer to the file to read
+ * @param buffer Buffer to store the read data
+ * @param size Size to read
+ * @param callback Called on an engine thread when done, NULL to post the
+ *        request to the completion queue
+ * @return 0 if submitted, -1 if failed
+ */
+int fat_driver_read_file_async(FatIoEngine* engine, FatIoRequest* request, FATDriver* driver,
+                               FileNode* file, void* buffer, uint32_t size, FatIoCallback callback);
+
+/**
+ * Find a path without waiting. A relative path is resolved against the
+ * working directory of the driver at the time of the call, not at the time
+ * the lookup runs. request->user_data is left as the caller set it
+ * @param engine Pointer to FatIoEngine structure
+ * @param request Request to fill and submit
+ * @param driver Pointer to FATDriver structure
+ * @param path Path to find, kept valid by the caller until completion
+ * @param callback Called on an engine thread when done, NULL to post the
+ *        request to the completion queue
+ * @return 0 if submitted, -1 if failed
+ */
+int fat_driver_find_path_async(FatIoEngine* engine, FatIoRequest* request, FATDriver* driver,
+                               const char* path, FatIoCallback callback);
+
+/**
+ * Take completed requests from the completion queue, oldest first
+ * @param engine Pointer to FatIoEngine structure
+ * @param completed Array to store the requests
+ * @param max Size of the array
+ * @param wait Wait for a completion when the queue is empty and requests are
+ *        in flight
+ * @return Number of requests stored
+ */
+uint32_t fat_driver_io_reap(FatIoEngine* engine, FatIoRequest** completed, uint32_t max, bool wait);
+
 /**
  * Write file content
  * @param driver Pointer to FATDriver structure
@@ -97,6 +322,35 @@ int fat_driver_read_file(FATDriver* driver, FileNode* file, void* buffer, uint32
  */
 int fat_driver_write_file(FATDriver* driver, FileNode* file, const void* buffer, uint32_t size);
 
+/**
+ * Create a directory entry and its node (read-write mode only)
+ * @param driver Pointer to FATDriver structure
+ * @param parent Directory to create the entry in
+ * @param name 8.3 name of the new entry
+ * @param type FILE_TYPE_REGULAR or FILE_TYPE_DIRECTORY
+ * @param first_cluster First cluster of the content, 0 for none (a directory gets a new cluster)
+ * @param size File size in bytes
+ * @return Pointer to the new node if successful, NULL if failed
+ */
+FileNode* fat_driver_create_entry(FATDriver* driver, FileNode* parent, const char* name,
+                                  FileType type, uint32_t first_cluster, uint32_t size);
+
+/**
+ * Delete an entry, release its clusters and free its node (read-write mode only)
+ * @param driver Pointer to FATDriver structure
+ * @param node Node to delete (a directory must be empty)
+ * @return 0 if successful, -1 if failed
+ */
+int fat_driver_delete_entry(FATDriver* driver, FileNode* node);
+
+/**
+ * Write the first cluster and size of a node back to its directory entry
+ * @param driver Pointer to FATDriver structure
+ * @param node Node to update
+ * @return 0 if successful, -1 if failed
+ */
+int fat_driver_update_entry(FATDriver* driver, FileNode* node);
+
 /**
  * Get FAT type
  * @param driver Pointer to FATDriver structure
@@ -113,6 +367,127 @@ FatType fat_driver_get_fat_type(FATDriver* driver);
  */
 int fat_driver_get_filesystem_info(FATDriver* driver, uint64_t* total_size, uint64_t* free_size);
 
+/**
+ * Estimate the heap memory held by a mounted volume: tree nodes and their
+ * free-slot indexes, run index, dirty FAT ranges and
+ * the cache when the driver owns it
+ * @param driver Pointer to FATDriver structure
+ * @return Number of bytes
+ */
+size_t fat_driver_memory_usage(FATDriver* driver);
+
+/**
+ * Allocate a chain of free clusters (read-write mode only)
+ * @param driver Pointer to FATDriver structure
+ * @param count Number of clusters to allocate
+ * @param prev_cluster Cluster to link the new chain after, 0 for a new chain
+ * @param first_cluster Pointer to store the first allocated cluster
+ * @return 0 if successful, -1 if failed
+ */
+int fat_driver_allocate_clusters(FATDriver* driver, uint32_t count, uint32_t prev_cluster, uint32_t* first_cluster);
+
+/**
+ * Release a cluster chain (read-write mode only)
+ * @param driver Pointer to FATDriver structure
+ * @param first_cluster First cluster of the chain
+ * @return 0 if successful, -1 if failed
+ */
+int fat_driver_free_chain(FATDriver* driver, uint32_t first_cluster);
+
+/**
+ * Write cached metadata (dirty FAT sectors to every FAT copy, cached sectors,
+ * FSInfo free count and hint) back to the image
+ * @param driver Pointer to FATDriver structure
+ * @return 0 if successful, -1 if failed
+ */
+int fat_driver_sync(FATDriver* driver);
+
+/**
+ * Bring the mounted tree up to date after another program changed the image.
+ * Only directories whose content hash changed are scanned again; unchanged
+ * nodes keep their identity. The current directory falls back to the root
+ * if it was removed. Readers of a read-only mount take no lock, so on such a
+ * mount no other call may run at the same time.
+ * @param driver Pointer to FATDriver structure
+ * @param rescanned Pointer to store the number of directories scanned again (may be NULL)
+ * @return 0 if successful, -1 if failed (a changed boot sector needs a remount)
+ */
+int fat_driver_refresh(FATDriver* driver, uint32_t* rescanned);
+
+/**
+ * Check the volume: walk every chain in parallel, marking cluster ownership,
+ * and report cycles, cross-links, bad chain ends, size/chain-length
+ * mismatches, lost chains, differing FAT copies and a wrong FSInfo free count
+ * @param driver Pointer to FATDriver structure
+ * @param report Pointer to the report to fill (free with fat_driver_check_free)
+ * @return 0 if the check ran (the report may still hold problems), -1 if failed
+ */
+int fat_driver_check(FATDriver* driver, FatCheckReport* report);
+
+/**
+ * Free the findings of a check report
+ * @param report Pointer to the report
+ */
+void fat_driver_check_free(FatCheckReport* report);
+
+/**
+ * Short stable name of a finding kind, for machine-readable output
+ * @param kind Finding kind
+ * @return Name such as "cross-link"
+ */
+const char* fat_driver_check_kind_name(FatCheckKind kind);
+
+/**
+ * Defragment the volume (read-write mode only): every fragmented regular file
+ * whose chain is intact is copied into the first free run that holds it, in
+ * large sequential transfers, then its directory entry and FAT chain are
+ * switched over and the old clusters released
+ * @param driver Pointer to FATDriver structure
+ * @param report Pointer to store the extent counts before and after
+ * @return 0 if successful, -1 if failed (files already moved stay moved)
+ */
+int fat_driver_defrag(FATDriver* driver, FatDefragReport* report);
+
+/**
+ * Import a whole tree into a directory (read-write mode only). The tree is
+ * planned first: every file and directory gets its clusters, contiguous where
+ * a free run allows, and the directory clusters are packed together. The data
+ * is then written as one sequential stream in large requests, and the FAT and
+ * the new directory entries are flushed once at the end
+ * @param driver Pointer to FATDriver structure
+ * @param destination Directory to import into
+ * @param entries Tree to import, each directory before its content
+ * @param count Number of entries
+ * @param read Function supplying the content of the files
+ * @param user_data Value passed to read
+ * @param report Pointer to store what was written
+ * @return 0 if successful, -1 if failed (only entries marked imported are linked)
+ */
+int fat_driver_import(FATDriver* driver, FileNode* destination, FatImportEntry* entries, uint32_t count,
+                      FatImportRead read, void* user_data, FatImportReport* report);
+
+/**
+ * Create an image file holding an empty FAT12/16/32 volume that
+ * fat_driver_mount() accepts, replacing any file of that name. Only the boot
+ * sector (with FSInfo and backups on FAT32) and the first sector of each FAT
+ * are written; the rest of the FATs, the root directory and the data area
+ * are left as a hole in the file, so the time taken does not depend on size
+ * @param img_path Path of the image file to create (.img)
+ * @param options Size, FAT type and cluster size
+ * @param report Pointer to store the geometry chosen, may be NULL
+ * @return 0 if successful, -1 if failed (unsupported size for the type or cluster size, or I/O error)
+ */
+int fat_driver_format(const char* img_path, const FatFormatOptions* options, FatFormatReport* report);
+
+/**
+ * Build the absolute path of a node
+ * @param node Node in the mounted tree
+ * @param buffer Buffer to store the path
+ * @param size Size of the buffer
+ * @return 0 if successful, -1 if failed or the path does not fit
+ */
+int fat_driver_get_path(const FileNode* node, char* buffer, size_t size);
+
 /**
  * Convert cluster to sector
  * @param driver Pointer to FATDriver structure
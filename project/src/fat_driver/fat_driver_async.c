@@ -0,0 +1,252 @@
+/**
+ * @file fat_driver_async.c
+ * @brief Asynchronous file reads and path lookups
+ * @details An I/O engine runs requests of any number of volumes on its own
+ *          thread pool, so a single caller can keep hundreds of reads in
+ *          flight without a thread of its own per request. Requests are
+ *          plain blocking driver calls on an engine thread: reads overlap
+ *          because the image is read with pread() and the driver is safe to
+ *          share between threads. A finished request either runs its
+ *          callback on the engine thread or is appended to the engine's
+ *          completion queue for fat_driver_io_reap().
+ *
+ *          A lookup may run long after it was submitted, when the working
+ *          directory has moved on, so a relative path is joined to the
+ *          working directory at submit and the lookup runs on the result.
+ * @date 2026-10-18
+ * @author Le Duc Son
+ */
+#include "fat_driver.h"
+#include "fat_driver_private.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Longest path a relative lookup is resolved to, longer ones fail at submit
+ */
+#define FAT_IO_PATH_MAX 4096
+
+/* Local functions */
+static char* fat_driver_io_resolve(FATDriver* driver, const char* path);
+static int fat_driver_io_submit(FatIoEngine* engine, FatIoRequest* request);
+static void fat_driver_io_task(void* arg, uint32_t worker);
+
+/**
+ * Starts an I/O engine.
+ *
+ * @param engine Pointer to the FatIoEngine structure.
+ * @param threads Number of threads, 0 for one per processor.
+ * @return 0 if successful, -1 if failed.
+ */
+int fat_driver_io_init(FatIoEngine* engine, uint32_t threads) {
+    if (!engine) return -1;
+
+    memset(engine, 0, sizeof(FatIoEngine));
+    if (pthread_mutex_init(&engine->lock, NULL) != 0) return -1;
+    if (pthread_cond_init(&engine->completed, NULL) != 0) {
+        pthread_mutex_destroy(&engine->lock);
+        return -1;
+    }
+    if (!threadpool_init(&engine->pool, threads ? threads : threadpool_cpu_count())) {
+        pthread_cond_destroy(&engine->completed);
+        pthread_mutex_destroy(&engine->lock);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Waits for the requests in flight and stops the engine.
+ *
+ * @param engine Pointer to the FatIoEngine structure.
+ */
+void fat_driver_io_deinit(FatIoEngine* engine) {
+    if (!engine) return;
+
+    /* The pool runs every queued request before its threads exit */
+    threadpool_deinit(&engine->pool);
+    pthread_cond_destroy(&engine->completed);
+    pthread_mutex_destroy(&engine->lock);
+    memset(engine, 0, sizeof(FatIoEngine));
+}
+
+/**
+ * Submits an asynchronous file read.
+ *
+ * @param engine Pointer to the FatIoEngine structure.
+ * @param request Request to fill and submit.
+ * @param driver Pointer to the FATDriver structure.
+ * @param file File to read.
+ * @param buffer Buffer to store the file content.
+ * @param size Size of the buffer.
+ * @param callback Completion callback, NULL for the completion queue.
+ * @return 0 if submitted, -1 if failed.
+ */
+int fat_driver_read_file_async(FatIoEngine* engine, FatIoRequest* request, FATDriver* driver,
+                               FileNode* file, void* buffer, uint32_t size, FatIoCallback callback) {
+    if (!engine || !request || !driver || !file || !buffer) return -1;
+
+    request->kind = FAT_IO_READ_FILE;
+    request->driver = driver;
+    request->path = NULL;
+    request->resolved_path = NULL;
+    request->node = file;
+    request->buffer = buffer;
+    request->size = size;
+    request->callback = callback;
+
+    return fat_driver_io_submit(engine, request);
+}
+
+/**
+ * Submits an asynchronous path lookup.
+ *
+ * @param engine Pointer to the FatIoEngine structure.
+ * @param request Request to fill and submit.
+ * @param driver Pointer to the FATDriver structure.
+ * @param path Path to find.
+ * @param callback Completion callback, NULL for the completion queue.
+ * @return 0 if submitted, -1 if failed.
+ */
+int fat_driver_find_path_async(FatIoEngine* engine, FatIoRequest* request, FATDriver* driver,
+                               const char* path, FatIoCallback callback) {
+    if (!engine || !request || !driver || !path) return -1;
+
+    request->kind = FAT_IO_FIND_PATH;
+    request->driver = driver;
+    request->path = path;
+    request->resolved_path = NULL;
+    request->node = NULL;
+    request->buffer = NULL;
+    request->size = 0;
+    request->callback = callback;
+
+    if (path[0] != '/') {
+        request->resolved_path = fat_driver_io_resolve(driver, path);
+        if (!request->resolved_path) return -1;
+    }
+
+    if (fat_driver_io_submit(engine, request) != 0) {
+        free(request->resolved_path);
+        request->resolved_path = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Takes completed requests from the completion queue.
+ *
+ * @param engine Pointer to the FatIoEngine structure.
+ * @param completed Array to store the requests.
+ * @param max Size of the array.
+ * @param wait Wait for a completion if the queue is empty and requests are in flight.
+ * @return Number of requests stored.
+ */
+uint32_t fat_driver_io_reap(FatIoEngine* engine, FatIoRequest** completed, uint32_t max, bool wait) {
+    if (!engine || !completed || max == 0) return 0;
+
+    pthread_mutex_lock(&engine->lock);
+    while (wait && !engine->done_head && engine->in_flight > 0) {
+        pthread_cond_wait(&engine->completed, &engine->lock);
+    }
+
+    uint32_t count = 0;
+    while (count < max && engine->done_head) {
+        FatIoRequest* request = engine->done_head;
+        engine->done_head = request->next;
+        request->next = NULL;
+        completed[count++] = request;
+    }
+    if (!engine->done_head) engine->done_tail = NULL;
+    pthread_mutex_unlock(&engine->lock);
+
+    return count;
+}
+
+/**
+ * Joins a relative path to the current working directory of the driver.
+ *
+ * @return Absolute path to release with free(), NULL if failed.
+ */
+static char* fat_driver_io_resolve(FATDriver* driver, const char* path) {
+    char directory[FAT_IO_PATH_MAX];
+
+    /* The working directory stays allocated while its path is built */
+    int token = fat_driver_read_begin(driver);
+    int result = fat_driver_get_path(FAT_LOAD_LINK(driver->current_directory), directory, sizeof(directory));
+    fat_driver_read_end(driver, token);
+    if (result != 0) return NULL;
+
+    size_t length = strlen(directory);
+    size_t path_length = strlen(path);
+    if (length == 0 || directory[length - 1] != '/') directory[length++] = '/';
+    if (length + path_length >= FAT_IO_PATH_MAX) return NULL;
+
+    char* resolved = malloc(length + path_length + 1);
+    if (!resolved) return NULL;
+    memcpy(resolved, directory, length);
+    memcpy(resolved + length, path, path_length + 1);
+    return resolved;
+}
+
+/**
+ * Queues a filled request on the engine's pool.
+ */
+static int fat_driver_io_submit(FatIoEngine* engine, FatIoRequest* request) {
+    request->result = -1;
+    request->engine = engine;
+    request->next = NULL;
+
+    pthread_mutex_lock(&engine->lock);
+    engine->in_flight++;
+    pthread_mutex_unlock(&engine->lock);
+
+    if (!threadpool_submit(&engine->pool, fat_driver_io_task, request)) {
+        pthread_mutex_lock(&engine->lock);
+        engine->in_flight--;
+        pthread_mutex_unlock(&engine->lock);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Pool task: runs one request and completes it.
+ */
+static void fat_driver_io_task(void* arg, uint32_t worker) {
+    FatIoRequest* request = (FatIoRequest*)arg;
+    FatIoEngine* engine = request->engine;
+    (void)worker;
+
+    if (request->kind == FAT_IO_READ_FILE) {
+        request->result = fat_driver_read_file(request->driver, request->node, request->buffer, request->size);
+    } else {
+        const char* path = request->resolved_path ? request->resolved_path : request->path;
+        request->node = fat_driver_find_path(request->driver, path);
+        request->result = request->node ? 0 : -1;
+        free(request->resolved_path);
+        request->resolved_path = NULL;
+    }
+
+    /* The request may be freed by its callback, do not touch it afterwards */
+    FatIoCallback callback = request->callback;
+    if (callback) {
+        callback(request);
+    }
+
+    pthread_mutex_lock(&engine->lock);
+    if (!callback) {
+        if (engine->done_tail) {
+            engine->done_tail->next = request;
+        } else {
+            engine->done_head = request;
+        }
+        engine->done_tail = request;
+    }
+    engine->in_flight--;
+    pthread_cond_broadcast(&engine->completed);
+    pthread_mutex_unlock(&engine->lock);
+}
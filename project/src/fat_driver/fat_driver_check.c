@@ -0,0 +1,684 @@
+/**
+ * @file fat_driver_check.c
+ * @brief Volume consistency check (fsck)
+ * @details FAT #1 is read into memory once and every chain of the mounted
+ *          tree is walked on the worker pool. A walk first measures its chain
+ *          with Brent's cycle detection, so a looping chain is reported and
+ *          walked exactly once around. It then claims each cluster in an
+ *          atomic ownership bitmap; a cluster that is already claimed is
+ *          marked contested. Which walk claims first depends on the workers,
+ *          so contested clusters are attributed afterwards in one ordered
+ *          pass: the chain with the lowest first cluster keeps them and every
+ *          other chain through them is reported as a cross-link.
+ *
+ *          After the walks, allocated clusters nobody claimed are grouped
+ *          into lost chains, the free count is compared with FSInfo and the
+ *          other FAT copies are compared with FAT #1 sector by sector.
+ * @date 2026-10-18
+ * @author Le Duc Son
+ */
+#include "fat_driver.h"
+#include "fat_driver_private.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Number of nodes walked by one pool task
+ */
+#define FAT_CHECK_TASK_NODES 64
+
+/**
+ * Number of FAT sectors read at a time
+ */
+#define FAT_CHECK_BATCH_SECTORS 256
+
+/**
+ * Marks the end of a chain in fat_driver_check_next()
+ */
+#define FAT_CHECK_END 0
+
+/**
+ * State shared by the chain walks
+ */
+typedef struct {
+    FATDriver* driver;
+    FatType fat_type;
+    const uint8_t* fat;             /**< FAT #1 */
+    uint32_t fat_bytes;             /**< Size of FAT #1 in bytes */
+    uint32_t eoc_min;               /**< Smallest end-of-chain value */
+    uint32_t bad_cluster;           /**< Bad cluster marker */
+    uint32_t cluster_bytes;         /**< Bytes per cluster */
+    atomic_uint_least32_t* owned;   /**< One bit per cluster, set by the first chain through it */
+    atomic_uint_least32_t* contested; /**< One bit per cluster, set when a second chain runs into it */
+    atomic_bool any_contested;      /**< Some bit of contested is set */
+    FileNode** nodes;               /**< Files and directories to walk */
+    uint32_t* lengths;              /**< Clusters walked per node, bounded for a looping chain */
+    uint32_t node_count;
+    atomic_uint used_clusters;      /**< Clusters claimed so far */
+    pthread_mutex_t lock;           /**< Protects the report */
+    FatCheckReport* report;
+} FatCheckContext;
+
+/**
+ * Node ordered for the cross-link pass
+ */
+typedef struct {
+    uint32_t first_cluster;
+    uint32_t index;                 /**< Index in FatCheckContext.nodes, breaks ties */
+} FatCheckOrder;
+
+/**
+ * Range of nodes walked by one pool task
+ */
+typedef struct {
+    FatCheckContext* context;
+    uint32_t first;
+    uint32_t count;
+} FatCheckTask;
+
+/* Local functions */
+static int fat_driver_check_unlocked(FATDriver* driver, FatCheckReport* report);
+static int fat_driver_check_load_fat(FatCheckContext* context, uint8_t** fat);
+static void fat_driver_check_collect(FatCheckContext* context, FileNode* node, uint32_t* capacity);
+static void fat_driver_check_task(void* arg, uint32_t worker);
+static void fat_driver_check_chain(FatCheckContext* context, uint32_t index);
+static void fat_driver_check_cross_links(FatCheckContext* context);
+static int fat_driver_check_compare_order(const void* a, const void* b);
+static uint32_t fat_driver_check_entry(const FatCheckContext* context, uint32_t cluster);
+static uint32_t fat_driver_check_next(const FatCheckContext* context, uint32_t cluster);
+static bool fat_driver_check_claim(FatCheckContext* context, uint32_t cluster);
+static bool fat_driver_check_owned(const FatCheckContext* context, uint32_t cluster);
+static void fat_driver_check_lost(FatCheckContext* context);
+static void fat_driver_check_copies(FatCheckContext* context);
+static void fat_driver_check_add(FatCheckContext* context, FatCheckKind kind, const FileNode* node,
+                                 uint32_t cluster, uint32_t expected, uint32_t actual);
+static void fat_driver_check_add_mismatch(FatCheckContext* context, uint32_t copy, uint32_t sector,
+                                          uint32_t sectors);
+static void fat_driver_check_append(FatCheckContext* context, const FatCheckFinding* finding);
+
+/**
+ * Checks the consistency of the mounted volume.
+ *
+ * The tree itself comes from the mount; a directory whose chain is damaged
+ * is checked as far as the mount could read it.
+ *
+ * The FAT copies are read from the disk. On a read-write mount the check
+ * holds the write lock and syncs first, so FAT changes still in memory or
+ * dirty in the block cache are on the disk when it reads them and none can
+ * be made while it runs.
+ *
+ * @param driver Pointer to the FATDriver structure.
+ * @param report Pointer to the report to fill.
+ * @return 0 if the check ran, -1 if failed.
+ */
+int fat_driver_check(FATDriver* driver, FatCheckReport* report) {
+    if (!driver || !report || !driver->root_directory) return -1;
+
+    if (driver->config.mode != MODE_READ_WRITE) {
+        fat_driver_read_lock(driver);
+        int result = fat_driver_check_unlocked(driver, report);
+        fat_driver_read_unlock(driver);
+        return result;
+    }
+
+    fat_driver_write_lock(driver);
+    int result = fat_driver_sync_unlocked(driver);
+    if (result == 0) result = fat_driver_check_unlocked(driver, report);
+    fat_driver_write_unlock(driver);
+
+    return result;
+}
+
+/** Internal function of fat_driver_check(), called with the lock held */
+static int fat_driver_check_unlocked(FATDriver* driver, FatCheckReport* report) {
+    memset(report, 0, sizeof(FatCheckReport));
+
+    FatCheckContext context;
+    memset(&context, 0, sizeof(context));
+    context.driver = driver;
+    context.report = report;
+    context.fat_type = fat_driver_get_fat_type(driver);
+    context.eoc_min = fat_driver_end_of_chain(driver) & ~7u;
+    context.bad_cluster = context.eoc_min - 1;
+    context.cluster_bytes = driver->boot_sector.sectors_per_cluster * hal_get_sector_size(driver->hal);
+    atomic_init(&context.used_clusters, 0);
+
+    uint8_t* fat = NULL;
+    if (fat_driver_check_load_fat(&context, &fat) != 0) return -1;
+    context.fat = fat;
+
+    uint32_t words = (driver->total_clusters + 2 + 31) / 32;
+    context.owned = calloc(words, sizeof(atomic_uint_least32_t));
+    context.contested = calloc(words, sizeof(atomic_uint_least32_t));
+    atomic_init(&context.any_contested, false);
+
+    uint32_t capacity = 0;
+    fat_driver_check_collect(&context, driver->root_directory, &capacity);
+    context.lengths = calloc(context.node_count ? context.node_count : 1, sizeof(uint32_t));
+
+    if (!context.owned || !context.contested || !context.lengths || (capacity && !context.nodes)) {
+        free(context.owned);
+        free(context.contested);
+        free(context.lengths);
+        free(context.nodes);
+        free(fat);
+        return -1;
+    }
+    pthread_mutex_init(&context.lock, NULL);
+
+    /*
+     * Walk the chains, on the pool when there is one. The pool is shared with
+     * other callers, so only the tasks of this check are waited for.
+     */
+    FatCheckTask* tasks = NULL;
+    ThreadPoolGroup group;
+    uint32_t task_count = (context.node_count + FAT_CHECK_TASK_NODES - 1) / FAT_CHECK_TASK_NODES;
+    if (driver->pool && task_count > 1 && threadpool_group_init(&group)) {
+        tasks = malloc(task_count * sizeof(FatCheckTask));
+        if (!tasks) threadpool_group_deinit(&group);
+    }
+    for (uint32_t i = 0; i < task_count; i++) {
+        uint32_t first = i * FAT_CHECK_TASK_NODES;
+        uint32_t count = context.node_count - first;
+        if (count > FAT_CHECK_TASK_NODES) count = FAT_CHECK_TASK_NODES;
+
+        if (tasks) {
+            tasks[i].context = &context;
+            tasks[i].first = first;
+            tasks[i].count = count;
+            if (threadpool_submit_group(driver->pool, &group, fat_driver_check_task, &tasks[i])) continue;
+        }
+
+        FatCheckTask inline_task = { &context, first, count };
+        fat_driver_check_task(&inline_task, 0);
+    }
+    if (tasks) {
+        threadpool_group_wait(&group);
+        threadpool_group_deinit(&group);
+        free(tasks);
+    }
+
+    report->used_clusters = atomic_load(&context.used_clusters);
+    if (atomic_load(&context.any_contested)) {
+        fat_driver_check_cross_links(&context);
+    }
+    fat_driver_check_lost(&context);
+    fat_driver_check_copies(&context);
+
+    /* FSInfo is only a hint, but a wrong hint misleads other drivers */
+    if (context.fat_type == FAT_TYPE_32 && driver->fs_info_valid &&
+        driver->fs_info.free_count != FSINFO_UNKNOWN && driver->fs_info.free_count != report->free_clusters) {
+        fat_driver_check_add(&context, FAT_CHECK_FREE_COUNT, NULL, 0,
+                             report->free_clusters, driver->fs_info.free_count);
+    }
+
+    pthread_mutex_destroy(&context.lock);
+    free(context.owned);
+    free(context.contested);
+    free(context.lengths);
+    free(context.nodes);
+    free(fat);
+    return 0;
+}
+
+/**
+ * Frees the findings of a check report.
+ *
+ * @param report Pointer to the report.
+ */
+void fat_driver_check_free(FatCheckReport* report) {
+    if (!report) return;
+
+    free(report->findings);
+    report->findings = NULL;
+    report->finding_count = 0;
+    report->finding_capacity = 0;
+}
+
+/**
+ * Gets the short stable name of a finding kind.
+ *
+ * @param kind Finding kind.
+ * @return Name of the kind.
+ */
+const char* fat_driver_check_kind_name(FatCheckKind kind) {
+    switch (kind) {
+        case FAT_CHECK_BAD_CHAIN:     return "bad-chain";
+        case FAT_CHECK_CYCLE:         return "cycle";
+        case FAT_CHECK_CROSS_LINK:    return "cross-link";
+        case FAT_CHECK_SIZE_MISMATCH: return "size-mismatch";
+        case FAT_CHECK_LOST_CHAIN:    return "lost-chain";
+        case FAT_CHECK_FAT_MISMATCH:  return "fat-mismatch";
+        case FAT_CHECK_FREE_COUNT:    return "free-count";
+    }
+    return "unknown";
+}
+
+/**
+ * Reads FAT #1 into memory in large sequential batches
+ */
+static int fat_driver_check_load_fat(FatCheckContext* context, uint8_t** fat) {
+    FATDriver* driver = context->driver;
+    uint32_t sector_size = hal_get_sector_size(driver->hal);
+
+    context->fat_bytes = driver->fat_size * sector_size;
+    *fat = malloc(context->fat_bytes);
+    if (!*fat) return -1;
+
+    for (uint32_t done = 0; done < driver->fat_size; ) {
+        uint32_t count = driver->fat_size - done;
+        if (count > FAT_CHECK_BATCH_SECTORS) count = FAT_CHECK_BATCH_SECTORS;
+
+        uint8_t* target = *fat + (size_t)done * sector_size;
+        if (hal_read_sectors(driver->hal, driver->first_fat_sector + done, count, target) != (int)(count * sector_size)) {
+            free(*fat);
+            *fat = NULL;
+            return -1;
+        }
+        done += count;
+    }
+
+    return 0;
+}
+
+/**
+ * Collects every node with a chain into the node array and counts files and
+ * directories. The FAT12/16 root has no chain and is only descended into.
+ */
+static void fat_driver_check_collect(FatCheckContext* context, FileNode* node, uint32_t* capacity) {
+    bool fixed_root = (node == context->driver->root_directory && context->fat_type != FAT_TYPE_32);
+
+    if (node->type == FILE_TYPE_DIRECTORY) {
+        context->report->directories++;
+    } else {
+        context->report->files++;
+    }
+
+    if (!fixed_root) {
+        if (context->node_count == *capacity) {
+            uint32_t new_capacity = *capacity ? *capacity * 2 : 256;
+            FileNode** nodes = realloc(context->nodes, new_capacity * sizeof(FileNode*));
+            if (!nodes) {
+                free(context->nodes);
+                context->nodes = NULL;
+                context->node_count = 0;
+                return;
+            }
+            context->nodes = nodes;
+            *capacity = new_capacity;
+        }
+        context->nodes[context->node_count++] = node;
+    }
+
+    for (FileNode* child = node->children; child; child = child->next) {
+        fat_driver_check_collect(context, child, capacity);
+        if (!context->nodes && *capacity) return;
+    }
+}
+
+/**
+ * Pool task: walks the chains of a range of nodes
+ */
+static void fat_driver_check_task(void* arg, uint32_t worker) {
+    (void)worker;
+    FatCheckTask* task = (FatCheckTask*)arg;
+
+    for (uint32_t i = 0; i < task->count; i++) {
+        fat_driver_check_chain(task->context, task->first + i);
+    }
+}
+
+/**
+ * Walks the chain of one node.
+ *
+ * Brent's algorithm gives the number of distinct clusters (mu + lambda) with
+ * O(1) memory, so the claiming walk below never goes round a loop twice.
+ * Cross-links are only marked here and reported by
+ * fat_driver_check_cross_links().
+ */
+static void fat_driver_check_chain(FatCheckContext* context, uint32_t index) {
+    FATDriver* driver = context->driver;
+    const FileNode* node = context->nodes[index];
+    uint32_t first = node->first_cluster;
+    uint32_t length = 0;
+
+    if (first != 0 && (first < 2 || first > driver->total_clusters + 1)) {
+        fat_driver_check_add(context, FAT_CHECK_BAD_CHAIN, node, first, 0, first);
+        return;
+    }
+
+    if (first != 0) {
+        /* Brent: find the loop length lambda, if any */
+        uint32_t power = 1, lambda = 1;
+        uint32_t tortoise = first;
+        uint32_t hare = fat_driver_check_next(context, first);
+        bool cycle = false;
+        while (hare != FAT_CHECK_END) {
+            if (hare == tortoise) {
+                cycle = true;
+                break;
+            }
+            if (power == lambda) {
+                tortoise = hare;
+                power *= 2;
+                lambda = 0;
+            }
+            hare = fat_driver_check_next(context, hare);
+            lambda++;
+        }
+
+        uint32_t limit = UINT32_MAX;
+        if (cycle) {
+            /* mu: distance from the first cluster to the loop start */
+            uint32_t mu = 0;
+            tortoise = hare = first;
+            for (uint32_t i = 0; i < lambda; i++) hare = fat_driver_check_next(context, hare);
+            while (tortoise != hare) {
+                tortoise = fat_driver_check_next(context, tortoise);
+                hare = fat_driver_check_next(context, hare);
+                mu++;
+            }
+            limit = mu + lambda;
+            fat_driver_check_add(context, FAT_CHECK_CYCLE, node, tortoise, 0, lambda);
+        }
+
+        /* Claim the clusters, mark the ones another chain claimed first */
+        uint32_t last = first;
+        for (uint32_t cluster = first; cluster != FAT_CHECK_END && length < limit;
+             cluster = fat_driver_check_next(context, cluster)) {
+            if (!fat_driver_check_claim(context, cluster)) {
+                atomic_fetch_or(&context->contested[cluster / 32], 1u << (cluster % 32));
+                atomic_store(&context->any_contested, true);
+            }
+            last = cluster;
+            length++;
+        }
+        context->lengths[index] = length;
+
+        /* An acyclic chain must end with an end-of-chain entry */
+        uint32_t entry = fat_driver_check_entry(context, last);
+        if (!cycle && entry < context->eoc_min) {
+            fat_driver_check_add(context, FAT_CHECK_BAD_CHAIN, node, last, 0, entry);
+        }
+    }
+
+    if (node->type == FILE_TYPE_REGULAR) {
+        uint32_t expected = (uint32_t)(((uint64_t)node->size + context->cluster_bytes - 1) / context->cluster_bytes);
+        if (expected != length) {
+            fat_driver_check_add(context, FAT_CHECK_SIZE_MISMATCH, node, first, expected, length);
+        }
+    }
+}
+
+/**
+ * Attributes contested clusters after the walks. Chains are walked again in
+ * order of first cluster (then tree order); the first to reach a contested
+ * cluster keeps it and each later chain through contested clusters gets one
+ * cross-link finding, so the report does not depend on worker timing.
+ */
+static void fat_driver_check_cross_links(FatCheckContext* context) {
+    uint32_t words = (context->driver->total_clusters + 2 + 31) / 32;
+    uint32_t* kept = calloc(words, sizeof(uint32_t));
+    FatCheckOrder* order = malloc((context->node_count ? context->node_count : 1) * sizeof(FatCheckOrder));
+    if (!kept || !order) {
+        free(kept);
+        free(order);
+        return;
+    }
+
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < context->node_count; i++) {
+        if (context->lengths[i] == 0) continue;
+        order[count].first_cluster = context->nodes[i]->first_cluster;
+        order[count].index = i;
+        count++;
+    }
+    qsort(order, count, sizeof(FatCheckOrder), fat_driver_check_compare_order);
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t shared = 0, first_shared = 0;
+        uint32_t cluster = order[i].first_cluster;
+        for (uint32_t n = 0; n < context->lengths[order[i].index] && cluster != FAT_CHECK_END; n++) {
+            uint32_t bit = 1u << (cluster % 32);
+            if (atomic_load(&context->contested[cluster / 32]) & bit) {
+                if (kept[cluster / 32] & bit) {
+                    if (shared++ == 0) first_shared = cluster;
+                } else {
+                    kept[cluster / 32] |= bit;
+                }
+            }
+            cluster = fat_driver_check_next(context, cluster);
+        }
+        if (shared) {
+            fat_driver_check_add(context, FAT_CHECK_CROSS_LINK, context->nodes[order[i].index],
+                                 first_shared, 0, shared);
+        }
+    }
+
+    free(kept);
+    free(order);
+}
+
+/**
+ * Orders nodes by first cluster, then by tree order
+ */
+static int fat_driver_check_compare_order(const void* a, const void* b) {
+    const FatCheckOrder* left = (const FatCheckOrder*)a;
+    const FatCheckOrder* right = (const FatCheckOrder*)b;
+    if (left->first_cluster != right->first_cluster) {
+        return left->first_cluster < right->first_cluster ? -1 : 1;
+    }
+    return (left->index > right->index) - (left->index < right->index);
+}
+
+/**
+ * Decodes the FAT #1 entry of a cluster
+ */
+static uint32_t fat_driver_check_entry(const FatCheckContext* context, uint32_t cluster) {
+    const uint8_t* fat = context->fat;
+
+    switch (context->fat_type) {
+        case FAT_TYPE_12: {
+            uint32_t offset = cluster + cluster / 2;
+            if (offset + 1 >= context->fat_bytes) return context->bad_cluster;
+            uint32_t value = fat[offset] | ((uint32_t)fat[offset + 1] << 8);
+            return (cluster & 1) ? (value >> 4) : (value & 0xFFF);
+        }
+        case FAT_TYPE_16: {
+            uint32_t offset = cluster * 2;
+            if (offset + 1 >= context->fat_bytes) return context->bad_cluster;
+            return fat[offset] | ((uint32_t)fat[offset + 1] << 8);
+        }
+        default: {
+            uint32_t offset = cluster * 4;
+            if (offset + 3 >= context->fat_bytes) return context->bad_cluster;
+            uint32_t value;
+            memcpy(&value, fat + offset, sizeof(value));
+            return value & 0x0FFFFFFF;
+        }
+    }
+}
+
+/**
+ * Next cluster of a chain, FAT_CHECK_END when the entry does not point into
+ * the data area
+ */
+static uint32_t fat_driver_check_next(const FatCheckContext* context, uint32_t cluster) {
+    uint32_t next = fat_driver_check_entry(context, cluster);
+    if (next < 2 || next > context->driver->total_clusters + 1) return FAT_CHECK_END;
+    return next;
+}
+
+/**
+ * Sets the ownership bit of a cluster. Returns false if it was already set.
+ */
+static bool fat_driver_check_claim(FatCheckContext* context, uint32_t cluster) {
+    uint32_t bit = 1u << (cluster % 32);
+    uint32_t old = atomic_fetch_or(&context->owned[cluster / 32], bit);
+    if (old & bit) return false;
+
+    atomic_fetch_add(&context->used_clusters, 1);
+    return true;
+}
+
+/**
+ * Tests the ownership bit of a cluster (after the walks)
+ */
+static bool fat_driver_check_owned(const FatCheckContext* context, uint32_t cluster) {
+    return (atomic_load(&context->owned[cluster / 32]) >> (cluster % 32)) & 1u;
+}
+
+/**
+ * Counts free clusters and groups allocated clusters nobody owns into lost
+ * chains. A chain head is a lost cluster no other lost cluster points to;
+ * lost clusters left after following every head form loops and are reported
+ * starting from their lowest cluster.
+ */
+static void fat_driver_check_lost(FatCheckContext* context) {
+    FATDriver* driver = context->driver;
+    uint32_t last_cluster = driver->total_clusters + 1;
+    uint32_t words = (last_cluster + 1 + 31) / 32;
+
+    uint32_t* lost = calloc(words, sizeof(uint32_t));
+    uint32_t* pointed = calloc(words, sizeof(uint32_t));
+    if (!lost || !pointed) {
+        free(lost);
+        free(pointed);
+        return;
+    }
+
+    for (uint32_t cluster = 2; cluster <= last_cluster; cluster++) {
+        uint32_t entry = fat_driver_check_entry(context, cluster);
+        if (entry == 0) {
+            context->report->free_clusters++;
+        } else if (entry != context->bad_cluster && !fat_driver_check_owned(context, cluster)) {
+            lost[cluster / 32] |= 1u << (cluster % 32);
+            context->report->lost_clusters++;
+        }
+    }
+
+    for (uint32_t cluster = 2; cluster <= last_cluster; cluster++) {
+        if (!(lost[cluster / 32] >> (cluster % 32) & 1u)) continue;
+        uint32_t next = fat_driver_check_next(context, cluster);
+        if (next != FAT_CHECK_END) pointed[next / 32] |= 1u << (next % 32);
+    }
+
+    /* Heads first, then whatever is left (loops) */
+    for (int pass = 0; pass < 2; pass++) {
+        for (uint32_t head = 2; head <= last_cluster; head++) {
+            if (!(lost[head / 32] >> (head % 32) & 1u)) continue;
+            if (pass == 0 && (pointed[head / 32] >> (head % 32) & 1u)) continue;
+
+            uint32_t length = 0;
+            uint32_t cluster = head;
+            while (cluster != FAT_CHECK_END && (lost[cluster / 32] >> (cluster % 32) & 1u)) {
+                lost[cluster / 32] &= ~(1u << (cluster % 32));
+                length++;
+                cluster = fat_driver_check_next(context, cluster);
+            }
+            fat_driver_check_add(context, FAT_CHECK_LOST_CHAIN, NULL, head, 0, length);
+        }
+    }
+
+    free(lost);
+    free(pointed);
+}
+
+/**
+ * Compares every other FAT copy with FAT #1 sector by sector and reports
+ * runs of differing sectors
+ */
+static void fat_driver_check_copies(FatCheckContext* context) {
+    FATDriver* driver = context->driver;
+    uint32_t sector_size = hal_get_sector_size(driver->hal);
+
+    uint8_t* buffer = malloc((size_t)FAT_CHECK_BATCH_SECTORS * sector_size);
+    if (!buffer) return;
+
+    for (uint32_t copy = 1; copy < driver->boot_sector.number_of_fats; copy++) {
+        uint32_t copy_start = driver->first_fat_sector + copy * driver->fat_size;
+        uint32_t run_start = 0, run_length = 0;
+
+        for (uint32_t done = 0; done < driver->fat_size; ) {
+            uint32_t count = driver->fat_size - done;
+            if (count > FAT_CHECK_BATCH_SECTORS) count = FAT_CHECK_BATCH_SECTORS;
+
+            if (hal_read_sectors(driver->hal, copy_start + done, count, buffer) != (int)(count * sector_size)) {
+                /* An unreadable copy is reported as differing from here on */
+                if (run_length == 0) run_start = done;
+                run_length += driver->fat_size - done;
+                break;
+            }
+
+            for (uint32_t i = 0; i < count; i++) {
+                bool same = memcmp(buffer + (size_t)i * sector_size,
+                                   context->fat + (size_t)(done + i) * sector_size, sector_size) == 0;
+                if (!same) {
+                    if (run_length == 0) run_start = done + i;
+                    run_length++;
+                } else if (run_length) {
+                    fat_driver_check_add_mismatch(context, copy, run_start, run_length);
+                    run_length = 0;
+                }
+            }
+            done += count;
+        }
+
+        if (run_length) {
+            fat_driver_check_add_mismatch(context, copy, run_start, run_length);
+        }
+    }
+
+    free(buffer);
+}
+
+/**
+ * Appends a finding about a chain or a cluster to the report
+ */
+static void fat_driver_check_add(FatCheckContext* context, FatCheckKind kind, const FileNode* node,
+                                 uint32_t cluster, uint32_t expected, uint32_t actual) {
+    FatCheckFinding finding;
+    memset(&finding, 0, sizeof(finding));
+    finding.kind = kind;
+    finding.node = node;
+    finding.cluster = cluster;
+    finding.expected = expected;
+    finding.actual = actual;
+    fat_driver_check_append(context, &finding);
+}
+
+/**
+ * Appends a run of FAT copy sectors that differ from FAT #1 to the report
+ */
+static void fat_driver_check_add_mismatch(FatCheckContext* context, uint32_t copy, uint32_t sector,
+                                          uint32_t sectors) {
+    FatCheckFinding finding;
+    memset(&finding, 0, sizeof(finding));
+    finding.kind = FAT_CHECK_FAT_MISMATCH;
+    finding.copy = copy;
+    finding.sector = sector;
+    finding.sectors = sectors;
+    fat_driver_check_append(context, &finding);
+}
+
+/**
+ * Appends a finding to the report (thread safe)
+ */
+static void fat_driver_check_append(FatCheckContext* context, const FatCheckFinding* finding) {
+    FatCheckReport* report = context->report;
+
+    pthread_mutex_lock(&context->lock);
+    if (report->finding_count == report->finding_capacity) {
+        uint32_t capacity = report->finding_capacity ? report->finding_capacity * 2 : 16;
+        FatCheckFinding* findings = realloc(report->findings, capacity * sizeof(FatCheckFinding));
+        if (!findings) {
+            pthread_mutex_unlock(&context->lock);
+            return;
+        }
+        report->findings = findings;
+        report->finding_capacity = capacity;
+    }
+
+    report->findings[report->finding_count++] = *finding;
+    pthread_mutex_unlock(&context->lock);
+}
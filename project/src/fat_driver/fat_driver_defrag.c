@@ -0,0 +1,411 @@
+/**
+ * @file fat_driver_defrag.c
+ * @brief Offline defragmentation of regular files
+ * @details The allocation state of every cluster is read from FAT #1 into a
+ *          bitmap once. Fragmented files are then placed largest first, each
+ *          into the lowest free run that holds the whole chain, so the volume
+ *          fills from the front. The clusters a file gives up become free
+ *          runs for the files placed after it.
+ *
+ *          Files on a damaged volume are protected too: every cluster a
+ *          chain reaches counts as used even where the FAT says free, and a
+ *          file sharing clusters with another chain is not moved.
+ *
+ *          A file is moved in an order that keeps the volume consistent at
+ *          every step: the data is copied into the free run and the new chain
+ *          is written and synced, then the directory entry is switched over
+ *          and synced, and only then is the old chain released. An
+ *          interruption leaves at worst a lost chain, never a file pointing
+ *          at clusters that are not its own.
+ * @date 2026-10-18
+ * @author Le Duc Son
+ */
+#include "fat_driver.h"
+#include "fat_driver_private.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Number of sectors moved per read/write pair
+ */
+#define FAT_DEFRAG_BATCH_SECTORS 2048
+
+/**
+ * A fragmented file waiting to be placed
+ */
+typedef struct {
+    FileNode* node;
+    uint32_t clusters;              /**< Chain length */
+    uint32_t extents;               /**< Runs of consecutive clusters */
+} FatDefragFile;
+
+/**
+ * State shared by the planning and the moves
+ */
+typedef struct {
+    FATDriver* driver;
+    uint64_t* used;                 /**< One bit per cluster, set when allocated or reached by a chain */
+    uint64_t* owned;                /**< One bit per cluster, set when reached by a chain */
+    uint64_t* shared;               /**< One bit per cluster, set when reached by a second chain */
+    uint32_t last_cluster;          /**< Highest cluster number of the volume */
+    uint32_t sectors_per_cluster;
+    uint32_t sector_size;
+    uint8_t* buffer;                /**< FAT_DEFRAG_BATCH_SECTORS sectors */
+    FatDefragFile* files;           /**< Fragmented files with intact chains */
+    uint32_t file_count;
+    uint32_t file_capacity;
+    FatDefragReport* report;
+} FatDefragContext;
+
+/* Local functions */
+static int fat_driver_defrag_unlocked(FATDriver* driver, FatDefragReport* report);
+static int fat_driver_defrag_load_bitmap(FatDefragContext* context);
+static void fat_driver_defrag_mark(uint64_t* bitmap, uint32_t cluster, bool set);
+static bool fat_driver_defrag_test(const uint64_t* bitmap, uint32_t cluster);
+static int fat_driver_defrag_collect(FatDefragContext* context, FileNode* directory);
+static bool fat_driver_defrag_is_shared(const FatDefragContext* context, const FileNode* node);
+static int fat_driver_defrag_compare(const void* a, const void* b);
+static uint32_t fat_driver_defrag_find_run(const FatDefragContext* context, uint32_t count);
+static int fat_driver_defrag_move(FatDefragContext* context, const FatDefragFile* file, uint32_t target);
+static int fat_driver_defrag_copy(FatDefragContext* context, uint32_t first_cluster, uint32_t target);
+
+/**
+ * Defragments the regular files of a read-write mount.
+ *
+ * Directories are not moved. A fragmented file is left where it is when its
+ * chain is damaged (run the check first) or when no free run can hold it.
+ * The write lock is held throughout.
+ *
+ * @param driver Pointer to the FATDriver structure.
+ * @param report Pointer to store the extent counts before and after.
+ * @return 0 if successful, -1 if failed.
+ */
+int fat_driver_defrag(FATDriver* driver, FatDefragReport* report) {
+    if (!driver || !report || !driver->root_directory) return -1;
+    if (driver->config.mode != MODE_READ_WRITE) return -1;
+
+    fat_driver_write_lock(driver);
+    int result = fat_driver_defrag_unlocked(driver, report);
+    fat_driver_write_unlock(driver);
+
+    return result;
+}
+
+/** Internal function of fat_driver_defrag(), called with the write lock held */
+static int fat_driver_defrag_unlocked(FATDriver* driver, FatDefragReport* report) {
+    memset(report, 0, sizeof(FatDefragReport));
+
+    /* Directory entries and the FAT are written directly below */
+    if (fat_driver_sync_unlocked(driver) != 0) return -1;
+
+    FatDefragContext context;
+    memset(&context, 0, sizeof(context));
+    context.driver = driver;
+    context.report = report;
+    context.last_cluster = driver->total_clusters + 1;
+    context.sectors_per_cluster = driver->boot_sector.sectors_per_cluster;
+    context.sector_size = hal_get_sector_size(driver->hal);
+    context.buffer = malloc((size_t)FAT_DEFRAG_BATCH_SECTORS * context.sector_size);
+
+    if (!context.buffer || fat_driver_defrag_load_bitmap(&context) != 0 ||
+        fat_driver_defrag_collect(&context, driver->root_directory) != 0) {
+        free(context.buffer);
+        free(context.used);
+        free(context.owned);
+        free(context.shared);
+        free(context.files);
+        return -1;
+    }
+
+    /* Cross-linked files stay where they are */
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < context.file_count; i++) {
+        if (fat_driver_defrag_is_shared(&context, context.files[i].node)) {
+            report->skipped++;
+        } else {
+            context.files[kept++] = context.files[i];
+        }
+    }
+    context.file_count = kept;
+
+    report->extents_after = report->extents_before;
+    report->fragmented_after = report->fragmented_before;
+
+    qsort(context.files, context.file_count, sizeof(FatDefragFile), fat_driver_defrag_compare);
+
+    int result = 0;
+    for (uint32_t i = 0; i < context.file_count; i++) {
+        const FatDefragFile* file = &context.files[i];
+
+        uint32_t target = fat_driver_defrag_find_run(&context, file->clusters);
+        if (target == 0) {
+            report->skipped++;
+            continue;
+        }
+
+        if (fat_driver_defrag_move(&context, file, target) != 0) {
+            result = -1;
+            break;
+        }
+
+        report->moved++;
+        report->moved_clusters += file->clusters;
+        report->extents_after -= file->extents - 1;
+        report->fragmented_after--;
+    }
+
+    /*
+     * The sectors written behind the cache may be cached with old content,
+     * also when a move stopped part way, so they are always dropped
+     */
+    if (fat_driver_sync_unlocked(driver) != 0) result = -1;
+    block_cache_invalidate(driver->cache, driver->hal);
+
+    free(context.buffer);
+    free(context.used);
+    free(context.owned);
+    free(context.shared);
+    free(context.files);
+    return result;
+}
+
+/**
+ * Reads the allocation state of every cluster from FAT #1.
+ * Clusters 0 and 1 and the bits past the last cluster count as used.
+ */
+static int fat_driver_defrag_load_bitmap(FatDefragContext* context) {
+    uint32_t words = (context->last_cluster + 1 + 63) / 64;
+
+    context->used = malloc(words * sizeof(uint64_t));
+    context->owned = calloc(words, sizeof(uint64_t));
+    context->shared = calloc(words, sizeof(uint64_t));
+    if (!context->used || !context->owned || !context->shared) return -1;
+    memset(context->used, 0xFF, words * sizeof(uint64_t));
+
+    for (uint32_t cluster = 2; cluster <= context->last_cluster; cluster++) {
+        if (fat_driver_get_fat_entry(context->driver, cluster) == 0) {
+            fat_driver_defrag_mark(context->used, cluster, false);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Sets or clears the bit of a cluster.
+ */
+static void fat_driver_defrag_mark(uint64_t* bitmap, uint32_t cluster, bool set) {
+    uint64_t bit = 1ULL << (cluster % 64);
+
+    if (set) {
+        bitmap[cluster / 64] |= bit;
+    } else {
+        bitmap[cluster / 64] &= ~bit;
+    }
+}
+
+/**
+ * Tests the bit of a cluster.
+ */
+static bool fat_driver_defrag_test(const uint64_t* bitmap, uint32_t cluster) {
+    return (bitmap[cluster / 64] >> (cluster % 64)) & 1;
+}
+
+/**
+ * Walks the chain of every node below a directory, marking the clusters it
+ * reaches. Regular files are counted for the report and the fragmented ones
+ * with intact chains are kept.
+ */
+static int fat_driver_defrag_collect(FatDefragContext* context, FileNode* directory) {
+    for (FileNode* child = directory->children; child; child = child->next) {
+        FatChainIterator chain;
+        uint32_t cluster, previous = 0;
+        uint32_t clusters = 0, extents = 0;
+
+        fat_driver_chain_begin(&chain, context->driver, child->first_cluster);
+        while (fat_driver_chain_next(&chain, &cluster)) {
+            if (fat_driver_defrag_test(context->owned, cluster)) {
+                fat_driver_defrag_mark(context->shared, cluster, true);
+            }
+            fat_driver_defrag_mark(context->owned, cluster, true);
+            fat_driver_defrag_mark(context->used, cluster, true);
+
+            if (cluster != previous + 1) extents++;
+            previous = cluster;
+            clusters++;
+        }
+
+        if (child->type == FILE_TYPE_DIRECTORY) {
+            if (fat_driver_defrag_collect(context, child) != 0) return -1;
+            continue;
+        }
+        if (child->type != FILE_TYPE_REGULAR || clusters == 0) continue;
+
+        context->report->files++;
+        context->report->extents_before += extents;
+        if (extents <= 1) continue;
+        context->report->fragmented_before++;
+
+        if (chain.status != FAT_CHAIN_END) {
+            context->report->skipped++;
+            continue;
+        }
+
+        if (context->file_count == context->file_capacity) {
+            uint32_t capacity = context->file_capacity ? context->file_capacity * 2 : 64;
+            FatDefragFile* files = realloc(context->files, capacity * sizeof(FatDefragFile));
+            if (!files) return -1;
+            context->files = files;
+            context->file_capacity = capacity;
+        }
+
+        FatDefragFile* file = &context->files[context->file_count++];
+        file->node = child;
+        file->clusters = clusters;
+        file->extents = extents;
+    }
+
+    return 0;
+}
+
+/**
+ * Tells whether the chain of a node reaches a cluster another chain reaches.
+ */
+static bool fat_driver_defrag_is_shared(const FatDefragContext* context, const FileNode* node) {
+    FatChainIterator chain;
+    uint32_t cluster;
+
+    fat_driver_chain_begin(&chain, context->driver, node->first_cluster);
+    while (fat_driver_chain_next(&chain, &cluster)) {
+        if (fat_driver_defrag_test(context->shared, cluster)) return true;
+    }
+
+    return false;
+}
+
+/** Internal function to order files by chain length, longest first */
+static int fat_driver_defrag_compare(const void* a, const void* b) {
+    const FatDefragFile* file_a = (const FatDefragFile*)a;
+    const FatDefragFile* file_b = (const FatDefragFile*)b;
+
+    if (file_a->clusters != file_b->clusters) return (file_a->clusters > file_b->clusters) ? -1 : 1;
+    return (file_a->node->first_cluster < file_b->node->first_cluster) ? -1 :
+           (file_a->node->first_cluster > file_b->node->first_cluster);
+}
+
+/**
+ * Finds the lowest run of count free clusters. Fully used words of the
+ * bitmap are skipped 64 clusters at a time.
+ *
+ * @return First cluster of the run, 0 if there is none.
+ */
+static uint32_t fat_driver_defrag_find_run(const FatDefragContext* context, uint32_t count) {
+    uint32_t run_start = 0;
+    uint32_t run_length = 0;
+
+    for (uint32_t cluster = 2; cluster <= context->last_cluster; cluster++) {
+        if (cluster % 64 == 0 && context->used[cluster / 64] == UINT64_MAX) {
+            run_length = 0;
+            cluster += 63;
+            continue;
+        }
+
+        if (fat_driver_defrag_test(context->used, cluster)) {
+            run_length = 0;
+            continue;
+        }
+
+        if (run_length == 0) run_start = cluster;
+        if (++run_length == count) return run_start;
+    }
+
+    return 0;
+}
+
+/**
+ * Moves one file into the free run starting at target.
+ */
+static int fat_driver_defrag_move(FatDefragContext* context, const FatDefragFile* file, uint32_t target) {
+    FATDriver* driver = context->driver;
+    uint32_t old_first = file->node->first_cluster;
+    uint32_t end_of_chain = fat_driver_end_of_chain(driver);
+
+    if (fat_driver_defrag_copy(context, old_first, target) != 0) return -1;
+
+    /* New chain first, it is only a lost chain until the entry points at it */
+    for (uint32_t i = 0; i < file->clusters; i++) {
+        uint32_t next = (i + 1 < file->clusters) ? target + i + 1 : end_of_chain;
+        if (fat_driver_set_fat_entry(driver, target + i, next) != 0) return -1;
+        fat_driver_defrag_mark(context->used, target + i, true);
+    }
+    if (fat_driver_sync_unlocked(driver) != 0) return -1;
+
+    if (fat_driver_relink_entry(driver, file->node, target) != 0) return -1;
+    if (fat_driver_sync_unlocked(driver) != 0) return -1;
+
+    /* The old clusters become free runs for the files placed later */
+    FatChainIterator chain;
+    uint32_t cluster;
+    fat_driver_chain_begin(&chain, driver, old_first);
+    while (fat_driver_chain_next(&chain, &cluster)) {
+        fat_driver_defrag_mark(context->used, cluster, false);
+    }
+
+    return fat_driver_free_chain_unlocked(driver, old_first);
+}
+
+/**
+ * Copies the chain starting at first_cluster to consecutive clusters from
+ * target. Runs of consecutive source clusters are read with one request each
+ * and gathered in the buffer, which is written out in one request when full.
+ */
+static int fat_driver_defrag_copy(FatDefragContext* context, uint32_t first_cluster, uint32_t target) {
+    FATDriver* driver = context->driver;
+    uint32_t spc = context->sectors_per_cluster;
+    uint32_t destination = fat_driver_cluster_to_sector(driver, target);
+    uint32_t filled = 0;
+    uint32_t run_start = 0, run_length = 0;
+    FatChainIterator chain;
+    uint32_t cluster;
+    bool more = true;
+
+    fat_driver_chain_begin(&chain, driver, first_cluster);
+    while (more) {
+        more = fat_driver_chain_next(&chain, &cluster);
+        if (more && run_length > 0 && cluster == run_start + run_length) {
+            run_length++;
+            continue;
+        }
+
+        /* Read the finished run, writing the buffer out whenever it fills */
+        uint32_t sector = run_length ? fat_driver_cluster_to_sector(driver, run_start) : 0;
+        uint32_t remaining = run_length * spc;
+        while (remaining > 0) {
+            uint32_t count = FAT_DEFRAG_BATCH_SECTORS - filled;
+            if (count > remaining) count = remaining;
+
+            uint32_t bytes = count * context->sector_size;
+            if (hal_read_sectors(driver->hal, sector, count, context->buffer + filled * context->sector_size) !=
+                (int)bytes) {
+                return -1;
+            }
+            sector += count;
+            remaining -= count;
+            filled += count;
+
+            if (filled == FAT_DEFRAG_BATCH_SECTORS || (!more && remaining == 0)) {
+                if (hal_write_sectors(driver->hal, destination, filled, context->buffer) !=
+                    (int)(filled * context->sector_size)) {
+                    return -1;
+                }
+                destination += filled;
+                filled = 0;
+            }
+        }
+
+        run_start = cluster;
+        run_length = 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,881 @@
+/**
+ * @file fat_driver_dir.c
+ * @brief Directory entry creation, deletion and update
+ * @details Every directory loaded on a read-write mount keeps a free-slot
+ *          index. Free runs of 32-byte slots are linked into buckets by
+ *          length and tagged at both ends, so a new entry takes a run from
+ *          the first non-empty bucket that fits and a deleted entry merges
+ *          with the free runs on either side without scanning the directory.
+ *          The first change to a directory also hashes its children by name
+ *          and links them both ways, so the duplicate check of a new entry
+ *          and the unlink of a deleted one do not walk the child list either.
+ *          Entries are written through the block cache and reach the disk at
+ *          sync.
+ * @date 2026-10-18
+ * @author Le Duc Son
+ */
+#include "fat_driver.h"
+#include "fat_driver_private.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Local functions */
+static uint32_t fat_driver_slot_bucket(uint32_t length);
+static int fat_driver_slot_index_reserve(FatSlotIndex* index, uint32_t slot_count);
+static void fat_driver_slot_index_insert(FatSlotIndex* index, uint32_t start, uint32_t length);
+static void fat_driver_slot_index_remove(FatSlotIndex* index, uint32_t start);
+static uint32_t fat_driver_slot_index_take(FatSlotIndex* index, uint32_t count);
+static void fat_driver_slot_index_release(FatSlotIndex* index, uint32_t start, uint32_t count);
+static int fat_driver_name_table_build(FileNode* directory);
+static int fat_driver_name_table_grow(FatSlotIndex* index, uint32_t capacity);
+static uint32_t fat_driver_name_table_home(const FatSlotIndex* index, const char* name, size_t length);
+static void fat_driver_name_table_insert(FatSlotIndex* index, FileNode* node);
+static void fat_driver_name_table_remove(FatSlotIndex* index, FileNode* node);
+static int fat_driver_slot_location(FATDriver* driver, const FatSlotIndex* index, uint32_t slot,
+                                    uint32_t* sector, uint32_t* offset);
+static int fat_driver_write_slot(FATDriver* driver, const FatSlotIndex* index, uint32_t slot,
+                                 const void* data, uint32_t length);
+static int fat_driver_claim_slots(FATDriver* driver, FatSlotIndex* index, uint32_t start, uint32_t count);
+static int fat_driver_extend_directory(FATDriver* driver, FileNode* directory);
+static int fat_driver_init_directory_cluster(FATDriver* driver, uint32_t cluster, uint32_t parent_cluster,
+                                             const FATDirEntry* template_entry);
+static int fat_driver_update_entry_unlocked(FATDriver* driver, FileNode* node);
+
+/**
+ * Creates an empty free-slot index.
+ *
+ * @return Pointer to the index, NULL if out of memory.
+ */
+FatSlotIndex* fat_driver_slot_index_create(void) {
+    FatSlotIndex* index = calloc(1, sizeof(FatSlotIndex));
+    if (!index) return NULL;
+
+    for (uint32_t i = 0; i < FAT_SLOT_BUCKETS; i++) {
+        index->buckets[i] = FAT_SLOT_NONE;
+    }
+    index->end_slot = FAT_SLOT_NONE;
+    index->open_run = FAT_SLOT_NONE;
+
+    return index;
+}
+
+/**
+ * Appends a directory cluster to the index, in chain order.
+ *
+ * @param index Pointer to the FatSlotIndex structure.
+ * @param cluster Cluster number.
+ * @return 0 if successful, -1 if failed.
+ */
+int fat_driver_slot_index_add_cluster(FatSlotIndex* index, uint32_t cluster) {
+    if (!index) return -1;
+
+    if (index->cluster_count == index->cluster_capacity) {
+        uint32_t capacity = index->cluster_capacity ? index->cluster_capacity * 2 : 4;
+        uint32_t* clusters = realloc(index->clusters, capacity * sizeof(uint32_t));
+        if (!clusters) return -1;
+        index->clusters = clusters;
+        index->cluster_capacity = capacity;
+    }
+
+    index->clusters[index->cluster_count++] = cluster;
+    return 0;
+}
+
+/**
+ * Appends the next slot of the directory while it is being loaded.
+ *
+ * @param index Pointer to the FatSlotIndex structure.
+ * @param is_free True if the slot is 0x00, 0xE5 or after the end marker.
+ * @param is_end True if the slot is in the 0x00 end-of-directory region.
+ * @return 0 if successful, -1 if failed.
+ */
+int fat_driver_slot_index_add_slot(FatSlotIndex* index, bool is_free, bool is_end) {
+    if (!index) return -1;
+    if (fat_driver_slot_index_reserve(index, index->slot_count + 1) != 0) return -1;
+
+    uint32_t slot = index->slot_count++;
+    index->run_length[slot] = 0;
+    index->run_start[slot] = 0;
+
+    if (is_end && index->end_slot == FAT_SLOT_NONE) {
+        index->end_slot = slot;
+    }
+
+    if (is_free) {
+        if (index->open_run == FAT_SLOT_NONE) index->open_run = slot;
+    } else if (index->open_run != FAT_SLOT_NONE) {
+        fat_driver_slot_index_insert(index, index->open_run, slot - index->open_run);
+        index->open_run = FAT_SLOT_NONE;
+    }
+
+    return 0;
+}
+
+/**
+ * Closes the run still open at the end of the directory.
+ *
+ * @param index Pointer to the FatSlotIndex structure.
+ */
+void fat_driver_slot_index_finish(FatSlotIndex* index) {
+    if (!index) return;
+
+    if (index->open_run != FAT_SLOT_NONE) {
+        fat_driver_slot_index_insert(index, index->open_run, index->slot_count - index->open_run);
+        index->open_run = FAT_SLOT_NONE;
+    }
+    if (index->end_slot == FAT_SLOT_NONE) {
+        index->end_slot = index->slot_count;
+    }
+}
+
+/**
+ * Frees a free-slot index.
+ *
+ * @param index Pointer to the FatSlotIndex structure.
+ */
+void fat_driver_slot_index_free(FatSlotIndex* index) {
+    if (!index) return;
+
+    free(index->run_length);
+    free(index->run_start);
+    free(index->run_next);
+    free(index->run_prev);
+    free(index->clusters);
+    free(index->names);
+    free(index);
+}
+
+/**
+ * Creates a directory entry and its node.
+ *
+ * Only 8.3 names are accepted. A directory without a first cluster gets a
+ * new zeroed cluster holding its "." and ".." entries. When no free slot is
+ * left the directory grows by one cluster, except the fixed FAT12/16 root.
+ *
+ * @param driver Pointer to the FATDriver structure.
+ * @param parent Directory to create the entry in.
+ * @param name 8.3 name of the new entry.
+ * @param type FILE_TYPE_REGULAR or FILE_TYPE_DIRECTORY.
+ * @param first_cluster First cluster of the content, 0 for none.
+ * @param size File size in bytes.
+ * @return Pointer to the new node if successful, NULL if failed.
+ */
+FileNode* fat_driver_create_entry(FATDriver* driver, FileNode* parent, const char* name,
+                                  FileType type, uint32_t first_cluster, uint32_t size) {
+    if (!driver) return NULL;
+
+    fat_driver_write_lock(driver);
+    FileNode* node = fat_driver_create_entry_unlocked(driver, parent, name, type, first_cluster, size, time(NULL));
+    fat_driver_write_unlock(driver);
+
+    return node;
+}
+
+/**
+ * Internal function of fat_driver_create_entry(), called with the write lock
+ * held. The entry is stamped with the given time.
+ */
+FileNode* fat_driver_create_entry_unlocked(FATDriver* driver, FileNode* parent, const char* name,
+                                           FileType type, uint32_t first_cluster, uint32_t size, time_t when) {
+    if (!parent || !name || driver->config.mode != MODE_READ_WRITE) return NULL;
+    if (parent->type != FILE_TYPE_DIRECTORY || !parent->slot_index) return NULL;
+    if (type != FILE_TYPE_REGULAR && type != FILE_TYPE_DIRECTORY) return NULL;
+
+    FATDirEntry entry;
+    uint8_t short_name[11];
+    if (fat_driver_make_short_name(name, short_name) != 0) return NULL;
+    memset(&entry, 0, sizeof(entry));
+    memcpy(entry.name, short_name, sizeof(entry.name));
+    memcpy(entry.ext, short_name + sizeof(entry.name), sizeof(entry.ext));
+
+    FileNode* node = malloc(sizeof(FileNode));
+    if (!node) return NULL;
+
+    /* Fill the node once to get the name as the tree stores it */
+    fat_driver_fill_file_node(driver, node, &entry);
+    FatSlotIndex* index = parent->slot_index;
+    if (fat_driver_name_table_build(parent) != 0 ||
+        fat_driver_slot_index_find_name(index, node->name, strlen(node->name)) ||
+        fat_driver_name_table_grow(index, index->name_count + 1) != 0) {
+        free(node);
+        return NULL;
+    }
+
+    uint32_t slot = fat_driver_slot_index_take(index, 1);
+    if (slot == FAT_SLOT_NONE) {
+        if (fat_driver_extend_directory(driver, parent) != 0) {
+            free(node);
+            return NULL;
+        }
+        slot = fat_driver_slot_index_take(index, 1);
+        if (slot == FAT_SLOT_NONE) {
+            free(node);
+            return NULL;
+        }
+    }
+
+    /* Fill in the entry */
+    uint16_t date, time_value;
+    fat_driver_encode_time(when, &date, &time_value);
+    entry.attributes = (type == FILE_TYPE_DIRECTORY) ? FAT_ATTR_DIRECTORY : FAT_ATTR_ARCHIVE;
+    entry.create_time = time_value;
+    entry.create_date = date;
+    entry.last_access_date = date;
+    entry.write_time = time_value;
+    entry.write_date = date;
+    entry.file_size = (type == FILE_TYPE_DIRECTORY) ? 0 : size;
+
+    bool new_cluster = false;
+    if (type == FILE_TYPE_DIRECTORY && first_cluster == 0) {
+        if (fat_driver_allocate_clusters_unlocked(driver, 1, 0, &first_cluster) != 0) {
+            fat_driver_slot_index_release(index, slot, 1);
+            free(node);
+            return NULL;
+        }
+        new_cluster = true;
+    }
+    entry.first_cluster_high = (uint16_t)(first_cluster >> 16);
+    entry.first_cluster_low = (uint16_t)(first_cluster & 0xFFFF);
+
+    uint32_t parent_cluster = (parent == driver->root_directory) ? 0 : parent->first_cluster;
+    if ((new_cluster && fat_driver_init_directory_cluster(driver, first_cluster, parent_cluster, &entry) != 0) ||
+        fat_driver_claim_slots(driver, index, slot, 1) != 0 ||
+        fat_driver_write_slot(driver, index, slot, &entry, sizeof(entry)) != 0) {
+        if (new_cluster) fat_driver_free_chain_unlocked(driver, first_cluster);
+        fat_driver_slot_index_release(index, slot, 1);
+        free(node);
+        return NULL;
+    }
+
+    /* Fill in the node */
+    fat_driver_fill_file_node(driver, node, &entry);
+    node->entry_slot = slot;
+    node->parent = parent;
+
+    if (new_cluster) {
+        /* A new directory holds "." and ".." followed by the end marker */
+        uint32_t sector_size = hal_get_sector_size(driver->hal);
+        uint32_t slots = driver->boot_sector.sectors_per_cluster * (sector_size / 32);
+        node->slot_index = fat_driver_slot_index_create();
+        if (node->slot_index) {
+            fat_driver_slot_index_add_cluster(node->slot_index, first_cluster);
+            for (uint32_t i = 0; i < slots; i++) {
+                fat_driver_slot_index_add_slot(node->slot_index, i >= 2, i >= 2);
+            }
+            fat_driver_slot_index_finish(node->slot_index);
+        }
+    }
+
+    /* Link it into the tree once it is complete, lookups may be running */
+    node->prev = NULL;
+    node->next = parent->children;
+    if (node->next) node->next->prev = node;
+    FAT_PUBLISH_LINK(parent->children, node);
+    fat_driver_name_table_insert(index, node);
+    fat_driver_sort_invalidate(driver, parent);
+
+    return node;
+}
+
+/**
+ * Deletes an entry.
+ *
+ * The short entry and the LFN entries in front of it are marked 0xE5 and
+ * given back to the parent's free-slot index, the cluster chain is released
+ * and the node is unlinked. The node is freed once no path lookup that may
+ * have reached it is still running.
+ *
+ * @param driver Pointer to the FATDriver structure.
+ * @param node Node to delete (a directory must be empty).
+ * @return 0 if successful, -1 if failed.
+ */
+int fat_driver_delete_entry(FATDriver* driver, FileNode* node) {
+    if (!driver) return -1;
+
+    fat_driver_write_lock(driver);
+    int result = fat_driver_delete_entry_unlocked(driver, node);
+    fat_driver_write_unlock(driver);
+
+    return result;
+}
+
+/** Internal function of fat_driver_delete_entry(), called with the write lock held */
+int fat_driver_delete_entry_unlocked(FATDriver* driver, FileNode* node) {
+    if (!node || driver->config.mode != MODE_READ_WRITE) return -1;
+    if (node == driver->root_directory || !node->parent || !node->parent->slot_index) return -1;
+    if (node->children) return -1;
+
+    FileNode* parent = node->parent;
+    FatSlotIndex* index = parent->slot_index;
+    uint32_t first_slot = node->entry_slot - node->lfn_slots;
+    uint32_t count = (uint32_t)node->lfn_slots + 1;
+    uint8_t deleted = 0xE5;
+
+    for (uint32_t slot = first_slot; slot < first_slot + count; slot++) {
+        if (fat_driver_write_slot(driver, index, slot, &deleted, 1) != 0) return -1;
+    }
+    fat_driver_slot_index_release(index, first_slot, count);
+
+    if (node->first_cluster >= 2) {
+        fat_driver_free_chain_unlocked(driver, node->first_cluster);
+    }
+
+    /* Unlink the node from its parent, walking the list only without a name table */
+    if (fat_driver_name_table_build(parent) == 0) {
+        fat_driver_name_table_remove(index, node);
+        if (node->next) node->next->prev = node->prev;
+        if (node->prev) {
+            FAT_PUBLISH_LINK(node->prev->next, node->next);
+        } else {
+            FAT_PUBLISH_LINK(parent->children, node->next);
+        }
+    } else {
+        FileNode** link = &parent->children;
+        while (*link && *link != node) {
+            link = &(*link)->next;
+        }
+        if (*link) FAT_PUBLISH_LINK(*link, node->next);
+    }
+    fat_driver_sort_invalidate(driver, parent);
+
+    fat_driver_forget_subtree(driver, node, parent);
+
+    fat_driver_retire_node(driver, node, true);
+    fat_driver_reclaim(driver);
+    return 0;
+}
+
+/**
+ * Writes the first cluster, size and modification time of a node back to its
+ * directory entry.
+ *
+ * @param driver Pointer to the FATDriver structure.
+ * @param node Node to update.
+ * @return 0 if successful, -1 if failed.
+ */
+int fat_driver_update_entry(FATDriver* driver, FileNode* node) {
+    if (!driver) return -1;
+
+    fat_driver_write_lock(driver);
+    int result = fat_driver_update_entry_unlocked(driver, node);
+    fat_driver_write_unlock(driver);
+
+    return result;
+}
+
+/** Internal function of fat_driver_update_entry(), called with the write lock held */
+static int fat_driver_update_entry_unlocked(FATDriver* driver, FileNode* node) {
+    if (!node || driver->config.mode != MODE_READ_WRITE) return -1;
+    if (node == driver->root_directory || !node->parent || !node->parent->slot_index) return -1;
+
+    FatSlotIndex* index = node->parent->slot_index;
+    uint32_t sector, offset;
+    if (fat_driver_slot_location(driver, index, node->entry_slot, &sector, &offset) != 0) return -1;
+
+    FATDirEntry entry;
+    if (block_cache_read_bytes(driver->cache, driver->hal, sector, offset, &entry, sizeof(entry)) != 0) {
+        return -1;
+    }
+
+    fat_driver_encode_time(time(NULL), &entry.write_date, &entry.write_time);
+    entry.first_cluster_high = (uint16_t)(node->first_cluster >> 16);
+    entry.first_cluster_low = (uint16_t)(node->first_cluster & 0xFFFF);
+    entry.file_size = (node->type == FILE_TYPE_DIRECTORY) ? 0 : node->size;
+
+    if (block_cache_write_bytes(driver->cache, driver->hal, sector, offset, &entry, sizeof(entry)) != 0) {
+        return -1;
+    }
+
+    node->modified_time.year = 1980 + ((entry.write_date >> 9) & 0x7F);
+    node->modified_time.month = (entry.write_date >> 5) & 0x0F;
+    node->modified_time.day = entry.write_date & 0x1F;
+    node->modified_time.hour = (entry.write_time >> 11) & 0x1F;
+    node->modified_time.minute = (entry.write_time >> 5) & 0x3F;
+    node->modified_time.second = (entry.write_time & 0x1F) * 2;
+
+    /* Size and time orders of the parent may have changed */
+    fat_driver_sort_invalidate(driver, node->parent);
+    return 0;
+}
+
+/**
+ * Points the directory entry of a node at another first cluster. Unlike
+ * fat_driver_update_entry() the size and times are left as they are.
+ *
+ * @param driver Pointer to the FATDriver structure.
+ * @param node Node to update.
+ * @param first_cluster New first cluster.
+ * @return 0 if successful, -1 if failed.
+ */
+int fat_driver_relink_entry(FATDriver* driver, FileNode* node, uint32_t first_cluster) {
+    if (!driver || !node || driver->config.mode != MODE_READ_WRITE) return -1;
+    if (node == driver->root_directory || !node->parent || !node->parent->slot_index) return -1;
+
+    uint32_t sector, offset;
+    if (fat_driver_slot_location(driver, node->parent->slot_index, node->entry_slot, &sector, &offset) != 0) {
+        return -1;
+    }
+
+    FATDirEntry entry;
+    if (block_cache_read_bytes(driver->cache, driver->hal, sector, offset, &entry, sizeof(entry)) != 0) {
+        return -1;
+    }
+
+    entry.first_cluster_high = (uint16_t)(first_cluster >> 16);
+    entry.first_cluster_low = (uint16_t)(first_cluster & 0xFFFF);
+
+    if (block_cache_write_bytes(driver->cache, driver->hal, sector, offset, &entry, sizeof(entry)) != 0) {
+        return -1;
+    }
+
+    node->first_cluster = first_cluster;
+    return 0;
+}
+
+/**
+ * Bucket of a free run: exact buckets up to FAT_SLOT_BUCKETS - 2 slots, the
+ * last bucket for longer runs.
+ */
+static uint32_t fat_driver_slot_bucket(uint32_t length) {
+    return (length < FAT_SLOT_BUCKETS - 1) ? length : FAT_SLOT_BUCKETS - 1;
+}
+
+/**
+ * Grows the per-slot arrays to hold at least slot_count slots.
+ */
+static int fat_driver_slot_index_reserve(FatSlotIndex* index, uint32_t slot_count) {
+    if (slot_count <= index->slot_capacity) return 0;
+
+    uint32_t capacity = index->slot_capacity ? index->slot_capacity : 64;
+    while (capacity < slot_count) capacity *= 2;
+
+    uint32_t** arrays[4] = { &index->run_length, &index->run_start, &index->run_next, &index->run_prev };
+    for (int i = 0; i < 4; i++) {
+        uint32_t* grown = realloc(*arrays[i], capacity * sizeof(uint32_t));
+        if (!grown) return -1;
+        *arrays[i] = grown;
+    }
+    index->slot_capacity = capacity;
+
+    return 0;
+}
+
+/**
+ * Tags a free run at both ends and links it into its bucket.
+ */
+static void fat_driver_slot_index_insert(FatSlotIndex* index, uint32_t start, uint32_t length) {
+    uint32_t bucket = fat_driver_slot_bucket(length);
+
+    index->run_length[start] = length;
+    index->run_start[start + length - 1] = start + 1;
+    index->run_prev[start] = FAT_SLOT_NONE;
+    index->run_next[start] = index->buckets[bucket];
+    if (index->buckets[bucket] != FAT_SLOT_NONE) {
+        index->run_prev[index->buckets[bucket]] = start;
+    }
+    index->buckets[bucket] = start;
+    index->free_slots += length;
+}
+
+/**
+ * Unlinks a free run from its bucket and clears its tags.
+ */
+static void fat_driver_slot_index_remove(FatSlotIndex* index, uint32_t start) {
+    uint32_t length = index->run_length[start];
+    uint32_t prev = index->run_prev[start];
+    uint32_t next = index->run_next[start];
+
+    if (prev != FAT_SLOT_NONE) {
+        index->run_next[prev] = next;
+    } else {
+        index->buckets[fat_driver_slot_bucket(length)] = next;
+    }
+    if (next != FAT_SLOT_NONE) {
+        index->run_prev[next] = prev;
+    }
+
+    index->run_length[start] = 0;
+    index->run_start[start + length - 1] = 0;
+    index->free_slots -= length;
+}
+
+/**
+ * Takes count consecutive free slots. The remainder of the run goes back to
+ * the bucket of its new length. Entries are created with a short name only,
+ * so count is 1 today; runs longer than one slot are for LFN entries.
+ *
+ * @return First slot taken, FAT_SLOT_NONE if no run is long enough.
+ */
+static uint32_t fat_driver_slot_index_take(FatSlotIndex* index, uint32_t count) {
+    if (count == 0) return FAT_SLOT_NONE;
+
+    uint32_t start = FAT_SLOT_NONE;
+    for (uint32_t bucket = fat_driver_slot_bucket(count); bucket < FAT_SLOT_BUCKETS; bucket++) {
+        uint32_t run = index->buckets[bucket];
+
+        /* Only the last bucket mixes lengths */
+        while (run != FAT_SLOT_NONE && index->run_length[run] < count) {
+            run = index->run_next[run];
+        }
+        if (run != FAT_SLOT_NONE) {
+            start = run;
+            break;
+        }
+    }
+    if (start == FAT_SLOT_NONE) return FAT_SLOT_NONE;
+
+    uint32_t length = index->run_length[start];
+    fat_driver_slot_index_remove(index, start);
+    if (length > count) {
+        fat_driver_slot_index_insert(index, start + count, length - count);
+    }
+
+    return start;
+}
+
+/**
+ * Returns count slots to the index, merging with the free runs right before
+ * and after them.
+ */
+static void fat_driver_slot_index_release(FatSlotIndex* index, uint32_t start, uint32_t count) {
+    if (start > 0 && index->run_start[start - 1] != 0) {
+        uint32_t left = index->run_start[start - 1] - 1;
+        count += index->run_length[left];
+        fat_driver_slot_index_remove(index, left);
+        start = left;
+    }
+    if (start + count < index->slot_count && index->run_length[start + count] != 0) {
+        uint32_t right = start + count;
+        count += index->run_length[right];
+        fat_driver_slot_index_remove(index, right);
+    }
+
+    fat_driver_slot_index_insert(index, start, count);
+}
+
+/**
+ * Hashes the children of a directory by name and links them both ways. The
+ * table is built on the first change to the directory, or the first batched
+ * lookup in it, and kept up to date by every create and delete after that.
+ * It is built aside and published with one store, so a reader holding the
+ * read lock sees either no table or a complete one.
+ *
+ * @return 0 if the table is ready, -1 if memory ran out.
+ */
+static int fat_driver_name_table_build(FileNode* directory) {
+    FatSlotIndex* index = directory->slot_index;
+    if (FAT_LOAD_LINK(index->names)) return 0;
+
+    FatSlotIndex table;
+    memset(&table, 0, sizeof(table));
+    uint32_t count = 0;
+    for (FileNode* child = FAT_LOAD_LINK(directory->children); child; child = FAT_LOAD_LINK(child->next)) {
+        count++;
+    }
+    if (fat_driver_name_table_grow(&table, count) != 0) return -1;
+
+    FileNode* previous = NULL;
+    for (FileNode* child = FAT_LOAD_LINK(directory->children); child; child = FAT_LOAD_LINK(child->next)) {
+        child->prev = previous;
+        previous = child;
+        fat_driver_name_table_insert(&table, child);
+    }
+
+    index->name_capacity = table.name_capacity;
+    index->name_count = table.name_count;
+    FAT_PUBLISH_LINK(index->names, table.names);
+    return 0;
+}
+
+/**
+ * Gives a directory its name table for a lookup that holds only the read
+ * lock. Readers building tables are serialized by name_lock; writers change
+ * a table only under the write lock, when no such reader runs. A directory
+ * of a read-only mount gets a free-slot index that holds just the names.
+ *
+ * @param driver Pointer to the FATDriver structure.
+ * @param directory Directory to look into.
+ * @return The index holding the table, NULL if memory ran out or the
+ *         directory has no index to hold it.
+ */
+const FatSlotIndex* fat_driver_slot_index_share_names(FATDriver* driver, FileNode* directory) {
+    FatSlotIndex* index = FAT_LOAD_LINK(directory->slot_index);
+    if (index && FAT_LOAD_LINK(index->names)) return index;
+
+    pthread_mutex_lock(&driver->name_lock);
+    index = directory->slot_index;
+    if (!index && driver->config.mode != MODE_READ_WRITE) {
+        index = fat_driver_slot_index_create();
+        if (index) FAT_PUBLISH_LINK(directory->slot_index, index);
+    }
+    if (index && fat_driver_name_table_build(directory) != 0) index = NULL;
+    pthread_mutex_unlock(&driver->name_lock);
+
+    return index;
+}
+
+/**
+ * Makes room for count names at a load of at most 3/4, rehashing the table
+ * if it has to grow.
+ */
+static int fat_driver_name_table_grow(FatSlotIndex* index, uint32_t count) {
+    uint32_t capacity = index->name_capacity ? index->name_capacity : 16;
+    while ((uint64_t)count * 4 > (uint64_t)capacity * 3) capacity *= 2;
+    if (index->names && capacity == index->name_capacity) return 0;
+
+    FileNode** names = calloc(capacity, sizeof(FileNode*));
+    if (!names) return -1;
+
+    FileNode** old_names = index->names;
+    uint32_t old_capacity = index->name_capacity;
+    index->names = names;
+    index->name_capacity = capacity;
+    index->name_count = 0;
+    for (uint32_t i = 0; i < old_capacity; i++) {
+        if (old_names[i]) fat_driver_name_table_insert(index, old_names[i]);
+    }
+    free(old_names);
+    return 0;
+}
+
+/** Home position of a name in the table */
+static uint32_t fat_driver_name_table_home(const FatSlotIndex* index, const char* name, size_t length) {
+    uint64_t hash = fat_driver_hash_mix(fat_driver_hash_bytes(FAT_HASH_SEED, name, length));
+    return (uint32_t)hash & (index->name_capacity - 1);
+}
+
+/**
+ * Finds a child by name in the name table of a directory. Called with the
+ * driver lock held, the table changes under the write lock.
+ *
+ * @param index Free-slot index of the directory.
+ * @param name Name as the tree stores it, not necessarily terminated.
+ * @param length Length of the name.
+ * @return The child, NULL if there is none or the directory has no name table yet.
+ */
+FileNode* fat_driver_slot_index_find_name(const FatSlotIndex* index, const char* name, size_t length) {
+    FileNode* const* names = index ? FAT_LOAD_LINK(index->names) : NULL;
+    if (!names) return NULL;
+
+    uint32_t mask = index->name_capacity - 1;
+    for (uint32_t i = fat_driver_name_table_home(index, name, length); names[i]; i = (i + 1) & mask) {
+        const char* candidate = names[i]->name;
+        if (strncmp(candidate, name, length) == 0 && candidate[length] == '\0') return names[i];
+    }
+    return NULL;
+}
+
+/** Adds a child, the table must have room for it */
+static void fat_driver_name_table_insert(FatSlotIndex* index, FileNode* node) {
+    uint32_t mask = index->name_capacity - 1;
+    uint32_t i = fat_driver_name_table_home(index, node->name, strlen(node->name));
+    while (index->names[i]) i = (i + 1) & mask;
+    index->names[i] = node;
+    index->name_count++;
+}
+
+/**
+ * Removes a child. The entries after it in the same probe sequence move back
+ * into the gap, so lookups never stop early and no tombstones build up.
+ */
+static void fat_driver_name_table_remove(FatSlotIndex* index, FileNode* node) {
+    uint32_t mask = index->name_capacity - 1;
+    uint32_t gap = fat_driver_name_table_home(index, node->name, strlen(node->name));
+    while (index->names[gap] && index->names[gap] != node) gap = (gap + 1) & mask;
+    if (!index->names[gap]) return;
+
+    index->names[gap] = NULL;
+    index->name_count--;
+    for (uint32_t i = (gap + 1) & mask; index->names[i]; i = (i + 1) & mask) {
+        const char* name = index->names[i]->name;
+        uint32_t home = fat_driver_name_table_home(index, name, strlen(name));
+        /* Move it back unless its home lies cyclically in (gap, i] */
+        if (((i - home) & mask) >= ((i - gap) & mask)) {
+            index->names[gap] = index->names[i];
+            index->names[i] = NULL;
+            gap = i;
+        }
+    }
+}
+
+/**
+ * Finds the sector and byte offset of a slot.
+ */
+static int fat_driver_slot_location(FATDriver* driver, const FatSlotIndex* index, uint32_t slot,
+                                    uint32_t* sector, uint32_t* offset) {
+    if (slot >= index->slot_count) return -1;
+
+    uint32_t slots_per_sector = hal_get_sector_size(driver->hal) / 32;
+
+    if (index->clusters) {
+        uint32_t slots_per_cluster = driver->boot_sector.sectors_per_cluster * slots_per_sector;
+        uint32_t cluster = index->clusters[slot / slots_per_cluster];
+        *sector = fat_driver_cluster_to_sector(driver, cluster) + (slot % slots_per_cluster) / slots_per_sector;
+    } else {
+        /* FAT12/16 root directory region */
+        *sector = driver->first_root_dir_sector + slot / slots_per_sector;
+    }
+    *offset = (slot % slots_per_sector) * 32;
+
+    return 0;
+}
+
+/**
+ * Writes the first length bytes of a slot through the block cache.
+ */
+static int fat_driver_write_slot(FATDriver* driver, const FatSlotIndex* index, uint32_t slot,
+                                 const void* data, uint32_t length) {
+    uint32_t sector, offset;
+    if (fat_driver_slot_location(driver, index, slot, &sector, &offset) != 0) return -1;
+    return block_cache_write_bytes(driver->cache, driver->hal, sector, offset, data, length);
+}
+
+/**
+ * Keeps the end-of-directory marker valid for slots about to be used.
+ *
+ * Readers stop at the first 0x00 entry, so end-region slots in front of the
+ * new entry are turned into deleted entries and the slot after it becomes the
+ * new end marker.
+ */
+static int fat_driver_claim_slots(FATDriver* driver, FatSlotIndex* index, uint32_t start, uint32_t count) {
+    if (start + count <= index->end_slot) return 0;
+
+    uint8_t marker = 0xE5;
+    for (uint32_t slot = index->end_slot; slot < start; slot++) {
+        if (fat_driver_write_slot(driver, index, slot, &marker, 1) != 0) return -1;
+    }
+
+    index->end_slot = start + count;
+    if (index->end_slot < index->slot_count) {
+        marker = 0x00;
+        if (fat_driver_write_slot(driver, index, index->end_slot, &marker, 1) != 0) return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Grows a directory by one zeroed cluster and adds its slots to the index.
+ */
+static int fat_driver_extend_directory(FATDriver* driver, FileNode* directory) {
+    FatSlotIndex* index = directory->slot_index;
+    if (!index->clusters || index->cluster_count == 0) return -1; /* Fixed FAT12/16 root */
+
+    uint32_t sector_size = hal_get_sector_size(driver->hal);
+    uint32_t slots = driver->boot_sector.sectors_per_cluster * (sector_size / 32);
+    uint32_t last_cluster = index->clusters[index->cluster_count - 1];
+    uint32_t cluster;
+
+    if (fat_driver_slot_index_reserve(index, index->slot_count + slots) != 0) return -1;
+    if (fat_driver_allocate_clusters_unlocked(driver, 1, last_cluster, &cluster) != 0) return -1;
+
+    uint8_t* zero = calloc(1, sector_size);
+    if (!zero) return -1;
+
+    uint32_t first_sector = fat_driver_cluster_to_sector(driver, cluster);
+    int result = 0;
+    for (uint32_t i = 0; i < driver->boot_sector.sectors_per_cluster && result == 0; i++) {
+        result = block_cache_write_bytes(driver->cache, driver->hal, first_sector + i, 0, zero, sector_size);
+    }
+    free(zero);
+
+    if (result != 0 || fat_driver_slot_index_add_cluster(index, cluster) != 0) {
+        fat_driver_set_fat_entry(driver, last_cluster, fat_driver_end_of_chain(driver));
+        fat_driver_free_chain_unlocked(driver, cluster);
+        return -1;
+    }
+
+    uint32_t first_slot = index->slot_count;
+    for (uint32_t slot = first_slot; slot < first_slot + slots; slot++) {
+        index->run_length[slot] = 0;
+        index->run_start[slot] = 0;
+    }
+    index->slot_count += slots;
+    fat_driver_slot_index_release(index, first_slot, slots);
+
+    return 0;
+}
+
+/**
+ * Converts a name to the 11-byte 8.3 form.
+ *
+ * @return 0 if the name is a valid 8.3 name, -1 otherwise.
+ */
+int fat_driver_make_short_name(const char* name, uint8_t short_name[11]) {
+    static const char* invalid = "\"*+,/:;<=>?[\\]|. ";
+
+    memset(short_name, ' ', 11);
+
+    const char* dot = strrchr(name, '.');
+    size_t base_len = dot ? (size_t)(dot - name) : strlen(name);
+    size_t ext_len = dot ? strlen(dot + 1) : 0;
+
+    if (base_len == 0 || base_len > 8 || ext_len > 3 || (dot && ext_len == 0)) return -1;
+
+    for (size_t i = 0; i < base_len + (dot ? ext_len + 1 : 0); i++) {
+        unsigned char c = (unsigned char)name[i];
+        if (i == base_len) continue; /* The dot */
+        if (c < 0x20 || c >= 0x7F || strchr(invalid, c)) return -1;
+        if (c >= 'a' && c <= 'z') c = (unsigned char)(c - 'a' + 'A');
+
+        if (i < base_len) {
+            short_name[i] = c;
+        } else {
+            short_name[8 + i - base_len - 1] = c;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Encodes a time in the FAT date and time format.
+ */
+void fat_driver_encode_time(time_t now, uint16_t* date, uint16_t* time_value) {
+    struct tm* local = localtime(&now);
+
+    if (!local || local->tm_year < 80) {
+        *date = (1 << 5) | 1; /* 1980-01-01 */
+        *time_value = 0;
+        return;
+    }
+
+    *date = (uint16_t)(((local->tm_year - 80) << 9) | ((local->tm_mon + 1) << 5) | local->tm_mday);
+    *time_value = (uint16_t)((local->tm_hour << 11) | (local->tm_min << 5) | (local->tm_sec / 2));
+}
+
+/**
+ * Zeroes a new directory cluster and writes its "." and ".." entries.
+ */
+static int fat_driver_init_directory_cluster(FATDriver* driver, uint32_t cluster, uint32_t parent_cluster,
+                                             const FATDirEntry* template_entry) {
+    uint32_t sector_size = hal_get_sector_size(driver->hal);
+    uint32_t first_sector = fat_driver_cluster_to_sector(driver, cluster);
+    uint8_t* buffer = calloc(1, sector_size);
+    if (!buffer) return -1;
+
+    FATDirEntry* dot = (FATDirEntry*)buffer;
+    FATDirEntry* dot_dot = (FATDirEntry*)(buffer + 32);
+
+    *dot = *template_entry;
+    memset(dot->name, ' ', sizeof(dot->name));
+    memset(dot->ext, ' ', sizeof(dot->ext));
+    dot->name[0] = '.';
+    dot->first_cluster_high = (uint16_t)(cluster >> 16);
+    dot->first_cluster_low = (uint16_t)(cluster & 0xFFFF);
+
+    *dot_dot = *dot;
+    dot_dot->name[1] = '.';
+    dot_dot->first_cluster_high = (uint16_t)(parent_cluster >> 16);
+    dot_dot->first_cluster_low = (uint16_t)(parent_cluster & 0xFFFF);
+
+    int result = 0;
+    for (uint32_t i = 0; i < driver->boot_sector.sectors_per_cluster && result == 0; i++) {
+        result = block_cache_write_bytes(driver->cache, driver->hal, first_sector + i, 0, buffer, sector_size);
+        if (i == 0) memset(buffer, 0, 64);
+    }
+
+    free(buffer);
+    return result;
+}
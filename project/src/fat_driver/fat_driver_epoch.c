@@ -0,0 +1,165 @@
+/**
+ * @file fat_driver_epoch.c
+ * @brief Lock-free path lookups with epoch-based reclamation
+ * @details Path lookups do not take the driver lock. A reader announces the
+ *          current epoch in a reader slot for the length of its read
+ *          section; writers, still serialized by the write lock, never change
+ *          a link a reader may be following in a way that exposes an
+ *          unfinished node. New nodes and new child lists are built
+ *          privately and published with a single release store. Unlinked
+ *          nodes are not freed at once: they are retired with the epoch they
+ *          were unlinked in and freed once every announced reader started in
+ *          a later epoch, because such a reader can no longer reach them.
+ *
+ *          When all slots are taken a reader falls back to the shared lock,
+ *          so it is still safe, only no longer wait-free.
+ * @date 2026-10-18
+ * @author Le Duc Son
+ */
+#include "fat_driver.h"
+#include "fat_driver_private.h"
+#include <sched.h>
+#include <stdlib.h>
+
+/* Local functions */
+static uint64_t fat_driver_oldest_reader(FATDriver* driver);
+static void fat_driver_free_retired_node(FileNode* node, bool whole_subtree);
+
+/**
+ * Enters a read section.
+ *
+ * The search for a free slot starts at a slot picked by thread, so threads
+ * that read often keep to different cache lines.
+ *
+ * @param driver Pointer to the FATDriver structure.
+ * @return Index of the slot taken, -1 if the shared lock was taken instead.
+ */
+int fat_driver_read_begin(FATDriver* driver) {
+    static _Thread_local uint8_t thread_tag;
+    uint32_t start = (uint32_t)(((uintptr_t)&thread_tag >> 6) % FAT_READER_SLOTS);
+
+    for (uint32_t i = 0; i < FAT_READER_SLOTS; i++) {
+        uint32_t index = (start + i) % FAT_READER_SLOTS;
+        uint_fast64_t expected = 0;
+        uint_fast64_t epoch = atomic_load(&driver->epoch);
+
+        if (atomic_compare_exchange_strong(&driver->reader_slots[index].epoch, &expected, epoch)) {
+            /* The slot must be visible before the first link is loaded */
+            atomic_thread_fence(memory_order_seq_cst);
+            return (int)index;
+        }
+    }
+
+    pthread_rwlock_rdlock(&driver->lock);
+    return -1;
+}
+
+/**
+ * Leaves a read section.
+ *
+ * @param driver Pointer to the FATDriver structure.
+ * @param token Value returned by fat_driver_read_begin().
+ */
+void fat_driver_read_end(FATDriver* driver, int token) {
+    if (token < 0) {
+        pthread_rwlock_unlock(&driver->lock);
+        return;
+    }
+
+    atomic_store_explicit(&driver->reader_slots[token].epoch, 0, memory_order_release);
+}
+
+/**
+ * Retires a node that was just unlinked from the tree. Called with the write
+ * lock held, after every link to the node has been replaced.
+ *
+ * @param driver Pointer to the FATDriver structure.
+ * @param node Unlinked node.
+ * @param whole_subtree Free the node's children with it. A node whose
+ *        children moved to a new version is retired alone.
+ */
+void fat_driver_retire_node(FATDriver* driver, FileNode* node, bool whole_subtree) {
+    uint64_t epoch = atomic_fetch_add(&driver->epoch, 1);
+
+    FatRetiredNode* retired = malloc(sizeof(FatRetiredNode));
+    if (!retired) {
+        /* Nowhere to queue it, wait out the readers that may still see it */
+        atomic_thread_fence(memory_order_seq_cst);
+        while (fat_driver_oldest_reader(driver) <= epoch) {
+            sched_yield();
+        }
+        fat_driver_free_retired_node(node, whole_subtree);
+        return;
+    }
+
+    retired->node = node;
+    retired->whole_subtree = whole_subtree;
+    retired->epoch = epoch;
+    retired->next = driver->retired;
+    driver->retired = retired;
+}
+
+/**
+ * Frees the retired nodes no reader can reach any more. Called with the write
+ * lock held.
+ *
+ * @param driver Pointer to the FATDriver structure.
+ */
+void fat_driver_reclaim(FATDriver* driver) {
+    /* The unlinking stores must be ordered before the slots are read */
+    atomic_thread_fence(memory_order_seq_cst);
+    uint64_t oldest = fat_driver_oldest_reader(driver);
+
+    FatRetiredNode** link = &driver->retired;
+    while (*link) {
+        FatRetiredNode* retired = *link;
+        if (retired->epoch < oldest) {
+            *link = retired->next;
+            fat_driver_free_retired_node(retired->node, retired->whole_subtree);
+            free(retired);
+        } else {
+            link = &retired->next;
+        }
+    }
+}
+
+/**
+ * Frees every retired node. Called at unmount, when no reader is left.
+ *
+ * @param driver Pointer to the FATDriver structure.
+ */
+void fat_driver_free_retired(FATDriver* driver) {
+    while (driver->retired) {
+        FatRetiredNode* retired = driver->retired;
+        driver->retired = retired->next;
+        fat_driver_free_retired_node(retired->node, retired->whole_subtree);
+        free(retired);
+    }
+}
+
+/**
+ * Smallest epoch announced by a reader, UINT64_MAX if no reader is inside a
+ * read section.
+ */
+static uint64_t fat_driver_oldest_reader(FATDriver* driver) {
+    uint64_t oldest = UINT64_MAX;
+
+    for (uint32_t i = 0; i < FAT_READER_SLOTS; i++) {
+        uint64_t epoch = atomic_load(&driver->reader_slots[i].epoch);
+        if (epoch != 0 && epoch < oldest) oldest = epoch;
+    }
+
+    return oldest;
+}
+
+/**
+ * Frees a retired node, with its subtree or alone.
+ */
+static void fat_driver_free_retired_node(FileNode* node, bool whole_subtree) {
+    if (whole_subtree) {
+        fat_driver_free_file_node(node);
+    } else {
+        fat_driver_sort_free(node->sort_cache);
+        if (!node->in_arena) free(node);
+    }
+}
@@ -0,0 +1,385 @@
+/**
+ * @file fat_driver_format.c
+ * @brief Creation of empty FAT12/16/32 images
+ * @details The geometry follows the rules fat_driver_mount() applies when it
+ *          reads an image back: the FAT type comes from the number of data
+ *          clusters alone, so the FAT size is solved for the cluster count it
+ *          must describe, and the result is rejected when that count falls
+ *          outside the range of the requested type. The reserved area is
+ *          padded so the data area starts on a cluster boundary.
+ *
+ *          A new volume is almost entirely zeroes: the FATs past their first
+ *          entries, the root directory and the whole data area. The image
+ *          file is created as one hole of the full size and only the sectors
+ *          holding something else are written, which takes the same few
+ *          writes for a floppy as for a volume of several gigabytes.
+ * @date 2026-10-18
+ * @author Le Duc Son
+ */
+#include "fat_driver.h"
+#include "fat_driver_private.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Sector size of formatted images, the one fat_driver_init() opens images with
+ */
+#define FAT_FORMAT_SECTOR_SIZE 512
+
+/**
+ * Largest cluster size accepted
+ */
+#define FAT_FORMAT_MAX_CLUSTER (32 * 1024)
+
+/**
+ * Number of FAT copies
+ */
+#define FAT_FORMAT_FATS 2
+
+/**
+ * Root directory entries of a FAT12/16 volume
+ */
+#define FAT_FORMAT_ROOT_ENTRIES 512
+
+/**
+ * Reserved sectors of a FAT32 volume, before padding
+ */
+#define FAT_FORMAT_FAT32_RESERVED 32
+
+/**
+ * FSInfo sector and backup boot sector of a FAT32 volume
+ */
+#define FAT_FORMAT_FS_INFO 1
+#define FAT_FORMAT_BACKUP_BOOT 6
+
+/**
+ * Largest number of data clusters of a FAT32 volume
+ */
+#define FAT_FORMAT_FAT32_MAX_CLUSTERS 0x0FFFFFF4
+
+/**
+ * Media descriptor of a fixed disk
+ */
+#define FAT_FORMAT_MEDIA 0xF8
+
+/**
+ * Layout of a volume
+ */
+typedef struct {
+    FatType type;                   /**< FAT type */
+    uint32_t total_sectors;         /**< Sectors of the volume */
+    uint32_t sectors_per_cluster;   /**< Sectors per cluster */
+    uint32_t reserved_sectors;      /**< Sectors before the first FAT */
+    uint32_t root_entries;          /**< Root directory entries, 0 on FAT32 */
+    uint32_t root_sectors;          /**< Sectors of the root directory region */
+    uint32_t fat_sectors;           /**< Sectors of each FAT */
+    uint32_t clusters;              /**< Data clusters */
+} FatFormatGeometry;
+
+/* Local functions */
+static FatType fat_driver_format_default_type(uint64_t size);
+static uint32_t fat_driver_format_default_cluster(FatType type, uint64_t size);
+static int fat_driver_format_choose(FatType type, uint32_t total_sectors, uint32_t cluster_size, uint64_t size,
+                                    FatFormatGeometry* geometry);
+static int fat_driver_format_geometry(FatType type, uint32_t total_sectors, uint32_t sectors_per_cluster,
+                                      FatFormatGeometry* geometry);
+static void fat_driver_format_put16(uint8_t* buffer, uint32_t offset, uint16_t value);
+static void fat_driver_format_put32(uint8_t* buffer, uint32_t offset, uint32_t value);
+static void fat_driver_format_boot_sector(const FatFormatGeometry* geometry, uint32_t volume_id, uint8_t* sector);
+static void fat_driver_format_fs_info(const FatFormatGeometry* geometry, uint8_t* sector);
+static void fat_driver_format_fat_head(const FatFormatGeometry* geometry, uint8_t* sector);
+
+/**
+ * Creates an image file holding an empty FAT volume.
+ *
+ * Without a type, images up to 16 MiB get FAT12, up to 512 MiB FAT16 and
+ * larger ones FAT32. Without a cluster size, the usual size for the type and
+ * volume size is tried first, then larger and smaller ones until the cluster
+ * count fits the type.
+ *
+ * @param img_path Path of the image file to create.
+ * @param options Size, FAT type and cluster size.
+ * @param report Pointer to store the geometry chosen, may be NULL.
+ * @return 0 if successful, -1 if failed.
+ */
+int fat_driver_format(const char* img_path, const FatFormatOptions* options, FatFormatReport* report) {
+    if (!img_path || !options) return -1;
+    if (report) memset(report, 0, sizeof(FatFormatReport));
+
+    uint64_t total_sectors = options->size / FAT_FORMAT_SECTOR_SIZE;
+    if (total_sectors == 0 || total_sectors > UINT32_MAX) return -1;
+
+    FatType type = options->fat_type;
+    if (type == FAT_TYPE_UNKNOWN) type = fat_driver_format_default_type(options->size);
+    if (type != FAT_TYPE_12 && type != FAT_TYPE_16 && type != FAT_TYPE_32) return -1;
+
+    FatFormatGeometry geometry;
+    if (fat_driver_format_choose(type, (uint32_t)total_sectors, options->cluster_size, options->size,
+                                 &geometry) != 0) {
+        return -1;
+    }
+
+    /* Reserved sectors up to the backup FSInfo on FAT32, the boot sector alone otherwise */
+    uint32_t head_sectors = (type == FAT_TYPE_32) ? FAT_FORMAT_BACKUP_BOOT + 2 : 1;
+    uint8_t* head = calloc(head_sectors, FAT_FORMAT_SECTOR_SIZE);
+    uint8_t* fat_head = calloc(1, FAT_FORMAT_SECTOR_SIZE);
+    if (!head || !fat_head) {
+        free(head);
+        free(fat_head);
+        return -1;
+    }
+
+    uint32_t volume_id = (uint32_t)time(NULL);
+    fat_driver_format_boot_sector(&geometry, volume_id, head);
+    if (type == FAT_TYPE_32) {
+        fat_driver_format_fs_info(&geometry, head + FAT_FORMAT_FS_INFO * FAT_FORMAT_SECTOR_SIZE);
+        memcpy(head + FAT_FORMAT_BACKUP_BOOT * FAT_FORMAT_SECTOR_SIZE, head, 2 * FAT_FORMAT_SECTOR_SIZE);
+    }
+    fat_driver_format_fat_head(&geometry, fat_head);
+
+    HAL hal;
+    uint64_t image_size = (uint64_t)geometry.total_sectors * FAT_FORMAT_SECTOR_SIZE;
+    if (hal_create(&hal, img_path, SECTOR_SIZE_512, image_size) != 0) {
+        free(head);
+        free(fat_head);
+        return -1;
+    }
+
+    /* Everything else reads back as zeroes from the hole */
+    int result = 0;
+    uint32_t written = 0;
+    if (hal_write_sectors(&hal, 0, head_sectors, head) != (int)(head_sectors * FAT_FORMAT_SECTOR_SIZE)) {
+        result = -1;
+    } else {
+        written += head_sectors;
+    }
+    for (uint32_t i = 0; i < FAT_FORMAT_FATS && result == 0; i++) {
+        uint32_t sector = geometry.reserved_sectors + i * geometry.fat_sectors;
+        if (hal_write_sector(&hal, sector, fat_head) != FAT_FORMAT_SECTOR_SIZE) {
+            result = -1;
+        } else {
+            written++;
+        }
+    }
+    hal_deinit(&hal);
+
+    free(head);
+    free(fat_head);
+
+    if (result == 0 && report) {
+        report->fat_type = type;
+        report->cluster_size = geometry.sectors_per_cluster * FAT_FORMAT_SECTOR_SIZE;
+        report->total_clusters = geometry.clusters;
+        report->fat_sectors = geometry.fat_sectors;
+        report->first_data_sector = geometry.reserved_sectors + FAT_FORMAT_FATS * geometry.fat_sectors +
+                                    geometry.root_sectors;
+        report->sectors_written = written;
+    }
+    return result;
+}
+
+/**
+ * FAT type used when none is requested.
+ */
+static FatType fat_driver_format_default_type(uint64_t size) {
+    if (size <= 16ULL * 1024 * 1024) return FAT_TYPE_12;
+    if (size <= 512ULL * 1024 * 1024) return FAT_TYPE_16;
+    return FAT_TYPE_32;
+}
+
+/**
+ * Cluster size tried first when none is requested.
+ */
+static uint32_t fat_driver_format_default_cluster(FatType type, uint64_t size) {
+    if (type == FAT_TYPE_12) return 512;
+    if (type == FAT_TYPE_16) return 2048;
+
+    if (size <= 8ULL * 1024 * 1024 * 1024) return 4096;
+    if (size <= 16ULL * 1024 * 1024 * 1024) return 8192;
+    if (size <= 32ULL * 1024 * 1024 * 1024) return 16384;
+    return 32768;
+}
+
+/**
+ * Picks the geometry: the requested cluster size only, or else the default
+ * one, then the larger ones, then the smaller ones.
+ */
+static int fat_driver_format_choose(FatType type, uint32_t total_sectors, uint32_t cluster_size, uint64_t size,
+                                    FatFormatGeometry* geometry) {
+    if (cluster_size != 0) {
+        bool power_of_two = (cluster_size & (cluster_size - 1)) == 0;
+        if (!power_of_two || cluster_size < FAT_FORMAT_SECTOR_SIZE || cluster_size > FAT_FORMAT_MAX_CLUSTER) {
+            return -1;
+        }
+        return fat_driver_format_geometry(type, total_sectors, cluster_size / FAT_FORMAT_SECTOR_SIZE, geometry);
+    }
+
+    uint32_t preferred = fat_driver_format_default_cluster(type, size);
+    for (uint32_t candidate = preferred; candidate <= FAT_FORMAT_MAX_CLUSTER; candidate *= 2) {
+        if (fat_driver_format_geometry(type, total_sectors, candidate / FAT_FORMAT_SECTOR_SIZE, geometry) == 0) {
+            return 0;
+        }
+    }
+    for (uint32_t candidate = preferred / 2; candidate >= FAT_FORMAT_SECTOR_SIZE; candidate /= 2) {
+        if (fat_driver_format_geometry(type, total_sectors, candidate / FAT_FORMAT_SECTOR_SIZE, geometry) == 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Solves the layout for a type and cluster size.
+ *
+ * The FAT size is grown until it covers the clusters left beside it; each
+ * step leaves fewer clusters, so the loop ends. Padding the reserved area to
+ * align the data area can only remove clusters, so the FATs stay large
+ * enough.
+ *
+ * @return 0 if the cluster count fits the type, -1 otherwise.
+ */
+static int fat_driver_format_geometry(FatType type, uint32_t total_sectors, uint32_t sectors_per_cluster,
+                                      FatFormatGeometry* geometry) {
+    memset(geometry, 0, sizeof(FatFormatGeometry));
+    geometry->type = type;
+    geometry->total_sectors = total_sectors;
+    geometry->sectors_per_cluster = sectors_per_cluster;
+    geometry->reserved_sectors = (type == FAT_TYPE_32) ? FAT_FORMAT_FAT32_RESERVED : 1;
+    geometry->root_entries = (type == FAT_TYPE_32) ? 0 : FAT_FORMAT_ROOT_ENTRIES;
+    geometry->root_sectors = geometry->root_entries * sizeof(FATDirEntry) / FAT_FORMAT_SECTOR_SIZE;
+
+    uint64_t fat_sectors = 0;
+    uint64_t clusters = 0;
+    for (;;) {
+        uint64_t metadata = geometry->reserved_sectors + FAT_FORMAT_FATS * fat_sectors + geometry->root_sectors;
+        if (metadata >= total_sectors) return -1;
+        clusters = (total_sectors - metadata) / sectors_per_cluster;
+
+        /* Two reserved entries come before the first data cluster */
+        uint64_t entries = clusters + 2;
+        uint64_t bytes = (type == FAT_TYPE_12) ? (entries * 3 + 1) / 2 :
+                         (type == FAT_TYPE_16) ? entries * 2 : entries * 4;
+        uint64_t needed = (bytes + FAT_FORMAT_SECTOR_SIZE - 1) / FAT_FORMAT_SECTOR_SIZE;
+        if (needed <= fat_sectors) break;
+        fat_sectors = needed;
+    }
+
+    uint64_t metadata = geometry->reserved_sectors + FAT_FORMAT_FATS * fat_sectors + geometry->root_sectors;
+    uint32_t padding = (uint32_t)((sectors_per_cluster - metadata % sectors_per_cluster) % sectors_per_cluster);
+    if (metadata + padding >= total_sectors) return -1;
+    geometry->reserved_sectors += padding;
+    clusters = (total_sectors - metadata - padding) / sectors_per_cluster;
+
+    /* The type fat_driver_mount() will derive from the cluster count */
+    bool fits;
+    if (type == FAT_TYPE_12) {
+        fits = clusters >= 1 && clusters < 4085;
+    } else if (type == FAT_TYPE_16) {
+        fits = clusters >= 4085 && clusters < 65525 && fat_sectors <= UINT16_MAX;
+    } else {
+        fits = clusters >= 65525 && clusters <= FAT_FORMAT_FAT32_MAX_CLUSTERS;
+    }
+    if (!fits) return -1;
+
+    geometry->fat_sectors = (uint32_t)fat_sectors;
+    geometry->clusters = (uint32_t)clusters;
+    return 0;
+}
+
+/**
+ * Stores a little-endian 16-bit value.
+ */
+static void fat_driver_format_put16(uint8_t* buffer, uint32_t offset, uint16_t value) {
+    buffer[offset] = (uint8_t)value;
+    buffer[offset + 1] = (uint8_t)(value >> 8);
+}
+
+/**
+ * Stores a little-endian 32-bit value.
+ */
+static void fat_driver_format_put32(uint8_t* buffer, uint32_t offset, uint32_t value) {
+    fat_driver_format_put16(buffer, offset, (uint16_t)value);
+    fat_driver_format_put16(buffer, offset + 2, (uint16_t)(value >> 16));
+}
+
+/**
+ * Builds the boot sector. The extended fields sit at offset 36 on FAT12/16
+ * and at offset 64, after the FAT32 fields, on FAT32.
+ */
+static void fat_driver_format_boot_sector(const FatFormatGeometry* geometry, uint32_t volume_id, uint8_t* sector) {
+    bool fat32 = (geometry->type == FAT_TYPE_32);
+
+    sector[0] = 0xEB;
+    sector[1] = fat32 ? 0x58 : 0x3C;
+    sector[2] = 0x90;
+    memcpy(sector + 3, "MSWIN4.1", 8);
+
+    fat_driver_format_put16(sector, 11, FAT_FORMAT_SECTOR_SIZE);
+    sector[13] = (uint8_t)geometry->sectors_per_cluster;
+    fat_driver_format_put16(sector, 14, (uint16_t)geometry->reserved_sectors);
+    sector[16] = FAT_FORMAT_FATS;
+    fat_driver_format_put16(sector, 17, (uint16_t)geometry->root_entries);
+    if (!fat32 && geometry->total_sectors <= UINT16_MAX) {
+        fat_driver_format_put16(sector, 19, (uint16_t)geometry->total_sectors);
+    } else {
+        fat_driver_format_put32(sector, 32, geometry->total_sectors);
+    }
+    sector[21] = FAT_FORMAT_MEDIA;
+    fat_driver_format_put16(sector, 24, 32);
+    fat_driver_format_put16(sector, 26, 64);
+
+    uint32_t extended = 36;
+    const char* fs_type = (geometry->type == FAT_TYPE_12) ? "FAT12   " : "FAT16   ";
+    if (fat32) {
+        fat_driver_format_put32(sector, 36, geometry->fat_sectors);
+        fat_driver_format_put32(sector, 44, 2);
+        fat_driver_format_put16(sector, 48, FAT_FORMAT_FS_INFO);
+        fat_driver_format_put16(sector, 50, FAT_FORMAT_BACKUP_BOOT);
+        extended = 64;
+        fs_type = "FAT32   ";
+    } else {
+        fat_driver_format_put16(sector, 22, (uint16_t)geometry->fat_sectors);
+    }
+
+    sector[extended] = 0x80;
+    sector[extended + 2] = 0x29;
+    fat_driver_format_put32(sector, extended + 3, volume_id);
+    memcpy(sector + extended + 7, "NO NAME    ", 11);
+    memcpy(sector + extended + 18, fs_type, 8);
+
+    sector[510] = 0x55;
+    sector[511] = 0xAA;
+}
+
+/**
+ * Builds the FSInfo sector of a FAT32 volume. The root directory already
+ * holds cluster 2.
+ */
+static void fat_driver_format_fs_info(const FatFormatGeometry* geometry, uint8_t* sector) {
+    fat_driver_format_put32(sector, 0, FSINFO_LEAD_SIGNATURE);
+    fat_driver_format_put32(sector, 484, FSINFO_STRUCT_SIGNATURE);
+    fat_driver_format_put32(sector, 488, geometry->clusters - 1);
+    fat_driver_format_put32(sector, 492, 3);
+    fat_driver_format_put32(sector, 508, FSINFO_TRAIL_SIGNATURE);
+}
+
+/**
+ * Builds the first sector of a FAT: the media descriptor in entry 0, an end
+ * of chain in entry 1 and, on FAT32, the one-cluster root directory chain.
+ */
+static void fat_driver_format_fat_head(const FatFormatGeometry* geometry, uint8_t* sector) {
+    if (geometry->type == FAT_TYPE_12) {
+        /* Entries 0 and 1 packed into three bytes: 0xFF8 and 0xFFF */
+        sector[0] = FAT_FORMAT_MEDIA;
+        sector[1] = 0xFF;
+        sector[2] = 0xFF;
+    } else if (geometry->type == FAT_TYPE_16) {
+        fat_driver_format_put16(sector, 0, 0xFF00 | FAT_FORMAT_MEDIA);
+        fat_driver_format_put16(sector, 2, 0xFFFF);
+    } else {
+        fat_driver_format_put32(sector, 0, 0x0FFFFF00 | FAT_FORMAT_MEDIA);
+        fat_driver_format_put32(sector, 4, 0x0FFFFFFF);
+        fat_driver_format_put32(sector, 8, 0x0FFFFFFF);
+    }
+}
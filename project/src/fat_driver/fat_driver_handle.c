@@ -0,0 +1,210 @@
+/**
+ * @file fat_driver_handle.c
+ * @brief Locking of a shared mount and per-handle working directories
+ * @details A mounted FATDriver may be used by several threads. Calls that
+ *          change the tree, the FAT or the free count take the driver's
+ *          reader-writer lock exclusively; calls that only read take it
+ *          shared, on read-only mounts too: fat_driver_refresh() rebuilds
+ *          the run index and the tree there under the exclusive lock.
+ *
+ *          Public entry points take the lock once and call internal
+ *          functions (named *_unlocked where a public twin exists) that
+ *          expect it to be held, so the lock is never taken twice. Path
+ *          lookups are the exception: they run in a read section of
+ *          fat_driver_epoch.c and do not lock at all.
+ *
+ *          Each thread opens its own FatHandle for relative paths. Open
+ *          handles are linked to the driver, so a deletion or a refresh that
+ *          removes a handle's working directory moves the handle out of it.
+ * @date 2026-10-18
+ * @author Le Duc Son
+ */
+#include "fat_driver.h"
+#include "fat_driver_private.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Local functions */
+static void fat_driver_leave_subtree(FileNode** directory, const FileNode* node, FileNode* replacement);
+
+/**
+ * Takes the driver lock for reading, on every mount.
+ *
+ * @param driver Pointer to the FATDriver structure.
+ */
+void fat_driver_read_lock(FATDriver* driver) {
+    pthread_rwlock_rdlock(&driver->lock);
+}
+
+/**
+ * Releases the lock taken by fat_driver_read_lock().
+ *
+ * @param driver Pointer to the FATDriver structure.
+ */
+void fat_driver_read_unlock(FATDriver* driver) {
+    pthread_rwlock_unlock(&driver->lock);
+}
+
+/**
+ * Takes the driver lock for writing, on every mount.
+ *
+ * @param driver Pointer to the FATDriver structure.
+ */
+void fat_driver_write_lock(FATDriver* driver) {
+    pthread_rwlock_wrlock(&driver->lock);
+}
+
+/**
+ * Releases the lock taken by fat_driver_write_lock().
+ *
+ * @param driver Pointer to the FATDriver structure.
+ */
+void fat_driver_write_unlock(FATDriver* driver) {
+    pthread_rwlock_unlock(&driver->lock);
+}
+
+/**
+ * Opens a handle on a mounted volume, starting in the root directory.
+ *
+ * @param driver Pointer to the FATDriver structure.
+ * @param handle Pointer to the handle to open.
+ * @return 0 if successful, -1 if failed.
+ */
+int fat_driver_open_handle(FATDriver* driver, FatHandle* handle) {
+    if (!driver || !handle || !driver->root_directory) return -1;
+
+    fat_driver_write_lock(driver);
+    handle->driver = driver;
+    handle->current_directory = driver->root_directory;
+    handle->next = driver->handles;
+    driver->handles = handle;
+    fat_driver_write_unlock(driver);
+
+    return 0;
+}
+
+/**
+ * Closes a handle opened by fat_driver_open_handle().
+ *
+ * @param handle Pointer to the handle.
+ */
+void fat_driver_close_handle(FatHandle* handle) {
+    if (!handle || !handle->driver) return;
+
+    FATDriver* driver = handle->driver;
+    fat_driver_write_lock(driver);
+    for (FatHandle** link = &driver->handles; *link; link = &(*link)->next) {
+        if (*link == handle) {
+            *link = handle->next;
+            break;
+        }
+    }
+    fat_driver_write_unlock(driver);
+
+    handle->driver = NULL;
+    handle->current_directory = NULL;
+    handle->next = NULL;
+}
+
+/**
+ * Finds a path, relative paths starting at the handle's working directory.
+ *
+ * @param handle Pointer to the handle.
+ * @param path Path to find.
+ * @return Pointer to the node if found, NULL if not found.
+ */
+FileNode* fat_driver_handle_find_path(FatHandle* handle, const char* path) {
+    if (!handle || !handle->driver || !path) return NULL;
+
+    FATDriver* driver = handle->driver;
+    int token = fat_driver_read_begin(driver);
+    FileNode* node = fat_driver_resolve_path(driver, FAT_LOAD_LINK(handle->current_directory), path);
+    fat_driver_read_end(driver, token);
+
+    return node;
+}
+
+/**
+ * Changes the working directory of a handle.
+ *
+ * @param handle Pointer to the handle.
+ * @param path Absolute path, or path relative to the current working directory.
+ * @return 0 if successful, -1 if the path is not a directory.
+ */
+int fat_driver_handle_change_directory(FatHandle* handle, const char* path) {
+    if (!handle || !handle->driver || !path) return -1;
+
+    FATDriver* driver = handle->driver;
+    int result = -1;
+
+    /* Exclusive, a deletion may be moving the handle at the same time */
+    fat_driver_write_lock(driver);
+    FileNode* node = fat_driver_resolve_path(driver, handle->current_directory, path);
+    if (node && node->type == FILE_TYPE_DIRECTORY) {
+        FAT_PUBLISH_LINK(handle->current_directory, node);
+        result = 0;
+    }
+    fat_driver_write_unlock(driver);
+
+    return result;
+}
+
+/**
+ * Gets the working directory of a handle.
+ *
+ * @param handle Pointer to the handle.
+ * @return Pointer to the directory, NULL if the handle is not open.
+ */
+FileNode* fat_driver_handle_get_directory(FatHandle* handle) {
+    if (!handle || !handle->driver) return NULL;
+
+    return FAT_LOAD_LINK(handle->current_directory);
+}
+
+/**
+ * Moves the driver's current directory and every handle's working directory
+ * out of a subtree that is about to be freed. Called with the write lock held.
+ *
+ * @param driver Pointer to the FATDriver structure.
+ * @param node Root of the subtree.
+ * @param replacement Directory to move to.
+ */
+void fat_driver_forget_subtree(FATDriver* driver, const FileNode* node, FileNode* replacement) {
+    fat_driver_leave_subtree(&driver->current_directory, node, replacement);
+
+    for (FatHandle* handle = driver->handles; handle; handle = handle->next) {
+        fat_driver_leave_subtree(&handle->current_directory, node, replacement);
+    }
+}
+
+/**
+ * Points the driver's current directory and every handle's working directory
+ * that is exactly node at a new version of it. Called with the write lock held.
+ *
+ * @param driver Pointer to the FATDriver structure.
+ * @param node Directory being replaced.
+ * @param replacement New version of the directory.
+ */
+void fat_driver_replace_directory(FATDriver* driver, const FileNode* node, FileNode* replacement) {
+    if (driver->current_directory == node) {
+        FAT_PUBLISH_LINK(driver->current_directory, replacement);
+    }
+
+    for (FatHandle* handle = driver->handles; handle; handle = handle->next) {
+        if (handle->current_directory == node) {
+            FAT_PUBLISH_LINK(handle->current_directory, replacement);
+        }
+    }
+}
+
+/**
+ * Replaces a directory pointer that is node or below it.
+ */
+static void fat_driver_leave_subtree(FileNode** directory, const FileNode* node, FileNode* replacement) {
+    for (const FileNode* p = *directory; p; p = p->parent) {
+        if (p == node) {
+            FAT_PUBLISH_LINK(*directory, replacement);
+            return;
+        }
+    }
+}
@@ -0,0 +1,771 @@
+/**
+ * @file fat_driver_import.c
+ * @brief Bulk import of a whole tree into a read-write mount
+ * @details The import is planned before anything is written. Every entry
+ *          gets its short name checked, duplicates are dropped, and the size
+ *          of each new directory is known from the number of its entries.
+ *          Clusters come from a bitmap of FAT #1: directories first, so their
+ *          clusters are packed together, then the files in the order given.
+ *          Each one takes the first free run that holds it whole, searching
+ *          forward from where the previous one ended, and is split over
+ *          several runs only when no run is large enough. On a volume with
+ *          one large free area the whole import is one run.
+ *
+ *          The data, directory clusters included, is then written in cluster
+ *          order through a large buffer, one write request per buffer or per
+ *          gap between runs. Only after that are the FAT chains set and the
+ *          top entries created in the destination, and everything is flushed
+ *          in one sync. An interruption before the sync leaves the volume as
+ *          it was.
+ * @date 2026-10-18
+ * @author Le Duc Son
+ */
+#include "fat_driver.h"
+#include "fat_driver_private.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Largest write request of the data stream
+ */
+#define FAT_IMPORT_BATCH_BYTES (4 * 1024 * 1024)
+
+/**
+ * Plan of one entry
+ */
+typedef struct {
+    uint8_t short_name[11];         /**< Name in the 8.3 form */
+    bool skipped;                   /**< Left out of the import */
+    uint32_t clusters;              /**< Clusters of the entry, 0 for an empty file */
+    uint32_t first_piece;           /**< Index of its first piece in the plan */
+    uint32_t piece_count;           /**< Number of pieces */
+    uint32_t children;              /**< Entries inside a directory */
+    uint32_t first_child;           /**< First entry inside a directory, UINT32_MAX for none */
+    uint32_t last_child;            /**< Last entry inside a directory */
+    uint32_t next_sibling;          /**< Next entry in the same directory, UINT32_MAX for none */
+} FatImportItem;
+
+/**
+ * Consecutive clusters of one entry
+ */
+typedef struct {
+    uint32_t start;                 /**< First cluster */
+    uint32_t length;                /**< Number of clusters */
+    uint32_t item;                  /**< Entry the clusters belong to */
+    uint32_t offset;                /**< Position of the first cluster in the entry, in clusters */
+} FatImportPiece;
+
+/**
+ * Sort key used to find duplicate names
+ */
+typedef struct {
+    uint32_t parent;                /**< Parent index */
+    uint32_t index;                 /**< Entry index */
+    uint8_t short_name[11];         /**< Name in the 8.3 form */
+} FatImportName;
+
+/**
+ * State shared by the planning and the writes
+ */
+typedef struct {
+    FATDriver* driver;
+    FileNode* destination;
+    FatImportEntry* entries;
+    uint32_t count;
+    FatImportItem* items;
+    FatImportPiece* pieces;         /**< Pieces in allocation order, those of an entry together */
+    uint32_t piece_count;
+    uint32_t piece_capacity;
+    uint64_t* used;                 /**< One bit per cluster, set when allocated */
+    uint32_t last_cluster;          /**< Highest cluster number of the volume */
+    uint32_t cursor;                /**< Where the next search for a free run starts */
+    uint32_t sector_size;
+    uint32_t cluster_size;
+    uint8_t* buffer;                /**< Data waiting to be written */
+    uint32_t batch_clusters;        /**< Capacity of buffer in clusters */
+    uint32_t batch_start;           /**< Cluster the buffer is written at */
+    uint32_t batch_filled;          /**< Clusters in the buffer */
+    uint8_t* directory;             /**< Content of the directory being written */
+    uint32_t directory_item;        /**< Entry whose content is in directory, UINT32_MAX for none */
+    FatImportRead read;
+    void* user_data;
+    FatImportReport* report;
+    FileNode** created;             /**< Node made for each top entry, NULL for none */
+} FatImportContext;
+
+/* Local functions */
+static int fat_driver_import_unlocked(FatImportContext* context);
+static int fat_driver_import_check_names(FatImportContext* context);
+static int fat_driver_import_compare_name(const void* a, const void* b);
+static bool fat_driver_import_exists(FatImportContext* context, const uint8_t short_name[11]);
+static int fat_driver_import_load_bitmap(FatImportContext* context);
+static bool fat_driver_import_test(const FatImportContext* context, uint32_t cluster);
+static void fat_driver_import_mark(FatImportContext* context, uint32_t start, uint32_t length);
+static uint32_t fat_driver_import_find_run(const FatImportContext* context, uint32_t count, uint32_t from,
+                                           uint32_t to);
+static int fat_driver_import_allocate(FatImportContext* context, uint32_t item);
+static int fat_driver_import_add_piece(FatImportContext* context, uint32_t item, uint32_t start, uint32_t length);
+static int fat_driver_import_compare_piece(const void* a, const void* b);
+static int fat_driver_import_write_data(FatImportContext* context);
+static int fat_driver_import_fill(FatImportContext* context, const FatImportPiece* piece, uint32_t cluster,
+                                  uint8_t* data);
+static void fat_driver_import_build_directory(FatImportContext* context, uint32_t item);
+static void fat_driver_import_make_entry(FATDirEntry* entry, const uint8_t short_name[11], bool directory,
+                                         uint32_t first_cluster, uint32_t size, time_t modified);
+static int fat_driver_import_flush(FatImportContext* context);
+static uint32_t fat_driver_import_first_cluster(const FatImportContext* context, uint32_t item);
+static int fat_driver_import_link_chains(FatImportContext* context);
+static void fat_driver_import_unlink_chains(FatImportContext* context);
+static void fat_driver_import_undo(FatImportContext* context);
+static void fat_driver_import_mark_imported(FatImportContext* context, uint32_t item);
+static void fat_driver_import_release(FatImportContext* context, uint32_t item);
+
+/**
+ * Imports a whole tree into a directory.
+ *
+ * An entry whose name is not a valid 8.3 name, that repeats the name of an
+ * earlier entry of the same directory, or that is already in the destination
+ * is left out together with everything inside it. An entry left out for its
+ * name has its invalid_name flag set, so the caller can tell which names to
+ * report. The write lock is held throughout.
+ *
+ * @param driver Pointer to the FATDriver structure.
+ * @param destination Directory to import into.
+ * @param entries Tree to import, each directory before its content. The
+ *        imported and invalid_name flags of each entry are set.
+ * @param count Number of entries.
+ * @param read Function supplying the content of the files.
+ * @param user_data Value passed to read.
+ * @param report Pointer to store what was written.
+ * @return 0 if successful, -1 if failed. Only entries marked imported are
+ *         linked into the volume; the clusters of the others stay free.
+ */
+int fat_driver_import(FATDriver* driver, FileNode* destination, FatImportEntry* entries, uint32_t count,
+                      FatImportRead read, void* user_data, FatImportReport* report) {
+    if (!driver || !destination || (!entries && count > 0) || !read || !report) return -1;
+
+    memset(report, 0, sizeof(FatImportReport));
+    for (uint32_t i = 0; i < count; i++) {
+        entries[i].imported = false;
+        entries[i].invalid_name = false;
+    }
+    if (driver->config.mode != MODE_READ_WRITE) return -1;
+
+    FatImportContext context;
+    memset(&context, 0, sizeof(context));
+    context.driver = driver;
+    context.destination = destination;
+    context.entries = entries;
+    context.count = count;
+    context.read = read;
+    context.user_data = user_data;
+    context.report = report;
+    context.directory_item = UINT32_MAX;
+
+    fat_driver_write_lock(driver);
+    int result = fat_driver_import_unlocked(&context);
+    fat_driver_write_unlock(driver);
+
+    free(context.items);
+    free(context.pieces);
+    free(context.used);
+    free(context.buffer);
+    free(context.directory);
+    free(context.created);
+    return result;
+}
+
+/** Internal function of fat_driver_import(), called with the write lock held */
+static int fat_driver_import_unlocked(FatImportContext* context) {
+    FATDriver* driver = context->driver;
+    FileNode* destination = context->destination;
+    FatImportReport* report = context->report;
+
+    if (destination->type != FILE_TYPE_DIRECTORY || !destination->slot_index) return -1;
+
+    /* Data is written behind the cache, nothing dirty may be flushed over it later */
+    if (fat_driver_sync_unlocked(driver) != 0) return -1;
+
+    context->sector_size = hal_get_sector_size(driver->hal);
+    context->cluster_size = context->sector_size * driver->boot_sector.sectors_per_cluster;
+    context->last_cluster = driver->total_clusters + 1;
+    if (context->cluster_size == 0) return -1;
+
+    context->items = calloc(context->count ? context->count : 1, sizeof(FatImportItem));
+    context->created = calloc(context->count ? context->count : 1, sizeof(FileNode*));
+    if (!context->items || !context->created || fat_driver_import_check_names(context) != 0) return -1;
+
+    /* Sizes: a directory holds ".", ".." and one short entry per child */
+    uint64_t total = 0;
+    uint32_t largest_directory = 0;
+    for (uint32_t i = 0; i < context->count; i++) {
+        FatImportItem* item = &context->items[i];
+        if (item->skipped) continue;
+
+        if (context->entries[i].type == FILE_TYPE_DIRECTORY) {
+            uint64_t bytes = (uint64_t)(2 + item->children) * sizeof(FATDirEntry);
+            item->clusters = (uint32_t)((bytes + context->cluster_size - 1) / context->cluster_size);
+            if (item->clusters > largest_directory) largest_directory = item->clusters;
+        } else {
+            item->clusters = (uint32_t)(((uint64_t)context->entries[i].size + context->cluster_size - 1) /
+                                        context->cluster_size);
+        }
+        total += item->clusters;
+    }
+    if (driver->free_count_valid && total > driver->free_clusters) return -1;
+
+    /* Plan: directories packed first, then the files */
+    if (fat_driver_import_load_bitmap(context) != 0) return -1;
+    context->cursor = (driver->next_free_cluster >= 2) ? driver->next_free_cluster : 2;
+
+    for (int pass = 0; pass < 2; pass++) {
+        FileType type = (pass == 0) ? FILE_TYPE_DIRECTORY : FILE_TYPE_REGULAR;
+        for (uint32_t i = 0; i < context->count; i++) {
+            if (context->items[i].skipped || context->entries[i].type != type) continue;
+            if (fat_driver_import_allocate(context, i) != 0) return -1;
+        }
+    }
+    report->clusters = (uint32_t)total;
+    report->extents = context->piece_count;
+
+    /* One stream of data, then the metadata */
+    context->batch_clusters = FAT_IMPORT_BATCH_BYTES / context->cluster_size;
+    if (context->batch_clusters == 0) context->batch_clusters = 1;
+    context->buffer = malloc((size_t)context->batch_clusters * context->cluster_size);
+    context->directory = malloc((size_t)(largest_directory ? largest_directory : 1) * context->cluster_size);
+    if (!context->buffer || !context->directory) return -1;
+
+    if (fat_driver_import_write_data(context) != 0) return -1;
+    if (fat_driver_import_link_chains(context) != 0) {
+        /* Entries already set would reach the disk at the next sync as lost chains */
+        fat_driver_import_unlink_chains(context);
+        return -1;
+    }
+    fat_driver_adjust_free_clusters(driver, 0, context->cursor > context->last_cluster ? 2 : context->cursor);
+
+    /* The top entries go into the destination, each subtree hangs below its entry */
+    int result = 0;
+    for (uint32_t i = 0; i < context->count; i++) {
+        const FatImportEntry* entry = &context->entries[i];
+        if (context->items[i].skipped || entry->parent != FAT_IMPORT_TOP) continue;
+
+        FileNode* node = fat_driver_create_entry_unlocked(driver, destination, entry->name, entry->type,
+                                                          fat_driver_import_first_cluster(context, i),
+                                                          entry->size, entry->modified);
+        if (!node) {
+            /* Nothing would reach the chains of the subtree, release them all */
+            fat_driver_import_release(context, i);
+            result = -1;
+            continue;
+        }
+        context->created[i] = node;
+        fat_driver_import_mark_imported(context, i);
+    }
+
+    if (fat_driver_sync_unlocked(driver) != 0) {
+        /* Still dirty in the cache: take it all back so a later sync writes a consistent state */
+        fat_driver_import_undo(context);
+        return -1;
+    }
+
+    /* The data went around the cache, drop what it may hold of those clusters */
+    block_cache_invalidate(driver->cache, driver->hal);
+
+    for (FileNode* child = destination->children; child; child = child->next) {
+        if (child->type == FILE_TYPE_DIRECTORY && !child->children && !child->slot_index) {
+            fat_driver_build_directory_tree_recursive(driver, child);
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Converts the names, drops invalid and duplicate ones, and links every kept
+ * entry into the child list of its directory. A dropped directory drops
+ * everything inside it.
+ */
+static int fat_driver_import_check_names(FatImportContext* context) {
+    FatImportEntry* entries = context->entries;
+    FatImportItem* items = context->items;
+    uint32_t count = context->count;
+
+    FatImportName* names = malloc((count ? count : 1) * sizeof(FatImportName));
+    if (!names) return -1;
+
+    uint32_t named = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        items[i].first_child = UINT32_MAX;
+        items[i].last_child = UINT32_MAX;
+        items[i].next_sibling = UINT32_MAX;
+
+        bool valid_type = (entries[i].type == FILE_TYPE_REGULAR || entries[i].type == FILE_TYPE_DIRECTORY);
+        if (!valid_type || !entries[i].name) {
+            items[i].skipped = true;
+            continue;
+        }
+        if (fat_driver_make_short_name(entries[i].name, items[i].short_name) != 0) {
+            items[i].skipped = true;
+            entries[i].invalid_name = true;
+            context->report->invalid_names++;
+            continue;
+        }
+
+        names[named].parent = entries[i].parent;
+        names[named].index = i;
+        memcpy(names[named].short_name, items[i].short_name, sizeof(names[named].short_name));
+        named++;
+    }
+
+    /* The first of several equal names in a directory is kept */
+    qsort(names, named, sizeof(FatImportName), fat_driver_import_compare_name);
+    for (uint32_t i = 1; i < named; i++) {
+        if (names[i].parent == names[i - 1].parent &&
+            memcmp(names[i].short_name, names[i - 1].short_name, sizeof(names[i].short_name)) == 0) {
+            items[names[i].index].skipped = true;
+        }
+    }
+    free(names);
+
+    for (uint32_t i = 0; i < count; i++) {
+        FatImportItem* item = &items[i];
+        uint32_t parent = entries[i].parent;
+
+        if (!item->skipped) {
+            if (parent == FAT_IMPORT_TOP) {
+                item->skipped = fat_driver_import_exists(context, item->short_name);
+            } else {
+                item->skipped = (parent >= i || items[parent].skipped ||
+                                 entries[parent].type != FILE_TYPE_DIRECTORY);
+            }
+        }
+
+        if (item->skipped) {
+            context->report->skipped++;
+            continue;
+        }
+
+        if (parent != FAT_IMPORT_TOP) {
+            FatImportItem* directory = &items[parent];
+            if (directory->last_child == UINT32_MAX) {
+                directory->first_child = i;
+            } else {
+                items[directory->last_child].next_sibling = i;
+            }
+            directory->last_child = i;
+            directory->children++;
+        }
+    }
+
+    return 0;
+}
+
+/** qsort() order of names by parent, name and then index */
+static int fat_driver_import_compare_name(const void* a, const void* b) {
+    const FatImportName* first = (const FatImportName*)a;
+    const FatImportName* second = (const FatImportName*)b;
+
+    if (first->parent != second->parent) return (first->parent < second->parent) ? -1 : 1;
+    int order = memcmp(first->short_name, second->short_name, sizeof(first->short_name));
+    if (order != 0) return order;
+    return (first->index > second->index) - (first->index < second->index);
+}
+
+/**
+ * Tells whether the destination already has an entry of that name, comparing
+ * names as the tree stores them.
+ */
+static bool fat_driver_import_exists(FatImportContext* context, const uint8_t short_name[11]) {
+    FATDirEntry entry;
+    FileNode node;
+
+    memset(&entry, 0, sizeof(entry));
+    memcpy(entry.name, short_name, sizeof(entry.name));
+    memcpy(entry.ext, short_name + sizeof(entry.name), sizeof(entry.ext));
+    fat_driver_fill_file_node(context->driver, &node, &entry);
+
+    const FatSlotIndex* index = fat_driver_slot_index_share_names(context->driver, context->destination);
+    if (index) return fat_driver_slot_index_find_name(index, node.name, strlen(node.name)) != NULL;
+
+    for (FileNode* child = context->destination->children; child; child = child->next) {
+        if (strcmp(child->name, node.name) == 0) return true;
+    }
+    return false;
+}
+
+/**
+ * Reads the allocation state of every cluster from FAT #1. Clusters 0 and 1
+ * and the bits past the last cluster count as used.
+ */
+static int fat_driver_import_load_bitmap(FatImportContext* context) {
+    uint32_t words = (context->last_cluster + 1 + 63) / 64;
+
+    context->used = malloc(words * sizeof(uint64_t));
+    if (!context->used) return -1;
+    memset(context->used, 0xFF, words * sizeof(uint64_t));
+
+    for (uint32_t cluster = 2; cluster <= context->last_cluster; cluster++) {
+        if (fat_driver_get_fat_entry(context->driver, cluster) == 0) {
+            context->used[cluster / 64] &= ~(1ULL << (cluster % 64));
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Tests the bit of a cluster.
+ */
+static bool fat_driver_import_test(const FatImportContext* context, uint32_t cluster) {
+    return (context->used[cluster / 64] >> (cluster % 64)) & 1;
+}
+
+/**
+ * Marks consecutive clusters as used.
+ */
+static void fat_driver_import_mark(FatImportContext* context, uint32_t start, uint32_t length) {
+    for (uint32_t cluster = start; cluster < start + length; cluster++) {
+        context->used[cluster / 64] |= 1ULL << (cluster % 64);
+    }
+}
+
+/**
+ * Finds the first run of count free clusters starting in [from, to). Fully
+ * used words of the bitmap are skipped 64 clusters at a time.
+ *
+ * @return First cluster of the run, 0 if there is none.
+ */
+static uint32_t fat_driver_import_find_run(const FatImportContext* context, uint32_t count, uint32_t from,
+                                           uint32_t to) {
+    uint32_t run_start = 0;
+    uint32_t run_length = 0;
+
+    for (uint32_t cluster = from; cluster <= context->last_cluster; cluster++) {
+        if (run_length == 0 && cluster >= to) break;
+
+        if (cluster % 64 == 0 && context->used[cluster / 64] == UINT64_MAX) {
+            run_length = 0;
+            cluster += 63;
+            continue;
+        }
+
+        if (fat_driver_import_test(context, cluster)) {
+            run_length = 0;
+            continue;
+        }
+
+        if (run_length == 0) run_start = cluster;
+        if (++run_length == count) return run_start;
+    }
+
+    return 0;
+}
+
+/**
+ * Gives an entry its clusters: the first free run that holds it whole, from
+ * the cursor on and then from the start of the volume, or else the free
+ * clusters from the cursor on, run after run.
+ */
+static int fat_driver_import_allocate(FatImportContext* context, uint32_t item) {
+    uint32_t count = context->items[item].clusters;
+
+    context->items[item].first_piece = context->piece_count;
+    if (count == 0) return 0;
+
+    uint32_t start = fat_driver_import_find_run(context, count, context->cursor, context->last_cluster + 1);
+    if (start == 0) start = fat_driver_import_find_run(context, count, 2, context->cursor);
+
+    if (start != 0) {
+        if (fat_driver_import_add_piece(context, item, start, count) != 0) return -1;
+        context->cursor = start + count;
+        return 0;
+    }
+
+    uint32_t offset = 0;
+    uint32_t cluster = context->cursor;
+    for (uint32_t scanned = 0; scanned <= context->last_cluster && offset < count; scanned++, cluster++) {
+        if (cluster < 2 || cluster > context->last_cluster) cluster = 2;
+        if (fat_driver_import_test(context, cluster)) continue;
+
+        uint32_t length = 1;
+        while (offset + length < count && cluster + length <= context->last_cluster &&
+               !fat_driver_import_test(context, cluster + length)) {
+            length++;
+        }
+        if (fat_driver_import_add_piece(context, item, cluster, length) != 0) return -1;
+
+        offset += length;
+        scanned += length - 1;
+        cluster += length - 1;
+        context->cursor = cluster + 1;
+    }
+
+    return (offset == count) ? 0 : -1;
+}
+
+/**
+ * Appends a piece to the plan and marks its clusters used.
+ */
+static int fat_driver_import_add_piece(FatImportContext* context, uint32_t item, uint32_t start, uint32_t length) {
+    if (context->piece_count == context->piece_capacity) {
+        uint32_t capacity = context->piece_capacity ? context->piece_capacity * 2 : 64;
+        FatImportPiece* pieces = realloc(context->pieces, capacity * sizeof(FatImportPiece));
+        if (!pieces) return -1;
+        context->pieces = pieces;
+        context->piece_capacity = capacity;
+    }
+
+    FatImportItem* plan = &context->items[item];
+    FatImportPiece* piece = &context->pieces[context->piece_count++];
+    piece->start = start;
+    piece->length = length;
+    piece->item = item;
+    piece->offset = 0;
+    if (plan->piece_count > 0) {
+        const FatImportPiece* previous = piece - 1;
+        piece->offset = previous->offset + previous->length;
+    }
+    plan->piece_count++;
+
+    fat_driver_import_mark(context, start, length);
+    return 0;
+}
+
+/** qsort() order of pieces by first cluster */
+static int fat_driver_import_compare_piece(const void* a, const void* b) {
+    uint32_t first = ((const FatImportPiece*)a)->start;
+    uint32_t second = ((const FatImportPiece*)b)->start;
+    return (first > second) - (first < second);
+}
+
+/**
+ * Writes every planned cluster in cluster order. Clusters are gathered in the
+ * buffer, which is written out in one request when it is full or when the
+ * next piece does not follow it on the volume.
+ */
+static int fat_driver_import_write_data(FatImportContext* context) {
+    if (context->piece_count == 0) return 0;
+
+    FatImportPiece* order = malloc(context->piece_count * sizeof(FatImportPiece));
+    if (!order) return -1;
+    memcpy(order, context->pieces, context->piece_count * sizeof(FatImportPiece));
+    qsort(order, context->piece_count, sizeof(FatImportPiece), fat_driver_import_compare_piece);
+
+    int result = 0;
+    for (uint32_t i = 0; i < context->piece_count && result == 0; i++) {
+        const FatImportPiece* piece = &order[i];
+
+        if (context->batch_filled > 0 && piece->start != context->batch_start + context->batch_filled) {
+            result = fat_driver_import_flush(context);
+        }
+
+        for (uint32_t cluster = 0; cluster < piece->length && result == 0; cluster++) {
+            if (context->batch_filled == 0) context->batch_start = piece->start + cluster;
+
+            uint8_t* data = context->buffer + (size_t)context->batch_filled * context->cluster_size;
+            result = fat_driver_import_fill(context, piece, cluster, data);
+            context->batch_filled++;
+
+            if (result == 0 && context->batch_filled == context->batch_clusters) {
+                result = fat_driver_import_flush(context);
+            }
+        }
+    }
+
+    if (result == 0 && context->batch_filled > 0) result = fat_driver_import_flush(context);
+
+    free(order);
+    return result;
+}
+
+/**
+ * Fills one cluster of a piece: directory content, or file data padded with
+ * zeroes past the end of the file.
+ */
+static int fat_driver_import_fill(FatImportContext* context, const FatImportPiece* piece, uint32_t cluster,
+                                  uint8_t* data) {
+    uint32_t item = piece->item;
+    uint64_t offset = (uint64_t)(piece->offset + cluster) * context->cluster_size;
+
+    if (context->entries[item].type == FILE_TYPE_DIRECTORY) {
+        if (context->directory_item != item) fat_driver_import_build_directory(context, item);
+        memcpy(data, context->directory + offset, context->cluster_size);
+        return 0;
+    }
+
+    const FatImportEntry* entry = &context->entries[item];
+    uint32_t length = context->cluster_size;
+    if (offset + length > entry->size) length = (uint32_t)(entry->size - offset);
+
+    if (context->read(context->entries, item, (uint32_t)offset, data, length, context->user_data) != 0) {
+        return -1;
+    }
+    memset(data + length, 0, context->cluster_size - length);
+    return 0;
+}
+
+/**
+ * Builds the content of a new directory: "." and "..", one short entry per
+ * child and zeroes after, the first of which ends the directory.
+ */
+static void fat_driver_import_build_directory(FatImportContext* context, uint32_t item) {
+    const FatImportEntry* entry = &context->entries[item];
+    const FatImportItem* plan = &context->items[item];
+    FATDirEntry* slots = (FATDirEntry*)context->directory;
+
+    memset(context->directory, 0, (size_t)plan->clusters * context->cluster_size);
+
+    /* ".." of a directory in the root points at cluster 0 */
+    uint32_t parent_cluster;
+    if (entry->parent != FAT_IMPORT_TOP) {
+        parent_cluster = fat_driver_import_first_cluster(context, entry->parent);
+    } else {
+        parent_cluster = (context->destination == context->driver->root_directory) ? 0 :
+                         context->destination->first_cluster;
+    }
+
+    uint8_t dot_name[11];
+    memset(dot_name, ' ', sizeof(dot_name));
+    dot_name[0] = '.';
+    fat_driver_import_make_entry(&slots[0], dot_name, true, fat_driver_import_first_cluster(context, item), 0,
+                                 entry->modified);
+    dot_name[1] = '.';
+    fat_driver_import_make_entry(&slots[1], dot_name, true, parent_cluster, 0, entry->modified);
+
+    uint32_t slot = 2;
+    for (uint32_t child = plan->first_child; child != UINT32_MAX; child = context->items[child].next_sibling) {
+        const FatImportEntry* child_entry = &context->entries[child];
+        fat_driver_import_make_entry(&slots[slot++], context->items[child].short_name,
+                                     child_entry->type == FILE_TYPE_DIRECTORY,
+                                     fat_driver_import_first_cluster(context, child), child_entry->size,
+                                     child_entry->modified);
+    }
+
+    context->directory_item = item;
+}
+
+/**
+ * Fills a short directory entry.
+ */
+static void fat_driver_import_make_entry(FATDirEntry* entry, const uint8_t short_name[11], bool directory,
+                                         uint32_t first_cluster, uint32_t size, time_t modified) {
+    uint16_t date, time_value;
+    fat_driver_encode_time(modified, &date, &time_value);
+
+    memset(entry, 0, sizeof(FATDirEntry));
+    memcpy(entry->name, short_name, sizeof(entry->name));
+    memcpy(entry->ext, short_name + sizeof(entry->name), sizeof(entry->ext));
+    entry->attributes = directory ? FAT_ATTR_DIRECTORY : FAT_ATTR_ARCHIVE;
+    entry->create_time = time_value;
+    entry->create_date = date;
+    entry->last_access_date = date;
+    entry->write_time = time_value;
+    entry->write_date = date;
+    entry->first_cluster_high = (uint16_t)(first_cluster >> 16);
+    entry->first_cluster_low = (uint16_t)(first_cluster & 0xFFFF);
+    entry->file_size = directory ? 0 : size;
+}
+
+/**
+ * Writes the buffer at its cluster in one request.
+ */
+static int fat_driver_import_flush(FatImportContext* context) {
+    FATDriver* driver = context->driver;
+    uint32_t sectors = context->batch_filled * driver->boot_sector.sectors_per_cluster;
+    uint32_t sector = fat_driver_cluster_to_sector(driver, context->batch_start);
+
+    int written = hal_write_sectors(driver->hal, sector, sectors, context->buffer);
+    context->batch_filled = 0;
+    context->report->writes++;
+
+    return (written == (int)(sectors * context->sector_size)) ? 0 : -1;
+}
+
+/**
+ * First cluster of an entry, 0 for an empty file.
+ */
+static uint32_t fat_driver_import_first_cluster(const FatImportContext* context, uint32_t item) {
+    const FatImportItem* plan = &context->items[item];
+    return plan->piece_count ? context->pieces[plan->first_piece].start : 0;
+}
+
+/**
+ * Writes the FAT chain of every entry, piece after piece.
+ */
+static int fat_driver_import_link_chains(FatImportContext* context) {
+    FATDriver* driver = context->driver;
+    uint32_t end_of_chain = fat_driver_end_of_chain(driver);
+
+    for (uint32_t i = 0; i < context->piece_count; i++) {
+        const FatImportPiece* piece = &context->pieces[i];
+        bool last = (i + 1 == context->piece_count || context->pieces[i + 1].item != piece->item);
+        uint32_t after = last ? end_of_chain : context->pieces[i + 1].start;
+
+        for (uint32_t cluster = piece->start; cluster < piece->start + piece->length; cluster++) {
+            uint32_t next = (cluster + 1 < piece->start + piece->length) ? cluster + 1 : after;
+            if (fat_driver_set_fat_entry(driver, cluster, next) != 0) return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Frees every cluster of the plan again, after linking its chains failed
+ * part way. Entries not set yet are already 0.
+ */
+static void fat_driver_import_unlink_chains(FatImportContext* context) {
+    for (uint32_t i = 0; i < context->piece_count; i++) {
+        const FatImportPiece* piece = &context->pieces[i];
+        for (uint32_t cluster = piece->start; cluster < piece->start + piece->length; cluster++) {
+            fat_driver_set_fat_entry(context->driver, cluster, 0);
+        }
+    }
+}
+
+/**
+ * Takes a whole import back after the final sync failed: deletes the top
+ * entries made in the destination and frees every planned cluster.
+ */
+static void fat_driver_import_undo(FatImportContext* context) {
+    for (uint32_t i = 0; i < context->count; i++) {
+        if (context->created[i]) fat_driver_delete_entry_unlocked(context->driver, context->created[i]);
+        context->created[i] = NULL;
+        context->entries[i].imported = false;
+    }
+    fat_driver_import_unlink_chains(context);
+    context->report->files = 0;
+    context->report->directories = 0;
+}
+
+/**
+ * Marks an entry and everything inside it as imported and counts them.
+ */
+static void fat_driver_import_mark_imported(FatImportContext* context, uint32_t item) {
+    context->entries[item].imported = true;
+
+    if (context->entries[item].type != FILE_TYPE_DIRECTORY) {
+        context->report->files++;
+        return;
+    }
+
+    context->report->directories++;
+    for (uint32_t child = context->items[item].first_child; child != UINT32_MAX;
+         child = context->items[child].next_sibling) {
+        fat_driver_import_mark_imported(context, child);
+    }
+}
+
+/**
+ * Frees the clusters planned for an entry and everything inside it, after
+ * its chains were linked but its top entry could not be created.
+ */
+static void fat_driver_import_release(FatImportContext* context, uint32_t item) {
+    uint32_t first_cluster = fat_driver_import_first_cluster(context, item);
+    if (first_cluster != 0) fat_driver_free_chain_unlocked(context->driver, first_cluster);
+
+    for (uint32_t child = context->items[item].first_child; child != UINT32_MAX;
+         child = context->items[child].next_sibling) {
+        fat_driver_import_release(context, child);
+    }
+}
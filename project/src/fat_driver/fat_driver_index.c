@@ -0,0 +1,504 @@
+/**
+ * @file fat_driver_index.c
+ * @brief Sidecar mount index: the directory tree saved next to the image
+ * @details After a full scan the tree is written to "<image>.idx" as a flat
+ *          node table and a string pool with the names. Nodes refer to each
+ *          other by table index and are stored in preorder, so children and
+ *          siblings always come after the node that links to them.
+ *
+ *          The file starts with a key that is cheap to compute: volume ID,
+ *          cluster count, image size and mtime, a hash of the boot sector and
+ *          FSInfo, and a hash of a fixed sample of FAT #1 sectors. A later
+ *          mount whose key matches maps the file and copies the table into
+ *          one block of FileNodes, turning the indexes into pointers, without
+ *          reading a directory sector. Any mismatch or damage makes the mount
+ *          scan and rewrite the file.
+ * @date 2026-10-18
+ * @author Le Duc Son
+ */
+#include "fat_driver.h"
+#include "fat_driver_private.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * File name suffix of the sidecar index
+ */
+#define FAT_INDEX_SUFFIX ".idx"
+
+/**
+ * Magic and format version of the sidecar index
+ */
+#define FAT_INDEX_MAGIC "FATIDX\r\n"
+#define FAT_INDEX_VERSION 3
+
+/**
+ * Marks a missing link in the node table
+ */
+#define FAT_INDEX_NONE 0xFFFFFFFF
+
+/**
+ * Number of FAT #1 sectors sampled into the key, spread evenly from the first
+ * to the last
+ */
+#define FAT_INDEX_SAMPLE_SECTORS 64
+
+/**
+ * FNV-1a 64-bit prime
+ */
+#define FAT_HASH_PRIME 0x100000001B3ULL
+
+/**
+ * Header of the sidecar index
+ */
+typedef struct {
+    char magic[8];                  /**< FAT_INDEX_MAGIC */
+    uint32_t version;               /**< FAT_INDEX_VERSION */
+    uint32_t node_size;             /**< sizeof(FatIndexNode) of the writer */
+    FatIndexKey key;                /**< Image the index describes */
+    uint32_t node_count;            /**< Number of nodes, the root is node 0 */
+    uint32_t node_offset;           /**< File offset of the node table */
+    uint32_t string_size;           /**< Size of the string pool */
+    uint32_t string_offset;         /**< File offset of the string pool */
+    uint64_t payload_hash;          /**< Hash of everything after the header */
+} FatIndexHeader;
+
+/**
+ * Node of the sidecar index
+ */
+typedef struct {
+    uint32_t name_offset;           /**< Name in the string pool */
+    uint32_t parent;                /**< Parent node, FAT_INDEX_NONE for the root */
+    uint32_t first_child;           /**< First child, FAT_INDEX_NONE if none */
+    uint32_t next;                  /**< Next sibling, FAT_INDEX_NONE if none */
+    uint32_t size;                  /**< File size */
+    uint32_t first_cluster;         /**< First cluster */
+    uint32_t first_sector;          /**< First sector */
+    uint32_t entry_slot;            /**< Slot of the short entry in the parent */
+    uint64_t content_hash;          /**< Directory content hash of the scan */
+    uint8_t type;                   /**< FileType */
+    uint8_t lfn_slots;              /**< LFN slots before the short entry */
+    FileAttributes attributes;      /**< Attributes */
+    DateTime created_time;          /**< Creation time */
+    DateTime modified_time;         /**< Last modification time */
+} FatIndexNode;
+
+/**
+ * Tables being filled while saving the index
+ */
+typedef struct {
+    FatIndexNode* nodes;
+    uint32_t node_count;
+    char* strings;
+    uint32_t string_size;
+} FatIndexWriter;
+
+/* Local functions */
+static char* fat_driver_index_path(const FATDriver* driver);
+static void fat_driver_index_count(const FileNode* node, uint32_t* nodes, uint32_t* strings);
+static uint32_t fat_driver_index_store(FatIndexWriter* writer, const FileNode* node, uint32_t parent);
+static int fat_driver_index_check(const FatIndexHeader* header, size_t size, const FatIndexKey* key);
+static int fat_driver_index_materialise(FATDriver* driver, const uint8_t* map);
+
+/**
+ * Computes the key of the mounted image.
+ *
+ * The key reads at most FAT_INDEX_SAMPLE_SECTORS + 2 sectors, whatever the
+ * size of the volume. The image mtime is what catches a change made by
+ * another program; the boot sector, FSInfo and the FAT sample catch an image
+ * replaced by one of the same size and time. The sectors are read through
+ * the HAL, bypassing the block cache.
+ *
+ * @param driver Pointer to the FATDriver structure (boot sector parsed).
+ * @param key Pointer to store the key.
+ * @return 0 if successful, -1 if failed.
+ */
+int fat_driver_index_key(FATDriver* driver, FatIndexKey* key) {
+    if (!driver || !key || !driver->config.img_path) return -1;
+
+    struct stat st;
+    if (stat(driver->config.img_path, &st) != 0) return -1;
+
+    memset(key, 0, sizeof(FatIndexKey));
+    key->volume_id = driver->boot_sector.volume_id;
+    key->total_clusters = driver->total_clusters;
+    key->image_size = (uint64_t)st.st_size;
+    key->image_mtime = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+
+    uint32_t sector_size = hal_get_sector_size(driver->hal);
+    uint8_t* buffer = malloc(sector_size);
+    if (!buffer) return -1;
+
+    /* Boot sector, then FSInfo on FAT32 */
+    uint64_t hash = FAT_HASH_SEED;
+    bool valid = hal_read_sector(driver->hal, 0, buffer) == (int)sector_size;
+    if (valid) hash = fat_driver_hash_bytes(hash, buffer, sector_size);
+    if (valid && fat_driver_get_fat_type(driver) == FAT_TYPE_32 && driver->boot_sector.fs_info != 0) {
+        valid = hal_read_sector(driver->hal, driver->boot_sector.fs_info, buffer) == (int)sector_size;
+        if (valid) hash = fat_driver_hash_bytes(hash, buffer, sector_size);
+    }
+    key->boot_hash = hash;
+
+    uint32_t samples = driver->fat_size < FAT_INDEX_SAMPLE_SECTORS ? driver->fat_size : FAT_INDEX_SAMPLE_SECTORS;
+    hash = FAT_HASH_SEED;
+    for (uint32_t i = 0; valid && i < samples; i++) {
+        uint32_t sector = samples > 1 ? (uint32_t)((uint64_t)i * (driver->fat_size - 1) / (samples - 1)) : 0;
+        valid = hal_read_sector(driver->hal, driver->first_fat_sector + sector, buffer) == (int)sector_size;
+        if (valid) hash = fat_driver_hash_bytes(hash, buffer, sector_size);
+    }
+    key->fat_sample_hash = hash;
+
+    free(buffer);
+    return valid ? 0 : -1;
+}
+
+/**
+ * Loads the directory tree from the sidecar index.
+ *
+ * The file is mapped read-only for the copy into the node block and unmapped
+ * before returning; nothing refers to it while mounted.
+ *
+ * @param driver Pointer to the FATDriver structure.
+ * @param key Key of the mounted image.
+ * @return 0 if the tree was loaded, -1 if the index is missing, stale or damaged.
+ */
+int fat_driver_index_load(FATDriver* driver, const FatIndexKey* key) {
+    if (!driver || !key) return -1;
+
+    char* path = fat_driver_index_path(driver);
+    if (!path) return -1;
+
+    int fd = open(path, O_RDONLY);
+    free(path);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(FatIndexHeader)) {
+        close(fd);
+        return -1;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    int result = -1;
+    if (fat_driver_index_check((const FatIndexHeader*)map, size, key) == 0 &&
+        fat_driver_index_materialise(driver, (const uint8_t*)map) == 0) {
+        driver->index_state = FAT_INDEX_LOADED;
+        result = 0;
+    }
+
+    munmap(map, size);
+    return result;
+}
+
+/**
+ * Writes the scanned directory tree to the sidecar index.
+ *
+ * The file is written under a temporary name and renamed over the old index,
+ * so a concurrent or interrupted mount never sees a partial file.
+ *
+ * @param driver Pointer to the FATDriver structure (tree built).
+ * @param key Key of the mounted image.
+ * @return 0 if successful, -1 if failed (the mount is not affected).
+ */
+int fat_driver_index_save(FATDriver* driver, const FatIndexKey* key) {
+    if (!driver || !key || !driver->root_directory) return -1;
+
+    uint32_t node_count = 0, string_size = 0;
+    fat_driver_index_count(driver->root_directory, &node_count, &string_size);
+
+    FatIndexWriter writer;
+    memset(&writer, 0, sizeof(writer));
+    writer.nodes = calloc(node_count, sizeof(FatIndexNode));
+    writer.strings = malloc(string_size);
+
+    int result = -1;
+    char* path = fat_driver_index_path(driver);
+    char* temp_path = path ? malloc(strlen(path) + 5) : NULL;
+
+    if (writer.nodes && writer.strings && temp_path) {
+        fat_driver_index_store(&writer, driver->root_directory, FAT_INDEX_NONE);
+
+        FatIndexHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, FAT_INDEX_MAGIC, sizeof(header.magic));
+        header.version = FAT_INDEX_VERSION;
+        header.node_size = sizeof(FatIndexNode);
+        header.key = *key;
+        header.node_count = writer.node_count;
+        header.node_offset = sizeof(FatIndexHeader);
+        header.string_size = writer.string_size;
+        header.string_offset = header.node_offset + writer.node_count * (uint32_t)sizeof(FatIndexNode);
+
+        uint64_t hash = FAT_HASH_SEED;
+        hash = fat_driver_hash_bytes(hash, (const uint8_t*)writer.nodes, writer.node_count * sizeof(FatIndexNode));
+        hash = fat_driver_hash_bytes(hash, (const uint8_t*)writer.strings, writer.string_size);
+        header.payload_hash = hash;
+
+        sprintf(temp_path, "%s.tmp", path);
+        FILE* file = fopen(temp_path, "wb");
+        if (file) {
+            bool written =
+                fwrite(&header, sizeof(header), 1, file) == 1 &&
+                fwrite(writer.nodes, sizeof(FatIndexNode), writer.node_count, file) == writer.node_count &&
+                fwrite(writer.strings, 1, writer.string_size, file) == writer.string_size;
+
+            if (fclose(file) == 0 && written && rename(temp_path, path) == 0) {
+                driver->index_state = FAT_INDEX_WRITTEN;
+                result = 0;
+            } else {
+                remove(temp_path);
+            }
+        }
+    }
+
+    free(writer.nodes);
+    free(writer.strings);
+    free(temp_path);
+    free(path);
+    return result;
+}
+
+/**
+ * Hashes a byte range with FNV-1a, eight bytes per step.
+ *
+ * Used for the image key, the index payload and the directory content
+ * hashes that fat_driver_refresh() compares.
+ *
+ * @param hash FAT_HASH_SEED or the result of the previous range.
+ * @param data Bytes to hash.
+ * @param length Number of bytes.
+ * @return The updated hash.
+ */
+uint64_t fat_driver_hash_bytes(uint64_t hash, const void* data, size_t length) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    size_t i = 0;
+
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        hash = (hash ^ word) * FAT_HASH_PRIME;
+    }
+    for (; i < length; i++) {
+        hash = (hash ^ bytes[i]) * FAT_HASH_PRIME;
+    }
+    return hash;
+}
+
+/**
+ * Spreads every bit of a hash over its low bits.
+ *
+ * A step of fat_driver_hash_bytes() only carries bits upwards, so names
+ * that differ only in their last bytes of a word share the low bits of the
+ * hash. Tables that take a slot from the low bits mix the hash first.
+ *
+ * @param hash Result of fat_driver_hash_bytes().
+ * @return The mixed hash.
+ */
+uint64_t fat_driver_hash_mix(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+/**
+ * Releases the node block of a loaded index.
+ *
+ * The nodes are marked in_arena, so fat_driver_free_file_node() has already
+ * walked them without freeing; the block goes away here in one call.
+ *
+ * @param driver Pointer to the FATDriver structure.
+ */
+void fat_driver_index_release(FATDriver* driver) {
+    if (!driver) return;
+
+    free(driver->index_nodes);
+    driver->index_nodes = NULL;
+    driver->index_node_count = 0;
+}
+
+/**
+ * Path of the sidecar index, the image path plus FAT_INDEX_SUFFIX (malloc'd)
+ */
+static char* fat_driver_index_path(const FATDriver* driver) {
+    const char* img_path = driver->config.img_path;
+    if (!img_path) return NULL;
+
+    char* path = malloc(strlen(img_path) + sizeof(FAT_INDEX_SUFFIX));
+    if (path) {
+        sprintf(path, "%s%s", img_path, FAT_INDEX_SUFFIX);
+    }
+    return path;
+}
+
+/**
+ * Counts the nodes of a subtree and the string pool bytes of their names
+ */
+static void fat_driver_index_count(const FileNode* node, uint32_t* nodes, uint32_t* strings) {
+    (*nodes)++;
+    *strings += (uint32_t)strlen(node->name) + 1;
+
+    for (const FileNode* child = node->children; child; child = child->next) {
+        fat_driver_index_count(child, nodes, strings);
+    }
+}
+
+/**
+ * Appends a subtree in preorder. Returns the index of the node.
+ */
+static uint32_t fat_driver_index_store(FatIndexWriter* writer, const FileNode* node, uint32_t parent) {
+    uint32_t index = writer->node_count++;
+    FatIndexNode* record = &writer->nodes[index];
+
+    size_t name_length = strlen(node->name) + 1;
+    memcpy(writer->strings + writer->string_size, node->name, name_length);
+    record->name_offset = writer->string_size;
+    writer->string_size += (uint32_t)name_length;
+
+    record->parent = parent;
+    record->first_child = FAT_INDEX_NONE;
+    record->next = FAT_INDEX_NONE;
+    record->size = node->size;
+    record->first_cluster = node->first_cluster;
+    record->first_sector = node->first_sector;
+    record->entry_slot = node->entry_slot;
+    record->content_hash = node->content_hash;
+    record->type = (uint8_t)node->type;
+    record->lfn_slots = node->lfn_slots;
+    record->attributes = node->attributes;
+    record->created_time = node->created_time;
+    record->modified_time = node->modified_time;
+
+    uint32_t previous = FAT_INDEX_NONE;
+    for (const FileNode* child = node->children; child; child = child->next) {
+        uint32_t child_index = fat_driver_index_store(writer, child, index);
+
+        /* The table may not move, it was sized by fat_driver_index_count() */
+        if (previous == FAT_INDEX_NONE) {
+            writer->nodes[index].first_child = child_index;
+        } else {
+            writer->nodes[previous].next = child_index;
+        }
+        previous = child_index;
+    }
+
+    return index;
+}
+
+/**
+ * Validates the header of a mapped index against the file size and the key
+ */
+static int fat_driver_index_check(const FatIndexHeader* header, size_t size, const FatIndexKey* key) {
+    if (memcmp(header->magic, FAT_INDEX_MAGIC, sizeof(header->magic)) != 0) return -1;
+    if (header->version != FAT_INDEX_VERSION || header->node_size != sizeof(FatIndexNode)) return -1;
+    if (memcmp(&header->key, key, sizeof(FatIndexKey)) != 0) return -1;
+    if (header->node_count == 0 || header->string_size == 0) return -1;
+
+    uint64_t node_end = (uint64_t)header->node_offset + (uint64_t)header->node_count * sizeof(FatIndexNode);
+    uint64_t string_end = (uint64_t)header->string_offset + header->string_size;
+
+    if (header->node_offset != sizeof(FatIndexHeader) || header->string_offset != node_end) return -1;
+    if (string_end != size) return -1;
+
+    /* Same sections as the writer hashed them */
+    const uint8_t* map = (const uint8_t*)header;
+    uint64_t hash = FAT_HASH_SEED;
+    hash = fat_driver_hash_bytes(hash, map + header->node_offset, node_end - header->node_offset);
+    hash = fat_driver_hash_bytes(hash, map + header->string_offset, header->string_size);
+    if (hash != header->payload_hash) return -1;
+
+    return 0;
+}
+
+/**
+ * Turns the node table into a FileNode block. Links are only accepted forward
+ * (children and siblings have higher indexes) and every node but the root
+ * must be linked exactly once, so a damaged file cannot create a cycle.
+ */
+static int fat_driver_index_materialise(FATDriver* driver, const uint8_t* map) {
+    const FatIndexHeader* header = (const FatIndexHeader*)map;
+    const FatIndexNode* table = (const FatIndexNode*)(map + header->node_offset);
+    const char* strings = (const char*)(map + header->string_offset);
+    uint32_t count = header->node_count;
+
+    FileNode* nodes = calloc(count, sizeof(FileNode));
+    uint8_t* linked = calloc(count, 1);
+    if (!nodes || !linked) {
+        free(nodes);
+        free(linked);
+        return -1;
+    }
+
+    bool valid = table[0].parent == FAT_INDEX_NONE;
+    for (uint32_t i = 0; valid && i < count; i++) {
+        const FatIndexNode* record = &table[i];
+        FileNode* node = &nodes[i];
+
+        if (record->name_offset >= header->string_size ||
+            !memchr(strings + record->name_offset, '\0', header->string_size - record->name_offset) ||
+            record->type > FILE_TYPE_UNKNOWN ||
+            (i > 0 && record->parent >= i)) {
+            valid = false;
+            break;
+        }
+
+        strncpy(node->name, strings + record->name_offset, FILE_NAME_MAX);
+        node->type = (FileType)record->type;
+        node->attributes = record->attributes;
+        node->size = record->size;
+        node->first_cluster = record->first_cluster;
+        node->first_sector = record->first_sector;
+        node->created_time = record->created_time;
+        node->modified_time = record->modified_time;
+        node->entry_slot = record->entry_slot;
+        node->lfn_slots = record->lfn_slots;
+        node->content_hash = record->content_hash;
+        node->in_arena = true;
+
+        if (record->first_child != FAT_INDEX_NONE) {
+            uint32_t child = record->first_child;
+            if (child <= i || child >= count || table[child].parent != i || linked[child]) {
+                valid = false;
+                break;
+            }
+            linked[child] = 1;
+            node->children = &nodes[child];
+        }
+        if (record->next != FAT_INDEX_NONE) {
+            uint32_t next = record->next;
+            if (i == 0 || next <= i || next >= count || table[next].parent != record->parent || linked[next]) {
+                valid = false;
+                break;
+            }
+            linked[next] = 1;
+            node->next = &nodes[next];
+        }
+        if (i > 0) {
+            node->parent = &nodes[record->parent];
+        }
+    }
+
+    for (uint32_t i = 1; valid && i < count; i++) {
+        if (!linked[i]) valid = false;
+    }
+    free(linked);
+
+    if (!valid) {
+        free(nodes);
+        return -1;
+    }
+
+    driver->index_nodes = nodes;
+    driver->index_node_count = count;
+    driver->root_directory = &nodes[0];
+    return 0;
+}
@@ -11,6 +11,11 @@
 #define FAT16_EOC 0xFFFF     /**< End of cluster chain for FAT16 */
 #define FAT32_EOC 0x0FFFFFFF /**< End of cluster chain for FAT32 */
 
+#define FSINFO_LEAD_SIGNATURE   0x41615252 /**< FSInfo lead signature */
+#define FSINFO_STRUCT_SIGNATURE 0x61417272 /**< FSInfo structure signature */
+#define FSINFO_TRAIL_SIGNATURE  0xAA550000 /**< FSInfo trail signature */
+#define FSINFO_UNKNOWN          0xFFFFFFFF /**< Free count / hint not known */
+
 #define FAT_ATTR_READ_ONLY  0x01 /**< Read-only attribute */
 #define FAT_ATTR_HIDDEN     0x02 /**< Hidden attribute */
 #define FAT_ATTR_SYSTEM     0x04 /**< System attribute */
@@ -38,6 +43,50 @@ typedef struct {
     uint32_t file_size;        /**< File size (bytes) */
 } FATDirEntry;
 
+/**
+ * Initial value of fat_driver_hash_bytes() (FNV-1a 64-bit offset basis)
+ */
+#define FAT_HASH_SEED 0xCBF29CE484222325ULL
+
+/**
+ * Number of directory entries classified together
+ */
+#define FAT_SCAN_GROUP 16
+
+/**
+ * Classification of a group of directory entries, bit i describes entry i
+ */
+typedef struct {
+    uint32_t live;             /**< Files and directories to turn into nodes */
+    uint32_t lfn;              /**< Long file name entries */
+    uint32_t free;             /**< 0x00 and 0xE5 entries */
+    uint32_t end;              /**< Index of the first 0x00 entry, the group size if none */
+} FatEntryMask;
+
+/**
+ * Reason a cluster chain walk stopped
+ */
+typedef enum {
+    FAT_CHAIN_OK = 0,          /**< Walk still in progress */
+    FAT_CHAIN_END,             /**< End-of-chain marker reached */
+    FAT_CHAIN_BAD,             /**< Free, reserved, bad or out-of-range entry */
+    FAT_CHAIN_CYCLE,           /**< Chain loops back on itself */
+    FAT_CHAIN_TOO_LONG         /**< More hops than there are clusters */
+} FatChainStatus;
+
+/**
+ * Bounded walk over a cluster chain, see fat_driver_chain_next()
+ */
+typedef struct {
+    FATDriver* driver;         /**< Driver the FAT is read from */
+    uint32_t next;             /**< Next cluster, read ahead from the FAT */
+    uint32_t end_of_chain;     /**< Smallest end-of-chain value of the FAT type */
+    uint32_t hops;             /**< Clusters returned so far */
+    uint32_t power;            /**< Hop count at which mark moves next */
+    uint32_t mark;             /**< Cluster later hops are compared against */
+    FatChainStatus status;     /**< FAT_CHAIN_OK until the walk stops */
+} FatChainIterator;
+
 /**
  * Internal functions for FAT Driver
  */
@@ -46,9 +95,59 @@ typedef struct {
 // int fat_driver_load_root_directory(FATDriver* driver);
 // int fat_driver_build_directory_tree(FATDriver* driver);
 int fat_driver_build_directory_tree_recursive(FATDriver* driver, FileNode* directory);
+void fat_driver_read_lock(FATDriver* driver);
+void fat_driver_read_unlock(FATDriver* driver);
+void fat_driver_write_lock(FATDriver* driver);
+void fat_driver_write_unlock(FATDriver* driver);
+void fat_driver_forget_subtree(FATDriver* driver, const FileNode* node, FileNode* replacement);
+void fat_driver_replace_directory(FATDriver* driver, const FileNode* node, FileNode* replacement);
+void fat_driver_retire_node(FATDriver* driver, FileNode* node, bool whole_subtree);
+void fat_driver_reclaim(FATDriver* driver);
+void fat_driver_free_retired(FATDriver* driver);
+FileNode* fat_driver_resolve_path(FATDriver* driver, FileNode* current, const char* path);
+void fat_driver_sort_invalidate(FATDriver* driver, FileNode* directory);
+void fat_driver_sort_free(FatSortCache* cache);
+int fat_driver_sync_unlocked(FATDriver* driver);
+int fat_driver_allocate_clusters_unlocked(FATDriver* driver, uint32_t count, uint32_t prev_cluster,
+                                          uint32_t* first_cluster);
+int fat_driver_free_chain_unlocked(FATDriver* driver, uint32_t first_cluster);
+int fat_driver_scan_directory(FATDriver* driver, FileNode* directory, FileNodeArena* arena, bool through_cache);
 uint32_t fat_driver_get_next_cluster(FATDriver* driver, uint32_t current_cluster);
 uint32_t fat_driver_get_fat_entry(FATDriver* driver, uint32_t cluster);
 void fat_driver_fill_file_node(FATDriver* driver, FileNode* node, const FATDirEntry* entry);
+void fat_driver_adjust_free_clusters(FATDriver* driver, int32_t delta, uint32_t next_free);
+uint32_t fat_driver_read_fat_entry(FATDriver* driver, uint32_t cluster);
+uint32_t fat_driver_fat_offset(FATDriver* driver, uint32_t cluster);
+int fat_driver_read_fat_bytes(FATDriver* driver, uint32_t offset, uint8_t* buffer, uint32_t length);
+int fat_driver_set_fat_entry(FATDriver* driver, uint32_t cluster, uint32_t value);
+uint32_t fat_driver_end_of_chain(FATDriver* driver);
+void fat_driver_chain_begin(FatChainIterator* chain, FATDriver* driver, uint32_t first_cluster);
+bool fat_driver_chain_next(FatChainIterator* chain, uint32_t* cluster);
+int fat_driver_flush_fat(FATDriver* driver);
+void fat_driver_free_dirty_ranges(FATDriver* driver);
+void fat_driver_classify_entries(const uint8_t* entries, uint32_t count, FatEntryMask* mask);
+FatSlotIndex* fat_driver_slot_index_create(void);
+int fat_driver_slot_index_add_cluster(FatSlotIndex* index, uint32_t cluster);
+int fat_driver_slot_index_add_slot(FatSlotIndex* index, bool is_free, bool is_end);
+void fat_driver_slot_index_finish(FatSlotIndex* index);
+void fat_driver_slot_index_free(FatSlotIndex* index);
+FileNode* fat_driver_slot_index_find_name(const FatSlotIndex* index, const char* name, size_t length);
+const FatSlotIndex* fat_driver_slot_index_share_names(FATDriver* driver, FileNode* directory);
+int fat_driver_relink_entry(FATDriver* driver, FileNode* node, uint32_t first_cluster);
+FileNode* fat_driver_create_entry_unlocked(FATDriver* driver, FileNode* parent, const char* name,
+                                           FileType type, uint32_t first_cluster, uint32_t size, time_t when);
+int fat_driver_delete_entry_unlocked(FATDriver* driver, FileNode* node);
+int fat_driver_make_short_name(const char* name, uint8_t short_name[11]);
+void fat_driver_encode_time(time_t now, uint16_t* date, uint16_t* time_value);
+int fat_driver_build_run_index(FATDriver* driver);
+void fat_driver_free_run_index(FATDriver* driver);
+uint32_t fat_driver_run_index_lookup(const FATDriver* driver, uint32_t cluster);
+uint64_t fat_driver_hash_bytes(uint64_t hash, const void* data, size_t length);
+uint64_t fat_driver_hash_mix(uint64_t hash);
+int fat_driver_index_key(FATDriver* driver, FatIndexKey* key);
+int fat_driver_index_load(FATDriver* driver, const FatIndexKey* key);
+int fat_driver_index_save(FATDriver* driver, const FatIndexKey* key);
+void fat_driver_index_release(FATDriver* driver);
 
 #endif // FAT_DRIVER_PRIVATE_H
 
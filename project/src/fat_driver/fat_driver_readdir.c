@@ -0,0 +1,194 @@
+/**
+ * @file fat_driver_readdir.c
+ * @brief Directory streams read straight from the directory clusters
+ * @details A stream walks the cluster chain of one directory and keeps a
+ *          single sector in memory. Entries are classified a group at a time
+ *          like during the tree build, and the stream stops at the 0x00
+ *          end-of-directory marker. Each call takes the driver lock only for
+ *          its own reads, so a directory changed between two calls is read
+ *          as it is on the volume at the time of each call.
+ * @date 2026-10-18
+ * @author Le Duc Son
+ */
+#include "fat_driver.h"
+#include "fat_driver_private.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * State of an open directory stream
+ */
+struct FatDir {
+    FATDriver* driver;         /**< Driver the directory belongs to */
+    FatChainIterator chain;    /**< Walk over the directory clusters */
+    bool fixed_root;           /**< FAT12/16 root directory, outside the data area */
+    uint32_t sector;           /**< Next sector to read */
+    uint32_t sectors_left;     /**< Sectors left in the current cluster */
+    uint32_t sector_size;      /**< Bytes per sector */
+    uint32_t entry;            /**< Next entry of the buffer */
+    uint32_t entry_count;      /**< Entries in the buffer, 0 if it is empty */
+    uint32_t slot;             /**< Slot of the next entry in the directory */
+    FatEntryMask mask;         /**< Classification of the group holding the next entry */
+    bool end;                  /**< End of the directory reached */
+    bool failed;               /**< A read failed or the chain loops */
+    uint8_t buffer[];          /**< Current sector */
+};
+
+/* Local functions */
+static int fat_driver_readdir_fill(FatDir* dir);
+static void fat_driver_fill_dirent(FATDriver* driver, FatDirent* entry, const FATDirEntry* raw, uint32_t slot);
+
+/**
+ * Opens a directory stream.
+ *
+ * @param driver Pointer to the FATDriver structure.
+ * @param first_cluster First cluster of the directory, 0 for the root.
+ * @return Directory stream, NULL if failed.
+ */
+FatDir* fat_driver_opendir(FATDriver* driver, uint32_t first_cluster) {
+    if (!driver || !driver->hal) return NULL;
+
+    uint32_t sector_size = hal_get_sector_size(driver->hal);
+    FatDir* dir = calloc(1, sizeof(FatDir) + sector_size);
+    if (!dir) return NULL;
+
+    dir->driver = driver;
+    dir->sector_size = sector_size;
+
+    if (first_cluster == 0 && fat_driver_get_fat_type(driver) != FAT_TYPE_32) {
+        dir->fixed_root = true;
+        dir->sector = driver->first_root_dir_sector;
+        dir->sectors_left = driver->root_dir_sectors;
+    } else {
+        if (first_cluster == 0) first_cluster = driver->boot_sector.root_cluster;
+        fat_driver_chain_begin(&dir->chain, driver, first_cluster);
+    }
+
+    return dir;
+}
+
+/**
+ * Reads the next entry of a directory stream.
+ *
+ * @param dir Directory stream.
+ * @param entry Pointer to store the entry.
+ * @return 1 if an entry was read, 0 at the end of the directory, -1 if failed.
+ */
+int fat_driver_readdir(FatDir* dir, FatDirent* entry) {
+    return fat_driver_readdir_batch(dir, entry, 1);
+}
+
+/**
+ * Reads up to max entries of a directory stream.
+ *
+ * The driver lock is held for the whole batch, so a larger batch takes it
+ * fewer times.
+ *
+ * @param dir Directory stream.
+ * @param entries Array of max entries.
+ * @param max Number of entries wanted.
+ * @return Number of entries read, 0 at the end of the directory, -1 if failed.
+ */
+int fat_driver_readdir_batch(FatDir* dir, FatDirent* entries, uint32_t max) {
+    if (!dir || !entries) return -1;
+    if (dir->failed) return -1;
+
+    FATDriver* driver = dir->driver;
+    uint32_t count = 0;
+
+    fat_driver_read_lock(driver);
+    while (count < max && !dir->end) {
+        if (dir->entry == dir->entry_count) {
+            if (fat_driver_readdir_fill(dir) != 0) break;
+            continue;
+        }
+
+        /* Classify a new group when the stream enters it */
+        uint32_t in_group = dir->entry % FAT_SCAN_GROUP;
+        if (in_group == 0) {
+            uint32_t group_size = dir->entry_count - dir->entry;
+            if (group_size > FAT_SCAN_GROUP) group_size = FAT_SCAN_GROUP;
+            fat_driver_classify_entries(dir->buffer + dir->entry * 32, group_size, &dir->mask);
+        }
+
+        if (in_group >= dir->mask.end) {
+            dir->end = true;
+            break;
+        }
+        if (dir->mask.live & (1u << in_group)) {
+            fat_driver_fill_dirent(driver, &entries[count++],
+                                   (const FATDirEntry*)(dir->buffer + dir->entry * 32), dir->slot);
+        }
+        dir->entry++;
+        dir->slot++;
+    }
+    fat_driver_read_unlock(driver);
+
+    /* Entries read before a failure are still returned */
+    if (count == 0 && dir->failed) return -1;
+    return (int)count;
+}
+
+/**
+ * Closes a directory stream.
+ *
+ * @param dir Directory stream, may be NULL.
+ */
+void fat_driver_closedir(FatDir* dir) {
+    free(dir);
+}
+
+/**
+ * Reads the next sector of the directory into the buffer, moving to the next
+ * cluster when needed. Called with the read lock held.
+ *
+ * @return 0 if a sector was read, -1 at the end of the directory or on failure.
+ */
+static int fat_driver_readdir_fill(FatDir* dir) {
+    FATDriver* driver = dir->driver;
+
+    if (dir->sectors_left == 0) {
+        uint32_t cluster;
+        if (dir->fixed_root || !fat_driver_chain_next(&dir->chain, &cluster)) {
+            /* A looping chain is an error, a short one just ends the directory */
+            if (!dir->fixed_root &&
+                (dir->chain.status == FAT_CHAIN_CYCLE || dir->chain.status == FAT_CHAIN_TOO_LONG)) {
+                dir->failed = true;
+            }
+            dir->end = true;
+            return -1;
+        }
+        dir->sector = fat_driver_cluster_to_sector(driver, cluster);
+        dir->sectors_left = driver->boot_sector.sectors_per_cluster;
+    }
+
+    uint32_t read_bytes = block_cache_read(driver->cache, driver->hal, dir->sector, dir->buffer);
+    if (read_bytes != dir->sector_size) {
+        dir->failed = true;
+        dir->end = true;
+        return -1;
+    }
+
+    dir->sector++;
+    dir->sectors_left--;
+    dir->entry = 0;
+    dir->entry_count = dir->sector_size / 32;
+    return 0;
+}
+
+/**
+ * Fills a stream entry from a short directory entry.
+ */
+static void fat_driver_fill_dirent(FATDriver* driver, FatDirent* entry, const FATDirEntry* raw, uint32_t slot) {
+    FileNode node;
+    fat_driver_fill_file_node(driver, &node, raw);
+
+    memset(entry, 0, sizeof(FatDirent));
+    memcpy(entry->name, node.name, FAT_DIRENT_NAME_MAX);
+    entry->type = node.type;
+    entry->size = node.size;
+    entry->first_cluster = node.first_cluster;
+    entry->created_time = node.created_time;
+    entry->modified_time = node.modified_time;
+    entry->entry_slot = slot;
+}
@@ -0,0 +1,164 @@
+/**
+ * @file fat_driver_scan.c
+ * @brief Classification of directory entries a group at a time
+ * @details The first name byte, the next two name bytes and the attribute
+ *          byte of 16 consecutive 32-byte entries are gathered into vector
+ *          lanes and compared together; the results come back as bitmasks
+ *          with one bit per entry. The gather loads the first 16 bytes of
+ *          each entry whole, keeps bytes 0-2 and 11 of each as one 32-bit
+ *          word with shuffles and masks, then transposes the 16 words into
+ *          one vector per byte with unpacks. Builds without SSE2 use an
+ *          equivalent scalar loop.
+ * @date 2026-10-18
+ * @author Le Duc Son
+ */
+#include "fat_driver.h"
+#include "fat_driver_private.h"
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* Local functions */
+static uint32_t fat_driver_first_zero(uint32_t zero_mask, uint32_t count);
+
+#if defined(__SSE2__)
+
+/**
+ * Words holding bytes 0-2 and byte 11 of four consecutive entries. Bytes
+ * 0-3 and 8-11 of each entry are picked with two shuffles, then byte 11
+ * replaces byte 3.
+ */
+static inline __m128i fat_driver_scan_words(const uint8_t* e) {
+    __m128 low = _mm_shuffle_ps(_mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(e + 0 * 32))),
+                                _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(e + 1 * 32))),
+                                _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 high = _mm_shuffle_ps(_mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(e + 2 * 32))),
+                                 _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(e + 3 * 32))),
+                                 _MM_SHUFFLE(2, 0, 2, 0));
+    __m128i name = _mm_castps_si128(_mm_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0)));
+    __m128i attributes = _mm_castps_si128(_mm_shuffle_ps(low, high, _MM_SHUFFLE(3, 1, 3, 1)));
+    __m128i keep = _mm_set1_epi32(0x00FFFFFF);
+    return _mm_or_si128(_mm_and_si128(name, keep), _mm_andnot_si128(keep, attributes));
+}
+
+/**
+ * Classifies up to FAT_SCAN_GROUP directory entries.
+ *
+ * @param entries First entry of the group.
+ * @param count Number of entries (at most FAT_SCAN_GROUP).
+ * @param mask Pointer to store the classification.
+ */
+void fat_driver_classify_entries(const uint8_t* entries, uint32_t count, FatEntryMask* mask) {
+    uint8_t group[FAT_SCAN_GROUP * 32];
+    const uint8_t* e = entries;
+
+    if (count < FAT_SCAN_GROUP) {
+        /* Pad a short group with end markers, they are masked off below */
+        memcpy(group, entries, count * 32);
+        memset(group + count * 32, 0, (FAT_SCAN_GROUP - count) * 32);
+        e = group;
+    }
+
+    /* Entries 4k..4k+3 per vector, then bytes of entries 0-7 and 8-15 interleaved */
+    __m128i w0 = fat_driver_scan_words(e + 0 * 32);
+    __m128i w1 = fat_driver_scan_words(e + 4 * 32);
+    __m128i w2 = fat_driver_scan_words(e + 8 * 32);
+    __m128i w3 = fat_driver_scan_words(e + 12 * 32);
+    __m128i t0 = _mm_unpacklo_epi8(w0, w1);
+    __m128i t1 = _mm_unpackhi_epi8(w0, w1);
+    __m128i t2 = _mm_unpacklo_epi8(w2, w3);
+    __m128i t3 = _mm_unpackhi_epi8(w2, w3);
+    __m128i u0 = _mm_unpacklo_epi8(t0, t1);
+    __m128i u1 = _mm_unpackhi_epi8(t0, t1);
+    __m128i u2 = _mm_unpacklo_epi8(t2, t3);
+    __m128i u3 = _mm_unpackhi_epi8(t2, t3);
+    __m128i v0 = _mm_unpacklo_epi8(u0, u1);
+    __m128i v1 = _mm_unpackhi_epi8(u0, u1);
+    __m128i v2 = _mm_unpacklo_epi8(u2, u3);
+    __m128i v3 = _mm_unpackhi_epi8(u2, u3);
+
+    /* One byte of the 16 entries per vector, entry i in lane i */
+    __m128i first = _mm_unpacklo_epi64(v0, v2);
+    __m128i second = _mm_unpackhi_epi64(v0, v2);
+    __m128i third = _mm_unpacklo_epi64(v1, v3);
+    __m128i attributes = _mm_unpackhi_epi64(v1, v3);
+
+    __m128i space = _mm_set1_epi8(' ');
+    __m128i dot = _mm_set1_epi8('.');
+
+    __m128i zero = _mm_cmpeq_epi8(first, _mm_setzero_si128());
+    __m128i deleted = _mm_cmpeq_epi8(first, _mm_set1_epi8((char)0xE5));
+    __m128i lfn = _mm_cmpeq_epi8(attributes, _mm_set1_epi8(FAT_ATTR_LFN));
+    __m128i volume = _mm_cmpeq_epi8(_mm_and_si128(attributes, _mm_set1_epi8(FAT_ATTR_VOLUME_ID)),
+                                    _mm_set1_epi8(FAT_ATTR_VOLUME_ID));
+
+    /* "." is '.' then ' ', ".." is '.', '.', ' ' */
+    __m128i first_dot = _mm_cmpeq_epi8(first, dot);
+    __m128i dot_entry = _mm_cmpeq_epi8(second, space);
+    __m128i dot_dot_entry = _mm_and_si128(_mm_cmpeq_epi8(second, dot), _mm_cmpeq_epi8(third, space));
+    __m128i dots = _mm_and_si128(first_dot, _mm_or_si128(dot_entry, dot_dot_entry));
+
+    uint32_t valid = (1u << count) - 1;
+    uint32_t zero_mask = (uint32_t)_mm_movemask_epi8(zero) & valid;
+    uint32_t free_mask = zero_mask | ((uint32_t)_mm_movemask_epi8(deleted) & valid);
+    uint32_t lfn_mask = (uint32_t)_mm_movemask_epi8(lfn) & valid & ~free_mask;
+    uint32_t skip_mask = (uint32_t)_mm_movemask_epi8(_mm_or_si128(volume, dots)) & valid;
+
+    mask->free = free_mask;
+    mask->lfn = lfn_mask;
+    mask->live = valid & ~free_mask & ~lfn_mask & ~skip_mask;
+    mask->end = fat_driver_first_zero(zero_mask, count);
+}
+
+#else
+
+/**
+ * Classifies up to FAT_SCAN_GROUP directory entries (scalar version).
+ *
+ * @param entries First entry of the group.
+ * @param count Number of entries (at most FAT_SCAN_GROUP).
+ * @param mask Pointer to store the classification.
+ */
+void fat_driver_classify_entries(const uint8_t* entries, uint32_t count, FatEntryMask* mask) {
+    uint32_t zero_mask = 0;
+
+    mask->live = 0;
+    mask->lfn = 0;
+    mask->free = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        const FATDirEntry* entry = (const FATDirEntry*)(entries + i * 32);
+        uint32_t bit = 1u << i;
+
+        if (entry->name[0] == 0x00 || entry->name[0] == (uint8_t)0xE5) {
+            mask->free |= bit;
+            if (entry->name[0] == 0x00) zero_mask |= bit;
+        } else if (entry->attributes == FAT_ATTR_LFN) {
+            mask->lfn |= bit;
+        } else if (!(entry->attributes & FAT_ATTR_VOLUME_ID) &&
+                   !(entry->name[0] == '.' && entry->name[1] == ' ') &&
+                   !(entry->name[0] == '.' && entry->name[1] == '.' && entry->name[2] == ' ')) {
+            mask->live |= bit;
+        }
+    }
+
+    mask->end = fat_driver_first_zero(zero_mask, count);
+}
+
+#endif
+
+/**
+ * Index of the lowest set bit of zero_mask, count if there is none.
+ */
+static uint32_t fat_driver_first_zero(uint32_t zero_mask, uint32_t count) {
+    if (zero_mask == 0) return count;
+
+    uint32_t index = 0;
+    while (!(zero_mask & 1u)) {
+        zero_mask >>= 1;
+        index++;
+    }
+    return index;
+}
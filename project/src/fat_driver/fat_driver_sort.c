@@ -0,0 +1,305 @@
+/**
+ * @file fat_driver_sort.c
+ * @brief Sorted directory listings
+ * @details The children of a directory are listed in the order they were
+ *          found. fat_driver_list_sorted() keeps, per directory, an array of
+ *          the children and one permutation of it per ordering, built with
+ *          an LSD radix sort the first time the ordering is asked for: one
+ *          counting pass per name byte for names, per key byte for sizes and
+ *          times. Size and time orders start from the name order, and each
+ *          pass is stable, so equal keys stay sorted by name. Passes where
+ *          every element has the same byte are skipped.
+ *
+ *          Writers drop the cache of a directory whose children changed,
+ *          after the change is published and before any node is retired.
+ *          The cache is built and read under sort_lock, so a listing never
+ *          mixes two versions of a directory.
+ * @date 2026-10-18
+ * @author Le Duc Son
+ */
+#include "fat_driver.h"
+#include "fat_driver_private.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Bytes of the packed modification time, see fat_driver_time_key()
+ */
+#define FAT_SORT_TIME_BYTES 7
+
+/* Local functions */
+static FatSortCache* fat_driver_sort_build_cache(const FileNode* directory);
+static int fat_driver_sort_build_order(FatSortCache* cache, FatSortKey key);
+static int fat_driver_sort_by_name(FatSortCache* cache, uint32_t* order, uint32_t* scratch, uint8_t* digits);
+static void fat_driver_radix_pass(uint32_t* order, uint32_t* scratch, uint32_t count, const uint8_t* digits);
+static void fat_driver_sort_copy(const FatSortCache* cache, FatSortKey key, bool reverse, FileNode** list);
+static uint64_t fat_driver_sort_value(const FileNode* node, FatSortKey key);
+
+/**
+ * Lists the children of a directory in a given order.
+ *
+ * @param driver Pointer to the FATDriver structure.
+ * @param directory Directory to list.
+ * @param key Ordering.
+ * @param reverse List from the last key to the first; children with equal
+ *        keys stay in name order.
+ * @param nodes Pointer to store an array of the children, to be released with
+ *        free(). NULL when the directory is empty. The nodes stay valid as
+ *        those returned by fat_driver_find_path().
+ * @param count Pointer to store the number of children.
+ * @return 0 if successful, -1 if failed.
+ */
+int fat_driver_list_sorted(FATDriver* driver, FileNode* directory, FatSortKey key, bool reverse,
+                           FileNode*** nodes, uint32_t* count) {
+    if (!driver || !directory || !nodes || !count) return -1;
+    if (directory->type != FILE_TYPE_DIRECTORY || key >= FAT_SORT_KEYS) return -1;
+
+    *nodes = NULL;
+    *count = 0;
+
+    int token = fat_driver_read_begin(driver);
+    pthread_mutex_lock(&driver->sort_lock);
+
+    int result = 0;
+    FatSortCache* cache = directory->sort_cache;
+    if (!cache) {
+        cache = fat_driver_sort_build_cache(directory);
+        directory->sort_cache = cache;
+    }
+
+    if (!cache || fat_driver_sort_build_order(cache, key) != 0) {
+        result = -1;
+    } else if (cache->count > 0) {
+        FileNode** list = malloc((size_t)cache->count * sizeof(FileNode*));
+        if (list) {
+            fat_driver_sort_copy(cache, key, reverse, list);
+            *nodes = list;
+            *count = cache->count;
+        } else {
+            result = -1;
+        }
+    }
+
+    pthread_mutex_unlock(&driver->sort_lock);
+    fat_driver_read_end(driver, token);
+
+    return result;
+}
+
+/**
+ * Drops the sort cache of a directory whose children changed. Called with the
+ * write lock held, after the change is published and before any unlinked
+ * node is retired.
+ *
+ * @param driver Pointer to the FATDriver structure.
+ * @param directory Directory that changed.
+ */
+void fat_driver_sort_invalidate(FATDriver* driver, FileNode* directory) {
+    if (!directory) return;
+
+    pthread_mutex_lock(&driver->sort_lock);
+    FatSortCache* cache = directory->sort_cache;
+    directory->sort_cache = NULL;
+    pthread_mutex_unlock(&driver->sort_lock);
+
+    fat_driver_sort_free(cache);
+}
+
+/**
+ * Frees a sort cache.
+ *
+ * @param cache Cache to free, may be NULL.
+ */
+void fat_driver_sort_free(FatSortCache* cache) {
+    if (!cache) return;
+
+    for (uint32_t key = 0; key < FAT_SORT_KEYS; key++) {
+        free(cache->order[key]);
+    }
+    free(cache->nodes);
+    free(cache);
+}
+
+/**
+ * Packs a date and time into an integer with the same order.
+ *
+ * @param time Date and time to pack.
+ * @return The packed value, 7 significant bytes.
+ */
+uint64_t fat_driver_time_key(const DateTime* time) {
+    return ((uint64_t)time->year << 40) | ((uint64_t)time->month << 32) | ((uint64_t)time->day << 24) |
+           ((uint64_t)time->hour << 16) | ((uint64_t)time->minute << 8) | (uint64_t)time->second;
+}
+
+/**
+ * Takes the children of a directory into a new cache, without any order.
+ */
+static FatSortCache* fat_driver_sort_build_cache(const FileNode* directory) {
+    FatSortCache* cache = calloc(1, sizeof(FatSortCache));
+    if (!cache) return NULL;
+
+    uint32_t count = 0;
+    for (FileNode* child = FAT_LOAD_LINK(directory->children); child; child = FAT_LOAD_LINK(child->next)) {
+        count++;
+    }
+
+    cache->nodes = malloc((count ? count : 1) * sizeof(FileNode*));
+    if (!cache->nodes) {
+        free(cache);
+        return NULL;
+    }
+
+    /* A child published since counting is left for the next cache */
+    uint32_t index = 0;
+    for (FileNode* child = FAT_LOAD_LINK(directory->children); child && index < count;
+         child = FAT_LOAD_LINK(child->next)) {
+        cache->nodes[index++] = child;
+    }
+    cache->count = index;
+
+    return cache;
+}
+
+/**
+ * Builds one ordering of a cache if it is not built yet. Size and time orders
+ * need the name order and build it first.
+ *
+ * @return 0 if successful, -1 if memory ran out.
+ */
+static int fat_driver_sort_build_order(FatSortCache* cache, FatSortKey key) {
+    if (cache->order[key]) return 0;
+    if (key != FAT_SORT_NAME && fat_driver_sort_build_order(cache, FAT_SORT_NAME) != 0) return -1;
+
+    uint32_t count = cache->count;
+    size_t length = count ? count : 1;
+    uint32_t* order = malloc(length * sizeof(uint32_t));
+    uint32_t* scratch = malloc(length * sizeof(uint32_t));
+    uint8_t* digits = malloc(length);
+    if (!order || !scratch || !digits) {
+        free(order);
+        free(scratch);
+        free(digits);
+        return -1;
+    }
+
+    int result = 0;
+    if (key == FAT_SORT_NAME) {
+        result = fat_driver_sort_by_name(cache, order, scratch, digits);
+    } else {
+        memcpy(order, cache->order[FAT_SORT_NAME], count * sizeof(uint32_t));
+        uint32_t bytes = (key == FAT_SORT_SIZE) ? sizeof(uint32_t) : FAT_SORT_TIME_BYTES;
+
+        for (uint32_t byte = 0; byte < bytes; byte++) {
+            for (uint32_t i = 0; i < count; i++) {
+                digits[i] = (uint8_t)(fat_driver_sort_value(cache->nodes[i], key) >> (byte * 8));
+            }
+            fat_driver_radix_pass(order, scratch, count, digits);
+        }
+    }
+
+    free(scratch);
+    free(digits);
+    if (result != 0) {
+        free(order);
+        return -1;
+    }
+
+    cache->order[key] = order;
+    return 0;
+}
+
+/**
+ * Sorts the children by name, from the last character position to the first.
+ * A name shorter than the position counts as a 0 byte there, which gives the
+ * strcmp() order.
+ *
+ * @return 0 if successful, -1 if memory ran out.
+ */
+static int fat_driver_sort_by_name(FatSortCache* cache, uint32_t* order, uint32_t* scratch, uint8_t* digits) {
+    uint32_t count = cache->count;
+    size_t longest = 0;
+
+    uint8_t* lengths = malloc(count ? count : 1);
+    if (!lengths) return -1;
+
+    for (uint32_t i = 0; i < count; i++) {
+        size_t length = strnlen(cache->nodes[i]->name, FILE_NAME_MAX);
+        order[i] = i;
+        lengths[i] = (uint8_t)length;
+        if (length > longest) longest = length;
+    }
+
+    for (size_t position = longest; position-- > 0;) {
+        for (uint32_t i = 0; i < count; i++) {
+            digits[i] = (lengths[i] > position) ? (uint8_t)cache->nodes[i]->name[position] : 0;
+        }
+        fat_driver_radix_pass(order, scratch, count, digits);
+    }
+
+    free(lengths);
+    return 0;
+}
+
+/**
+ * One stable counting-sort pass of order by the digit of each element.
+ * Skipped when every element has the same digit.
+ */
+static void fat_driver_radix_pass(uint32_t* order, uint32_t* scratch, uint32_t count, const uint8_t* digits) {
+    uint32_t histogram[256] = {0};
+
+    for (uint32_t i = 0; i < count; i++) {
+        histogram[digits[i]]++;
+    }
+    if (count == 0 || histogram[digits[0]] == count) return;
+
+    uint32_t position = 0;
+    for (uint32_t digit = 0; digit < 256; digit++) {
+        uint32_t size = histogram[digit];
+        histogram[digit] = position;
+        position += size;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        scratch[histogram[digits[order[i]]]++] = order[i];
+    }
+    memcpy(order, scratch, count * sizeof(uint32_t));
+}
+
+/**
+ * Copies the children in one order. In reverse, runs of equal keys are taken
+ * from the last to the first but each run keeps its name order.
+ */
+static void fat_driver_sort_copy(const FatSortCache* cache, FatSortKey key, bool reverse, FileNode** list) {
+    const uint32_t* order = cache->order[key];
+    uint32_t count = cache->count;
+
+    if (!reverse) {
+        for (uint32_t i = 0; i < count; i++) {
+            list[i] = cache->nodes[order[i]];
+        }
+        return;
+    }
+
+    uint32_t out = 0;
+    uint32_t end = count;
+    while (end > 0) {
+        /* Names are unique, so by name every run is one child */
+        uint32_t start = end - 1;
+        if (key != FAT_SORT_NAME) {
+            uint64_t value = fat_driver_sort_value(cache->nodes[order[start]], key);
+            while (start > 0 && fat_driver_sort_value(cache->nodes[order[start - 1]], key) == value) start--;
+        }
+
+        for (uint32_t i = start; i < end; i++) {
+            list[out++] = cache->nodes[order[i]];
+        }
+        end = start;
+    }
+}
+
+/**
+ * Key of a child for the size and time orders
+ */
+static uint64_t fat_driver_sort_value(const FileNode* node, FatSortKey key) {
+    return (key == FAT_SORT_SIZE) ? node->size : fat_driver_time_key(&node->modified_time);
+}
@@ -0,0 +1,208 @@
+/**
+ * @file fat_driver_stat.c
+ * @brief Batched path lookups
+ * @details fat_driver_stat_many() sorts the paths so paths sharing
+ *          directories come one after another. Each path keeps the nodes
+ *          of the leading components it shares with the previous path and
+ *          only resolves the rest. A component is one probe of the name
+ *          table of its directory, the table writers keep for creates and
+ *          deletes. A directory without one gets it the first time a batch
+ *          looks into it, and keeps it, so the child list is walked once
+ *          per directory rather than once per batch.
+ *
+ *          The batch holds the driver read lock, so no writer changes the
+ *          tables or frees a node while it runs.
+ *
+ *          Paths with "." or ".." components, empty components, or deeper
+ *          than FAT_STAT_MAX_DEPTH are resolved one by one like
+ *          fat_driver_find_path().
+ * @date 2026-10-18
+ * @author Le Duc Son
+ */
+#include "fat_driver.h"
+#include "fat_driver_private.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Deepest path resolved by the batch, deeper paths are resolved one by one
+ */
+#define FAT_STAT_MAX_DEPTH 64
+
+/**
+ * Component of a path: a name inside the path string
+ */
+typedef struct {
+    const char* name;          /**< First character */
+    uint32_t length;           /**< Number of characters */
+} FatStatComponent;
+
+/* Local functions */
+static int fat_driver_compare_path(const void* a, const void* b);
+static int fat_driver_split_path(const char* path, FatStatComponent* components, uint32_t* count);
+static const FileNode* fat_driver_stat_child(FATDriver* driver, const FileNode* directory,
+                                             const FatStatComponent* component);
+static void fat_driver_fill_stat(FatStat* stat, const FileNode* node);
+
+/**
+ * Looks up many paths in one call.
+ *
+ * @param driver Pointer to the FATDriver structure.
+ * @param paths Paths to look up.
+ * @param count Number of paths.
+ * @param results Records filled in the order of paths. Nodes stay valid as
+ *        those returned by fat_driver_find_path(). Takes the driver read lock.
+ * @return Number of paths found, -1 if failed.
+ */
+int fat_driver_stat_many(FATDriver* driver, const char* const* paths, uint32_t count, FatStat* results) {
+    if (!driver || (!paths && count > 0) || (!results && count > 0)) return -1;
+    if (count == 0) return 0;
+
+    const char* const** order = malloc((size_t)count * sizeof(*order));
+    if (!order) return -1;
+
+    for (uint32_t i = 0; i < count; i++) {
+        order[i] = &paths[i];
+    }
+    qsort(order, count, sizeof(*order), fat_driver_compare_path);
+
+    FatStatComponent previous[FAT_STAT_MAX_DEPTH];
+    FatStatComponent current[FAT_STAT_MAX_DEPTH];
+    const FileNode* resolved[FAT_STAT_MAX_DEPTH + 1];
+    uint32_t previous_count = 0;
+    bool previous_absolute = false;
+    int found = 0;
+
+    fat_driver_read_lock(driver);
+    const FileNode* root = driver->root_directory;
+    const FileNode* cwd = FAT_LOAD_LINK(driver->current_directory);
+
+    for (uint32_t i = 0; i < count; i++) {
+        const char* path = *order[i];
+        FatStat* stat = &results[order[i] - paths];
+        const FileNode* node = NULL;
+        bool absolute = (path && path[0] == '/');
+        uint32_t depth = 0;
+
+        if (!path) {
+            previous_count = 0;
+        } else if (fat_driver_split_path(path, current, &depth) != 0) {
+            /* Not a plain path: no prefix to share */
+            node = fat_driver_resolve_path(driver, (FileNode*)cwd, path);
+            previous_count = 0;
+        } else {
+            /* Leading components shared with the previous path keep their nodes */
+            uint32_t shared = 0;
+            if (absolute == previous_absolute) {
+                while (shared < depth && shared < previous_count &&
+                       current[shared].length == previous[shared].length &&
+                       memcmp(current[shared].name, previous[shared].name, current[shared].length) == 0) {
+                    shared++;
+                }
+            }
+
+            resolved[0] = absolute ? root : cwd;
+            uint32_t level = shared;
+            while (level < depth && resolved[level]) {
+                const FileNode* parent = resolved[level];
+                const FileNode* child = NULL;
+                if (parent->type == FILE_TYPE_DIRECTORY) {
+                    child = fat_driver_stat_child(driver, parent, &current[level]);
+                }
+                resolved[++level] = child;
+            }
+            node = resolved[depth];
+
+            /* Only components with a node can be shared with the next path */
+            memcpy(previous, current, depth * sizeof(FatStatComponent));
+            previous_count = 0;
+            while (previous_count < depth && resolved[previous_count + 1]) previous_count++;
+            previous_absolute = absolute;
+        }
+
+        fat_driver_fill_stat(stat, node);
+        if (node) found++;
+    }
+
+    fat_driver_read_unlock(driver);
+
+    free(order);
+    return found;
+}
+
+/**
+ * qsort comparator for pointers into the path array, NULL paths first
+ */
+static int fat_driver_compare_path(const void* a, const void* b) {
+    const char* left = **(const char* const* const*)a;
+    const char* right = **(const char* const* const*)b;
+
+    if (!left || !right) return (left != NULL) - (right != NULL);
+    return strcmp(left, right);
+}
+
+/**
+ * Splits a path into its components. A single trailing '/' is ignored.
+ *
+ * @return 0 if successful, -1 for the paths fat_driver_resolve_path() has to
+ *         handle: "." or ".." components, empty or overlong components, and
+ *         paths deeper than FAT_STAT_MAX_DEPTH.
+ */
+static int fat_driver_split_path(const char* path, FatStatComponent* components, uint32_t* count) {
+    *count = 0;
+
+    const char* p = (path[0] == '/') ? path + 1 : path;
+    while (*p) {
+        const char* start = p;
+        while (*p && *p != '/') p++;
+        uint32_t length = (uint32_t)(p - start);
+        if (*p == '/') p++;
+
+        if (length == 0 || length > FILE_NAME_MAX || *count == FAT_STAT_MAX_DEPTH) return -1;
+        if ((length == 1 && start[0] == '.') || (length == 2 && start[0] == '.' && start[1] == '.')) {
+            return -1;
+        }
+
+        components[*count].name = start;
+        components[*count].length = length;
+        (*count)++;
+    }
+
+    return 0;
+}
+
+/**
+ * Finds a child by name in the name table of the directory. A directory that
+ * cannot get a table, when memory runs out, has its child list walked.
+ */
+static const FileNode* fat_driver_stat_child(FATDriver* driver, const FileNode* directory,
+                                             const FatStatComponent* component) {
+    const FatSlotIndex* index = fat_driver_slot_index_share_names(driver, (FileNode*)directory);
+    if (index) return fat_driver_slot_index_find_name(index, component->name, component->length);
+
+    for (const FileNode* child = FAT_LOAD_LINK(directory->children); child; child = FAT_LOAD_LINK(child->next)) {
+        if (strncmp(child->name, component->name, component->length) == 0 &&
+            child->name[component->length] == '\0') {
+            return child;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Fills a stat record, an empty one when node is NULL.
+ */
+static void fat_driver_fill_stat(FatStat* stat, const FileNode* node) {
+    memset(stat, 0, sizeof(FatStat));
+    if (!node) {
+        stat->type = FILE_TYPE_UNKNOWN;
+        return;
+    }
+
+    stat->node = node;
+    stat->type = node->type;
+    stat->size = node->size;
+    stat->first_cluster = node->first_cluster;
+    stat->created_time = node->created_time;
+    stat->modified_time = node->modified_time;
+}
@@ -0,0 +1,696 @@
+/**
+ * @file fat_driver_table.c
+ * @brief In-memory representations of the FAT and FAT modification
+ * @details The run index stores each chain segment of consecutive clusters
+ *          as one (start, length, next) record instead of one entry per
+ *          cluster. It is built with a single linear pass over the FAT when
+ *          the mount asks for it, answers next-cluster lookups with a binary
+ *          search, and is kept in step with every FAT entry written.
+ *
+ *          FAT modifications go into FAT #1 sectors in the block cache and
+ *          are recorded as dirty sector ranges. At sync the ranges are
+ *          written to all number_of_fats copies together in LBA order, so an
+ *          allocation-heavy operation costs a few large sequential writes.
+ * @date 2026-10-18
+ * @author Le Duc Son
+ */
+#include "fat_driver.h"
+#include "fat_driver_private.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Maximum number of FAT sectors gathered in memory per mirror write pass
+ */
+#define FAT_FLUSH_BATCH_SECTORS 2048
+
+/* Local functions */
+static int fat_driver_run_index_append(FATDriver* driver, uint32_t start, uint32_t length, uint32_t next);
+static int fat_driver_run_index_update(FATDriver* driver, uint32_t cluster, uint32_t value);
+static int fat_driver_write_fat_bytes(FATDriver* driver, uint32_t offset, const uint8_t* buffer, uint32_t length);
+static int fat_driver_mark_fat_dirty(FATDriver* driver, uint32_t sector);
+
+/**
+ * Builds the run index from FAT #1.
+ * 
+ * Clusters are visited once in order. A run grows while each entry points to
+ * the following cluster and is closed by the first entry that does not; that
+ * entry becomes the run's next value. Free clusters are not stored, so a
+ * lookup that misses every run returns 0 just like the on-disk FAT.
+ * 
+ * @param driver Pointer to the FATDriver structure.
+ * @return 0 if successful, -1 if failed (the driver keeps using the paged FAT).
+ */
+int fat_driver_build_run_index(FATDriver* driver) {
+    if (!driver) return -1;
+    
+    fat_driver_free_run_index(driver);
+    
+    uint32_t last_cluster = driver->total_clusters + 1;
+    uint32_t run_start = 0;
+    uint32_t run_length = 0;
+    
+    for (uint32_t cluster = 2; cluster <= last_cluster; cluster++) {
+        uint32_t entry = fat_driver_read_fat_entry(driver, cluster);
+        
+        if (run_length == 0) {
+            if (entry == 0) continue;
+            run_start = cluster;
+        }
+        run_length++;
+        
+        /* Keep growing while the chain moves to the very next cluster */
+        if (entry == cluster + 1 && cluster < last_cluster) continue;
+        
+        if (fat_driver_run_index_append(driver, run_start, run_length, entry) != 0) {
+            fat_driver_free_run_index(driver);
+            return -1;
+        }
+        run_length = 0;
+    }
+    
+    /* Give back the slack of the last doubling */
+    if (driver->fat_run_count > 0 && driver->fat_run_count < driver->fat_run_capacity) {
+        FatRun* runs = realloc(driver->fat_runs, driver->fat_run_count * sizeof(FatRun));
+        if (runs) {
+            driver->fat_runs = runs;
+            driver->fat_run_capacity = driver->fat_run_count;
+        }
+    }
+    
+    /* An empty FAT still needs a non-NULL index to be used */
+    if (!driver->fat_runs) {
+        driver->fat_runs = malloc(sizeof(FatRun));
+        if (!driver->fat_runs) return -1;
+        driver->fat_run_capacity = 1;
+    }
+    
+    return 0;
+}
+
+/**
+ * Frees the run index. FAT lookups fall back to the paged FAT.
+ * 
+ * @param driver Pointer to the FATDriver structure.
+ */
+void fat_driver_free_run_index(FATDriver* driver) {
+    if (!driver) return;
+    
+    free(driver->fat_runs);
+    driver->fat_runs = NULL;
+    driver->fat_run_count = 0;
+    driver->fat_run_capacity = 0;
+}
+
+/**
+ * Looks up a FAT entry in the run index.
+ * 
+ * @param driver Pointer to the FATDriver structure.
+ * @param cluster Cluster number.
+ * @return The FAT entry of the cluster, 0 if the cluster is free.
+ */
+uint32_t fat_driver_run_index_lookup(const FATDriver* driver, uint32_t cluster) {
+    if (!driver || !driver->fat_runs) return 0;
+    
+    /* Find the last run starting at or before the cluster */
+    uint32_t low = 0;
+    uint32_t high = driver->fat_run_count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (driver->fat_runs[mid].start <= cluster) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low == 0) return 0;
+    
+    const FatRun* run = &driver->fat_runs[low - 1];
+    uint32_t last = run->start + run->length - 1;
+    
+    if (cluster < last) return cluster + 1;
+    if (cluster == last) return run->next;
+    return 0;
+}
+
+/**
+ * Internal function to apply one FAT entry change to the run index.
+ * 
+ * The run holding the cluster is split around it into at most three records:
+ * the clusters before it, the cluster itself with its new value (none when it
+ * becomes free) and the clusters after it. The new records are then merged
+ * with each other and with the neighbouring runs wherever a chain moves on to
+ * the very next cluster, so the index answers every lookup as the FAT does.
+ * Extending a chain in place, as allocations do, leaves the number of runs
+ * unchanged.
+ * 
+ * @return 0 if successful, -1 if the index could not grow.
+ */
+static int fat_driver_run_index_update(FATDriver* driver, uint32_t cluster, uint32_t value) {
+    FatRun* runs = driver->fat_runs;
+    
+    /* Number of runs starting at or before the cluster */
+    uint32_t low = 0;
+    uint32_t high = driver->fat_run_count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (runs[mid].start <= cluster) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    
+    FatRun pieces[3];
+    uint32_t count = 0;
+    uint32_t first = low;
+    uint32_t removed = 0;
+    FatRun tail = { 0, 0, 0 };
+    
+    if (low > 0 && cluster < runs[low - 1].start + runs[low - 1].length) {
+        FatRun run = runs[low - 1];
+        first = low - 1;
+        removed = 1;
+        if (cluster > run.start) {
+            pieces[count].start = run.start;
+            pieces[count].length = cluster - run.start;
+            pieces[count].next = cluster;
+            count++;
+        }
+        if (cluster < run.start + run.length - 1) {
+            tail.start = cluster + 1;
+            tail.length = run.start + run.length - 1 - cluster;
+            tail.next = run.next;
+        }
+    }
+    if (value != 0) {
+        pieces[count].start = cluster;
+        pieces[count].length = 1;
+        pieces[count].next = value;
+        count++;
+    }
+    if (tail.length > 0) pieces[count++] = tail;
+    
+    /* Join records where one leads straight into the next */
+    uint32_t merged = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        FatRun* last = merged ? &pieces[merged - 1] : NULL;
+        if (last && last->start + last->length == pieces[i].start && last->next == pieces[i].start) {
+            last->length += pieces[i].length;
+            last->next = pieces[i].next;
+        } else {
+            pieces[merged++] = pieces[i];
+        }
+    }
+    count = merged;
+    
+    if (count > 0 && first > 0) {
+        FatRun* left = &runs[first - 1];
+        if (left->start + left->length == pieces[0].start && left->next == pieces[0].start) {
+            pieces[0].length += left->length;
+            pieces[0].start = left->start;
+            first--;
+            removed++;
+        }
+    }
+    if (count > 0 && first + removed < driver->fat_run_count) {
+        FatRun* right = &runs[first + removed];
+        FatRun* last = &pieces[count - 1];
+        if (last->start + last->length == right->start && last->next == right->start) {
+            last->length += right->length;
+            last->next = right->next;
+            removed++;
+        }
+    }
+    
+    /* Replace the removed runs by the new records */
+    uint32_t run_count = driver->fat_run_count - removed + count;
+    if (run_count > driver->fat_run_capacity) {
+        uint32_t capacity = driver->fat_run_capacity ? driver->fat_run_capacity * 2 : 256;
+        while (capacity < run_count) capacity *= 2;
+        runs = realloc(driver->fat_runs, capacity * sizeof(FatRun));
+        if (!runs) return -1;
+        driver->fat_runs = runs;
+        driver->fat_run_capacity = capacity;
+    }
+    memmove(&runs[first + count], &runs[first + removed],
+            (driver->fat_run_count - first - removed) * sizeof(FatRun));
+    memcpy(&runs[first], pieces, count * sizeof(FatRun));
+    driver->fat_run_count = run_count;
+    
+    return 0;
+}
+
+/** Internal function to append a run, doubling the array when full */
+static int fat_driver_run_index_append(FATDriver* driver, uint32_t start, uint32_t length, uint32_t next) {
+    if (driver->fat_run_count == driver->fat_run_capacity) {
+        uint32_t capacity = driver->fat_run_capacity ? driver->fat_run_capacity * 2 : 256;
+        FatRun* runs = realloc(driver->fat_runs, capacity * sizeof(FatRun));
+        if (!runs) return -1;
+        
+        driver->fat_runs = runs;
+        driver->fat_run_capacity = capacity;
+    }
+    
+    FatRun* run = &driver->fat_runs[driver->fat_run_count++];
+    run->start = start;
+    run->length = length;
+    run->next = next;
+    return 0;
+}
+
+/**
+ * Gets the end-of-chain marker written by this driver.
+ * 
+ * @param driver Pointer to the FATDriver structure.
+ * @return FAT12_EOC, FAT16_EOC or FAT32_EOC.
+ */
+uint32_t fat_driver_end_of_chain(FATDriver* driver) {
+    switch (fat_driver_get_fat_type(driver)) {
+        case FAT_TYPE_12: return FAT12_EOC;
+        case FAT_TYPE_16: return FAT16_EOC;
+        default:          return FAT32_EOC;
+    }
+}
+
+/**
+ * Starts a walk over the cluster chain beginning at first_cluster.
+ * 
+ * A first cluster of 0 is an empty chain.
+ * 
+ * @param chain Iterator to initialise.
+ * @param driver Pointer to the FATDriver structure.
+ * @param first_cluster First cluster of the chain.
+ */
+void fat_driver_chain_begin(FatChainIterator* chain, FATDriver* driver, uint32_t first_cluster) {
+    chain->driver = driver;
+    chain->next = first_cluster;
+    chain->end_of_chain = fat_driver_end_of_chain(driver) & ~0x7u;
+    chain->hops = 0;
+    chain->power = 1;
+    chain->mark = 0;
+    chain->status = FAT_CHAIN_OK;
+}
+
+/**
+ * Gets the next cluster of a chain walk.
+ * 
+ * Only clusters of the data area are returned; an end-of-chain marker stops
+ * the walk with FAT_CHAIN_END and any other value (free, reserved, bad or out
+ * of range) with FAT_CHAIN_BAD. At most total_clusters clusters are returned.
+ * Loops are found with Brent's method: the cluster at every power-of-two hop
+ * is kept and the walk stops with FAT_CHAIN_CYCLE when it comes back to it,
+ * within two turns of the loop. The successor is read before the cluster is
+ * returned, so the caller may rewrite its entry.
+ * 
+ * @param chain Iterator started by fat_driver_chain_begin().
+ * @param cluster Pointer to store the cluster.
+ * @return true if a cluster was returned, false once the walk has stopped.
+ */
+bool fat_driver_chain_next(FatChainIterator* chain, uint32_t* cluster) {
+    if (chain->status != FAT_CHAIN_OK) return false;
+    
+    FATDriver* driver = chain->driver;
+    uint32_t candidate = chain->next;
+    
+    if (candidate >= chain->end_of_chain || (candidate == 0 && chain->hops == 0)) {
+        chain->status = FAT_CHAIN_END;
+    } else if (candidate < 2 || candidate > driver->total_clusters + 1) {
+        chain->status = FAT_CHAIN_BAD;
+    } else if (candidate == chain->mark) {
+        chain->status = FAT_CHAIN_CYCLE;
+    } else if (chain->hops >= driver->total_clusters) {
+        chain->status = FAT_CHAIN_TOO_LONG;
+    }
+    if (chain->status != FAT_CHAIN_OK) return false;
+    
+    chain->hops++;
+    if (chain->hops == chain->power) {
+        chain->mark = candidate;
+        chain->power *= 2;
+    }
+    chain->next = fat_driver_get_next_cluster(driver, candidate);
+    
+    *cluster = candidate;
+    return true;
+}
+
+/**
+ * Sets an entry of the FAT.
+ * 
+ * The entry is changed in the cached FAT #1 sector and the sector is recorded
+ * as dirty; other FAT copies are only written by fat_driver_flush_fat(). The
+ * free cluster count follows entries that become used or free, and the run
+ * index, when the mount has one, is updated in place. If the index cannot
+ * grow it is dropped and lookups go back to the paged FAT for the rest of the
+ * mount; fat_run_fallbacks counts those.
+ * 
+ * @param driver Pointer to the FATDriver structure.
+ * @param cluster Cluster number.
+ * @param value New entry value.
+ * @return 0 if successful, -1 if failed.
+ */
+int fat_driver_set_fat_entry(FATDriver* driver, uint32_t cluster, uint32_t value) {
+    if (!driver || !driver->cache || driver->config.mode != MODE_READ_WRITE) return -1;
+    if (cluster < 2 || cluster > driver->total_clusters + 1) return -1;
+    
+    uint32_t old_value = fat_driver_read_fat_entry(driver, cluster);
+    uint32_t offset = fat_driver_fat_offset(driver, cluster);
+    FatType fat_type = fat_driver_get_fat_type(driver);
+    int result;
+    
+    if (fat_type == FAT_TYPE_12) {
+        uint8_t bytes[2];
+        if (fat_driver_read_fat_bytes(driver, offset, bytes, 2) != 0) return -1;
+        
+        uint16_t packed = (uint16_t)(bytes[0] | (bytes[1] << 8));
+        if (cluster & 0x1) {
+            packed = (uint16_t)((packed & 0x000F) | ((value & 0x0FFF) << 4));
+        } else {
+            packed = (uint16_t)((packed & 0xF000) | (value & 0x0FFF));
+        }
+        bytes[0] = (uint8_t)(packed & 0xFF);
+        bytes[1] = (uint8_t)(packed >> 8);
+        result = fat_driver_write_fat_bytes(driver, offset, bytes, 2);
+    } else if (fat_type == FAT_TYPE_16) {
+        uint16_t entry = (uint16_t)value;
+        result = fat_driver_write_fat_bytes(driver, offset, (const uint8_t*)&entry, 2);
+    } else {
+        /* The top 4 bits of a FAT32 entry are reserved and preserved */
+        uint32_t entry;
+        if (fat_driver_read_fat_bytes(driver, offset, (uint8_t*)&entry, 4) != 0) return -1;
+        entry = (entry & 0xF0000000) | (value & 0x0FFFFFFF);
+        result = fat_driver_write_fat_bytes(driver, offset, (const uint8_t*)&entry, 4);
+    }
+    
+    if (result != 0) return -1;
+    
+    /* The index holds entries as read back, reserved bits masked */
+    if (driver->fat_runs &&
+        fat_driver_run_index_update(driver, cluster, fat_driver_read_fat_entry(driver, cluster)) != 0) {
+        fat_driver_free_run_index(driver);
+        driver->fat_run_fallbacks++;
+    }
+    
+    if (old_value == 0 && value != 0) {
+        fat_driver_adjust_free_clusters(driver, -1, 0);
+    } else if (old_value != 0 && value == 0) {
+        fat_driver_adjust_free_clusters(driver, 1, 0);
+    }
+    
+    return 0;
+}
+
+/**
+ * Allocates a chain of free clusters.
+ * 
+ * The search starts at the next-free hint and wraps around once. The new
+ * clusters are linked in order, terminated with end-of-chain, and appended to
+ * prev_cluster when it is given. Nothing is allocated if the volume does not
+ * have enough free clusters.
+ * 
+ * @param driver Pointer to the FATDriver structure.
+ * @param count Number of clusters to allocate.
+ * @param prev_cluster Cluster to link the new chain after, 0 for a new chain.
+ * @param first_cluster Pointer to store the first allocated cluster.
+ * @return 0 if successful, -1 if failed.
+ */
+int fat_driver_allocate_clusters(FATDriver* driver, uint32_t count, uint32_t prev_cluster, uint32_t* first_cluster) {
+    if (!driver) return -1;
+    
+    fat_driver_write_lock(driver);
+    int result = fat_driver_allocate_clusters_unlocked(driver, count, prev_cluster, first_cluster);
+    fat_driver_write_unlock(driver);
+    
+    return result;
+}
+
+/** Internal function of fat_driver_allocate_clusters(), called with the write lock held */
+int fat_driver_allocate_clusters_unlocked(FATDriver* driver, uint32_t count, uint32_t prev_cluster,
+                                          uint32_t* first_cluster) {
+    if (!first_cluster || count == 0 || driver->config.mode != MODE_READ_WRITE) return -1;
+    if (driver->free_count_valid && driver->free_clusters < count) return -1;
+    
+    uint32_t last_cluster = driver->total_clusters + 1;
+    uint32_t end_of_chain = fat_driver_end_of_chain(driver);
+    uint32_t cluster = driver->next_free_cluster;
+    uint32_t previous = prev_cluster;
+    uint32_t allocated = 0;
+    
+    *first_cluster = 0;
+    
+    for (uint32_t scanned = 0; scanned < driver->total_clusters && allocated < count; scanned++, cluster++) {
+        if (cluster < 2 || cluster > last_cluster) cluster = 2;
+        if (fat_driver_read_fat_entry(driver, cluster) != 0) continue;
+        
+        if (fat_driver_set_fat_entry(driver, cluster, end_of_chain) != 0) break;
+        if (previous != 0 && fat_driver_set_fat_entry(driver, previous, cluster) != 0) {
+            /* Marked but not on the chain the rollback frees */
+            fat_driver_set_fat_entry(driver, cluster, 0);
+            break;
+        }
+        
+        if (allocated == 0) *first_cluster = cluster;
+        previous = cluster;
+        allocated++;
+    }
+    
+    if (allocated < count) {
+        /* Roll back a partial allocation */
+        if (*first_cluster != 0) {
+            if (prev_cluster != 0) fat_driver_set_fat_entry(driver, prev_cluster, end_of_chain);
+            fat_driver_free_chain_unlocked(driver, *first_cluster);
+            *first_cluster = 0;
+        }
+        return -1;
+    }
+    
+    fat_driver_adjust_free_clusters(driver, 0, cluster > last_cluster ? 2 : cluster);
+    return 0;
+}
+
+/**
+ * Releases a cluster chain.
+ * 
+ * Every cluster of the chain is marked free. The walk stops where
+ * fat_driver_chain_next() stops it, or at a cluster that is already free.
+ * 
+ * @param driver Pointer to the FATDriver structure.
+ * @param first_cluster First cluster of the chain.
+ * @return 0 if successful, -1 if failed.
+ */
+int fat_driver_free_chain(FATDriver* driver, uint32_t first_cluster) {
+    if (!driver) return -1;
+    
+    fat_driver_write_lock(driver);
+    int result = fat_driver_free_chain_unlocked(driver, first_cluster);
+    fat_driver_write_unlock(driver);
+    
+    return result;
+}
+
+/** Internal function of fat_driver_free_chain(), called with the write lock held */
+int fat_driver_free_chain_unlocked(FATDriver* driver, uint32_t first_cluster) {
+    if (driver->config.mode != MODE_READ_WRITE) return -1;
+    
+    FatChainIterator chain;
+    uint32_t cluster;
+    
+    fat_driver_chain_begin(&chain, driver, first_cluster);
+    while (fat_driver_chain_next(&chain, &cluster)) {
+        if (chain.next == 0) break; /* Already free */
+        if (fat_driver_set_fat_entry(driver, cluster, 0) != 0) return -1;
+    }
+    
+    if (first_cluster >= 2 && first_cluster < driver->next_free_cluster) {
+        fat_driver_adjust_free_clusters(driver, 0, first_cluster);
+    }
+    
+    return 0;
+}
+
+/**
+ * Writes the dirty FAT sectors to every FAT copy.
+ * 
+ * Dirty ranges are gathered from the cache in batches. Each batch is written
+ * to FAT #1, then FAT #2 and so on, so the writes of one sync move forward
+ * through the disk in LBA order and adjacent sectors go out as one request.
+ * 
+ * @param driver Pointer to the FATDriver structure.
+ * @return 0 if successful, -1 if failed.
+ */
+int fat_driver_flush_fat(FATDriver* driver) {
+    if (!driver || !driver->cache) return -1;
+    if (driver->fat_dirty_count == 0) return 0;
+    
+    uint32_t sector_size = hal_get_sector_size(driver->hal);
+    uint8_t* batch = malloc((size_t)FAT_FLUSH_BATCH_SECTORS * sector_size);
+    if (!batch) return -1;
+    
+    int result = 0;
+    uint32_t range = 0;
+    uint32_t range_done = 0; /* Sectors of the current range already flushed */
+    
+    while (range < driver->fat_dirty_count && result == 0) {
+        /* Gather ranges (or part of one) until the batch is full */
+        FatDirtyRange pieces[FAT_FLUSH_BATCH_SECTORS];
+        uint32_t piece_count = 0;
+        uint32_t used = 0;
+        
+        while (range < driver->fat_dirty_count && used < FAT_FLUSH_BATCH_SECTORS) {
+            FatDirtyRange* dirty = &driver->fat_dirty[range];
+            uint32_t take = dirty->count - range_done;
+            if (take > FAT_FLUSH_BATCH_SECTORS - used) take = FAT_FLUSH_BATCH_SECTORS - used;
+            
+            for (uint32_t i = 0; i < take; i++) {
+                uint32_t sector = driver->first_fat_sector + dirty->first + range_done + i;
+                if (block_cache_read(driver->cache, driver->hal, sector, 
+                                     batch + (size_t)(used + i) * sector_size) != (int)sector_size) {
+                    result = -1;
+                }
+            }
+            
+            pieces[piece_count].first = dirty->first + range_done;
+            pieces[piece_count].count = take;
+            piece_count++;
+            used += take;
+            
+            range_done += take;
+            if (range_done == dirty->count) {
+                range++;
+                range_done = 0;
+            }
+        }
+        if (result != 0) break;
+        
+        for (uint32_t copy = 0; copy < driver->boot_sector.number_of_fats && result == 0; copy++) {
+            uint32_t copy_start = driver->first_fat_sector + copy * driver->fat_size;
+            uint32_t offset = 0;
+            
+            for (uint32_t i = 0; i < piece_count; i++) {
+                int written = hal_write_sectors(driver->hal, copy_start + pieces[i].first, pieces[i].count,
+                                                batch + (size_t)offset * sector_size);
+                if (written != (int)(pieces[i].count * sector_size)) {
+                    result = -1;
+                    break;
+                }
+                offset += pieces[i].count;
+            }
+        }
+        
+        /* FAT #1 on disk now matches the cache */
+        for (uint32_t i = 0; i < piece_count && result == 0; i++) {
+            block_cache_mark_clean(driver->cache, driver->hal,
+                                   driver->first_fat_sector + pieces[i].first, pieces[i].count);
+        }
+    }
+    
+    free(batch);
+    
+    if (result == 0) {
+        driver->fat_dirty_count = 0;
+    }
+    return result;
+}
+
+/**
+ * Frees the dirty range list without writing anything.
+ * 
+ * @param driver Pointer to the FATDriver structure.
+ */
+void fat_driver_free_dirty_ranges(FATDriver* driver) {
+    if (!driver) return;
+    
+    free(driver->fat_dirty);
+    driver->fat_dirty = NULL;
+    driver->fat_dirty_count = 0;
+    driver->fat_dirty_capacity = 0;
+}
+
+/** Internal function to write bytes of FAT #1 through the cache and record the dirty sectors */
+static int fat_driver_write_fat_bytes(FATDriver* driver, uint32_t offset, const uint8_t* buffer, uint32_t length) {
+    uint32_t sector_size = hal_get_sector_size(driver->hal);
+    
+    if ((uint64_t)offset + length > (uint64_t)driver->fat_size * sector_size) {
+        return -1;
+    }
+    
+    while (length > 0) {
+        uint32_t sector = offset / sector_size;
+        uint32_t in_sector = offset % sector_size;
+        uint32_t chunk = sector_size - in_sector;
+        if (chunk > length) chunk = length;
+        
+        if (block_cache_write_bytes(driver->cache, driver->hal, driver->first_fat_sector + sector,
+                                    in_sector, buffer, chunk) != 0 ||
+            fat_driver_mark_fat_dirty(driver, sector) != 0) {
+            return -1;
+        }
+        
+        buffer += chunk;
+        offset += chunk;
+        length -= chunk;
+    }
+    
+    return 0;
+}
+
+/**
+ * Internal function to add a sector to the sorted dirty range list, merging
+ * it with its neighbours.
+ */
+static int fat_driver_mark_fat_dirty(FATDriver* driver, uint32_t sector) {
+    /* Find the first range that starts after the sector */
+    uint32_t low = 0;
+    uint32_t high = driver->fat_dirty_count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (driver->fat_dirty[mid].first <= sector) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    
+    FatDirtyRange* left = low > 0 ? &driver->fat_dirty[low - 1] : NULL;
+    FatDirtyRange* right = low < driver->fat_dirty_count ? &driver->fat_dirty[low] : NULL;
+    
+    if (left && sector < left->first + left->count) {
+        return 0; /* Already dirty */
+    }
+    
+    bool joins_left = left && left->first + left->count == sector;
+    bool joins_right = right && right->first == sector + 1;
+    
+    if (joins_left && joins_right) {
+        left->count += 1 + right->count;
+        memmove(right, right + 1, (driver->fat_dirty_count - low - 1) * sizeof(FatDirtyRange));
+        driver->fat_dirty_count--;
+        return 0;
+    }
+    if (joins_left) {
+        left->count++;
+        return 0;
+    }
+    if (joins_right) {
+        right->first--;
+        right->count++;
+        return 0;
+    }
+    
+    if (driver->fat_dirty_count == driver->fat_dirty_capacity) {
+        uint32_t capacity = driver->fat_dirty_capacity ? driver->fat_dirty_capacity * 2 : 16;
+        FatDirtyRange* ranges = realloc(driver->fat_dirty, capacity * sizeof(FatDirtyRange));
+        if (!ranges) return -1;
+        
+        driver->fat_dirty = ranges;
+        driver->fat_dirty_capacity = capacity;
+    }
+    
+    memmove(&driver->fat_dirty[low + 1], &driver->fat_dirty[low],
+            (driver->fat_dirty_count - low) * sizeof(FatDirtyRange));
+    driver->fat_dirty[low].first = sector;
+    driver->fat_dirty[low].count = 1;
+    driver->fat_dirty_count++;
+    return 0;
+}
@@ -10,7 +10,31 @@
 #define FAT_DRIVER_TYPES_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include <time.h>
 #include "../common/common_types.h"
+#include "../block_cache/block_cache.h"
+#include "../utilities/threadpool/threadpool.h"
+
+/**
+ * Maximum number of FAT sectors kept pinned in the cache
+ */
+#define FAT_PINNED_SECTORS_MAX 8
+
+/**
+ * Number of nodes in one node arena chunk
+ */
+#define FAT_NODE_ARENA_CHUNK 256
+
+/**
+ * Number of lock-free reader slots of a mounted volume
+ */
+#define FAT_READER_SLOTS 64
+
+/**
+ * Longest name returned by fat_driver_readdir() (8.3 name with the dot)
+ */
+#define FAT_DIRENT_NAME_MAX 12
 
 /**
  * Boot Sector structure
@@ -47,6 +71,55 @@ typedef struct {
     char fs_type[8];                /**< Offset 82-89: File system type */
 } BootSector;
 
+/**
+ * FSInfo sector structure (FAT32)
+ */
+typedef struct {
+    uint32_t lead_signature;        /**< Offset 0-3: Lead signature (0x41615252) */
+    uint32_t struct_signature;      /**< Offset 484-487: Structure signature (0x61417272) */
+    uint32_t free_count;            /**< Offset 488-491: Last known free cluster count */
+    uint32_t next_free;             /**< Offset 492-495: Hint for the next free cluster */
+    uint32_t trail_signature;       /**< Offset 508-511: Trail signature (0xAA550000) */
+} FSInfo;
+
+/**
+ * Run of consecutive clusters in a chain
+ */
+typedef struct {
+    uint32_t start;                 /**< First cluster of the run */
+    uint32_t length;                /**< Number of consecutive clusters */
+    uint32_t next;                  /**< FAT entry of the last cluster (next run or EOC) */
+} FatRun;
+
+/**
+ * Key that ties a sidecar mount index to the exact image it describes
+ */
+typedef struct {
+    uint32_t volume_id;             /**< Volume ID from the boot sector */
+    uint32_t total_clusters;        /**< Number of data clusters */
+    uint64_t image_size;            /**< Size of the image file in bytes */
+    int64_t image_mtime;            /**< Modification time of the image file (ns) */
+    uint64_t boot_hash;             /**< Hash of the boot sector and FSInfo */
+    uint64_t fat_sample_hash;       /**< Hash of sampled sectors of FAT #1 */
+} FatIndexKey;
+
+/**
+ * Origin of the directory tree of a mount
+ */
+typedef enum {
+    FAT_INDEX_UNUSED,               /**< Sidecar index disabled or not usable */
+    FAT_INDEX_LOADED,               /**< Tree materialised from the sidecar index */
+    FAT_INDEX_WRITTEN               /**< Tree scanned, sidecar index regenerated */
+} FatIndexState;
+
+/**
+ * Range of modified FAT sectors, relative to the start of a FAT copy
+ */
+typedef struct {
+    uint32_t first;                 /**< First dirty sector */
+    uint32_t count;                 /**< Number of dirty sectors */
+} FatDirtyRange;
+
 /**
  * Directory Entry structure
  */
@@ -80,6 +153,65 @@ typedef struct {
     uint16_t name3[2];              /**< Last 2 characters (Unicode) */
 } LFNEntry;
 
+/**
+ * Number of free-slot buckets: runs of 1..21 slots (an LFN name needs up to
+ * 20 entries plus the short entry) have exact buckets, the last holds longer runs
+ */
+#define FAT_SLOT_BUCKETS 23
+
+/**
+ * Marks an empty bucket or list end in FatSlotIndex
+ */
+#define FAT_SLOT_NONE 0xFFFFFFFF
+
+/**
+ * Free-slot index of a loaded directory (read-write mounts)
+ * 
+ * Runs of free (0x00/0xE5) 32-byte slots are kept in buckets by length with
+ * boundary tags at both ends of each run, so finding a run for a new entry
+ * and merging a freed entry with its neighbours are O(1). The children are
+ * also hashed by name once the first entry is created or deleted, so the
+ * duplicate check and the unlink of a deleted child are O(1) as well.
+ */
+typedef struct FatSlotIndex {
+    uint32_t slot_count;            /**< Number of slots in the directory */
+    uint32_t slot_capacity;         /**< Allocated length of the per-slot arrays */
+    uint32_t end_slot;              /**< First slot of the 0x00 end-of-directory region */
+    uint32_t free_slots;            /**< Number of free slots */
+    uint32_t* run_length;           /**< Length of the free run starting at a slot, 0 otherwise */
+    uint32_t* run_start;            /**< 1 + start of the free run ending at a slot, 0 otherwise */
+    uint32_t* run_next;             /**< Next run in the same bucket (valid at run starts) */
+    uint32_t* run_prev;             /**< Previous run in the same bucket (valid at run starts) */
+    uint32_t buckets[FAT_SLOT_BUCKETS]; /**< First run of each length class */
+    uint32_t* clusters;             /**< Directory clusters in chain order, NULL for the FAT12/16 root */
+    uint32_t cluster_count;         /**< Number of clusters */
+    uint32_t cluster_capacity;      /**< Allocated clusters */
+    uint32_t open_run;              /**< Start of the run being built at load, FAT_SLOT_NONE if none */
+    struct FileNode** names;        /**< Children by name, open addressing, NULL until first needed */
+    uint32_t name_capacity;         /**< Size of the name table, a power of two */
+    uint32_t name_count;            /**< Children in the name table */
+} FatSlotIndex;
+
+/**
+ * Orderings offered by fat_driver_list_sorted()
+ */
+typedef enum {
+    FAT_SORT_NAME = 0,              /**< By name */
+    FAT_SORT_SIZE,                  /**< By size, then name */
+    FAT_SORT_MTIME,                 /**< By modification time, then name */
+    FAT_SORT_KEYS                   /**< Number of orderings */
+} FatSortKey;
+
+/**
+ * Sorted orders of one directory's children, kept until the directory
+ * changes. Each order is built the first time it is asked for.
+ */
+typedef struct FatSortCache {
+    uint32_t count;                 /**< Number of children */
+    struct FileNode** nodes;        /**< Children in list order */
+    uint32_t* order[FAT_SORT_KEYS]; /**< Permutations of nodes, NULL until built */
+} FatSortCache;
+
 /**
  * File/Directory structure
  */
@@ -95,8 +227,202 @@ typedef struct FileNode {
     struct FileNode* parent;        /**< Parent directory */
     struct FileNode* children;      /**< List of children (if directory) */
     struct FileNode* next;          /**< Next node in same directory */
+    struct FileNode* prev;          /**< Previous node in same directory, kept while the parent has a name table */
+    uint32_t entry_slot;            /**< Slot of the short entry in the parent directory */
+    uint8_t lfn_slots;              /**< Number of LFN slots right before the short entry */
+    FatSlotIndex* slot_index;       /**< Free-slot index (directories, read-write mounts) */
+    uint64_t content_hash;          /**< Hash of the directory sectors and chain at the last scan */
+    FatSortCache* sort_cache;       /**< Sorted orders of the children (directories), NULL if none */
+    bool in_arena;                  /**< Memory belongs to a node arena, not malloc */
 } FileNode;
 
+/**
+ * Chunk of nodes handed out by a node arena
+ */
+typedef struct FileNodeArenaChunk {
+    struct FileNodeArenaChunk* next; /**< Previously filled chunk */
+    uint32_t used;                  /**< Nodes handed out from this chunk */
+    FileNode nodes[FAT_NODE_ARENA_CHUNK]; /**< Node storage */
+} FileNodeArenaChunk;
+
+/**
+ * Per-worker node allocator used by the parallel tree build. Nodes are
+ * released all at once at unmount.
+ */
+typedef struct {
+    FileNodeArenaChunk* chunks;     /**< Current chunk first */
+} FileNodeArena;
+
+/**
+ * Kind of problem found by fat_driver_check()
+ */
+typedef enum {
+    FAT_CHECK_BAD_CHAIN,            /**< Chain leaves the data area or ends on a free/bad entry (cluster, actual = entry) */
+    FAT_CHECK_CYCLE,                /**< Chain loops back on itself (cluster = loop start, actual = loop length) */
+    FAT_CHECK_CROSS_LINK,           /**< Chain runs into clusters of a chain with a lower first cluster (cluster = first shared, actual = shared count) */
+    FAT_CHECK_SIZE_MISMATCH,        /**< File size and chain length disagree (expected/actual in clusters) */
+    FAT_CHECK_LOST_CHAIN,           /**< Allocated chain no entry refers to (cluster = head, actual = length) */
+    FAT_CHECK_FAT_MISMATCH,         /**< FAT copy differs from FAT #1 (copy, sector, sectors) */
+    FAT_CHECK_FREE_COUNT            /**< FSInfo free count is wrong (expected = counted, actual = stored) */
+} FatCheckKind;
+
+/**
+ * One problem found by fat_driver_check()
+ */
+typedef struct {
+    FatCheckKind kind;              /**< Kind of problem */
+    const FileNode* node;           /**< File or directory concerned, NULL for volume-level problems */
+    uint32_t cluster;               /**< Cluster where the problem is, see FatCheckKind */
+    uint32_t expected;              /**< Expected value, see FatCheckKind */
+    uint32_t actual;                /**< Value found, see FatCheckKind */
+    uint32_t copy;                  /**< FAT_CHECK_FAT_MISMATCH: FAT copy that differs (1 = second FAT) */
+    uint32_t sector;                /**< FAT_CHECK_FAT_MISMATCH: first differing sector, from the start of the FAT */
+    uint32_t sectors;               /**< FAT_CHECK_FAT_MISMATCH: number of differing sectors */
+} FatCheckFinding;
+
+/**
+ * Result of fat_driver_check()
+ */
+typedef struct {
+    FatCheckFinding* findings;      /**< Problems found */
+    uint32_t finding_count;         /**< Number of problems */
+    uint32_t finding_capacity;      /**< Allocated problems */
+    uint32_t files;                 /**< Files checked */
+    uint32_t directories;           /**< Directories checked */
+    uint32_t used_clusters;         /**< Clusters owned by a file or directory */
+    uint32_t lost_clusters;         /**< Allocated clusters owned by nothing */
+    uint32_t free_clusters;         /**< Free clusters in FAT #1 */
+} FatCheckReport;
+
+/**
+ * Attributes of one path returned by fat_driver_stat_many()
+ */
+typedef struct {
+    const FileNode* node;           /**< Node found, NULL if the path does not exist */
+    FileType type;                  /**< File or directory */
+    uint32_t size;                  /**< Size in bytes */
+    uint32_t first_cluster;         /**< First cluster, 0 if none */
+    DateTime created_time;          /**< Creation time */
+    DateTime modified_time;         /**< Last modification time */
+} FatStat;
+
+/**
+ * One entry returned by fat_driver_readdir()
+ */
+typedef struct {
+    char name[FAT_DIRENT_NAME_MAX + 1]; /**< Name, lowercase as in FileNode */
+    FileType type;                  /**< File or directory */
+    uint32_t size;                  /**< Size in bytes */
+    uint32_t first_cluster;         /**< First cluster, 0 if none */
+    DateTime created_time;          /**< Creation time */
+    DateTime modified_time;         /**< Last modification time */
+    uint32_t entry_slot;            /**< Slot of the short entry in the directory */
+} FatDirent;
+
+/**
+ * Open directory stream, see fat_driver_opendir()
+ */
+typedef struct FatDir FatDir;
+
+/**
+ * Result of fat_driver_defrag()
+ */
+typedef struct {
+    uint32_t files;                 /**< Regular files with clusters */
+    uint32_t fragmented_before;     /**< Files in more than one extent before */
+    uint32_t fragmented_after;      /**< Files in more than one extent after */
+    uint32_t extents_before;        /**< Extents of all files before */
+    uint32_t extents_after;         /**< Extents of all files after */
+    uint32_t moved;                 /**< Files rewritten contiguously */
+    uint32_t skipped;               /**< Fragmented files left alone (damaged chain or no free run) */
+    uint32_t moved_clusters;        /**< Clusters copied */
+} FatDefragReport;
+
+/**
+ * Parent index of an imported entry that goes straight into the destination
+ */
+#define FAT_IMPORT_TOP UINT32_MAX
+
+/**
+ * One entry of a tree given to fat_driver_import(). A directory comes before
+ * every entry inside it.
+ */
+typedef struct {
+    const char* name;               /**< 8.3 name, any case */
+    FileType type;                  /**< FILE_TYPE_REGULAR or FILE_TYPE_DIRECTORY */
+    uint32_t parent;                /**< Index of the parent directory, FAT_IMPORT_TOP for the destination */
+    uint32_t size;                  /**< File size in bytes */
+    time_t modified;                /**< Modification time */
+    bool imported;                  /**< Set by fat_driver_import() when the entry was written */
+    bool invalid_name;              /**< Set by fat_driver_import() when the name has no 8.3 form */
+} FatImportEntry;
+
+/**
+ * Supplies the content of an imported file
+ * @param entries Entries given to fat_driver_import()
+ * @param index Index of the file
+ * @param offset Offset in the file
+ * @param buffer Buffer to fill with exactly size bytes
+ * @param size Number of bytes wanted
+ * @param user_data Value given to fat_driver_import()
+ * @return 0 if the buffer was filled, -1 if failed
+ */
+typedef int (*FatImportRead)(const FatImportEntry* entries, uint32_t index, uint32_t offset, void* buffer,
+                             uint32_t size, void* user_data);
+
+/**
+ * Result of fat_driver_import()
+ */
+typedef struct {
+    uint32_t files;                 /**< Files written */
+    uint32_t directories;           /**< Directories written */
+    uint32_t skipped;               /**< Entries left out: invalid or duplicate name, or inside one */
+    uint32_t invalid_names;         /**< Entries left out because their name has no 8.3 form */
+    uint32_t clusters;              /**< Clusters allocated */
+    uint32_t extents;               /**< Runs of consecutive clusters allocated */
+    uint32_t writes;                /**< Write requests issued for the data */
+} FatImportReport;
+
+/**
+ * Parameters of fat_driver_format()
+ */
+typedef struct {
+    uint64_t size;                  /**< Image size in bytes, rounded down to whole sectors */
+    FatType fat_type;               /**< FAT_TYPE_12, FAT_TYPE_16 or FAT_TYPE_32, FAT_TYPE_UNKNOWN to pick from the size */
+    uint32_t cluster_size;          /**< Cluster size in bytes, power of two up to 32 KiB, 0 to pick from the size */
+} FatFormatOptions;
+
+/**
+ * Result of fat_driver_format()
+ */
+typedef struct {
+    FatType fat_type;               /**< FAT type of the image */
+    uint32_t cluster_size;          /**< Cluster size in bytes */
+    uint32_t total_clusters;        /**< Data clusters */
+    uint32_t fat_sectors;           /**< Sectors of each FAT */
+    uint32_t first_data_sector;     /**< First sector of the data area */
+    uint32_t sectors_written;       /**< Sectors actually written, the rest of the image is a hole */
+} FatFormatReport;
+
+/**
+ * Epoch announced by one reader inside fat_driver_read_begin(), padded to a
+ * cache line so readers on different slots do not share one
+ */
+typedef struct {
+    atomic_uint_fast64_t epoch;     /**< Epoch the reader started in, 0 if the slot is free */
+    uint8_t padding[64 - sizeof(atomic_uint_fast64_t)]; /**< Pads the slot to a cache line */
+} FatReaderSlot;
+
+/**
+ * Node unlinked from the tree, freed once no reader can still see it
+ */
+typedef struct FatRetiredNode {
+    FileNode* node;                 /**< Unlinked node */
+    bool whole_subtree;             /**< Free the children too, not only the node */
+    uint64_t epoch;                 /**< Epoch the node was unlinked in */
+    struct FatRetiredNode* next;    /**< Node retired before this one */
+} FatRetiredNode;
+
 /**
  * FAT Driver structure
  */
@@ -104,18 +430,113 @@ typedef struct {
     HAL* hal;                       /**< Pointer to HAL */
     FileSystemConfig config;        /**< File system configuration */
     BootSector boot_sector;         /**< Boot sector */
-    uint32_t* fat_table;            /**< FAT table */
+    uint32_t fat_size;              /**< Number of sectors per FAT */
     uint32_t first_fat_sector;      /**< First sector of FAT */
     uint32_t first_data_sector;     /**< First sector of data area */
     uint32_t root_dir_sectors;      /**< Number of sectors of root directory (FAT12/16) */
     uint32_t first_root_dir_sector; /**< First sector of root directory (FAT12/16) */
     uint32_t data_sectors;          /**< Number of sectors of data area */
     uint32_t total_clusters;        /**< Total number of clusters */
+    FSInfo fs_info;                 /**< FSInfo sector as read at mount (FAT32) */
+    bool fs_info_valid;             /**< FSInfo signatures matched at mount */
+    bool fs_info_dirty;             /**< Free count or hint changed since last sync */
+    bool free_count_valid;          /**< free_clusters holds a trusted value */
+    uint32_t free_clusters;         /**< Number of free clusters */
+    uint32_t next_free_cluster;     /**< Hint for the next free cluster */
     FileNode* root_directory;       /**< Root directory */
     FileNode* current_directory;    /**< Current directory */
-    void* cache;                    /**< Cache */
-    uint32_t cache_size;            /**< Cache size */
+    BlockCache* cache;              /**< Sector cache, FAT sectors are paged in through it */
+    bool shared_cache;              /**< Cache belongs to the caller of fat_driver_init_shared() */
+    uint32_t cache_size;            /**< Cache size (sectors) */
+    uint32_t pinned_fat_sectors[FAT_PINNED_SECTORS_MAX]; /**< Hot FAT sectors pinned in the cache */
+    uint32_t pinned_fat_count;      /**< Number of pinned FAT sectors */
+    FatRun* fat_runs;               /**< Run index (FAT_TABLE_RUNS), sorted by start */
+    uint32_t fat_run_count;         /**< Number of runs */
+    uint32_t fat_run_capacity;      /**< Allocated runs */
+    uint32_t fat_run_fallbacks;     /**< Times the run index was dropped for lack of memory */
+    FatDirtyRange* fat_dirty;       /**< Modified FAT sectors, sorted and merged */
+    uint32_t fat_dirty_count;       /**< Number of dirty ranges */
+    uint32_t fat_dirty_capacity;    /**< Allocated dirty ranges */
+    ThreadPool* pool;               /**< Worker pool while mounted, NULL if single threaded */
+    FileNodeArena* node_arenas;     /**< One node arena per pool worker */
+    FatIndexState index_state;      /**< Where the directory tree came from */
+    FileNode* index_nodes;          /**< Node block materialised from the index */
+    uint32_t index_node_count;      /**< Number of nodes in the block */
+    pthread_rwlock_t lock;          /**< Shared by readers, exclusive for tree and FAT changes */
+    struct FatHandle* handles;      /**< Open handles, their directories follow deletions */
+    atomic_uint_fast64_t epoch;     /**< Current epoch, advanced each time a node is retired */
+    FatReaderSlot reader_slots[FAT_READER_SLOTS]; /**< Epochs of the readers inside a lookup */
+    FatRetiredNode* retired;        /**< Retired nodes waiting for their grace period */
+    pthread_mutex_t sort_lock;      /**< Guards the sort caches of the directories */
+    pthread_mutex_t name_lock;      /**< Serializes readers building a directory name table */
 } FATDriver;
 
+/**
+ * One user of a mounted volume with its own working directory, so threads
+ * sharing a FATDriver do not share a current directory
+ */
+typedef struct FatHandle {
+    FATDriver* driver;              /**< Mounted volume */
+    FileNode* current_directory;    /**< Working directory of this handle */
+    struct FatHandle* next;         /**< Next open handle of the driver */
+} FatHandle;
+
+/**
+ * Receives a file piece by piece from fat_driver_read_file_chunks()
+ * @param data Next bytes of the file
+ * @param length Number of bytes, never 0
+ * @param offset Offset of data in the file
+ * @param user_data Value given to fat_driver_read_file_chunks()
+ * @return 0 to go on, anything else to stop the read
+ */
+typedef int (*FatChunkCallback)(const uint8_t* data, uint32_t length, uint32_t offset, void* user_data);
+
+/**
+ * Operation of an asynchronous request
+ */
+typedef enum {
+    FAT_IO_READ_FILE,               /**< fat_driver_read_file() */
+    FAT_IO_FIND_PATH                /**< fat_driver_find_path() */
+} FatIoKind;
+
+struct FatIoRequest;
+
+/**
+ * Completion callback, called on an engine thread once the request is done
+ */
+typedef void (*FatIoCallback)(struct FatIoRequest* request);
+
+/**
+ * Asynchronous request. The memory belongs to the caller and must stay valid
+ * until the request completes.
+ */
+typedef struct FatIoRequest {
+    FatIoKind kind;                 /**< Operation */
+    FATDriver* driver;              /**< Volume the request runs on */
+    const char* path;               /**< Path to look up (FAT_IO_FIND_PATH) */
+    char* resolved_path;            /**< Relative path joined to the working directory at submit, owned by the engine */
+    FileNode* node;                 /**< File to read, or the node found by a lookup */
+    void* buffer;                   /**< Destination of a read */
+    uint32_t size;                  /**< Size of the buffer */
+    int result;                     /**< Bytes read, or 0/-1 for a lookup */
+    FatIoCallback callback;         /**< Called on completion, NULL to post to the completion queue */
+    void* user_data;                /**< Left to the caller */
+    struct FatIoEngine* engine;     /**< Engine the request was submitted to */
+    struct FatIoRequest* next;      /**< Next request in the completion queue */
+} FatIoRequest;
+
+/**
+ * Engine running asynchronous requests of any number of volumes on a pool of
+ * threads, with a queue of completed requests
+ */
+typedef struct FatIoEngine {
+    ThreadPool pool;                /**< Threads running the requests */
+    pthread_mutex_t lock;           /**< Protects the completion queue and in_flight */
+    pthread_cond_t completed;       /**< Signalled when a request completes */
+    FatIoRequest* done_head;        /**< Oldest completed request not reaped yet */
+    FatIoRequest* done_tail;        /**< Newest completed request */
+    uint32_t in_flight;             /**< Requests submitted and not completed */
+} FatIoEngine;
+
 #endif // FAT_DRIVER_TYPES_H
 
@@ -37,6 +37,32 @@ int hal_init(HAL* hal, const char* img_path, SectorSize sector_size) {
     return 0;
 }
 
+/**
+ * Initialize HAL on a new image file
+ * @param hal Pointer to HAL structure
+ * @param img_path Path to image file
+ * @param sector_size Sector size
+ * @param size Size of the image in bytes
+ * @return 0 if success, -1 if failed
+ */
+int hal_create(HAL* hal, const char* img_path, SectorSize sector_size, uint64_t size) {
+    if (!hal || !img_path) return -1;
+    
+    // Check sector size before anything is created
+    if (sector_size != SECTOR_SIZE_512 && 
+        sector_size != SECTOR_SIZE_1024 && 
+        sector_size != SECTOR_SIZE_2048 && 
+        sector_size != SECTOR_SIZE_4096) {
+        return -1;
+    }
+    
+    if (ip_driver_create(&hal->ip_driver, img_path, size) != 0) return -1;
+    
+    hal->ip_driver.buffer_size = sector_size;
+    hal->sector_size = sector_size;
+    return 0;
+}
+
 /**
  * Deinitialize HAL
  * @param hal Pointer to HAL structure
@@ -75,6 +101,50 @@ int hal_write_sector(HAL* hal, uint32_t sector_number, const void* buffer) {
     return ip_driver_write_sector(&hal->ip_driver, sector_number, buffer);
 }
 
+/**
+ * Read consecutive sectors from image file
+ * @param hal Pointer to HAL structure
+ * @param sector_number First sector number to read
+ * @param count Number of sectors to read
+ * @param buffer Buffer to store read data
+ * @return Number of bytes read if success, -1 if failed
+ */
+int hal_read_sectors(HAL* hal, uint32_t sector_number, uint32_t count, void* buffer) {
+    if (!hal || !buffer) return -1;
+    
+    return ip_driver_read_sectors(&hal->ip_driver, sector_number, count, buffer);
+}
+
+/**
+ * Write consecutive sectors to image file
+ * @param hal Pointer to HAL structure
+ * @param sector_number First sector number to write
+ * @param count Number of sectors to write
+ * @param buffer Buffer containing data to write
+ * @return Number of bytes written if success, -1 if failed
+ */
+int hal_write_sectors(HAL* hal, uint32_t sector_number, uint32_t count, const void* buffer) {
+    if (!hal || !buffer) return -1;
+    
+    return ip_driver_write_sectors(&hal->ip_driver, sector_number, count, buffer);
+}
+
+/**
+ * Copy bytes of the image file into another file without bringing them
+ * into user space when the kernel allows it
+ * @param hal Pointer to HAL structure
+ * @param sector_number First sector number to copy
+ * @param length Number of bytes to copy
+ * @param fd Destination file descriptor, opened for writing
+ * @param fd_offset Offset to write at in the destination
+ * @return Number of bytes copied if success, -1 if failed
+ */
+int64_t hal_copy_to_fd(HAL* hal, uint32_t sector_number, uint64_t length, int fd, uint64_t fd_offset) {
+    if (!hal) return -1;
+    
+    return ip_driver_copy_to_fd(&hal->ip_driver, sector_number, length, fd, fd_offset);
+}
+
 /**
  * Close HAL
  * @param hal Pointer to HAL structure
@@ -37,6 +37,16 @@ typedef struct {
  */
 int hal_init(HAL* hal, const char* img_path, SectorSize sector_size);
 
+/**
+ * Initialize HAL on a new image file of the given size, read as zeroes
+ * @param hal Pointer to HAL structure
+ * @param img_path Path to image file, replaced if it exists
+ * @param sector_size Sector size
+ * @param size Size of the image in bytes
+ * @return 0 if success, -1 if failed
+ */
+int hal_create(HAL* hal, const char* img_path, SectorSize sector_size, uint64_t size);
+
 /**
  * Deinitialize HAL
  * @param hal Pointer to HAL structure
@@ -62,6 +72,38 @@ int hal_read_sector(HAL* hal, uint32_t sector_number, void* buffer);
  */
 int hal_write_sector(HAL* hal, uint32_t sector_number, const void* buffer);
 
+/**
+ * Read consecutive sectors from image file
+ * @param hal Pointer to HAL structure
+ * @param sector_number First sector number to read
+ * @param count Number of sectors to read
+ * @param buffer Buffer to store read data
+ * @return Number of bytes read if success, -1 if failed
+ */
+int hal_read_sectors(HAL* hal, uint32_t sector_number, uint32_t count, void* buffer);
+
+/**
+ * Write consecutive sectors to image file
+ * @param hal Pointer to HAL structure
+ * @param sector_number First sector number to write
+ * @param count Number of sectors to write
+ * @param buffer Buffer containing data to write
+ * @return Number of bytes written if success, -1 if failed
+ */
+int hal_write_sectors(HAL* hal, uint32_t sector_number, uint32_t count, const void* buffer);
+
+/**
+ * Copy bytes of the image file into another file without bringing them
+ * into user space when the kernel allows it
+ * @param hal Pointer to HAL structure
+ * @param sector_number First sector number to copy
+ * @param length Number of bytes to copy
+ * @param fd Destination file descriptor, opened for writing
+ * @param fd_offset Offset to write at in the destination
+ * @return Number of bytes copied if success, -1 if failed
+ */
+int64_t hal_copy_to_fd(HAL* hal, uint32_t sector_number, uint64_t length, int fd, uint64_t fd_offset);
+
 /**
  * Close HAL
  * @param hal Pointer to HAL structure
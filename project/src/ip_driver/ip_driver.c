@@ -5,9 +5,16 @@
  * @brief IP Driver implementation
  */
 
+/* copy_file_range() is a GNU extension */
+#define _GNU_SOURCE
+
 #include "ip_driver.h"
 #include "ip_driver_private.h"
+#include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
 
 /**
  * Initialize IP Driver
@@ -27,6 +34,37 @@ int ip_driver_init(IPDriver* driver, const char* img_path) {
     return 0;
 }
 
+/**
+ * Create an image file, replacing any file of that name, and open it
+ * @param driver Pointer to IPDriver structure
+ * @param img_path Path to image file
+ * @param size Size of the image in bytes
+ * @return 0 if success, -1 if failed
+ */
+int ip_driver_create(IPDriver* driver, const char* img_path, uint64_t size) {
+    if (!driver || !img_path) return -1;
+    
+    const char* ext = strrchr(img_path, '.');
+    if (!ext || strcmp(ext, ".img") != 0) return -1;
+    
+    int fd = open(img_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    
+    /* Emptied then grown, the whole file is one hole: no block is written or allocated */
+    if (ftruncate(fd, (off_t)size) != 0) {
+        close(fd);
+        return -1;
+    }
+    
+    driver->img_file = fdopen(fd, "rb+");
+    if (!driver->img_file) {
+        close(fd);
+        return -1;
+    }
+    
+    return 0;
+}
+
 /**
  * Read a sector from image file
  * @param driver Pointer to IPDriver structure
@@ -37,8 +75,9 @@ int ip_driver_init(IPDriver* driver, const char* img_path) {
 int ip_driver_read_sector(IPDriver* driver, uint32_t offset, void* buffer) {
     if (!driver || !driver->img_file || !buffer) return -1;
     
-    fseek(driver->img_file, offset * driver->buffer_size, SEEK_SET);
-    return fread(buffer, 1, driver->buffer_size, driver->img_file);
+    /* Positioned I/O keeps concurrent readers from sharing a file position */
+    return (int)pread(fileno(driver->img_file), buffer, driver->buffer_size,
+                      (off_t)((uint64_t)offset * driver->buffer_size));
 }
 
 /**
@@ -51,8 +90,93 @@ int ip_driver_read_sector(IPDriver* driver, uint32_t offset, void* buffer) {
 int ip_driver_write_sector(IPDriver* driver, uint32_t offset, const void* buffer) {
     if (!driver || !driver->img_file || !buffer) return -1;
     
-    fseek(driver->img_file, offset * driver->buffer_size, SEEK_SET);
-    return fwrite(buffer, 1, driver->buffer_size, driver->img_file);
+    return (int)pwrite(fileno(driver->img_file), buffer, driver->buffer_size,
+                       (off_t)((uint64_t)offset * driver->buffer_size));
+}
+
+/**
+ * Read consecutive sectors from image file with a single request
+ * @param driver Pointer to IPDriver structure
+ * @param offset First sector number to read
+ * @param count Number of sectors to read
+ * @param buffer Buffer to store read data
+ * @return Number of bytes read if success, -1 if failed
+ */
+int ip_driver_read_sectors(IPDriver* driver, uint32_t offset, uint32_t count, void* buffer) {
+    if (!driver || !driver->img_file || !buffer) return -1;
+    
+    return (int)pread(fileno(driver->img_file), buffer, (size_t)count * driver->buffer_size,
+                      (off_t)((uint64_t)offset * driver->buffer_size));
+}
+
+/**
+ * Write consecutive sectors to image file with a single request
+ * @param driver Pointer to IPDriver structure
+ * @param offset First sector number to write
+ * @param count Number of sectors to write
+ * @param buffer Buffer containing data to write
+ * @return Number of bytes written if success, -1 if failed
+ */
+int ip_driver_write_sectors(IPDriver* driver, uint32_t offset, uint32_t count, const void* buffer) {
+    if (!driver || !driver->img_file || !buffer) return -1;
+    
+    return (int)pwrite(fileno(driver->img_file), buffer, (size_t)count * driver->buffer_size,
+                       (off_t)((uint64_t)offset * driver->buffer_size));
+}
+
+/**
+ * Copy bytes of the image file into another file, inside the kernel when it
+ * can: copy_file_range() first, then sendfile(), then a read/write loop
+ * @param driver Pointer to IPDriver structure
+ * @param offset First sector number to copy
+ * @param length Number of bytes to copy
+ * @param fd Destination file descriptor, opened for writing
+ * @param fd_offset Offset to write at in the destination
+ * @return Number of bytes copied if success, -1 if failed
+ */
+int64_t ip_driver_copy_to_fd(IPDriver* driver, uint32_t offset, uint64_t length, int fd, uint64_t fd_offset) {
+    if (!driver || !driver->img_file || fd < 0) return -1;
+    
+    int img_fd = fileno(driver->img_file);
+    off_t in_offset = (off_t)((uint64_t)offset * driver->buffer_size);
+    off_t out_offset = (off_t)fd_offset;
+    uint64_t copied = 0;
+    
+    /* Each method goes on from where the previous one stopped */
+    while (copied < length) {
+        ssize_t result = copy_file_range(img_fd, &in_offset, fd, &out_offset, (size_t)(length - copied), 0);
+        if (result <= 0) break;
+        copied += (uint64_t)result;
+    }
+    
+    /* sendfile() writes at the file position of the destination */
+    if (copied < length && lseek(fd, out_offset, SEEK_SET) == out_offset) {
+        while (copied < length) {
+            ssize_t result = sendfile(fd, img_fd, &in_offset, (size_t)(length - copied));
+            if (result <= 0) break;
+            copied += (uint64_t)result;
+            out_offset += result;
+        }
+    }
+    
+    if (copied < length) {
+        uint8_t* buffer = malloc(IP_DRIVER_COPY_BUFFER);
+        if (!buffer) return -1;
+        
+        while (copied < length) {
+            size_t size = (length - copied < IP_DRIVER_COPY_BUFFER) ? (size_t)(length - copied) : IP_DRIVER_COPY_BUFFER;
+            ssize_t read_bytes = pread(img_fd, buffer, size, in_offset);
+            if (read_bytes <= 0) break;
+            ssize_t written = pwrite(fd, buffer, (size_t)read_bytes, out_offset);
+            if (written != read_bytes) break;
+            in_offset += read_bytes;
+            out_offset += read_bytes;
+            copied += (uint64_t)read_bytes;
+        }
+        free(buffer);
+    }
+    
+    return (copied == length) ? (int64_t)copied : -1;
 }
 
 /**
@@ -29,6 +29,17 @@ typedef struct {
  */
 int ip_driver_init(IPDriver* driver, const char* img_path);
 
+/**
+ * Create an image file, replacing any file of that name, and open it. The
+ * file is grown to its size without writing: it reads back as zeroes and
+ * takes no disk space until sectors are written
+ * @param driver Pointer to IPDriver structure
+ * @param img_path Path to image file
+ * @param size Size of the image in bytes
+ * @return 0 if success, -1 if failed
+ */
+int ip_driver_create(IPDriver* driver, const char* img_path, uint64_t size);
+
 /**
  * Read a sector from image file
  * @param driver Pointer to IPDriver structure
@@ -47,6 +58,38 @@ int ip_driver_read_sector(IPDriver* driver, uint32_t offset, void* buffer);
  */
 int ip_driver_write_sector(IPDriver* driver, uint32_t offset, const void* buffer);
 
+/**
+ * Read consecutive sectors from image file with a single request
+ * @param driver Pointer to IPDriver structure
+ * @param offset First sector number to read
+ * @param count Number of sectors to read
+ * @param buffer Buffer to store read data
+ * @return Number of bytes read if success, -1 if failed
+ */
+int ip_driver_read_sectors(IPDriver* driver, uint32_t offset, uint32_t count, void* buffer);
+
+/**
+ * Write consecutive sectors to image file with a single request
+ * @param driver Pointer to IPDriver structure
+ * @param offset First sector number to write
+ * @param count Number of sectors to write
+ * @param buffer Buffer containing data to write
+ * @return Number of bytes written if success, -1 if failed
+ */
+int ip_driver_write_sectors(IPDriver* driver, uint32_t offset, uint32_t count, const void* buffer);
+
+/**
+ * Copy bytes of the image file into another file, inside the kernel when it
+ * can: copy_file_range() first, then sendfile(), then a read/write loop
+ * @param driver Pointer to IPDriver structure
+ * @param offset First sector number to copy
+ * @param length Number of bytes to copy
+ * @param fd Destination file descriptor, opened for writing
+ * @param fd_offset Offset to write at in the destination
+ * @return Number of bytes copied if success, -1 if failed
+ */
+int64_t ip_driver_copy_to_fd(IPDriver* driver, uint32_t offset, uint64_t length, int fd, uint64_t fd_offset);
+
 /**
  * Close IP Driver
  * @param driver Pointer to IPDriver structure
@@ -10,5 +10,10 @@
 #ifndef IP_DRIVER_PRIVATE_H
 #define IP_DRIVER_PRIVATE_H
 
+/**
+ * Size of the bounce buffer used when the kernel cannot copy between two files
+ */
+#define IP_DRIVER_COPY_BUFFER (256 * 1024)
+
 #endif // IP_DRIVER_PRIVATE_H
 
@@ -11,23 +11,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <sys/stat.h>
 
-/** Initialize the middleware */
-int middleware_init(Middleware* middleware) {
+/** Mount the image on a FATDriver of its own, NULL if failed */
+static FATDriver* middleware_mount_private(Middleware* middleware) {
     FATDriver* fat_driver = malloc(sizeof(FATDriver)); /** Allocate FATDriver structure */
-    if (!middleware || !fat_driver) return -1;
-    
-    /** Check input parameters */
-    if (!middleware->img_path) {
-        print_error("Image file path is required\n");
-        return -1;
-    }
-    
-    const char* ext = strrchr(middleware->img_path, '.');
-    if (!ext || strcmp(ext, ".img") != 0) {
-        print_error("File is not an image file (.img): %s\n", middleware->img_path);
-        return -1;
-    }
+    if (!fat_driver) return NULL;
     
     /** Configure file system */
     FileSystemConfig config;
@@ -35,15 +25,21 @@ int middleware_init(Middleware* middleware) {
     config.mode = middleware->mode;
     config.fat_type = FAT_TYPE_16; /** Default, will be determined in fat_driver_mount */
     config.sector_size = SECTOR_SIZE_512;
-    config.cache_size = CACHE_SIZE_16;
+    config.cache_size = CACHE_SIZE_128;
     config.dir_name_len = DIR_NAME_LEN_8;
-    
-    middleware->fat_driver = fat_driver;
+    /** The run index costs a pass over the whole FAT at mount, so it is only built on request */
+    config.fat_table_mode = middleware->fat_run_index ? FAT_TABLE_RUNS : FAT_TABLE_PAGED;
+    /** Directory scans of the mount run on one worker per processor */
+    config.worker_threads = threadpool_cpu_count();
+    /** Directory sectors are read level by level in LBA order before parsing */
+    config.prefetch_tree = true;
+    /** Read-only mounts reuse the tree saved in <image>.idx while the image is unchanged */
+    config.mount_index = middleware->mount_index;
     
     if (fat_driver_init(fat_driver, config) != 0) {
         print_error("Failed to initialize FAT Driver\n");
         free(fat_driver);
-        return -1;
+        return NULL;
     }
     
     if (fat_driver_mount(fat_driver) != 0) {
@@ -51,9 +47,39 @@ int middleware_init(Middleware* middleware) {
         fat_driver_unmount(fat_driver);
         fat_driver_deinit(fat_driver);
         free(fat_driver);
+        return NULL;
+    }
+    
+    return fat_driver;
+}
+
+/** Initialize the middleware */
+int middleware_init(Middleware* middleware) {
+    if (!middleware) return -1;
+    
+    /** Check input parameters */
+    if (!middleware->img_path) {
+        print_error("Image file path is required\n");
         return -1;
     }
     
+    const char* ext = strrchr(middleware->img_path, '.');
+    if (!ext || strcmp(ext, ".img") != 0) {
+        print_error("File is not an image file (.img): %s\n", middleware->img_path);
+        return -1;
+    }
+    
+    /** A shared manager mounts the image on its cache, or hands out its existing mount */
+    FATDriver* fat_driver;
+    if (middleware->mount_manager) {
+        fat_driver = mount_manager_acquire(middleware->mount_manager, middleware->img_path, middleware->mode);
+        if (!fat_driver) print_error("Failed to mount file system\n");
+    } else {
+        fat_driver = middleware_mount_private(middleware);
+    }
+    if (!fat_driver) return -1;
+    
+    middleware->fat_driver = fat_driver;
     print_success("Mount successful\n");
     
     middleware->current_directory = fat_driver_get_root_directory(fat_driver);
@@ -69,84 +95,192 @@ int middleware_init(Middleware* middleware) {
     return 0;
 }
 
+/** Switch to another image through a shared mount manager */
+int middleware_open(Middleware* middleware, MountManager* manager, const char* img_path) {
+    if (!middleware || !manager || !img_path) return -1;
+    
+    const char* ext = strrchr(img_path, '.');
+    if (!ext || strcmp(ext, ".img") != 0) {
+        print_error("File is not an image file (.img): %s\n", img_path);
+        return -1;
+    }
+    if (strlen(img_path) >= PATH_MAX) {
+        print_error("Image path is too long: %s\n", img_path);
+        return -1;
+    }
+    
+    /** The same image must not get a second mount next to the current one */
+    struct stat current, next;
+    if (middleware->fat_driver && middleware->img_path &&
+        stat(middleware->img_path, &current) == 0 && stat(img_path, &next) == 0 &&
+        current.st_dev == next.st_dev && current.st_ino == next.st_ino) {
+        print_info("Already open: %s\n", img_path);
+        return 0;
+    }
+    
+    /** Mount the new image before letting go of the current one */
+    FATDriver* fat_driver = mount_manager_acquire(manager, img_path, middleware->mode);
+    if (!fat_driver) {
+        print_error("Failed to mount file system\n");
+        return -1;
+    }
+    
+    char path[PATH_MAX];
+    strcpy(path, img_path); /** img_path may be opened_path itself */
+    middleware_denit(middleware);
+    
+    strcpy(middleware->opened_path, path);
+    middleware->img_path = middleware->opened_path;
+    middleware->mount_manager = manager;
+    middleware->fat_driver = fat_driver;
+    print_success("Mount successful\n");
+    
+    middleware->current_directory = fat_driver_get_root_directory(fat_driver);
+    strcpy(middleware->current_path, "/");
+    middleware->is_root_mode = true;
+    middleware_switch_to_root_mode(middleware);
+    return 0;
+}
+
 /** Deinitialize the middleware */
 int middleware_denit(Middleware* middleware) {
     if (!middleware) return -1;
     
-    if (middleware->fat_driver) {
+    if (middleware->fat_driver && middleware->mount_manager) {
+        /** The manager unmounts the volume once it is idle and memory is short */
+        mount_manager_release(middleware->mount_manager, middleware->fat_driver);
+        middleware->fat_driver = NULL;
+    } else if (middleware->fat_driver) {
         fat_driver_unmount(middleware->fat_driver);
         fat_driver_deinit(middleware->fat_driver);
         free(middleware->fat_driver);
+        middleware->fat_driver = NULL; /** Unmount syncs metadata, never run it twice */
+    }
+    
+    /** No request is left in flight between commands */
+    if (middleware->io_ready) {
+        fat_driver_io_deinit(&middleware->io_engine);
+        middleware->io_ready = false;
     }
     
     return 0;
 }
 
-/** List directory contents */
-int middleware_ls(Middleware* middleware) {
-    if (!middleware || !middleware->current_directory) return -1;
+/** Print one row of the ls listing */
+static void middleware_ls_row(const char* name, FileType type, uint32_t size, const DateTime* created_time,
+                              const DateTime* modified_time) {
+    char type_str[16] = {0};
+    if (type == FILE_TYPE_DIRECTORY) {
+        strcpy(type_str, "Directory");
+    } else if (type == FILE_TYPE_REGULAR) {
+        strcpy(type_str, "File");
+    } else if (type == FILE_TYPE_VOLUME_ID) {
+        strcpy(type_str, "Volume ID");
+    } else {
+        strcpy(type_str, "Unknown");
+    }
     
-    FileNode* current = middleware->current_directory->children;
+    char created[32] = {0};
+    char modified[32] = {0};
     
-    if (!current) {
-        printf("Directory is empty\n");
-        return 0;
+    if (created_time->year > 0) {
+        sprintf(created, "%04d-%02d-%02d %02d:%02d:%02d", 
+                created_time->year, 
+                created_time->month, 
+                created_time->day,
+                created_time->hour,
+                created_time->minute,
+                created_time->second);
+    } else {
+        strcpy(created, "N/A");
     }
     
+    if (modified_time->year > 0) {
+        sprintf(modified, "%04d-%02d-%02d %02d:%02d:%02d", 
+                modified_time->year, 
+                modified_time->month, 
+                modified_time->day,
+                modified_time->hour,
+                modified_time->minute,
+                modified_time->second);
+    } else {
+        strcpy(modified, "N/A");
+    }
+    
+    /** Print color for directories */
+    print_color(type == FILE_TYPE_DIRECTORY ? COLOR_CYAN : COLOR_WHITE, "%-32s ", name);
+    printf("%-12s %-12u %-20s %-20s\n",
+           type_str, 
+           size, 
+           created, 
+           modified);
+}
+
+/** Print the header of the ls listing */
+static void middleware_ls_header(void) {
     printf("%-32s %-12s %-12s %-20s %-20s\n", 
            "Name", "Type", "Size", "Created", "Modified");
     printf("--------------------------------------------------------------------------------\n");
+}
+
+/** List directory contents */
+int middleware_ls(Middleware* middleware, bool sorted, FatSortKey order, bool reverse) {
+    if (!middleware || !middleware->current_directory) return -1;
     
-    while (current) {
-        char type_str[16] = {0};
-        if (current->type == FILE_TYPE_DIRECTORY) {
-            strcpy(type_str, "Directory");
-        } else if (current->type == FILE_TYPE_REGULAR) {
-            strcpy(type_str, "File");
-        } else if (current->type == FILE_TYPE_VOLUME_ID) {
-            strcpy(type_str, "Volume ID");
-        } else {
-            strcpy(type_str, "Unknown");
+    if (sorted) {
+        /** The driver keeps each order of a directory until it changes */
+        FileNode** nodes = NULL;
+        uint32_t count = 0;
+        if (fat_driver_list_sorted(middleware->fat_driver, middleware->current_directory, order, reverse,
+                                   &nodes, &count) != 0) {
+            print_error("Failed to list directory\n");
+            return -1;
         }
         
-        char created[32] = {0};
-        char modified[32] = {0};
-        
-        if (current->created_time.year > 0) {
-            sprintf(created, "%04d-%02d-%02d %02d:%02d:%02d", 
-                    current->created_time.year, 
-                    current->created_time.month, 
-                    current->created_time.day,
-                    current->created_time.hour,
-                    current->created_time.minute,
-                    current->created_time.second);
-        } else {
-            strcpy(created, "N/A");
+        if (count == 0) {
+            printf("Directory is empty\n");
+            return 0;
         }
         
-        if (current->modified_time.year > 0) {
-            sprintf(modified, "%04d-%02d-%02d %02d:%02d:%02d", 
-                    current->modified_time.year, 
-                    current->modified_time.month, 
-                    current->modified_time.day,
-                    current->modified_time.hour,
-                    current->modified_time.minute,
-                    current->modified_time.second);
-        } else {
-            strcpy(modified, "N/A");
+        middleware_ls_header();
+        for (uint32_t i = 0; i < count; i++) {
+            FileNode* current = nodes[i];
+            middleware_ls_row(current->name, current->type, current->size, &current->created_time,
+                              &current->modified_time);
         }
         
-        /** Print color for directories */
-        print_color(current->type == FILE_TYPE_DIRECTORY ? COLOR_CYAN : COLOR_WHITE, "%-32s ", current->name);
-        printf("%-12s %-12u %-20s %-20s\n",
-               type_str, 
-               current->size, 
-               created, 
-               modified);
-        
-        current = current->next;
+        free(nodes);
+        return 0;
     }
     
+    /** Directory order streams from the clusters a batch at a time, memory stays the same for any size */
+    FileNode* directory = middleware->current_directory;
+    bool is_root = (directory == fat_driver_get_root_directory(middleware->fat_driver));
+    FatDir* dir = fat_driver_opendir(middleware->fat_driver, is_root ? 0 : directory->first_cluster);
+    if (!dir) {
+        print_error("Failed to list directory\n");
+        return -1;
+    }
+    
+    FatDirent batch[64];
+    uint32_t listed = 0;
+    int count;
+    while ((count = fat_driver_readdir_batch(dir, batch, sizeof(batch) / sizeof(batch[0]))) > 0) {
+        for (int i = 0; i < count; i++) {
+            if (listed++ == 0) middleware_ls_header();
+            middleware_ls_row(batch[i].name, batch[i].type, batch[i].size, &batch[i].created_time,
+                              &batch[i].modified_time);
+        }
+    }
+    fat_driver_closedir(dir);
+    
+    if (count < 0) {
+        print_error("Failed to list directory\n");
+        return -1;
+    }
+    if (listed == 0) {
+        printf("Directory is empty\n");
+    }
     return 0;
 }
 
@@ -243,58 +377,168 @@ int middleware_cd(Middleware* middleware, const char* path) {
     return 0;
 }
 
+/**
+ * One file of the cat command
+ */
+typedef struct {
+    char path[PATH_MAX * 2];            /**< Absolute path */
+    FatIoRequest lookup;                /**< Lookup of the path */
+    FatIoRequest read;                  /**< Read of the content */
+    uint8_t* buffer;                    /**< Content, NULL if not read */
+} CatFile;
+
+/** Start the I/O engine of the middleware on first use, one thread per mount worker */
+static FatIoEngine* middleware_io_engine(Middleware* middleware) {
+    if (!middleware->io_ready) {
+        if (fat_driver_io_init(&middleware->io_engine, middleware->fat_driver->config.worker_threads) != 0) {
+            return NULL;
+        }
+        middleware->io_ready = true;
+    }
+    return &middleware->io_engine;
+}
+
+/** Wait until count requests posted to the completion queue are done */
+static void middleware_io_wait(FatIoEngine* engine, uint32_t count) {
+    FatIoRequest* done[32];
+    while (count > 0) {
+        uint32_t reaped = fat_driver_io_reap(engine, done, count < 32 ? count : 32, true);
+        if (reaped == 0) break;
+        count -= reaped;
+    }
+}
+
 /** Concatenate and display file content */
-int middleware_cat(Middleware* middleware, const char* path) {
-    if (!middleware || !path) return -1;
+int middleware_cat(Middleware* middleware, int argc, char** argv) {
+    if (!middleware || !middleware->fat_driver || argc <= 0 || !argv) return -1;
     
-    /** Update temporary path */
-    char temp_path[256] = {0};
-    strcpy(temp_path, middleware->current_path);
-    if(middleware->current_path[strlen(middleware->current_path) - 1] != '/')
-    {
-        strcat(temp_path, "/");
+    FatIoEngine* engine = middleware_io_engine(middleware);
+    CatFile* files = calloc((size_t)argc, sizeof(CatFile));
+    if (!engine || !files) {
+        print_error("Memory allocation failed\n");
+        free(files);
+        return -1;
     }
-    strcat(temp_path, path);
-    /** Find file by path */
-    FileNode* file = fat_driver_find_path(middleware->fat_driver, temp_path);
     
-    if (!file) {
-        print_error("File not found: %s\n", path);
-        return -1;
+    /** Nodes found by the engine stay allocated until the content is printed */
+    FATDriver* driver = middleware->fat_driver;
+    int token = fat_driver_read_begin(driver);
+    
+    /** Every lookup in flight at once, a refused one runs here */
+    bool has_slash = middleware->current_path[strlen(middleware->current_path) - 1] == '/';
+    uint32_t pending = 0;
+    for (int i = 0; i < argc; i++) {
+        CatFile* file = &files[i];
+        if (argv[i][0] == '/') {
+            snprintf(file->path, sizeof(file->path), "%s", argv[i]);
+        } else {
+            snprintf(file->path, sizeof(file->path), "%s%s%s", middleware->current_path, has_slash ? "" : "/",
+                     argv[i]);
+        }
+        if (fat_driver_find_path_async(engine, &file->lookup, driver, file->path, NULL) == 0) {
+            pending++;
+        } else {
+            file->lookup.node = fat_driver_find_path(driver, file->path);
+        }
     }
+    middleware_io_wait(engine, pending);
     
-    if (file->type != FILE_TYPE_REGULAR) {
-        print_error("Not a regular file: %s\n", path);
-        return -1;
+    /** Then every read */
+    pending = 0;
+    for (int i = 0; i < argc; i++) {
+        CatFile* file = &files[i];
+        FileNode* node = file->lookup.node;
+        if (!node || node->type != FILE_TYPE_REGULAR) continue;
+        
+        file->buffer = malloc(node->size + 1);
+        if (!file->buffer) continue;
+        if (fat_driver_read_file_async(engine, &file->read, driver, node, file->buffer, node->size, NULL) == 0) {
+            pending++;
+        } else {
+            file->read.result = fat_driver_read_file(driver, node, file->buffer, node->size);
+        }
     }
+    middleware_io_wait(engine, pending);
     
-    /** Read file content */
-    uint8_t* buffer = malloc(file->size + 1);
-    if (!buffer) {
-        print_error("Memory allocation failed\n");
-        return -1;
+    /** Print in the order given */
+    int result = 0;
+    for (int i = 0; i < argc; i++) {
+        CatFile* file = &files[i];
+        FileNode* node = file->lookup.node;
+        if (!node) {
+            print_error("File not found: %s\n", argv[i]);
+            result = -1;
+        } else if (node->type != FILE_TYPE_REGULAR) {
+            print_error("Not a regular file: %s\n", argv[i]);
+            result = -1;
+        } else if (!file->buffer) {
+            print_error("Memory allocation failed\n");
+            result = -1;
+        } else if (file->read.result < 0) {
+            print_error("Failed to read file: %s\n", argv[i]);
+            result = -1;
+        } else {
+            for (int j = 0; j < file->read.result; j++) {
+                print_color(COLOR_YELLOW, "%c", file->buffer[j]);
+            }
+            printf("\n");
+            fflush(stdout);
+        }
+        free(file->buffer);
     }
     
-    int bytes_read = fat_driver_read_file(middleware->fat_driver, file, buffer, file->size);
-    if (bytes_read < 0) {
-        print_error("Failed to read file: %s\n", path);
-        free(buffer);
+    fat_driver_read_end(driver, token);
+    free(files);
+    return result;
+}
+
+/** Look up several paths in one batch and print what the driver knows of each */
+int middleware_stat(Middleware* middleware, int argc, char** argv) {
+    if (!middleware || !middleware->fat_driver || argc <= 0 || !argv) return -1;
+    
+    char (*paths)[PATH_MAX * 2] = malloc((size_t)argc * sizeof(*paths));
+    const char** path_list = malloc((size_t)argc * sizeof(const char*));
+    FatStat* stats = malloc((size_t)argc * sizeof(FatStat));
+    if (!paths || !path_list || !stats) {
+        print_error("Memory allocation failed\n");
+        free(paths);
+        free(path_list);
+        free(stats);
         return -1;
     }
     
-    /** Add null-terminator */
-    buffer[bytes_read] = '\0';
+    bool has_slash = middleware->current_path[strlen(middleware->current_path) - 1] == '/';
+    for (int i = 0; i < argc; i++) {
+        if (argv[i][0] == '/') {
+            snprintf(paths[i], sizeof(paths[i]), "%s", argv[i]);
+        } else {
+            snprintf(paths[i], sizeof(paths[i]), "%s%s%s", middleware->current_path, has_slash ? "" : "/", argv[i]);
+        }
+        path_list[i] = paths[i];
+    }
     
-    /** Print file content */
-    for (int i = 0; i < bytes_read; i++)
-    {
-        print_color(COLOR_YELLOW, "%c", buffer[i]);
+    int found = fat_driver_stat_many(middleware->fat_driver, path_list, (uint32_t)argc, stats);
+    if (found < 0) {
+        print_error("stat: lookup failed\n");
+    } else {
+        for (int i = 0; i < argc; i++) {
+            const FatStat* stat = &stats[i];
+            if (!stat->node) {
+                print_error("stat: not found: %s\n", argv[i]);
+                continue;
+            }
+            print_color(stat->type == FILE_TYPE_DIRECTORY ? COLOR_CYAN : COLOR_WHITE, "%s", paths[i]);
+            printf(": %s size=%u cluster=%u modified=%04d-%02d-%02d %02d:%02d:%02d\n",
+                   stat->type == FILE_TYPE_DIRECTORY ? "directory" : "file", stat->size, stat->first_cluster,
+                   stat->modified_time.year, stat->modified_time.month, stat->modified_time.day,
+                   stat->modified_time.hour, stat->modified_time.minute, stat->modified_time.second);
+        }
     }
-    printf("\n");
-    fflush(stdout);
     
-    free(buffer);
-    return 0;
+    free(paths);
+    free(path_list);
+    free(stats);
+    return found == argc ? 0 : -1;
 }
 
 /** Display file system evidence */
@@ -339,6 +583,8 @@ int middleware_evidence(Middleware* middleware) {
     
     if (fat_driver_get_fat_type(driver) == FAT_TYPE_32) {
         printf("Root Cluster: %u\n", driver->boot_sector.root_cluster);
+        printf("FSInfo Sector: %u (%s)\n", driver->boot_sector.fs_info,
+               driver->fs_info_valid ? "valid" : "invalid");
     }
     
     /** Size information */
@@ -360,9 +606,479 @@ int middleware_evidence(Middleware* middleware) {
     printf("Mode: %s\n", mode_str);
     
     printf("Sector Size: %u\n", (uint32_t)driver->config.sector_size);
-    printf("Cache Size: %u sectors\n", (uint32_t)driver->config.cache_size);
+    if (driver->shared_cache && driver->cache) {
+        printf("Cache Size: %u sectors (shared)\n", driver->cache->capacity);
+    } else {
+        printf("Cache Size: %u sectors\n", (uint32_t)driver->config.cache_size);
+    }
+    if (driver->cache) {
+        printf("Cache Hits/Misses: %llu/%llu\n",
+               (unsigned long long)driver->cache->hits,
+               (unsigned long long)driver->cache->misses);
+    }
     printf("Directory Name Length: %u\n", (uint32_t)driver->config.dir_name_len);
+    if (driver->fat_runs) {
+        printf("FAT Table: run index (%u runs, %llu bytes)\n", driver->fat_run_count,
+               (unsigned long long)driver->fat_run_count * sizeof(FatRun));
+    } else if (driver->fat_run_fallbacks > 0) {
+        printf("FAT Table: paged (run index dropped, out of memory)\n");
+    } else {
+        printf("FAT Table: paged\n");
+    }
+    switch (driver->index_state) {
+        case FAT_INDEX_LOADED: printf("Mount Index: loaded from sidecar\n"); break;
+        case FAT_INDEX_WRITTEN: printf("Mount Index: scanned, sidecar rewritten\n"); break;
+        default: printf("Mount Index: not used\n"); break;
+    }
+    
+    return 0;
+}
+
+/** Reload directories changed by another program */
+int middleware_refresh(Middleware* middleware) {
+    if (!middleware || !middleware->fat_driver) return -1;
+    
+    uint32_t rescanned = 0;
+    if (fat_driver_refresh(middleware->fat_driver, &rescanned) != 0) {
+        print_error("Refresh failed, remount the image\n");
+        return -1;
+    }
+    
+    /** The current directory may have been removed, look it up again by path */
+    FileNode* current = fat_driver_find_path(middleware->fat_driver, middleware->current_path);
+    if (!current || current->type != FILE_TYPE_DIRECTORY) {
+        current = fat_driver_get_root_directory(middleware->fat_driver);
+        strcpy(middleware->current_path, "/");
+    }
+    middleware->current_directory = current;
+    
+    print_success("Refreshed, %u director%s rescanned\n", rescanned, rescanned == 1 ? "y" : "ies");
+    return 0;
+}
+
+/** Check the volume and print one key=value line per finding */
+int middleware_check(Middleware* middleware) {
+    if (!middleware || !middleware->fat_driver) return -1;
+    
+    FatCheckReport report;
+    if (fat_driver_check(middleware->fat_driver, &report) != 0) {
+        print_error("Check failed\n");
+        return -1;
+    }
+    
+    for (uint32_t i = 0; i < report.finding_count; i++) {
+        const FatCheckFinding* finding = &report.findings[i];
+        char path[PATH_MAX] = "-";
+        if (finding->node) {
+            fat_driver_get_path(finding->node, path, sizeof(path));
+        }
+        if (finding->kind == FAT_CHECK_FAT_MISMATCH) {
+            printf("check: %s path=%s copy=%u sector=%u sectors=%u\n",
+                   fat_driver_check_kind_name(finding->kind), path,
+                   finding->copy, finding->sector, finding->sectors);
+        } else {
+            printf("check: %s path=%s cluster=%u expected=%u actual=%u\n",
+                   fat_driver_check_kind_name(finding->kind), path,
+                   finding->cluster, finding->expected, finding->actual);
+        }
+    }
+    
+    printf("check: summary status=%s findings=%u files=%u directories=%u used=%u lost=%u free=%u\n",
+           report.finding_count ? "damaged" : "clean", report.finding_count, report.files,
+           report.directories, report.used_clusters, report.lost_clusters, report.free_clusters);
+    
+    fat_driver_check_free(&report);
+    return 0;
+}
+
+/** Defragment the files of a read-write mount and print the extent counts */
+int middleware_defrag(Middleware* middleware) {
+    if (!middleware || !middleware->fat_driver) return -1;
+    
+    FatDefragReport report;
+    if (fat_driver_defrag(middleware->fat_driver, &report) != 0) {
+        print_error("Defragmentation failed (read-write mode only)\n");
+        return -1;
+    }
+    
+    printf("defrag: files=%u moved=%u skipped=%u clusters=%u\n",
+           report.files, report.moved, report.skipped, report.moved_clusters);
+    printf("defrag: before extents=%u fragmented=%u\n", report.extents_before, report.fragmented_before);
+    printf("defrag: after extents=%u fragmented=%u\n", report.extents_after, report.fragmented_after);
+    return 0;
+}
+
+/** Print one match of the find command */
+static void middleware_find_print(const FileNode* node, const char* path, void* user_data) {
+    (void)user_data;
+    print_color(node->type == FILE_TYPE_DIRECTORY ? COLOR_CYAN : COLOR_WHITE, "%s\n", path);
+}
+
+/** Parse a find size: N, +N (larger) or -N (smaller), with an optional k or M unit */
+static int middleware_parse_find_size(const char* text, FindQuery* query) {
+    char sign = (text[0] == '+' || text[0] == '-') ? text[0] : 0;
+    char* end = NULL;
+    unsigned long long value = strtoull(sign ? text + 1 : text, &end, 10);
+    if (!end || end == text + (sign ? 1 : 0)) return -1;
+    
+    if (*end == 'k') {
+        value *= 1024;
+        end++;
+    } else if (*end == 'M') {
+        value *= 1024 * 1024;
+        end++;
+    }
+    if (*end != '\0' || value > UINT32_MAX) return -1;
+    
+    if (sign == '+') {
+        if (value == UINT32_MAX) return -1;
+        query->min_size = (uint32_t)value + 1;
+    } else if (sign == '-') {
+        if (value == 0) return -1;
+        query->max_size = (uint32_t)value - 1;
+    } else {
+        query->min_size = (uint32_t)value;
+        query->max_size = (uint32_t)value;
+    }
+    return 0;
+}
+
+/** Parse a find date: YYYY-MM-DD or YYYY-MM-DDTHH:MM[:SS] */
+static int middleware_parse_find_date(const char* text, DateTime* date) {
+    unsigned year, month, day, hour = 0, minute = 0, second = 0;
+    int fields = sscanf(text, "%u-%u-%uT%u:%u:%u", &year, &month, &day, &hour, &minute, &second);
+    if ((fields != 3 && fields < 5) || year == 0 || year > 9999 || month < 1 || month > 12 ||
+        day < 1 || day > 31 || hour > 23 || minute > 59 || second > 59) {
+        return -1;
+    }
+    
+    date->year = (uint16_t)year;
+    date->month = (uint8_t)month;
+    date->day = (uint8_t)day;
+    date->hour = (uint8_t)hour;
+    date->minute = (uint8_t)minute;
+    date->second = (uint8_t)second;
+    return 0;
+}
+
+/** Search the tree below a directory */
+int middleware_find(Middleware* middleware, int argc, char** argv) {
+    if (!middleware || !middleware->fat_driver || argc < 0) return -1;
+    
+    FindQuery query;
+    middleware_find_query_init(&query);
+    const char* start_path = ".";
+    
+    for (int i = 0; i < argc; i++) {
+        const char* option = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        
+        if (option[0] != '-') {
+            if (i != 0) {
+                print_error("find: path must come first: %s\n", option);
+                return -1;
+            }
+            start_path = option;
+            continue;
+        }
+        if (!value) {
+            print_error("find: missing value for %s\n", option);
+            return -1;
+        }
+        i++;
+        
+        int result = 0;
+        if (strcmp(option, "-name") == 0) {
+            /** Names are stored lowercase */
+            for (char* c = argv[i]; *c; c++) *c = (char)tolower((unsigned char)*c);
+            query.name = argv[i];
+        } else if (strcmp(option, "-path") == 0) {
+            for (char* c = argv[i]; *c; c++) *c = (char)tolower((unsigned char)*c);
+            query.path = argv[i];
+        } else if (strcmp(option, "-type") == 0) {
+            if (strcmp(value, "f") == 0) {
+                query.type = FIND_TYPE_FILE;
+            } else if (strcmp(value, "d") == 0) {
+                query.type = FIND_TYPE_DIRECTORY;
+            } else {
+                result = -1;
+            }
+        } else if (strcmp(option, "-size") == 0) {
+            result = middleware_parse_find_size(value, &query);
+        } else if (strcmp(option, "-newer") == 0) {
+            result = middleware_parse_find_date(value, &query.modified_after);
+        } else if (strcmp(option, "-older") == 0) {
+            result = middleware_parse_find_date(value, &query.modified_before);
+        } else if (strcmp(option, "-maxdepth") == 0) {
+            char* end = NULL;
+            unsigned long depth = strtoul(value, &end, 10);
+            if (!end || *end != '\0' || depth == 0 || depth > UINT32_MAX) {
+                result = -1;
+            } else {
+                query.max_depth = (uint32_t)depth;
+            }
+        } else {
+            print_error("find: unknown option: %s\n", option);
+            return -1;
+        }
+        
+        if (result != 0) {
+            print_error("find: invalid value for %s: %s\n", option, value);
+            return -1;
+        }
+    }
+    
+    /** Resolve the start directory from the current path */
+    char temp_path[PATH_MAX * 2];
+    if (start_path[0] == '/') {
+        snprintf(temp_path, sizeof(temp_path), "%s", start_path);
+    } else {
+        bool has_slash = middleware->current_path[strlen(middleware->current_path) - 1] == '/';
+        snprintf(temp_path, sizeof(temp_path), "%s%s%s", middleware->current_path, has_slash ? "" : "/", start_path);
+    }
+    
+    FileNode* start = fat_driver_find_path(middleware->fat_driver, temp_path);
+    if (!start || start->type != FILE_TYPE_DIRECTORY) {
+        print_error("Directory not found: %s\n", start_path);
+        return -1;
+    }
+    
+    /** Matches are printed as the workers find them */
+    int matches = middleware_find_run(middleware->fat_driver, start, &query, middleware_find_print, NULL);
+    if (matches < 0) {
+        print_error("find: search failed\n");
+        return -1;
+    }
+    
+    print_info("%d match(es)\n", matches);
+    return 0;
+}
+
+/** Print a grep match as path:offset: context, the match highlighted */
+static void middleware_grep_print(const GrepMatch* match, void* user_data) {
+    const char* const* patterns = (const char* const*)user_data;
+    size_t length = strlen(patterns[match->pattern]);
+    const char* context = match->context;
+    
+    print_color(COLOR_CYAN, "%s", match->path);
+    printf(":%u: %.*s", match->offset, (int)match->context_start, context);
+    print_color(COLOR_RED, "%.*s", (int)length, context + match->context_start);
+    printf("%s\n", context + match->context_start + length);
+}
+
+/** Process grep command */
+int middleware_grep(Middleware* middleware, int argc, char** argv) {
+    if (!middleware || !middleware->fat_driver || argc < 0) return -1;
+    
+    FindQuery query;
+    middleware_find_query_init(&query);
+    const char* start_path = ".";
+    const char* patterns[32];
+    uint32_t pattern_count = 0;
+    
+    for (int i = 0; i < argc; i++) {
+        const char* option = argv[i];
+        
+        if (strcmp(option, "-d") == 0 || strcmp(option, "-name") == 0) {
+            if (i + 1 >= argc) {
+                print_error("grep: missing value for %s\n", option);
+                return -1;
+            }
+            i++;
+            if (option[1] == 'd') {
+                start_path = argv[i];
+            } else {
+                /** Names are stored lowercase */
+                for (char* c = argv[i]; *c; c++) *c = (char)tolower((unsigned char)*c);
+                query.name = argv[i];
+            }
+        } else if (pattern_count < sizeof(patterns) / sizeof(patterns[0])) {
+            patterns[pattern_count++] = option;
+        }
+    }
+    
+    if (pattern_count == 0) {
+        print_error("Usage: grep [-d dir] [-name glob] pattern [pattern...]\n");
+        return -1;
+    }
+    
+    /** Resolve the start directory from the current path */
+    char temp_path[PATH_MAX * 2];
+    if (start_path[0] == '/') {
+        snprintf(temp_path, sizeof(temp_path), "%s", start_path);
+    } else {
+        bool has_slash = middleware->current_path[strlen(middleware->current_path) - 1] == '/';
+        snprintf(temp_path, sizeof(temp_path), "%s%s%s", middleware->current_path, has_slash ? "" : "/", start_path);
+    }
+    
+    FileNode* start = fat_driver_find_path(middleware->fat_driver, temp_path);
+    if (!start || start->type != FILE_TYPE_DIRECTORY) {
+        print_error("Directory not found: %s\n", start_path);
+        return -1;
+    }
+    
+    /** Matches are printed as the workers find them */
+    int matches = middleware_grep_run(middleware->fat_driver, start, &query, patterns, pattern_count,
+                                      middleware_grep_print, patterns);
+    if (matches < 0) {
+        print_error("grep: search failed\n");
+        return -1;
+    }
+    
+    print_info("%d match(es)\n", matches);
+    return 0;
+}
+
+/** Process export command */
+int middleware_export(Middleware* middleware, const char* path, const char* host_directory) {
+    if (!middleware || !middleware->fat_driver || !path || !host_directory) return -1;
+    
+    /** Resolve the source from the current path */
+    char temp_path[PATH_MAX * 2];
+    if (path[0] == '/') {
+        snprintf(temp_path, sizeof(temp_path), "%s", path);
+    } else {
+        bool has_slash = middleware->current_path[strlen(middleware->current_path) - 1] == '/';
+        snprintf(temp_path, sizeof(temp_path), "%s%s%s", middleware->current_path, has_slash ? "" : "/", path);
+    }
+    
+    FileNode* source = fat_driver_find_path(middleware->fat_driver, temp_path);
+    if (!source) {
+        print_error("File not found: %s\n", path);
+        return -1;
+    }
+    
+    ExportStats stats;
+    int result = middleware_export_run(middleware->fat_driver, source, host_directory, &stats);
+    
+    print_info("Exported %u file(s), %u directory(ies), %llu bytes to %s\n", stats.files, stats.directories,
+               (unsigned long long)stats.bytes, host_directory);
+    if (stats.unsafe_names > 0) {
+        print_error("export: %u entr%s left out, name%s not safe on the host\n", stats.unsafe_names,
+                    stats.unsafe_names == 1 ? "y" : "ies", stats.unsafe_names == 1 ? " is" : "s are");
+    }
+    if (stats.failed > 0) {
+        print_error("export: %u entr%s could not be copied\n", stats.failed, stats.failed == 1 ? "y" : "ies");
+    }
+    if (result != 0) return -1;
+    return 0;
+}
+
+/** Report a host entry the import left out because its name has no 8.3 form */
+static void middleware_import_invalid_name(const char* host_path, void* user_data) {
+    (void)user_data;
+    print_error("import: not an 8.3 name, left out: %s\n", host_path);
+}
+
+/** Process import command */
+int middleware_import(Middleware* middleware, const char* host_path, const char* path) {
+    if (!middleware || !middleware->fat_driver || !host_path || !path) return -1;
+    
+    /** Resolve the destination from the current path */
+    char temp_path[PATH_MAX * 2];
+    if (path[0] == '/') {
+        snprintf(temp_path, sizeof(temp_path), "%s", path);
+    } else {
+        bool has_slash = middleware->current_path[strlen(middleware->current_path) - 1] == '/';
+        snprintf(temp_path, sizeof(temp_path), "%s%s%s", middleware->current_path, has_slash ? "" : "/", path);
+    }
+    
+    FileNode* destination = fat_driver_find_path(middleware->fat_driver, temp_path);
+    if (!destination || destination->type != FILE_TYPE_DIRECTORY) {
+        print_error("Directory not found: %s\n", path);
+        return -1;
+    }
+    
+    ImportStats stats;
+    int result = middleware_import_run(middleware->fat_driver, host_path, destination,
+                                       middleware_import_invalid_name, NULL, &stats);
+    
+    print_info("Imported %u file(s), %u directory(ies), %llu bytes from %s\n", stats.files, stats.directories,
+               (unsigned long long)stats.bytes, host_path);
+    printf("import: extents=%u writes=%u skipped=%u\n", stats.extents, stats.writes, stats.skipped);
+    if (stats.invalid_names > 0) {
+        print_error("import: %u name%s not in 8.3 form, left out with their content\n", stats.invalid_names,
+                    stats.invalid_names == 1 ? " is" : "s are");
+        return -1;
+    }
+    if (result != 0) {
+        print_error("Import failed (read-write mode only, or not enough space); %u host entr%s could not be read\n",
+                    stats.failed, stats.failed == 1 ? "y" : "ies");
+        return -1;
+    }
+    return 0;
+}
+
+/** Parse a byte count with an optional k, M or G unit */
+static int middleware_parse_format_size(const char* text, uint64_t* value) {
+    char* end = NULL;
+    unsigned long long number = strtoull(text, &end, 10);
+    if (!end || end == text || text[0] == '-') return -1;
+    
+    if (*end == 'k' || *end == 'K') {
+        number *= 1024ULL;
+        end++;
+    } else if (*end == 'M') {
+        number *= 1024ULL * 1024;
+        end++;
+    } else if (*end == 'G') {
+        number *= 1024ULL * 1024 * 1024;
+        end++;
+    }
+    if (*end != '\0') return -1;
+    
+    *value = number;
+    return 0;
+}
+
+/** Create an image holding an empty FAT volume */
+int middleware_format(const char* img_path, int argc, char** argv) {
+    if (!img_path || argc < 1) {
+        print_error("format: usage: <img_file> format <size>[k|M|G] [fat12|fat16|fat32] [cluster size]\n");
+        return -1;
+    }
+    
+    const char* ext = strrchr(img_path, '.');
+    if (!ext || strcmp(ext, ".img") != 0) {
+        print_error("File is not an image file (.img): %s\n", img_path);
+        return -1;
+    }
+    
+    FatFormatOptions options;
+    memset(&options, 0, sizeof(options));
+    options.fat_type = FAT_TYPE_UNKNOWN;
+    
+    if (middleware_parse_format_size(argv[0], &options.size) != 0) {
+        print_error("format: invalid size: %s\n", argv[0]);
+        return -1;
+    }
+    for (int i = 1; i < argc; i++) {
+        uint64_t cluster_size;
+        if (strcmp(argv[i], "fat12") == 0) {
+            options.fat_type = FAT_TYPE_12;
+        } else if (strcmp(argv[i], "fat16") == 0) {
+            options.fat_type = FAT_TYPE_16;
+        } else if (strcmp(argv[i], "fat32") == 0) {
+            options.fat_type = FAT_TYPE_32;
+        } else if (middleware_parse_format_size(argv[i], &cluster_size) == 0 && cluster_size <= UINT32_MAX) {
+            options.cluster_size = (uint32_t)cluster_size;
+        } else {
+            print_error("format: invalid argument: %s\n", argv[i]);
+            return -1;
+        }
+    }
+    
+    FatFormatReport report;
+    if (fat_driver_format(img_path, &options, &report) != 0) {
+        print_error("format: cannot create %s with that size, type and cluster size\n", img_path);
+        return -1;
+    }
     
+    const char* type = report.fat_type == FAT_TYPE_12 ? "FAT12" : report.fat_type == FAT_TYPE_16 ? "FAT16" : "FAT32";
+    print_success("Formatted %s: %s, %u clusters of %u bytes\n", img_path, type, report.total_clusters,
+                  report.cluster_size);
+    printf("format: fat_sectors=%u data_sector=%u written_sectors=%u\n", report.fat_sectors,
+           report.first_data_sector, report.sectors_written);
     return 0;
 }
 
@@ -4,6 +4,11 @@
 #include "../common/common_types.h"
 #include "../fat_driver/fat_driver.h"
 #include "../fat_driver/fat_driver_types.h"
+#include "../mount_manager/mount_manager.h"
+#include "middleware_find.h"
+#include "middleware_grep.h"
+#include "middleware_export.h"
+#include "middleware_import.h"
 
 /**
  * @file middleware.h
@@ -18,9 +23,15 @@ typedef struct {
     const char* img_path;
     FileSystemMode mode;
     FATDriver* fat_driver;
+    MountManager* mount_manager; /**< Mounts through a shared manager when set, NULL for a private mount */
     FileNode* current_directory;
     char current_path[PATH_MAX];
     bool is_root_mode;
+    bool fat_run_index; /**< Build the FAT run index at mount (a pass over the whole FAT) */
+    bool mount_index; /**< Read-only mounts use the sidecar index next to the image */
+    char opened_path[PATH_MAX]; /**< Image switched to by middleware_open(), img_path then points here */
+    FatIoEngine io_engine; /**< Runs the lookups and reads of cat, started on first use */
+    bool io_ready; /**< io_engine is running */
 } Middleware;
 
 /**
@@ -30,6 +41,17 @@ typedef struct {
  */
 int middleware_init(Middleware* middleware);
 
+/**
+ * Switch to another image, mounted through a shared mount manager so it
+ * stays mounted, while memory allows, after switching away. The current image
+ * is kept if the new one cannot be mounted
+ * @param middleware Pointer to the Middleware structure
+ * @param manager Mount manager to mount through
+ * @param img_path Path to the image file
+ * @return 0 if successful, -1 if failed
+ */
+int middleware_open(Middleware* middleware, MountManager* manager, const char* img_path);
+
 /**
  * Deinitialize Middleware
  * @param middleware Pointer to the Middleware structure
@@ -38,11 +60,15 @@ int middleware_init(Middleware* middleware);
 int middleware_denit(Middleware* middleware);
 
 /**
- * Process ls command (list directory contents)
+ * Process ls command (list directory contents). Unsorted listings stream the
+ * entries in directory order straight from the directory clusters
  * @param middleware Pointer to the Middleware structure
+ * @param sorted List in the given order instead of directory order
+ * @param order Ordering of the listing when sorted
+ * @param reverse List from the last to the first when sorted
  * @return 0 if successful, -1 if failed
  */
-int middleware_ls(Middleware* middleware);
+int middleware_ls(Middleware* middleware, bool sorted, FatSortKey order, bool reverse);
 
 /**
  * Process cd command (change directory)
@@ -53,12 +79,24 @@ int middleware_ls(Middleware* middleware);
 int middleware_cd(Middleware* middleware, const char* path);
 
 /**
- * Process cat command (read file contents)
+ * Process cat command (read file contents). The files are looked up and read
+ * together on the I/O engine and printed in the order given
  * @param middleware Pointer to the Middleware structure
- * @param path Path to the file to read
- * @return 0 if successful, -1 if failed
+ * @param argc Number of files
+ * @param argv Paths of the files to read
+ * @return 0 if every file was printed, -1 if any failed
  */
-int middleware_cat(Middleware* middleware, const char* path);
+int middleware_cat(Middleware* middleware, int argc, char** argv);
+
+/**
+ * Process stat command: type, size, first cluster and modification time of
+ * several paths, looked up in one batch
+ * @param middleware Pointer to the Middleware structure
+ * @param argc Number of paths
+ * @param argv Paths to look up
+ * @return 0 if every path was found, -1 otherwise
+ */
+int middleware_stat(Middleware* middleware, int argc, char** argv);
 
 /**
  * Process evidence command (display filesystem info)
@@ -67,6 +105,73 @@ int middleware_cat(Middleware* middleware, const char* path);
  */
 int middleware_evidence(Middleware* middleware);
 
+/**
+ * Process refresh command (reload directories changed by another program)
+ * @param middleware Pointer to the Middleware structure
+ * @return 0 if successful, -1 if failed
+ */
+int middleware_refresh(Middleware* middleware);
+
+/**
+ * Process check command (volume consistency check)
+ * @param middleware Pointer to the Middleware structure
+ * @return 0 if the check ran, -1 if failed
+ */
+int middleware_check(Middleware* middleware);
+
+/**
+ * Process defrag command (rewrite fragmented files contiguously)
+ * @param middleware Pointer to the Middleware structure
+ * @return 0 if successful, -1 if failed
+ */
+int middleware_defrag(Middleware* middleware);
+
+/**
+ * Process find command (search the tree below a directory)
+ * @param middleware Pointer to the Middleware structure
+ * @param argc Number of arguments
+ * @param argv Arguments: [path] [-name glob] [-path glob] [-type f|d]
+ *             [-size [+|-]N[k|M]] [-newer date] [-older date] [-maxdepth N]
+ * @return 0 if successful, -1 if failed
+ */
+int middleware_find(Middleware* middleware, int argc, char** argv);
+
+/**
+ * Process grep command (search the content of the files below a directory)
+ * @param middleware Pointer to the Middleware structure
+ * @param argc Number of arguments
+ * @param argv Arguments: [-d dir] [-name glob] pattern [pattern...]
+ * @return 0 if successful, -1 if failed
+ */
+int middleware_grep(Middleware* middleware, int argc, char** argv);
+
+/**
+ * Process export command (copy a file or a directory tree to the host)
+ * @param middleware Pointer to the Middleware structure
+ * @param path Path of the file or directory in the image
+ * @param host_directory Host directory to copy into, created if missing
+ * @return 0 if successful, -1 if failed
+ */
+int middleware_export(Middleware* middleware, const char* path, const char* host_directory);
+
+/**
+ * Process import command (copy a host file or directory tree into the image, read-write mode)
+ * @param middleware Pointer to the Middleware structure
+ * @param host_path Host file or directory to copy
+ * @param path Path of the destination directory in the image
+ * @return 0 if successful, -1 if failed
+ */
+int middleware_import(Middleware* middleware, const char* host_path, const char* path);
+
+/**
+ * Create an image holding an empty FAT volume (no mount needed)
+ * @param img_path Path of the image to create, replaced if it exists
+ * @param argc Number of arguments
+ * @param argv Arguments: size[k|M|G] [fat12|fat16|fat32] [cluster size[k]]
+ * @return 0 if successful, -1 if failed
+ */
+int middleware_format(const char* img_path, int argc, char** argv);
+
 /**
  * Switch to root mode
  * @param middleware Pointer to the Middleware structure
@@ -0,0 +1,325 @@
+/**
+ * @file middleware_export.c
+ * @author Le Duc Son
+ * @date 2026-10-18
+ * @brief Copy of a subtree of the image to the host file system
+ * @details The subtree is walked with middleware_find_run(), which reports a
+ *          directory before anything below it, so host directories are made
+ *          from the callback in a valid order. The files are copied after the
+ *          walk, in first cluster order, inside the same read section so the
+ *          nodes collected stay allocated.
+ *
+ *          Names come from the image, so none is trusted as a host path: a
+ *          name that is empty, holds a '/', or is "." or ".." is left out
+ *          with everything below it. Host entries are opened and made one
+ *          component at a time relative to a descriptor of the host
+ *          directory, with O_NOFOLLOW, so a symbolic link already on the
+ *          host cannot lead a copy out of it either.
+ */
+
+#include "middleware_export.h"
+#include "middleware_find.h"
+#include "../fat_driver/fat_driver.h"
+#include "../utilities/threadpool/threadpool.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Longest host path built, longer entries fail
+ */
+#define EXPORT_PATH_MAX 4096
+
+/**
+ * File to copy
+ */
+typedef struct {
+    FileNode* node;                     /**< File in the image */
+    char* host_path;                    /**< Destination, relative to the host directory */
+} ExportFile;
+
+/**
+ * State shared by the workers of one export
+ */
+typedef struct {
+    FATDriver* driver;                  /**< Driver the files are read from */
+    FileNode* source;                   /**< Directory copied */
+    int host_fd;                        /**< Host directory copied into */
+    size_t source_length;               /**< Length of the source path stripped from each path */
+    ExportFile* files;                  /**< Files sorted by first cluster */
+    uint32_t file_count;                /**< Number of files */
+    uint32_t file_capacity;             /**< Allocated length of files */
+    atomic_uint next_file;              /**< Next file to take */
+    uint32_t directories;               /**< Directories created, counted by the walk */
+    uint32_t unsafe_names;              /**< Entries left out for their name, counted by the walk */
+    atomic_uint files_copied;           /**< Files copied */
+    atomic_uint failed;                 /**< Entries that could not be copied */
+    atomic_uint_fast64_t bytes;         /**< Bytes copied */
+} ExportContext;
+
+/* Local functions */
+static int middleware_export_make_directory(int parent_fd, const char* path);
+static bool middleware_export_safe_name(const char* name);
+static int middleware_export_open_parent(int host_fd, const char* path, const char** name);
+static void middleware_export_collect(const FileNode* node, const char* path, void* user_data);
+static int middleware_export_compare_file(const void* a, const void* b);
+static void middleware_export_worker(void* arg, uint32_t worker);
+static int middleware_export_file(ExportContext* context, FileNode* node, const char* host_path);
+
+/** Copy a file, or the content of a directory, to a host directory */
+int middleware_export_run(FATDriver* driver, FileNode* source, const char* host_directory, ExportStats* stats) {
+    if (stats) memset(stats, 0, sizeof(ExportStats));
+    if (!driver || !source || !host_directory) return -1;
+    if (middleware_export_make_directory(AT_FDCWD, host_directory) != 0) return -1;
+
+    ExportContext* context = calloc(1, sizeof(ExportContext));
+    if (!context) return -1;
+    context->driver = driver;
+    context->source = source;
+    context->host_fd = open(host_directory, O_RDONLY | O_DIRECTORY);
+    if (context->host_fd < 0) {
+        free(context);
+        return -1;
+    }
+
+    /** The nodes collected stay allocated until the end of this read section */
+    int token = fat_driver_read_begin(driver);
+
+    if (source->type == FILE_TYPE_REGULAR) {
+        if (!middleware_export_safe_name(source->name)) {
+            context->unsafe_names++;
+        } else if (middleware_export_file(context, source, source->name) != 0) {
+            context->failed++;
+        }
+    } else {
+        char source_path[EXPORT_PATH_MAX];
+        if (fat_driver_get_path(source, source_path, sizeof(source_path)) != 0) {
+            context->failed++;
+        } else {
+            /** Below the root, paths already start with the separator */
+            context->source_length = strcmp(source_path, "/") == 0 ? 0 : strlen(source_path);
+
+            FindQuery query;
+            middleware_find_query_init(&query);
+            if (middleware_find_run(driver, source, &query, middleware_export_collect, context) < 0) {
+                context->failed++;
+            }
+        }
+
+        /** Files in LBA order, read and written mostly forward */
+        qsort(context->files, context->file_count, sizeof(ExportFile), middleware_export_compare_file);
+
+        ThreadPool* pool = driver->pool;
+        ThreadPoolGroup group;
+        if (pool && !threadpool_group_init(&group)) pool = NULL;
+
+        uint32_t workers = pool ? pool->worker_count : 1;
+        if (workers > context->file_count) workers = context->file_count;
+        for (uint32_t i = 0; i < workers; i++) {
+            if (!pool || !threadpool_submit_group(pool, &group, middleware_export_worker, context)) {
+                middleware_export_worker(context, 0);
+            }
+        }
+
+        /** Only this export's workers, the pool may run other work too */
+        if (pool) {
+            threadpool_group_wait(&group);
+            threadpool_group_deinit(&group);
+        }
+    }
+
+    fat_driver_read_end(driver, token);
+
+    if (stats) {
+        stats->directories = context->directories;
+        stats->files = context->files_copied;
+        stats->unsafe_names = context->unsafe_names;
+        stats->failed = context->failed;
+        stats->bytes = context->bytes;
+    }
+    int result = (context->failed == 0 && context->unsafe_names == 0) ? 0 : -1;
+
+    close(context->host_fd);
+
+    for (uint32_t i = 0; i < context->file_count; i++) {
+        free(context->files[i].host_path);
+    }
+    free(context->files);
+    free(context);
+
+    return result;
+}
+
+/** Create a host directory, an existing one is fine but a link to one is not */
+static int middleware_export_make_directory(int parent_fd, const char* path) {
+    if (mkdirat(parent_fd, path, 0755) == 0) return 0;
+    if (errno != EEXIST) return -1;
+
+    struct stat info;
+    return (fstatat(parent_fd, path, &info, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(info.st_mode)) ? 0 : -1;
+}
+
+/**
+ * A name the host takes as one entry of the directory it is made in. A NUL
+ * ends the name in the tree, so an image name holding one can only come out
+ * shorter, never longer
+ */
+static bool middleware_export_safe_name(const char* name) {
+    return name[0] != '\0' && !strchr(name, '/') && strcmp(name, ".") != 0 && strcmp(name, "..") != 0;
+}
+
+/**
+ * Open the host directory that holds a path relative to host_fd, one
+ * component at a time and without following links. The components are
+ * names middleware_export_safe_name() accepted
+ * @return Descriptor of the directory, host_fd itself for a single
+ *         component, -1 if a component is missing or not a directory
+ */
+static int middleware_export_open_parent(int host_fd, const char* path, const char** name) {
+    int fd = host_fd;
+    const char* start = path;
+    const char* slash;
+
+    while ((slash = strchr(start, '/')) != NULL) {
+        char component[EXPORT_PATH_MAX];
+        size_t length = (size_t)(slash - start);
+        memcpy(component, start, length);
+        component[length] = '\0';
+
+        int next = openat(fd, component, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+        if (fd != host_fd) close(fd);
+        if (next < 0) return -1;
+        fd = next;
+        start = slash + 1;
+    }
+
+    *name = start;
+    return fd;
+}
+
+/** Find callback: create a directory now, keep a file for the workers */
+static void middleware_export_collect(const FileNode* node, const char* path, void* user_data) {
+    ExportContext* context = (ExportContext*)user_data;
+
+    /** A bad name is counted once, where it appears; what lies below it is left out silently */
+    if (!middleware_export_safe_name(node->name)) {
+        context->unsafe_names++;
+        return;
+    }
+    for (const FileNode* parent = FAT_LOAD_LINK(node->parent); parent && parent != context->source;
+         parent = FAT_LOAD_LINK(parent->parent)) {
+        if (!middleware_export_safe_name(parent->name)) return;
+    }
+
+    /** Paths below the source start with the separator */
+    const char* host_path = path + context->source_length + 1;
+    if (strlen(host_path) >= EXPORT_PATH_MAX) {
+        context->failed++;
+        return;
+    }
+
+    if (node->type == FILE_TYPE_DIRECTORY) {
+        const char* name;
+        int parent_fd = middleware_export_open_parent(context->host_fd, host_path, &name);
+        if (parent_fd >= 0 && middleware_export_make_directory(parent_fd, name) == 0) {
+            context->directories++;
+        } else {
+            context->failed++;
+        }
+        if (parent_fd >= 0 && parent_fd != context->host_fd) close(parent_fd);
+        return;
+    }
+
+    if (context->file_count == context->file_capacity) {
+        uint32_t capacity = context->file_capacity ? context->file_capacity * 2 : 64;
+        ExportFile* files = realloc(context->files, capacity * sizeof(ExportFile));
+        if (!files) {
+            context->failed++;
+            return;
+        }
+        context->files = files;
+        context->file_capacity = capacity;
+    }
+
+    char* copy = strdup(host_path);
+    if (!copy) {
+        context->failed++;
+        return;
+    }
+
+    context->files[context->file_count].node = (FileNode*)node;
+    context->files[context->file_count].host_path = copy;
+    context->file_count++;
+}
+
+/** qsort() order of files by first cluster */
+static int middleware_export_compare_file(const void* a, const void* b) {
+    uint32_t first = ((const ExportFile*)a)->node->first_cluster;
+    uint32_t second = ((const ExportFile*)b)->node->first_cluster;
+    return (first > second) - (first < second);
+}
+
+/** Task: copy files, taking the next one until none is left */
+static void middleware_export_worker(void* arg, uint32_t worker) {
+    (void)worker;
+    ExportContext* context = (ExportContext*)arg;
+
+    uint32_t index;
+    while ((index = atomic_fetch_add(&context->next_file, 1)) < context->file_count) {
+        ExportFile* file = &context->files[index];
+        if (middleware_export_file(context, file->node, file->host_path) != 0) {
+            atomic_fetch_add(&context->failed, 1);
+        }
+    }
+}
+
+/** Copy one file and give it the modification time it has in the image */
+static int middleware_export_file(ExportContext* context, FileNode* node, const char* host_path) {
+    const char* name;
+    int parent_fd = middleware_export_open_parent(context->host_fd, host_path, &name);
+    if (parent_fd < 0) return -1;
+
+    int fd = openat(parent_fd, name, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0644);
+    if (parent_fd != context->host_fd) close(parent_fd);
+    if (fd < 0) return -1;
+
+    int64_t copied = fat_driver_export_file(context->driver, node, fd);
+    if (copied < 0) {
+        close(fd);
+        return -1;
+    }
+
+    struct tm modified;
+    memset(&modified, 0, sizeof(modified));
+    modified.tm_year = node->modified_time.year - 1900;
+    modified.tm_mon = node->modified_time.month - 1;
+    modified.tm_mday = node->modified_time.day;
+    modified.tm_hour = node->modified_time.hour;
+    modified.tm_min = node->modified_time.minute;
+    modified.tm_sec = node->modified_time.second;
+    modified.tm_isdst = -1;
+
+    /** FAT times are local times; an invalid one leaves the host time as is */
+    time_t seconds = mktime(&modified);
+    if (node->modified_time.year != 0 && seconds != (time_t)-1) {
+        struct timespec times[2];
+        times[0].tv_sec = seconds;
+        times[0].tv_nsec = 0;
+        times[1] = times[0];
+        futimens(fd, times);
+    }
+
+    if (close(fd) != 0) return -1;
+
+    atomic_fetch_add(&context->files_copied, 1);
+    atomic_fetch_add(&context->bytes, (uint64_t)copied);
+    return 0;
+}
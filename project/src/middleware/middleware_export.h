@@ -0,0 +1,45 @@
+/**
+ * @file middleware_export.h
+ * @author Le Duc Son
+ * @date 2026-10-18
+ * @brief Copy of a subtree of the image to the host file system
+ * @details Directories are created on the host while the subtree is walked.
+ *          Files are then sorted by their first cluster and copied by a
+ *          thread pool, each worker taking the next file in that order, so
+ *          the image is read and the host files are written mostly in LBA
+ *          order. Each run of contiguous clusters is one kernel-side copy
+ *          when the kernel supports it.
+ */
+
+#ifndef MIDDLEWARE_EXPORT_H
+#define MIDDLEWARE_EXPORT_H
+
+#include <stdint.h>
+#include "../fat_driver/fat_driver_types.h"
+
+/**
+ * Outcome of an export
+ */
+typedef struct {
+    uint32_t directories;               /**< Directories created on the host */
+    uint32_t files;                     /**< Files copied */
+    uint32_t unsafe_names;              /**< Entries left out for a name that is not one host component */
+    uint32_t failed;                    /**< Files or directories that could not be copied */
+    uint64_t bytes;                     /**< Bytes copied */
+} ExportStats;
+
+/**
+ * Copy a file, or the content of a directory, to a host directory. The host
+ * directory is created if missing, host files of the same name are replaced
+ * and take the modification time of the image files. An entry whose name
+ * is empty, holds a '/', or is "." or ".." is left out with its content,
+ * and no host link is followed below host_directory
+ * @param driver Mounted driver
+ * @param source File or directory to copy
+ * @param host_directory Host directory to copy into
+ * @param stats Pointer to store the outcome, may be NULL
+ * @return 0 if everything was copied, -1 if anything failed or was left out for its name
+ */
+int middleware_export_run(FATDriver* driver, FileNode* source, const char* host_directory, ExportStats* stats);
+
+#endif /* MIDDLEWARE_EXPORT_H */
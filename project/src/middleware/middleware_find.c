@@ -0,0 +1,351 @@
+/**
+ * @file middleware_find.c
+ * @author Le Duc Son
+ * @date 2026-10-18
+ * @brief Parallel search of the mounted tree
+ * @details The whole search runs inside one read section of the driver, so
+ *          nodes reached by any worker stay allocated until it ends. Globs
+ *          are sorted out at compile time: a pattern without wildcards is a
+ *          string compare, "abc*" and "*abc" are a prefix or suffix compare,
+ *          and only the other patterns go through fnmatch(). The tree holds
+ *          names in lower case, so the patterns are folded to lower case
+ *          first and match whatever case they were typed in.
+ *
+ *          Directories are searched as tasks on the worker pool of the
+ *          driver, no pool is started per search. Without one, on a single
+ *          processor, the directories wait on a stack and the caller searches
+ *          them one after another.
+ */
+
+#include "middleware_find.h"
+#include "../fat_driver/fat_driver.h"
+#include "../utilities/threadpool/threadpool.h"
+#include <ctype.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Longest path a search builds, deeper entries are skipped
+ */
+#define FIND_PATH_MAX 4096
+
+/**
+ * How a compiled glob is tested
+ */
+typedef enum {
+    FIND_GLOB_ANY = 0,                  /**< No pattern or "*" */
+    FIND_GLOB_EXACT,                    /**< No wildcard, whole string compare */
+    FIND_GLOB_PREFIX,                   /**< "literal*" */
+    FIND_GLOB_SUFFIX,                   /**< "*literal" */
+    FIND_GLOB_GENERAL                   /**< Anything else, fnmatch() */
+} FindGlobKind;
+
+/**
+ * Glob prepared for repeated tests
+ */
+typedef struct {
+    FindGlobKind kind;                  /**< Test to run */
+    const char* pattern;                /**< Whole pattern */
+    const char* literal;                /**< Literal part for EXACT, PREFIX and SUFFIX */
+    size_t literal_length;              /**< Length of the literal part */
+} FindGlob;
+
+/**
+ * Query compiled for the workers
+ */
+typedef struct {
+    FindType type;                      /**< Type wanted */
+    bool check_size;                    /**< Size range is not the full range */
+    uint32_t min_size;                  /**< Smallest size */
+    uint32_t max_size;                  /**< Largest size */
+    uint64_t modified_after;            /**< Packed time, 0 for none */
+    uint64_t modified_before;           /**< Packed time, 0 for none */
+    FindGlob name;                      /**< Test on the name */
+    FindGlob path;                      /**< Test on the path */
+    const char* path_prefix;            /**< Every matching path starts with this, used to prune */
+    size_t path_prefix_length;          /**< Length of path_prefix */
+    uint32_t max_depth;                 /**< Depth limit, 0 for none */
+} FindFilter;
+
+/**
+ * State shared by the workers of one search
+ */
+typedef struct {
+    FindFilter filter;                  /**< Compiled query */
+    char* name_pattern;                 /**< Name glob in lower case */
+    char* path_pattern;                 /**< Path glob in lower case */
+    ThreadPool* pool;                   /**< Workers of the driver, one task per directory, NULL for none */
+    ThreadPoolGroup group;              /**< Tasks of this search, the pool may run other work too */
+    struct FindTask* stack;             /**< Directories left to search without a pool */
+    pthread_mutex_t lock;               /**< Serializes the callback */
+    FindCallback callback;              /**< Match callback */
+    void* user_data;                    /**< Callback argument */
+    int matches;                        /**< Matches reported */
+} FindContext;
+
+/**
+ * One directory to search
+ */
+typedef struct FindTask {
+    FindContext* context;               /**< Search it belongs to */
+    struct FindTask* next;              /**< Next directory on the stack */
+    const FileNode* directory;          /**< Directory to list */
+    uint32_t depth;                     /**< Depth of the directory below the start */
+    size_t path_length;                 /**< Length of path */
+    char path[];                        /**< Absolute path of the directory */
+} FindTask;
+
+/* Local functions */
+static char* middleware_find_fold(const char* pattern, bool* failed);
+static void middleware_find_compile_glob(FindGlob* glob, const char* pattern);
+static bool middleware_find_glob_match(const FindGlob* glob, const char* text, size_t length);
+static bool middleware_find_match(const FindFilter* filter, const FileNode* node, const char* path, size_t length);
+static bool middleware_find_may_enter(const FindFilter* filter, const char* path, size_t length);
+static void middleware_find_submit(FindContext* context, const FileNode* directory, uint32_t depth,
+                                   const char* path, size_t length);
+static void middleware_find_task(void* arg, uint32_t worker);
+
+/** Reset a query so that it matches everything */
+void middleware_find_query_init(FindQuery* query) {
+    if (!query) return;
+
+    memset(query, 0, sizeof(FindQuery));
+    query->type = FIND_TYPE_ANY;
+    query->max_size = UINT32_MAX;
+}
+
+/** Search the subtree below a directory */
+int middleware_find_run(FATDriver* driver, FileNode* start, const FindQuery* query, FindCallback callback,
+                        void* user_data) {
+    if (!driver || !start || !query || !callback || start->type != FILE_TYPE_DIRECTORY) return -1;
+
+    FindContext* context = calloc(1, sizeof(FindContext));
+    if (!context) return -1;
+
+    bool failed = false;
+    context->name_pattern = middleware_find_fold(query->name, &failed);
+    context->path_pattern = middleware_find_fold(query->path, &failed);
+    if (failed) {
+        free(context->name_pattern);
+        free(context->path_pattern);
+        free(context);
+        return -1;
+    }
+
+    /** Compile the query: cheap tests first, globs sorted out once */
+    FindFilter* filter = &context->filter;
+    filter->type = query->type;
+    filter->min_size = query->min_size;
+    filter->max_size = query->max_size;
+    filter->check_size = (query->min_size > 0 || query->max_size < UINT32_MAX);
+    filter->modified_after = query->modified_after.year ? fat_driver_time_key(&query->modified_after) : 0;
+    filter->modified_before = query->modified_before.year ? fat_driver_time_key(&query->modified_before) : 0;
+    filter->max_depth = query->max_depth;
+    middleware_find_compile_glob(&filter->name, context->name_pattern);
+    middleware_find_compile_glob(&filter->path, context->path_pattern);
+    if (context->path_pattern) {
+        filter->path_prefix = context->path_pattern;
+        filter->path_prefix_length = strcspn(context->path_pattern, "*?[\\");
+    }
+
+    context->callback = callback;
+    context->user_data = user_data;
+    context->pool = driver->pool;
+
+    /** Without a group to wait on, the search runs on this thread */
+    if (context->pool && !threadpool_group_init(&context->group)) context->pool = NULL;
+
+    if (pthread_mutex_init(&context->lock, NULL) != 0) {
+        if (context->pool) threadpool_group_deinit(&context->group);
+        free(context->name_pattern);
+        free(context->path_pattern);
+        free(context);
+        return -1;
+    }
+
+    /** One read section covers every worker, nodes stay valid until the end */
+    int token = fat_driver_read_begin(driver);
+
+    char path[FIND_PATH_MAX];
+    int result = -1;
+    if (fat_driver_get_path(start, path, sizeof(path)) == 0) {
+        middleware_find_submit(context, start, 0, path, strlen(path));
+        if (context->pool) threadpool_group_wait(&context->group);
+
+        /** Without a pool the tasks queue up here, newest first like a worker's deque */
+        while (context->stack) {
+            FindTask* task = context->stack;
+            context->stack = task->next;
+            middleware_find_task(task, 0);
+        }
+        result = context->matches;
+    }
+
+    fat_driver_read_end(driver, token);
+
+    if (context->pool) threadpool_group_deinit(&context->group);
+    pthread_mutex_destroy(&context->lock);
+    free(context->name_pattern);
+    free(context->path_pattern);
+    free(context);
+
+    return result;
+}
+
+/** Copy of a pattern in lower case, NULL for none; sets failed if memory ran out */
+static char* middleware_find_fold(const char* pattern, bool* failed) {
+    if (!pattern) return NULL;
+
+    char* folded = strdup(pattern);
+    if (!folded) {
+        *failed = true;
+        return NULL;
+    }
+    for (char* c = folded; *c; c++) {
+        *c = (char)tolower((unsigned char)*c);
+    }
+    return folded;
+}
+
+/** Sort a glob into the cheapest test that gives the same answer */
+static void middleware_find_compile_glob(FindGlob* glob, const char* pattern) {
+    memset(glob, 0, sizeof(FindGlob));
+    glob->pattern = pattern;
+
+    if (!pattern || strcmp(pattern, "*") == 0) {
+        glob->kind = FIND_GLOB_ANY;
+        return;
+    }
+
+    size_t length = strlen(pattern);
+    size_t first = strcspn(pattern, "*?[\\");
+
+    if (first == length) {
+        glob->kind = FIND_GLOB_EXACT;
+        glob->literal = pattern;
+        glob->literal_length = length;
+    } else if (first == length - 1 && pattern[first] == '*') {
+        glob->kind = FIND_GLOB_PREFIX;
+        glob->literal = pattern;
+        glob->literal_length = first;
+    } else if (first == 0 && pattern[0] == '*' && strcspn(pattern + 1, "*?[\\") == length - 1) {
+        glob->kind = FIND_GLOB_SUFFIX;
+        glob->literal = pattern + 1;
+        glob->literal_length = length - 1;
+    } else {
+        glob->kind = FIND_GLOB_GENERAL;
+    }
+}
+
+/** Test a string of known length against a compiled glob */
+static bool middleware_find_glob_match(const FindGlob* glob, const char* text, size_t length) {
+    switch (glob->kind) {
+        case FIND_GLOB_ANY:
+            return true;
+        case FIND_GLOB_EXACT:
+            return length == glob->literal_length && memcmp(text, glob->literal, length) == 0;
+        case FIND_GLOB_PREFIX:
+            return length >= glob->literal_length && memcmp(text, glob->literal, glob->literal_length) == 0;
+        case FIND_GLOB_SUFFIX:
+            return length >= glob->literal_length &&
+                   memcmp(text + length - glob->literal_length, glob->literal, glob->literal_length) == 0;
+        default:
+            return fnmatch(glob->pattern, text, 0) == 0;
+    }
+}
+
+/** Test one entry against the compiled query, cheapest test first */
+static bool middleware_find_match(const FindFilter* filter, const FileNode* node, const char* path, size_t length) {
+    if (filter->type == FIND_TYPE_FILE && node->type != FILE_TYPE_REGULAR) return false;
+    if (filter->type == FIND_TYPE_DIRECTORY && node->type != FILE_TYPE_DIRECTORY) return false;
+    if (filter->check_size && (node->size < filter->min_size || node->size > filter->max_size)) return false;
+
+    if (filter->modified_after || filter->modified_before) {
+        uint64_t modified = fat_driver_time_key(&node->modified_time);
+        if (filter->modified_after && modified < filter->modified_after) return false;
+        if (filter->modified_before && modified >= filter->modified_before) return false;
+    }
+
+    if (!middleware_find_glob_match(&filter->name, node->name, strlen(node->name))) return false;
+    return middleware_find_glob_match(&filter->path, path, length);
+}
+
+/**
+ * Whether anything below a directory can match: the depth limit is checked by
+ * the caller, here the paths below must agree with the literal start of the
+ * path pattern.
+ */
+static bool middleware_find_may_enter(const FindFilter* filter, const char* path, size_t length) {
+    if (!filter->path_prefix) return true;
+
+    /** Paths below are path + "/" + name ("/" + name below the root) */
+    size_t prefix_length = filter->path_prefix_length;
+    size_t common = (length < prefix_length) ? length : prefix_length;
+    if (memcmp(path, filter->path_prefix, common) != 0) return false;
+
+    return prefix_length <= length || path[length - 1] == '/' || filter->path_prefix[length] == '/';
+}
+
+/**
+ * Queue a directory on the pool, or on the stack of the caller without one.
+ * If the pool refuses it, it is searched on this thread.
+ */
+static void middleware_find_submit(FindContext* context, const FileNode* directory, uint32_t depth,
+                                   const char* path, size_t length) {
+    FindTask* task = malloc(sizeof(FindTask) + length + 1);
+    if (!task) return;
+
+    task->context = context;
+    task->directory = directory;
+    task->depth = depth;
+    task->path_length = length;
+    memcpy(task->path, path, length + 1);
+
+    if (!context->pool) {
+        task->next = context->stack;
+        context->stack = task;
+    } else if (!threadpool_submit_group(context->pool, &context->group, middleware_find_task, task)) {
+        middleware_find_task(task, 0);
+    }
+}
+
+/** Task: test the children of one directory and queue its subdirectories */
+static void middleware_find_task(void* arg, uint32_t worker) {
+    (void)worker;
+    FindTask* task = (FindTask*)arg;
+    FindContext* context = task->context;
+    const FindFilter* filter = &context->filter;
+    uint32_t depth = task->depth + 1;
+
+    /** Children at the depth limit are tested but not entered */
+    bool enter = (filter->max_depth == 0 || depth < filter->max_depth);
+
+    char path[FIND_PATH_MAX];
+    size_t base = task->path_length;
+    memcpy(path, task->path, base);
+    if (base == 0 || path[base - 1] != '/') path[base++] = '/';
+
+    for (const FileNode* child = FAT_LOAD_LINK(task->directory->children); child;
+         child = FAT_LOAD_LINK(child->next)) {
+        size_t name_length = strlen(child->name);
+        if (base + name_length >= sizeof(path)) continue;
+
+        memcpy(path + base, child->name, name_length + 1);
+        size_t length = base + name_length;
+
+        if (middleware_find_match(filter, child, path, length)) {
+            pthread_mutex_lock(&context->lock);
+            context->callback(child, path, context->user_data);
+            context->matches++;
+            pthread_mutex_unlock(&context->lock);
+        }
+
+        if (enter && child->type == FILE_TYPE_DIRECTORY && middleware_find_may_enter(filter, path, length)) {
+            middleware_find_submit(context, child, depth, path, length);
+        }
+    }
+
+    free(task);
+}
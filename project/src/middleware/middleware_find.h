@@ -0,0 +1,71 @@
+/**
+ * @file middleware_find.h
+ * @author Le Duc Son
+ * @date 2026-10-18
+ * @brief Parallel search of the mounted tree
+ * @details A query is compiled once into a filter whose tests run cheapest
+ *          first. The subtree below the start directory is walked by a thread
+ *          pool, one task per directory; a directory the query cannot match
+ *          below (depth limit, literal prefix of the path pattern) is not
+ *          entered. Matches are handed to a callback as soon as they are found.
+ */
+
+#ifndef MIDDLEWARE_FIND_H
+#define MIDDLEWARE_FIND_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../common/common_types.h"
+#include "../fat_driver/fat_driver_types.h"
+
+/**
+ * Type of entry a query looks for
+ */
+typedef enum {
+    FIND_TYPE_ANY = 0,                  /**< Files and directories */
+    FIND_TYPE_FILE,                     /**< Regular files only */
+    FIND_TYPE_DIRECTORY                 /**< Directories only */
+} FindType;
+
+/**
+ * Search criteria, every criterion set must hold
+ */
+typedef struct {
+    const char* name;                   /**< Glob on the entry name, NULL for any */
+    const char* path;                   /**< Glob on the whole path, NULL for any */
+    FindType type;                      /**< Type of entry */
+    uint32_t min_size;                  /**< Smallest size in bytes */
+    uint32_t max_size;                  /**< Largest size in bytes */
+    DateTime modified_after;            /**< Modified at or after, year 0 for any */
+    DateTime modified_before;           /**< Modified before, year 0 for any */
+    uint32_t max_depth;                 /**< Deepest level below the start (1 = its children), 0 for any */
+} FindQuery;
+
+/**
+ * Called for each match, never by two threads at once
+ * @param node Node found, valid until middleware_find_run() returns
+ * @param path Absolute path of the node
+ * @param user_data Value given to middleware_find_run()
+ */
+typedef void (*FindCallback)(const FileNode* node, const char* path, void* user_data);
+
+/**
+ * Reset a query so that it matches everything
+ * @param query Pointer to the query
+ */
+void middleware_find_query_init(FindQuery* query);
+
+/**
+ * Search the subtree below a directory on the worker pool of the driver.
+ * Name and path globs match regardless of case
+ * @param driver Mounted driver
+ * @param start Directory to search below (not reported itself)
+ * @param query Search criteria
+ * @param callback Function called for each match
+ * @param user_data Value passed to the callback
+ * @return Number of matches, -1 if failed
+ */
+int middleware_find_run(FATDriver* driver, FileNode* start, const FindQuery* query, FindCallback callback,
+                        void* user_data);
+
+#endif /* MIDDLEWARE_FIND_H */
@@ -0,0 +1,450 @@
+/**
+ * @file middleware_grep.c
+ * @author Le Duc Son
+ * @date 2026-10-18
+ * @brief Parallel content search of the files in the mounted tree
+ * @details Patterns are grouped by their first byte once. Candidate starts are
+ *          found with memchr() when every pattern starts with the same byte,
+ *          with SSE2 compares of 16 bytes against each distinct first byte
+ *          when there are a few, and with a byte table otherwise; each
+ *          candidate is then checked against the patterns of its group only.
+ *
+ *          The driver reads a file into the buffer of a worker one run of
+ *          contiguous clusters at a time. The bytes just before that buffer
+ *          hold the end of the previous piece: starts too close to the end of
+ *          a piece are left for the next one, so a match across two pieces is
+ *          found once, with its context on both sides. The files are listed
+ *          and then read on the worker pool of the driver.
+ */
+
+#include "middleware_grep.h"
+#include "../fat_driver/fat_driver.h"
+#include "../utilities/threadpool/threadpool.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+ * Largest piece of a file read at once, raised to one cluster if smaller
+ */
+#define GREP_CHUNK_SIZE (256 * 1024)
+
+/**
+ * Most distinct first bytes tested with SSE2, more use the byte table
+ */
+#define GREP_SIMD_BYTES 8
+
+/**
+ * Patterns prepared for scanning
+ */
+typedef struct {
+    const uint8_t** patterns;           /**< Patterns */
+    size_t* lengths;                    /**< Length of each pattern */
+    uint32_t count;                     /**< Number of patterns */
+    size_t max_length;                  /**< Length of the longest pattern */
+    uint32_t* order;                    /**< Pattern indexes grouped by first byte */
+    uint32_t group[257];                /**< Patterns starting with byte b are order[group[b]..group[b + 1]) */
+    uint8_t firsts[256];                /**< Distinct first bytes */
+    uint32_t first_count;               /**< Number of distinct first bytes */
+} GrepMatcher;
+
+/**
+ * File to search
+ */
+typedef struct {
+    FileNode* node;                     /**< File */
+    char* path;                         /**< Absolute path of the file */
+} GrepFile;
+
+/**
+ * State shared by the workers of one search
+ */
+typedef struct {
+    FATDriver* driver;                  /**< Driver the files are read from */
+    GrepMatcher matcher;                /**< Compiled patterns */
+    GrepFile* files;                    /**< Files sorted by first cluster */
+    uint32_t file_count;                /**< Number of files */
+    uint32_t file_capacity;             /**< Allocated length of files */
+    bool out_of_memory;                 /**< A file could not be added */
+    atomic_uint next_file;              /**< Next file to take */
+    uint32_t buffer_size;               /**< Read buffer size of a worker */
+    size_t defer;                       /**< Starts this close to the end of a piece wait for the next */
+    size_t keep;                        /**< Bytes of a piece kept in front of the next */
+    pthread_mutex_t lock;               /**< Serializes the callback */
+    GrepCallback callback;              /**< Match callback */
+    void* user_data;                    /**< Callback argument */
+    int matches;                        /**< Matches reported */
+} GrepContext;
+
+/**
+ * Scan of one file by one worker
+ */
+typedef struct {
+    GrepContext* context;               /**< Search it belongs to */
+    const GrepFile* file;               /**< File being read */
+    uint8_t* window;                    /**< keep bytes of carry followed by the read buffer */
+    size_t carried;                     /**< Bytes of the previous piece right before the buffer */
+    uint32_t next_start;                /**< File offset of the next start to test */
+    char* context_text;                 /**< Context of the match being reported */
+} GrepScan;
+
+/* Local functions */
+static int middleware_grep_compile(GrepMatcher* matcher, const char* const* patterns, uint32_t count);
+static void middleware_grep_free_matcher(GrepMatcher* matcher);
+static void middleware_grep_collect(const FileNode* node, const char* path, void* user_data);
+static int middleware_grep_compare_file(const void* a, const void* b);
+static void middleware_grep_worker(void* arg, uint32_t worker);
+static int middleware_grep_chunk(const uint8_t* data, uint32_t length, uint32_t offset, void* user_data);
+static void middleware_grep_scan(GrepScan* scan, const uint8_t* region, size_t begin, size_t stop,
+                                 size_t length, uint32_t region_offset);
+static void middleware_grep_verify(GrepScan* scan, const uint8_t* region, size_t position, size_t length,
+                                   uint32_t region_offset);
+static void middleware_grep_report(GrepScan* scan, const uint8_t* region, size_t position, size_t length,
+                                   uint32_t region_offset, uint32_t pattern);
+
+/** Search the content of the files below a directory */
+int middleware_grep_run(FATDriver* driver, FileNode* start, const FindQuery* files,
+                        const char* const* patterns, uint32_t pattern_count, GrepCallback callback,
+                        void* user_data) {
+    if (!driver || !start || !patterns || pattern_count == 0 || !callback) return -1;
+    if (start->type != FILE_TYPE_DIRECTORY) return -1;
+
+    GrepContext* context = calloc(1, sizeof(GrepContext));
+    if (!context) return -1;
+
+    if (middleware_grep_compile(&context->matcher, patterns, pattern_count) != 0) {
+        free(context);
+        return -1;
+    }
+    if (pthread_mutex_init(&context->lock, NULL) != 0) {
+        middleware_grep_free_matcher(&context->matcher);
+        free(context);
+        return -1;
+    }
+
+    context->driver = driver;
+    context->callback = callback;
+    context->user_data = user_data;
+    context->defer = context->matcher.max_length - 1 + GREP_CONTEXT;
+    context->keep = context->defer + GREP_CONTEXT;
+
+    uint32_t cluster_size = hal_get_sector_size(driver->hal) * driver->boot_sector.sectors_per_cluster;
+    context->buffer_size = (cluster_size > GREP_CHUNK_SIZE) ? cluster_size : GREP_CHUNK_SIZE;
+
+    /** The nodes collected stay allocated until the end of this read section */
+    int token = fat_driver_read_begin(driver);
+
+    FindQuery query;
+    if (files) {
+        query = *files;
+    } else {
+        middleware_find_query_init(&query);
+    }
+    query.type = FIND_TYPE_FILE;
+
+    int result = -1;
+    if (middleware_find_run(driver, start, &query, middleware_grep_collect, context) >= 0 &&
+        !context->out_of_memory) {
+        /** Files in LBA order, read mostly forward */
+        qsort(context->files, context->file_count, sizeof(GrepFile), middleware_grep_compare_file);
+
+        /** Each worker takes the next file in order until none is left */
+        ThreadPool* pool = driver->pool;
+        ThreadPoolGroup group;
+        if (pool && !threadpool_group_init(&group)) pool = NULL;
+
+        uint32_t workers = pool ? pool->worker_count : 1;
+        if (workers > context->file_count) workers = context->file_count;
+        for (uint32_t i = 0; i < workers; i++) {
+            if (!pool || !threadpool_submit_group(pool, &group, middleware_grep_worker, context)) {
+                middleware_grep_worker(context, 0);
+            }
+        }
+
+        /** Only this search's workers, the pool may run other work too */
+        if (pool) {
+            threadpool_group_wait(&group);
+            threadpool_group_deinit(&group);
+        }
+        result = context->matches;
+    }
+
+    fat_driver_read_end(driver, token);
+
+    for (uint32_t i = 0; i < context->file_count; i++) {
+        free(context->files[i].path);
+    }
+    free(context->files);
+    pthread_mutex_destroy(&context->lock);
+    middleware_grep_free_matcher(&context->matcher);
+    free(context);
+
+    return result;
+}
+
+/** Group the patterns by first byte, -1 if one is empty or memory ran out */
+static int middleware_grep_compile(GrepMatcher* matcher, const char* const* patterns, uint32_t count) {
+    memset(matcher, 0, sizeof(GrepMatcher));
+
+    matcher->patterns = malloc(count * sizeof(const uint8_t*));
+    matcher->lengths = malloc(count * sizeof(size_t));
+    matcher->order = malloc(count * sizeof(uint32_t));
+    if (!matcher->patterns || !matcher->lengths || !matcher->order) {
+        middleware_grep_free_matcher(matcher);
+        return -1;
+    }
+    matcher->count = count;
+
+    uint32_t histogram[256] = {0};
+    for (uint32_t i = 0; i < count; i++) {
+        size_t length = patterns[i] ? strlen(patterns[i]) : 0;
+        if (length == 0) {
+            middleware_grep_free_matcher(matcher);
+            return -1;
+        }
+        matcher->patterns[i] = (const uint8_t*)patterns[i];
+        matcher->lengths[i] = length;
+        if (length > matcher->max_length) matcher->max_length = length;
+        histogram[matcher->patterns[i][0]]++;
+    }
+
+    /** Counting sort of the indexes by first byte */
+    uint32_t position = 0;
+    for (uint32_t byte = 0; byte < 256; byte++) {
+        matcher->group[byte] = position;
+        if (histogram[byte] > 0) matcher->firsts[matcher->first_count++] = (uint8_t)byte;
+        position += histogram[byte];
+    }
+    matcher->group[256] = position;
+
+    uint32_t fill[256];
+    memcpy(fill, matcher->group, sizeof(fill));
+    for (uint32_t i = 0; i < count; i++) {
+        matcher->order[fill[matcher->patterns[i][0]]++] = i;
+    }
+
+    return 0;
+}
+
+/** Free the arrays of a matcher */
+static void middleware_grep_free_matcher(GrepMatcher* matcher) {
+    free(matcher->patterns);
+    free(matcher->lengths);
+    free(matcher->order);
+    matcher->patterns = NULL;
+    matcher->lengths = NULL;
+    matcher->order = NULL;
+}
+
+/** Find callback: add a non-empty file to the list */
+static void middleware_grep_collect(const FileNode* node, const char* path, void* user_data) {
+    GrepContext* context = (GrepContext*)user_data;
+    if (node->size == 0 || context->out_of_memory) return;
+
+    if (context->file_count == context->file_capacity) {
+        uint32_t capacity = context->file_capacity ? context->file_capacity * 2 : 64;
+        GrepFile* files = realloc(context->files, capacity * sizeof(GrepFile));
+        if (!files) {
+            context->out_of_memory = true;
+            return;
+        }
+        context->files = files;
+        context->file_capacity = capacity;
+    }
+
+    char* copy = strdup(path);
+    if (!copy) {
+        context->out_of_memory = true;
+        return;
+    }
+
+    context->files[context->file_count].node = (FileNode*)node;
+    context->files[context->file_count].path = copy;
+    context->file_count++;
+}
+
+/** qsort() order of files by first cluster */
+static int middleware_grep_compare_file(const void* a, const void* b) {
+    uint32_t first = ((const GrepFile*)a)->node->first_cluster;
+    uint32_t second = ((const GrepFile*)b)->node->first_cluster;
+    return (first > second) - (first < second);
+}
+
+/** Task: read and scan files, taking the next one until none is left */
+static void middleware_grep_worker(void* arg, uint32_t worker) {
+    (void)worker;
+    GrepContext* context = (GrepContext*)arg;
+
+    GrepScan* scan = calloc(1, sizeof(GrepScan));
+    uint8_t* window = malloc(context->keep + context->buffer_size);
+    char* text = malloc(context->matcher.max_length + 2 * GREP_CONTEXT + 1);
+    if (!scan || !window || !text) {
+        free(scan);
+        free(window);
+        free(text);
+        return;
+    }
+    scan->context = context;
+    scan->window = window;
+    scan->context_text = text;
+
+    uint32_t index;
+    while ((index = atomic_fetch_add(&context->next_file, 1)) < context->file_count) {
+        scan->file = &context->files[index];
+        scan->carried = 0;
+        scan->next_start = 0;
+
+        /** A file that cannot be read is skipped, matches already reported stand */
+        fat_driver_read_file_chunks(context->driver, scan->file->node, window + context->keep,
+                                    context->buffer_size, middleware_grep_chunk, scan);
+    }
+
+    free(text);
+    free(window);
+    free(scan);
+}
+
+/**
+ * Chunk callback: scan a piece together with the end of the previous one,
+ * then keep the end of both in front of the buffer for the next piece.
+ */
+static int middleware_grep_chunk(const uint8_t* data, uint32_t length, uint32_t offset, void* user_data) {
+    GrepScan* scan = (GrepScan*)user_data;
+    GrepContext* context = scan->context;
+
+    /** The region is the carried bytes followed by the piece, data is window + keep */
+    const uint8_t* region = data - scan->carried;
+    size_t region_length = scan->carried + length;
+    uint32_t region_offset = offset - (uint32_t)scan->carried;
+
+    /** Starts near the end wait for the next piece, unless this is the last one */
+    bool last = (uint64_t)offset + length >= scan->file->node->size;
+    size_t stop = region_length;
+    if (!last) stop = (region_length > context->defer) ? region_length - context->defer : 0;
+
+    size_t begin = scan->next_start - region_offset;
+    if (begin < stop) {
+        middleware_grep_scan(scan, region, begin, stop, region_length, region_offset);
+        scan->next_start = region_offset + (uint32_t)stop;
+    }
+
+    /** Move the last keep bytes of the region right in front of the buffer */
+    size_t carry = (region_length < context->keep) ? region_length : context->keep;
+    memmove(scan->window + context->keep - carry, region + region_length - carry, carry);
+    scan->carried = carry;
+
+    return 0;
+}
+
+/** Test every start in [begin, stop) of a region of length bytes */
+static void middleware_grep_scan(GrepScan* scan, const uint8_t* region, size_t begin, size_t stop,
+                                 size_t length, uint32_t region_offset) {
+    const GrepMatcher* matcher = &scan->context->matcher;
+    size_t i = begin;
+
+    if (matcher->first_count == 1) {
+        /** One first byte: let memchr() skip to each candidate */
+        uint8_t first = matcher->firsts[0];
+        while (i < stop) {
+            const uint8_t* hit = memchr(region + i, first, stop - i);
+            if (!hit) return;
+            i = (size_t)(hit - region);
+            middleware_grep_verify(scan, region, i, length, region_offset);
+            i++;
+        }
+        return;
+    }
+
+#if defined(__SSE2__)
+    if (matcher->first_count <= GREP_SIMD_BYTES) {
+        __m128i firsts[GREP_SIMD_BYTES];
+        for (uint32_t k = 0; k < matcher->first_count; k++) {
+            firsts[k] = _mm_set1_epi8((char)matcher->firsts[k]);
+        }
+
+        for (; i + 16 <= stop; i += 16) {
+            __m128i bytes = _mm_loadu_si128((const __m128i*)(region + i));
+            __m128i hits = _mm_cmpeq_epi8(bytes, firsts[0]);
+            for (uint32_t k = 1; k < matcher->first_count; k++) {
+                hits = _mm_or_si128(hits, _mm_cmpeq_epi8(bytes, firsts[k]));
+            }
+
+            uint32_t mask = (uint32_t)_mm_movemask_epi8(hits);
+            while (mask) {
+                middleware_grep_verify(scan, region, i + (uint32_t)__builtin_ctz(mask), length, region_offset);
+                mask &= mask - 1;
+            }
+        }
+    }
+#endif
+
+    /** Byte table for the rest, and for many first bytes */
+    for (; i < stop; i++) {
+        uint8_t byte = region[i];
+        if (matcher->group[byte] != matcher->group[byte + 1]) {
+            middleware_grep_verify(scan, region, i, length, region_offset);
+        }
+    }
+}
+
+/** Check the patterns starting with the byte at position */
+static void middleware_grep_verify(GrepScan* scan, const uint8_t* region, size_t position, size_t length,
+                                   uint32_t region_offset) {
+    const GrepMatcher* matcher = &scan->context->matcher;
+    uint8_t byte = region[position];
+
+    for (uint32_t k = matcher->group[byte]; k < matcher->group[byte + 1]; k++) {
+        uint32_t pattern = matcher->order[k];
+        size_t pattern_length = matcher->lengths[pattern];
+        if (position + pattern_length > length) continue;
+        if (memcmp(region + position + 1, matcher->patterns[pattern] + 1, pattern_length - 1) != 0) continue;
+
+        middleware_grep_report(scan, region, position, length, region_offset, pattern);
+    }
+}
+
+/** Build the context of a match and hand it to the callback */
+static void middleware_grep_report(GrepScan* scan, const uint8_t* region, size_t position, size_t length,
+                                   uint32_t region_offset, uint32_t pattern) {
+    GrepContext* context = scan->context;
+    size_t pattern_length = context->matcher.lengths[pattern];
+
+    /** The line around the match, at most GREP_CONTEXT bytes each side */
+    size_t first = (position > GREP_CONTEXT) ? position - GREP_CONTEXT : 0;
+    for (size_t i = position; i > first; i--) {
+        if (region[i - 1] == '\n') {
+            first = i;
+            break;
+        }
+    }
+
+    size_t end = position + pattern_length;
+    size_t limit = (end + GREP_CONTEXT < length) ? end + GREP_CONTEXT : length;
+    while (end < limit && region[end] != '\n') end++;
+
+    char* text = scan->context_text;
+    size_t out = 0;
+    for (size_t i = first; i < end; i++) {
+        uint8_t byte = region[i];
+        text[out++] = (byte >= 0x20 && byte < 0x7F) ? (char)byte : '.';
+    }
+    text[out] = '\0';
+
+    GrepMatch match;
+    match.node = scan->file->node;
+    match.path = scan->file->path;
+    match.offset = region_offset + (uint32_t)position;
+    match.pattern = pattern;
+    match.context = text;
+    match.context_start = (uint32_t)(position - first);
+
+    pthread_mutex_lock(&context->lock);
+    context->callback(&match, context->user_data);
+    context->matches++;
+    pthread_mutex_unlock(&context->lock);
+}
@@ -0,0 +1,64 @@
+/**
+ * @file middleware_grep.h
+ * @author Le Duc Son
+ * @date 2026-10-18
+ * @brief Parallel content search of the files in the mounted tree
+ * @details Candidate files are picked with a find query, sorted by their first
+ *          cluster and read in that order, so the image is read mostly
+ *          forward. Workers take the next file as they finish the last one.
+ *          A file is read one run of contiguous clusters at a time and each
+ *          piece is scanned as it arrives, a match that straddles two pieces
+ *          included. Matches are handed to a callback as soon as they are
+ *          found.
+ */
+
+#ifndef MIDDLEWARE_GREP_H
+#define MIDDLEWARE_GREP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "middleware_find.h"
+#include "../fat_driver/fat_driver_types.h"
+
+/**
+ * Bytes of context kept at most on each side of a match
+ */
+#define GREP_CONTEXT 32
+
+/**
+ * One match
+ */
+typedef struct {
+    const FileNode* node;               /**< File the match is in */
+    const char* path;                   /**< Absolute path of the file */
+    uint32_t offset;                    /**< Offset of the match in the file */
+    uint32_t pattern;                   /**< Index of the pattern that matched */
+    const char* context;                /**< Line around the match, cut at GREP_CONTEXT bytes
+                                             each side, unprintable bytes shown as '.' */
+    uint32_t context_start;             /**< Offset of the match in context */
+} GrepMatch;
+
+/**
+ * Called for each match, never by two threads at once
+ * @param match Match found, valid during the call
+ * @param user_data Value given to middleware_grep_run()
+ */
+typedef void (*GrepCallback)(const GrepMatch* match, void* user_data);
+
+/**
+ * Search the content of the files below a directory for fixed strings
+ * @param driver Mounted driver
+ * @param start Directory to search below
+ * @param files Which files to search, the type is forced to regular files.
+ *        NULL for every file
+ * @param patterns Strings to search for, none of them empty
+ * @param pattern_count Number of patterns
+ * @param callback Function called for each match
+ * @param user_data Value passed to the callback
+ * @return Number of matches, -1 if failed
+ */
+int middleware_grep_run(FATDriver* driver, FileNode* start, const FindQuery* files,
+                        const char* const* patterns, uint32_t pattern_count, GrepCallback callback,
+                        void* user_data);
+
+#endif /* MIDDLEWARE_GREP_H */
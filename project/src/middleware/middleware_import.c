@@ -0,0 +1,197 @@
+/**
+ * @file middleware_import.c
+ * @author Le Duc Son
+ * @date 2026-10-18
+ * @brief Copy of a host file or directory tree into the image
+ * @details The host tree is listed depth first with scandir(), in name order,
+ *          which puts every directory before its content as
+ *          fat_driver_import() requires. File content is read back by index
+ *          while the driver writes its stream; the stream reaches a file in
+ *          cluster order, so one file stays open at a time.
+ */
+
+#include "middleware_import.h"
+#include "../fat_driver/fat_driver.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Longest host path built, longer entries fail
+ */
+#define IMPORT_PATH_MAX 4096
+
+/**
+ * Host tree being imported
+ */
+typedef struct {
+    FatImportEntry* entries;            /**< Entries handed to the driver */
+    char** host_paths;                  /**< Host path of each entry */
+    uint32_t count;                     /**< Number of entries */
+    uint32_t capacity;                  /**< Allocated length of entries and host_paths */
+    uint32_t failed;                    /**< Host entries that could not be listed */
+    uint32_t open_index;                /**< Entry open in open_fd, UINT32_MAX for none */
+    int open_fd;                        /**< Descriptor of the open entry, -1 for none */
+} ImportContext;
+
+/* Local functions */
+static int middleware_import_add(ImportContext* context, const char* host_path, const char* name, uint32_t parent);
+static void middleware_import_list(ImportContext* context, const char* host_path, uint32_t parent);
+static int middleware_import_read(const FatImportEntry* entries, uint32_t index, uint32_t offset, void* buffer,
+                                  uint32_t size, void* user_data);
+
+/** Copy a host file, or the content of a host directory, into the image */
+int middleware_import_run(FATDriver* driver, const char* host_path, FileNode* destination,
+                          ImportNameCallback invalid_name, void* user_data, ImportStats* stats) {
+    if (stats) memset(stats, 0, sizeof(ImportStats));
+    if (!driver || !host_path || !destination) return -1;
+
+    struct stat info;
+    if (stat(host_path, &info) != 0) return -1;
+
+    ImportContext context;
+    memset(&context, 0, sizeof(context));
+    context.open_index = UINT32_MAX;
+    context.open_fd = -1;
+
+    if (S_ISDIR(info.st_mode)) {
+        middleware_import_list(&context, host_path, FAT_IMPORT_TOP);
+    } else {
+        const char* name = strrchr(host_path, '/');
+        name = name ? name + 1 : host_path;
+        if (middleware_import_add(&context, host_path, name, FAT_IMPORT_TOP) != 0) context.failed++;
+    }
+
+    FatImportReport report;
+    int result = fat_driver_import(driver, destination, context.entries, context.count, middleware_import_read,
+                                   &context, &report);
+    if (context.open_fd >= 0) close(context.open_fd);
+
+    if (invalid_name) {
+        for (uint32_t i = 0; i < context.count; i++) {
+            if (context.entries[i].invalid_name) invalid_name(context.host_paths[i], user_data);
+        }
+    }
+
+    if (stats) {
+        stats->directories = report.directories;
+        stats->files = report.files;
+        stats->skipped = report.skipped;
+        stats->invalid_names = report.invalid_names;
+        stats->failed = context.failed;
+        stats->extents = report.extents;
+        stats->writes = report.writes;
+        for (uint32_t i = 0; i < context.count; i++) {
+            if (context.entries[i].imported && context.entries[i].type == FILE_TYPE_REGULAR) {
+                stats->bytes += context.entries[i].size;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < context.count; i++) {
+        free((char*)context.entries[i].name);
+        free(context.host_paths[i]);
+    }
+    free(context.entries);
+    free(context.host_paths);
+
+    return (result == 0 && context.failed == 0 && report.invalid_names == 0) ? 0 : -1;
+}
+
+/** Append one host entry; files of 4 GiB or more do not fit in FAT */
+static int middleware_import_add(ImportContext* context, const char* host_path, const char* name, uint32_t parent) {
+    struct stat info;
+    if (stat(host_path, &info) != 0) return -1;
+    if (!S_ISDIR(info.st_mode) && !S_ISREG(info.st_mode)) return -1;
+    if (S_ISREG(info.st_mode) && (uint64_t)info.st_size > UINT32_MAX) return -1;
+
+    if (context->count == context->capacity) {
+        uint32_t capacity = context->capacity ? context->capacity * 2 : 64;
+        FatImportEntry* entries = realloc(context->entries, capacity * sizeof(FatImportEntry));
+        if (!entries) return -1;
+        context->entries = entries;
+        char** host_paths = realloc(context->host_paths, capacity * sizeof(char*));
+        if (!host_paths) return -1;
+        context->host_paths = host_paths;
+        context->capacity = capacity;
+    }
+
+    char* name_copy = strdup(name);
+    char* path_copy = strdup(host_path);
+    if (!name_copy || !path_copy) {
+        free(name_copy);
+        free(path_copy);
+        return -1;
+    }
+
+    FatImportEntry* entry = &context->entries[context->count];
+    memset(entry, 0, sizeof(FatImportEntry));
+    entry->name = name_copy;
+    entry->type = S_ISDIR(info.st_mode) ? FILE_TYPE_DIRECTORY : FILE_TYPE_REGULAR;
+    entry->parent = parent;
+    entry->size = S_ISREG(info.st_mode) ? (uint32_t)info.st_size : 0;
+    entry->modified = info.st_mtime;
+    context->host_paths[context->count] = path_copy;
+    context->count++;
+    return 0;
+}
+
+/** List a host directory into the tree, each subdirectory followed by its content */
+static void middleware_import_list(ImportContext* context, const char* host_path, uint32_t parent) {
+    struct dirent** names = NULL;
+    int count = scandir(host_path, &names, NULL, alphasort);
+    if (count < 0) {
+        context->failed++;
+        return;
+    }
+
+    for (int i = 0; i < count; i++) {
+        const char* name = names[i]->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+
+        char path[IMPORT_PATH_MAX];
+        int length = snprintf(path, sizeof(path), "%s/%s", host_path, name);
+        if (length < 0 || (size_t)length >= sizeof(path) ||
+            middleware_import_add(context, path, name, parent) != 0) {
+            context->failed++;
+            continue;
+        }
+
+        uint32_t index = context->count - 1;
+        if (context->entries[index].type == FILE_TYPE_DIRECTORY) {
+            middleware_import_list(context, path, index);
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        free(names[i]);
+    }
+    free(names);
+}
+
+/** Driver callback: read part of a host file, keeping the last file open */
+static int middleware_import_read(const FatImportEntry* entries, uint32_t index, uint32_t offset, void* buffer,
+                                  uint32_t size, void* user_data) {
+    (void)entries;
+    ImportContext* context = (ImportContext*)user_data;
+
+    if (context->open_index != index) {
+        if (context->open_fd >= 0) close(context->open_fd);
+        context->open_fd = open(context->host_paths[index], O_RDONLY);
+        context->open_index = context->open_fd >= 0 ? index : UINT32_MAX;
+        if (context->open_fd < 0) return -1;
+    }
+
+    /** A file that shrank since it was listed fails the import */
+    uint32_t done = 0;
+    while (done < size) {
+        ssize_t count = pread(context->open_fd, (uint8_t*)buffer + done, size - done, (off_t)offset + done);
+        if (count <= 0) return -1;
+        done += (uint32_t)count;
+    }
+    return 0;
+}
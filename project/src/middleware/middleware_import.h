@@ -0,0 +1,54 @@
+/**
+ * @file middleware_import.h
+ * @author Le Duc Son
+ * @date 2026-10-18
+ * @brief Copy of a host file or directory tree into the image
+ * @details The host tree is listed completely before anything is written, so
+ *          fat_driver_import() can plan the clusters of the whole tree at
+ *          once and write the data as one sequential stream.
+ */
+
+#ifndef MIDDLEWARE_IMPORT_H
+#define MIDDLEWARE_IMPORT_H
+
+#include <stdint.h>
+#include "../fat_driver/fat_driver_types.h"
+
+/**
+ * Outcome of an import
+ */
+typedef struct {
+    uint32_t directories;               /**< Directories created in the image */
+    uint32_t files;                     /**< Files copied */
+    uint32_t skipped;                   /**< Entries left out: name not valid in 8.3 form, or already present */
+    uint32_t invalid_names;             /**< Entries left out because their name has no 8.3 form */
+    uint32_t failed;                    /**< Host entries that could not be listed or are too large */
+    uint32_t extents;                   /**< Runs of consecutive clusters allocated */
+    uint32_t writes;                    /**< Write requests issued for the data */
+    uint64_t bytes;                     /**< Bytes copied */
+} ImportStats;
+
+/**
+ * Called for each host entry left out because its name has no 8.3 form
+ * @param host_path Host path of the entry, everything inside it is left out too
+ * @param user_data Value given to middleware_import_run()
+ */
+typedef void (*ImportNameCallback)(const char* host_path, void* user_data);
+
+/**
+ * Copy a host file, or the content of a host directory, into a directory of
+ * a read-write mount. Entries of the same name already in the destination
+ * are left as they are; entries whose name has no 8.3 form are left out and
+ * reported, and make the import fail
+ * @param driver Mounted driver
+ * @param host_path Host file or directory to copy
+ * @param destination Directory to copy into
+ * @param invalid_name Function called for each name without an 8.3 form, may be NULL
+ * @param user_data Value passed to invalid_name
+ * @param stats Pointer to store the outcome, may be NULL
+ * @return 0 if everything listed was copied, -1 if anything failed or was left out for its name
+ */
+int middleware_import_run(FATDriver* driver, const char* host_path, FileNode* destination,
+                          ImportNameCallback invalid_name, void* user_data, ImportStats* stats);
+
+#endif /* MIDDLEWARE_IMPORT_H */
@@ -0,0 +1,332 @@
+/**
+ * @file mount_manager.c
+ * @author Le Duc Son
+ * @date 2026-10-18
+ * @brief Mount manager implementation
+ */
+
+#include "mount_manager.h"
+#include "../fat_driver/fat_driver.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Local functions */
+static MountedVolume* mount_manager_find(MountManager* manager, const char* img_path);
+static MountedVolume* mount_manager_find_driver(MountManager* manager, const FATDriver* driver);
+static FATDriver* mount_manager_mount(MountManager* manager, const MountedVolume* volume, size_t* memory);
+static void mount_manager_unmount(MountManager* manager, MountedVolume* volume);
+static void mount_manager_unlink(MountManager* manager, MountedVolume* volume);
+static uint32_t mount_manager_evict(MountManager* manager, size_t target);
+
+/**
+ * Initialize a mount manager
+ * @param manager Pointer to MountManager structure
+ * @param cache_sectors Number of sectors of the shared cache
+ * @param memory_budget Bytes the mounted volumes may use besides the cache
+ * @return 0 if success, -1 if failed
+ */
+int mount_manager_init(MountManager* manager, uint32_t cache_sectors, size_t memory_budget) {
+    if (!manager) return -1;
+
+    memset(manager, 0, sizeof(MountManager));
+    if (block_cache_init(&manager->cache, cache_sectors, SECTOR_SIZE_512) != 0) return -1;
+    if (pthread_mutex_init(&manager->lock, NULL) != 0) {
+        block_cache_deinit(&manager->cache);
+        return -1;
+    }
+    if (pthread_cond_init(&manager->changed, NULL) != 0) {
+        pthread_mutex_destroy(&manager->lock);
+        block_cache_deinit(&manager->cache);
+        return -1;
+    }
+    manager->memory_budget = memory_budget;
+
+    return 0;
+}
+
+/**
+ * Unmount every volume and release the manager. No volume may still be
+ * acquired
+ * @param manager Pointer to MountManager structure
+ */
+void mount_manager_deinit(MountManager* manager) {
+    if (!manager) return;
+
+    pthread_mutex_lock(&manager->lock);
+    while (manager->volumes) {
+        mount_manager_unmount(manager, manager->volumes);
+    }
+    pthread_mutex_unlock(&manager->lock);
+
+    block_cache_deinit(&manager->cache);
+    pthread_cond_destroy(&manager->changed);
+    pthread_mutex_destroy(&manager->lock);
+    memset(manager, 0, sizeof(MountManager));
+}
+
+/**
+ * Get the driver of an image, mounting it if needed
+ * @param manager Pointer to MountManager structure
+ * @param img_path Path of the image
+ * @param mode Mount mode, an image in use in the other mode is refused
+ * @return Pointer to the mounted driver, NULL if failed
+ */
+FATDriver* mount_manager_acquire(MountManager* manager, const char* img_path, FileSystemMode mode) {
+    if (!manager || !img_path) return NULL;
+
+    pthread_mutex_lock(&manager->lock);
+
+    MountedVolume* volume;
+    for (;;) {
+        volume = mount_manager_find(manager, img_path);
+        if (volume && volume->state != VOLUME_MOUNTED) {
+            /* Another thread is mounting or unmounting it, wait for the outcome */
+            pthread_cond_wait(&manager->changed, &manager->lock);
+            continue;
+        }
+        if (volume && volume->mode != mode) {
+            /* An idle volume may change mode, one in use may not */
+            if (volume->users > 0) {
+                pthread_mutex_unlock(&manager->lock);
+                return NULL;
+            }
+            mount_manager_unmount(manager, volume);
+            continue;
+        }
+        break;
+    }
+
+    if (volume) {
+        volume->users++;
+    } else {
+        volume = calloc(1, sizeof(MountedVolume));
+        char* path = malloc(strlen(img_path) + 1);
+        if (!volume || !path) {
+            free(volume);
+            free(path);
+            pthread_mutex_unlock(&manager->lock);
+            return NULL;
+        }
+        strcpy(path, img_path);
+        volume->img_path = path;
+        volume->mode = mode;
+        volume->state = VOLUME_MOUNTING;
+        volume->users = 1;
+        volume->next = manager->volumes;
+        manager->volumes = volume;
+        manager->volume_count++;
+
+        /* The record keeps other acquires of the image waiting meanwhile */
+        pthread_mutex_unlock(&manager->lock);
+        size_t memory = 0;
+        FATDriver* driver = mount_manager_mount(manager, volume, &memory);
+        pthread_mutex_lock(&manager->lock);
+
+        pthread_cond_broadcast(&manager->changed);
+        if (!driver) {
+            mount_manager_unlink(manager, volume);
+            pthread_mutex_unlock(&manager->lock);
+            return NULL;
+        }
+
+        volume->driver = driver;
+        volume->state = VOLUME_MOUNTED;
+        volume->memory = memory;
+        manager->memory_used += memory;
+        manager->mounted_count++;
+        manager->mounts++;
+    }
+
+    /* The new mount may push the others over the budget */
+    mount_manager_evict(manager, manager->memory_budget);
+
+    FATDriver* driver = volume->driver;
+    pthread_mutex_unlock(&manager->lock);
+
+    return driver;
+}
+
+/**
+ * Give back a driver returned by mount_manager_acquire()
+ * @param manager Pointer to MountManager structure
+ * @param driver Driver to release
+ */
+void mount_manager_release(MountManager* manager, FATDriver* driver) {
+    if (!manager || !driver) return;
+
+    pthread_mutex_lock(&manager->lock);
+
+    MountedVolume* volume = mount_manager_find_driver(manager, driver);
+    if (volume && volume->users > 0) {
+        /* Writes grow free-slot indexes, count the volume again as it goes idle.
+           The walk over the tree runs unlocked, this use keeps the volume mounted */
+        if (volume->users == 1) {
+            pthread_mutex_unlock(&manager->lock);
+            size_t memory = fat_driver_memory_usage(driver);
+            pthread_mutex_lock(&manager->lock);
+            manager->memory_used = manager->memory_used - volume->memory + memory;
+            volume->memory = memory;
+        }
+
+        volume->users--;
+        volume->last_used = ++manager->clock;
+
+        mount_manager_evict(manager, manager->memory_budget);
+    }
+
+    pthread_mutex_unlock(&manager->lock);
+}
+
+/**
+ * Unmount idle volumes until the mounted volumes use at most target bytes
+ * @param manager Pointer to MountManager structure
+ * @param target Memory to get under, 0 unmounts every idle volume
+ * @return Number of volumes unmounted
+ */
+uint32_t mount_manager_trim(MountManager* manager, size_t target) {
+    if (!manager) return 0;
+
+    pthread_mutex_lock(&manager->lock);
+    uint32_t count = mount_manager_evict(manager, target);
+    pthread_mutex_unlock(&manager->lock);
+
+    return count;
+}
+
+/**
+ * Get the counters of a mount manager
+ * @param manager Pointer to MountManager structure
+ * @param stats Pointer to store the counters
+ */
+void mount_manager_get_stats(MountManager* manager, MountManagerStats* stats) {
+    if (!manager || !stats) return;
+
+    pthread_mutex_lock(&manager->lock);
+    stats->volumes = manager->volume_count;
+    stats->mounted = manager->mounted_count;
+    stats->memory_used = manager->memory_used;
+    stats->memory_budget = manager->memory_budget;
+    stats->mounts = manager->mounts;
+    stats->evictions = manager->evictions;
+    pthread_mutex_unlock(&manager->lock);
+
+    pthread_mutex_lock(&manager->cache.lock);
+    stats->cache_hits = manager->cache.hits;
+    stats->cache_misses = manager->cache.misses;
+    pthread_mutex_unlock(&manager->cache.lock);
+}
+
+/** Internal function to find a known image by path */
+static MountedVolume* mount_manager_find(MountManager* manager, const char* img_path) {
+    for (MountedVolume* volume = manager->volumes; volume; volume = volume->next) {
+        if (strcmp(volume->img_path, img_path) == 0) return volume;
+    }
+    return NULL;
+}
+
+/** Internal function to find the volume a driver belongs to */
+static MountedVolume* mount_manager_find_driver(MountManager* manager, const FATDriver* driver) {
+    for (MountedVolume* volume = manager->volumes; volume; volume = volume->next) {
+        if (volume->driver == driver) return volume;
+    }
+    return NULL;
+}
+
+/**
+ * Internal function to mount a volume on the shared cache, called without the
+ * manager lock. The configuration follows middleware_init(), except that no
+ * volume keeps a worker pool: with hundreds of mounts the pools' threads would
+ * outnumber the processors.
+ */
+static FATDriver* mount_manager_mount(MountManager* manager, const MountedVolume* volume, size_t* memory) {
+    FATDriver* driver = malloc(sizeof(FATDriver));
+    if (!driver) return NULL;
+
+    FileSystemConfig config;
+    config.img_path = volume->img_path;
+    config.mode = volume->mode;
+    config.fat_type = FAT_TYPE_16; /** Determined in fat_driver_mount */
+    config.sector_size = SECTOR_SIZE_512;
+    config.cache_size = CACHE_SIZE_128; /** Not used on a shared cache */
+    config.dir_name_len = DIR_NAME_LEN_8;
+    config.fat_table_mode = manager->fat_run_index ? FAT_TABLE_RUNS : FAT_TABLE_PAGED;
+    config.worker_threads = 1;
+    config.prefetch_tree = true;
+    config.mount_index = manager->mount_index;
+
+    if (fat_driver_init_shared(driver, config, &manager->cache) != 0) {
+        free(driver);
+        return NULL;
+    }
+    if (fat_driver_mount(driver) != 0) {
+        fat_driver_unmount(driver);
+        fat_driver_deinit(driver);
+        free(driver);
+        return NULL;
+    }
+
+    *memory = fat_driver_memory_usage(driver);
+    return driver;
+}
+
+/**
+ * Internal function to unmount an idle volume and free its record. Called
+ * with the manager lock held; the lock is dropped while the driver syncs and
+ * closes the image
+ */
+static void mount_manager_unmount(MountManager* manager, MountedVolume* volume) {
+    FATDriver* driver = volume->driver;
+    volume->state = VOLUME_UNMOUNTING;
+    volume->driver = NULL;
+    manager->memory_used -= volume->memory;
+    volume->memory = 0;
+    manager->mounted_count--;
+
+    pthread_mutex_unlock(&manager->lock);
+    fat_driver_unmount(driver);
+    fat_driver_deinit(driver);
+    free(driver);
+    pthread_mutex_lock(&manager->lock);
+
+    mount_manager_unlink(manager, volume);
+    pthread_cond_broadcast(&manager->changed);
+}
+
+/** Internal function to take a record off the volume list and free it */
+static void mount_manager_unlink(MountManager* manager, MountedVolume* volume) {
+    MountedVolume** link = &manager->volumes;
+    while (*link && *link != volume) {
+        link = &(*link)->next;
+    }
+    if (*link) *link = volume->next;
+
+    manager->volume_count--;
+    free(volume->img_path);
+    free(volume);
+}
+
+/**
+ * Internal function to unmount the least recently used idle volume until the
+ * mounted volumes fit in target bytes or no idle volume is left. The lock is
+ * dropped during each unmount
+ */
+static uint32_t mount_manager_evict(MountManager* manager, size_t target) {
+    uint32_t count = 0;
+
+    while (manager->memory_used > target) {
+        MountedVolume* oldest = NULL;
+        for (MountedVolume* volume = manager->volumes; volume; volume = volume->next) {
+            if (volume->state == VOLUME_MOUNTED && volume->users == 0 &&
+                (!oldest || volume->last_used < oldest->last_used)) {
+                oldest = volume;
+            }
+        }
+        if (!oldest) break;
+
+        mount_manager_unmount(manager, oldest);
+        manager->evictions++;
+        count++;
+    }
+
+    return count;
+}
@@ -0,0 +1,136 @@
+/**
+ * @file mount_manager.h
+ * @author Le Duc Son
+ * @date 2026-10-18
+ * @brief Many mounted images under one memory budget
+ * @details The manager owns a FATDriver per image and one block cache keyed by
+ *          (volume, sector) that every volume reads through, so cache slots
+ *          go to whichever volume is busy. Volumes are mounted on first use.
+ *          When the estimated memory of the mounted trees exceeds the budget,
+ *          idle volumes are unmounted, least recently used first, and mounted
+ *          again by the next acquire. All functions may be called from
+ *          several threads. Mounts and unmounts, with the sync an unmount
+ *          does, run without the manager lock: the volume is marked as being
+ *          mounted or unmounted and other acquires of that image wait for the
+ *          outcome, while the other images stay usable.
+ */
+
+#ifndef MOUNT_MANAGER_H
+#define MOUNT_MANAGER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "../common/common_types.h"
+#include "../block_cache/block_cache.h"
+#include "../fat_driver/fat_driver_types.h"
+
+/**
+ * State of a volume record. A record exists from the first acquire of an
+ * image until the image is unmounted
+ */
+typedef enum {
+    VOLUME_MOUNTING,                    /**< Being mounted by an acquire, driver still NULL */
+    VOLUME_MOUNTED,                     /**< Driver ready */
+    VOLUME_UNMOUNTING                   /**< Being unmounted, the record is freed after */
+} VolumeState;
+
+/**
+ * One image known to the manager
+ */
+typedef struct MountedVolume {
+    char* img_path;                     /**< Image path (owned copy) */
+    FileSystemMode mode;                /**< Mode of the mount */
+    VolumeState state;                  /**< Mounting, mounted or unmounting */
+    FATDriver* driver;                  /**< Mounted driver, NULL unless VOLUME_MOUNTED */
+    size_t memory;                      /**< Estimated memory of the mount */
+    uint32_t users;                     /**< Acquisitions not released yet */
+    uint64_t last_used;                 /**< Manager clock at the last release */
+    struct MountedVolume* next;         /**< Next known image */
+} MountedVolume;
+
+/**
+ * Counters of a mount manager
+ */
+typedef struct {
+    uint32_t volumes;                   /**< Images mounted or being mounted or unmounted */
+    uint32_t mounted;                   /**< Images mounted now */
+    size_t memory_used;                 /**< Estimated memory of the mounted volumes */
+    size_t memory_budget;               /**< Budget for the mounted volumes */
+    uint64_t mounts;                    /**< Mounts done, remounts included */
+    uint64_t evictions;                 /**< Idle volumes unmounted to fit the budget */
+    uint64_t cache_hits;                /**< Shared cache lookups served from memory */
+    uint64_t cache_misses;              /**< Shared cache lookups that read the image */
+} MountManagerStats;
+
+/**
+ * Mount manager structure
+ */
+typedef struct {
+    BlockCache cache;                   /**< Sector cache shared by every volume */
+    size_t memory_budget;               /**< Bytes for mounted volumes, the cache not included */
+    size_t memory_used;                 /**< Estimated bytes of the mounted volumes */
+    MountedVolume* volumes;             /**< Volume records */
+    uint32_t volume_count;              /**< Number of volume records */
+    uint32_t mounted_count;             /**< Number of mounted images */
+    uint64_t clock;                     /**< Advances at each release, orders idle volumes */
+    uint64_t mounts;                    /**< Mounts done */
+    uint64_t evictions;                 /**< Idle volumes unmounted to fit the budget */
+    pthread_mutex_t lock;               /**< Guards the volume list and counters, not held across mounts */
+    pthread_cond_t changed;             /**< Signaled when a volume finishes mounting or unmounting */
+    bool fat_run_index;                 /**< Mount with the FAT run index, false after init */
+    bool mount_index;                   /**< Read-only mounts use the sidecar index, false after init */
+} MountManager;
+
+/**
+ * Initialize a mount manager
+ * @param manager Pointer to MountManager structure
+ * @param cache_sectors Number of sectors of the shared cache
+ * @param memory_budget Bytes the mounted volumes may use besides the cache
+ * @return 0 if success, -1 if failed
+ */
+int mount_manager_init(MountManager* manager, uint32_t cache_sectors, size_t memory_budget);
+
+/**
+ * Unmount every volume and release the manager. No volume may still be
+ * acquired
+ * @param manager Pointer to MountManager structure
+ */
+void mount_manager_deinit(MountManager* manager);
+
+/**
+ * Get the driver of an image, mounting it if needed. With mount_index set,
+ * read-only mounts use the sidecar mount index, so remounting an evicted
+ * image is cheap while the image is unchanged
+ * @param manager Pointer to MountManager structure
+ * @param img_path Path of the image
+ * @param mode Mount mode, an image in use in the other mode is refused
+ * @return Pointer to the mounted driver, NULL if failed
+ */
+FATDriver* mount_manager_acquire(MountManager* manager, const char* img_path, FileSystemMode mode);
+
+/**
+ * Give back a driver returned by mount_manager_acquire(). The volume becomes
+ * idle when its last user releases it and may then be unmounted
+ * @param manager Pointer to MountManager structure
+ * @param driver Driver to release
+ */
+void mount_manager_release(MountManager* manager, FATDriver* driver);
+
+/**
+ * Unmount idle volumes, least recently used first, until the mounted volumes
+ * use at most the given memory
+ * @param manager Pointer to MountManager structure
+ * @param target Memory to get under, 0 unmounts every idle volume
+ * @return Number of volumes unmounted
+ */
+uint32_t mount_manager_trim(MountManager* manager, size_t target);
+
+/**
+ * Get the counters of a mount manager
+ * @param manager Pointer to MountManager structure
+ * @param stats Pointer to store the counters
+ */
+void mount_manager_get_stats(MountManager* manager, MountManagerStats* stats);
+
+#endif // MOUNT_MANAGER_H
@@ -0,0 +1,357 @@
+/**
+ * @file threadpool.c
+ * @brief Implementation of the work-stealing thread pool
+ * @author Le Duc Son
+ * @date 2026-10-18
+ */
+
+#include "threadpool.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+/**
+ * Initial ring size of a deque
+ */
+#define THREADPOOL_DEQUE_INITIAL 64
+
+/**
+ * Worker identity of the calling thread, used to route submissions
+ */
+static _Thread_local ThreadPool* threadpool_current_pool = NULL;
+static _Thread_local uint32_t threadpool_current_worker = 0;
+
+/* Local functions */
+static void* threadpool_worker_main(void* arg);
+static bool threadpool_push(ThreadPoolDeque* deque, ThreadPoolTask task);
+static bool threadpool_pop_newest(ThreadPoolDeque* deque, ThreadPoolTask* task);
+static bool threadpool_pop_oldest(ThreadPoolDeque* deque, ThreadPoolTask* task);
+static bool threadpool_take(ThreadPool* pool, uint32_t worker, ThreadPoolTask* task);
+static void threadpool_group_finish(ThreadPoolGroup* group);
+
+/**
+ * Initialize a thread pool and start its workers
+ * @param pool the ThreadPool to initialize
+ * @param worker_count the number of worker threads
+ * @return true if successful, false otherwise
+ */
+bool threadpool_init(ThreadPool* pool, uint32_t worker_count) {
+    if (!pool || worker_count == 0) return false;
+
+    pool->threads = calloc(worker_count, sizeof(pthread_t));
+    pool->deques = calloc(worker_count, sizeof(ThreadPoolDeque));
+    if (!pool->threads || !pool->deques) {
+        free(pool->threads);
+        free(pool->deques);
+        pool->threads = NULL;
+        pool->deques = NULL;
+        return false;
+    }
+
+    pool->worker_count = worker_count;
+    pool->stopping = false;
+    atomic_init(&pool->queued, 0);
+    atomic_init(&pool->pending, 0);
+    atomic_init(&pool->next_deque, 0);
+    atomic_init(&pool->started, 0);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->all_done, NULL);
+
+    for (uint32_t i = 0; i < worker_count; i++) {
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+    }
+
+    for (uint32_t i = 0; i < worker_count; i++) {
+        if (pthread_create(&pool->threads[i], NULL, threadpool_worker_main, pool) != 0) {
+            /* Stop the workers already running */
+            pool->thread_count = i;
+            threadpool_deinit(pool);
+            return false;
+        }
+    }
+    pool->thread_count = worker_count;
+
+    return true;
+}
+
+/**
+ * Finish the queued tasks, stop the workers and free the pool memory
+ * @param pool the ThreadPool to deinitialize
+ */
+void threadpool_deinit(ThreadPool* pool) {
+    if (!pool || !pool->deques) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (uint32_t i = 0; i < pool->thread_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    for (uint32_t i = 0; i < pool->worker_count; i++) {
+        pthread_mutex_destroy(&pool->deques[i].lock);
+        free(pool->deques[i].tasks);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->all_done);
+    free(pool->threads);
+    free(pool->deques);
+    pool->threads = NULL;
+    pool->deques = NULL;
+    pool->worker_count = 0;
+    pool->thread_count = 0;
+}
+
+/**
+ * Submit a task
+ * @param pool the ThreadPool to submit to
+ * @param func the function to run
+ * @param arg the argument of the function
+ * @return true if successful, false otherwise
+ */
+bool threadpool_submit(ThreadPool* pool, ThreadPoolFunc func, void* arg) {
+    return threadpool_submit_group(pool, NULL, func, arg);
+}
+
+/**
+ * Submit a task that counts in a group
+ * @param pool the ThreadPool to submit to
+ * @param group the group of the task, NULL for none
+ * @param func the function to run
+ * @param arg the argument of the function
+ * @return true if successful, false otherwise
+ */
+bool threadpool_submit_group(ThreadPool* pool, ThreadPoolGroup* group, ThreadPoolFunc func, void* arg) {
+    if (!pool || !func || pool->worker_count == 0) return false;
+
+    /* Workers keep their own tasks, other threads spread them round robin */
+    uint32_t target;
+    if (threadpool_current_pool == pool) {
+        target = threadpool_current_worker;
+    } else {
+        target = atomic_fetch_add(&pool->next_deque, 1) % pool->worker_count;
+    }
+
+    ThreadPoolTask task = { func, arg, group };
+    if (group) {
+        pthread_mutex_lock(&group->lock);
+        group->pending++;
+        pthread_mutex_unlock(&group->lock);
+    }
+    atomic_fetch_add(&pool->pending, 1);
+    atomic_fetch_add(&pool->queued, 1);
+    if (!threadpool_push(&pool->deques[target], task)) {
+        atomic_fetch_sub(&pool->queued, 1);
+        atomic_fetch_sub(&pool->pending, 1);
+        if (group) threadpool_group_finish(group);
+        return false;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    return true;
+}
+
+/**
+ * Wait until every submitted task has finished
+ * @param pool the ThreadPool to wait for
+ */
+void threadpool_wait(ThreadPool* pool) {
+    if (!pool || pool->worker_count == 0) return;
+
+    pthread_mutex_lock(&pool->lock);
+    while (atomic_load(&pool->pending) != 0) {
+        pthread_cond_wait(&pool->all_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Initialize an empty task group
+ * @param group the ThreadPoolGroup to initialize
+ * @return true if successful, false otherwise
+ */
+bool threadpool_group_init(ThreadPoolGroup* group) {
+    if (!group) return false;
+
+    group->pending = 0;
+    if (pthread_mutex_init(&group->lock, NULL) != 0) return false;
+    if (pthread_cond_init(&group->done, NULL) != 0) {
+        pthread_mutex_destroy(&group->lock);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Release a task group
+ * @param group the ThreadPoolGroup to release
+ */
+void threadpool_group_deinit(ThreadPoolGroup* group) {
+    if (!group) return;
+
+    pthread_cond_destroy(&group->done);
+    pthread_mutex_destroy(&group->lock);
+}
+
+/**
+ * Wait until every task of a group has finished
+ * @param group the ThreadPoolGroup to wait for
+ */
+void threadpool_group_wait(ThreadPoolGroup* group) {
+    if (!group) return;
+
+    pthread_mutex_lock(&group->lock);
+    while (group->pending != 0) {
+        pthread_cond_wait(&group->done, &group->lock);
+    }
+    pthread_mutex_unlock(&group->lock);
+}
+
+/**
+ * Number of online processors
+ * @return the processor count, at least 1
+ */
+uint32_t threadpool_cpu_count(void) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (uint32_t)count : 1;
+}
+
+/**
+ * Worker loop: run own tasks newest first, steal when empty, sleep when
+ * every deque is empty
+ */
+static void* threadpool_worker_main(void* arg) {
+    ThreadPool* pool = (ThreadPool*)arg;
+    uint32_t worker = atomic_fetch_add(&pool->started, 1);
+
+    threadpool_current_pool = pool;
+    threadpool_current_worker = worker;
+
+    for (;;) {
+        ThreadPoolTask task;
+        if (threadpool_take(pool, worker, &task)) {
+            task.func(task.arg, worker);
+            if (task.group) threadpool_group_finish(task.group);
+
+            if (atomic_fetch_sub(&pool->pending, 1) == 1) {
+                pthread_mutex_lock(&pool->lock);
+                pthread_cond_broadcast(&pool->all_done);
+                pthread_mutex_unlock(&pool->lock);
+            }
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        while (atomic_load(&pool->queued) == 0 && !pool->stopping) {
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+        bool done = pool->stopping && atomic_load(&pool->queued) == 0;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (done) break;
+    }
+
+    return NULL;
+}
+
+/**
+ * Append a task at the newest end of a deque, growing the ring if needed
+ */
+static bool threadpool_push(ThreadPoolDeque* deque, ThreadPoolTask task) {
+    pthread_mutex_lock(&deque->lock);
+
+    if (deque->count == deque->capacity) {
+        uint32_t capacity = deque->capacity ? deque->capacity * 2 : THREADPOOL_DEQUE_INITIAL;
+        ThreadPoolTask* tasks = malloc(capacity * sizeof(ThreadPoolTask));
+        if (!tasks) {
+            pthread_mutex_unlock(&deque->lock);
+            return false;
+        }
+
+        /* Unwrap the ring into the new storage */
+        for (uint32_t i = 0; i < deque->count; i++) {
+            tasks[i] = deque->tasks[(deque->head + i) & (deque->capacity - 1)];
+        }
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->capacity = capacity;
+        deque->head = 0;
+    }
+
+    deque->tasks[(deque->head + deque->count) & (deque->capacity - 1)] = task;
+    deque->count++;
+
+    pthread_mutex_unlock(&deque->lock);
+    return true;
+}
+
+/**
+ * Take the newest task of a deque (owner side)
+ */
+static bool threadpool_pop_newest(ThreadPoolDeque* deque, ThreadPoolTask* task) {
+    bool found = false;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count > 0) {
+        deque->count--;
+        *task = deque->tasks[(deque->head + deque->count) & (deque->capacity - 1)];
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return found;
+}
+
+/**
+ * Take the oldest task of a deque (thief side)
+ */
+static bool threadpool_pop_oldest(ThreadPoolDeque* deque, ThreadPoolTask* task) {
+    bool found = false;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count > 0) {
+        *task = deque->tasks[deque->head];
+        deque->head = (deque->head + 1) & (deque->capacity - 1);
+        deque->count--;
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return found;
+}
+
+/**
+ * Take a task from the worker's own deque or steal one from another worker
+ */
+static bool threadpool_take(ThreadPool* pool, uint32_t worker, ThreadPoolTask* task) {
+    if (atomic_load(&pool->queued) == 0) return false;
+
+    bool found = threadpool_pop_newest(&pool->deques[worker], task);
+    for (uint32_t i = 1; !found && i < pool->worker_count; i++) {
+        found = threadpool_pop_oldest(&pool->deques[(worker + i) % pool->worker_count], task);
+    }
+
+    if (found) {
+        atomic_fetch_sub(&pool->queued, 1);
+    }
+    return found;
+}
+
+/**
+ * Count one task of a group as finished. The count drops under the group
+ * lock, so a waiter woken by the last task can release the group at once.
+ */
+static void threadpool_group_finish(ThreadPoolGroup* group) {
+    pthread_mutex_lock(&group->lock);
+    if (--group->pending == 0) {
+        pthread_cond_broadcast(&group->done);
+    }
+    pthread_mutex_unlock(&group->lock);
+}
@@ -0,0 +1,147 @@
+/**
+ * @file threadpool.h
+ * @author Le Duc Son
+ * @date 2026-10-18
+ * @brief Header file for the work-stealing thread pool
+ * @details Each worker owns a task deque. A task submitted from a worker goes
+ *          to that worker's deque and is taken back newest first, which keeps
+ *          recursive work depth-first and cache friendly. An idle worker
+ *          steals the oldest task of another deque.
+ *
+ *          The pool may be shared by several callers at once. A caller that
+ *          needs to know when its own tasks are done submits them to a group
+ *          and waits on the group, not on the whole pool.
+ */
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/**
+ * Task function
+ * @param arg Argument given at submission
+ * @param worker Index of the worker running the task
+ */
+typedef void (*ThreadPoolFunc)(void* arg, uint32_t worker);
+
+/**
+ * @struct ThreadPoolGroup
+ * @brief Tasks of one caller, waited for apart from the rest of the pool
+ */
+typedef struct {
+    uint32_t pending;            /**< Tasks submitted to the group and not finished */
+    pthread_mutex_t lock;        /**< Protects pending */
+    pthread_cond_t done;         /**< Signalled when pending drops to zero */
+} ThreadPoolGroup;
+
+/**
+ * @struct ThreadPoolTask
+ * @brief Queued task
+ */
+typedef struct {
+    ThreadPoolFunc func;         /**< Function to run */
+    void* arg;                   /**< Argument of the function */
+    ThreadPoolGroup* group;      /**< Group the task counts in, NULL for none */
+} ThreadPoolTask;
+
+/**
+ * @struct ThreadPoolDeque
+ * @brief Task deque of one worker (ring buffer)
+ */
+typedef struct {
+    pthread_mutex_t lock;        /**< Protects the ring */
+    ThreadPoolTask* tasks;       /**< Ring storage */
+    uint32_t capacity;           /**< Ring size (power of two) */
+    uint32_t head;               /**< Oldest task, stolen first */
+    uint32_t count;              /**< Number of queued tasks */
+} ThreadPoolDeque;
+
+/**
+ * @struct ThreadPool
+ * @brief Thread pool structure
+ */
+typedef struct ThreadPool {
+    pthread_t* threads;          /**< Worker threads */
+    ThreadPoolDeque* deques;     /**< One deque per worker */
+    uint32_t worker_count;       /**< Number of workers */
+    uint32_t thread_count;       /**< Number of threads started */
+    atomic_uint queued;          /**< Tasks sitting in deques */
+    atomic_uint pending;         /**< Tasks submitted and not finished */
+    atomic_uint next_deque;      /**< Round robin for submissions from other threads */
+    atomic_uint started;         /**< Hands out worker indexes at thread start */
+    pthread_mutex_t lock;        /**< Protects sleeping and stopping */
+    pthread_cond_t work_ready;   /**< Signalled when a task is queued */
+    pthread_cond_t all_done;     /**< Signalled when pending drops to zero */
+    bool stopping;               /**< Workers exit once the deques are empty */
+} ThreadPool;
+
+/**
+ * @brief Initialize a thread pool and start its workers
+ * @param pool Pointer to ThreadPool structure
+ * @param worker_count Number of worker threads (at least 1)
+ * @return true if success, false if failed
+ */
+bool threadpool_init(ThreadPool* pool, uint32_t worker_count);
+
+/**
+ * @brief Finish the queued tasks, stop the workers and free the pool memory
+ * @param pool Pointer to ThreadPool structure
+ */
+void threadpool_deinit(ThreadPool* pool);
+
+/**
+ * @brief Submit a task. Tasks may submit further tasks.
+ * @param pool Pointer to ThreadPool structure
+ * @param func Function to run
+ * @param arg Argument of the function
+ * @return true if success, false if failed
+ */
+bool threadpool_submit(ThreadPool* pool, ThreadPoolFunc func, void* arg);
+
+/**
+ * @brief Wait until every submitted task, including tasks submitted by tasks, has finished
+ * @param pool Pointer to ThreadPool structure
+ */
+void threadpool_wait(ThreadPool* pool);
+
+/**
+ * @brief Initialize an empty task group
+ * @param group Pointer to ThreadPoolGroup structure
+ * @return true if success, false if failed
+ */
+bool threadpool_group_init(ThreadPoolGroup* group);
+
+/**
+ * @brief Release a task group, its tasks must have finished
+ * @param group Pointer to ThreadPoolGroup structure
+ */
+void threadpool_group_deinit(ThreadPoolGroup* group);
+
+/**
+ * @brief Submit a task that counts in a group. Tasks that should be waited for
+ *        with the group submit their own tasks to the same group.
+ * @param pool Pointer to ThreadPool structure
+ * @param group Group of the task
+ * @param func Function to run
+ * @param arg Argument of the function
+ * @return true if success, false if failed
+ */
+bool threadpool_submit_group(ThreadPool* pool, ThreadPoolGroup* group, ThreadPoolFunc func, void* arg);
+
+/**
+ * @brief Wait until every task of a group has finished, other tasks of the pool are not waited for
+ * @param group Pointer to ThreadPoolGroup structure
+ */
+void threadpool_group_wait(ThreadPoolGroup* group);
+
+/**
+ * @brief Number of online processors, at least 1
+ * @return Processor count
+ */
+uint32_t threadpool_cpu_count(void);
+
+#endif // THREADPOOL_H
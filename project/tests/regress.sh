@@ -0,0 +1,39 @@
+#!/bin/sh
+# @file regress.sh
+# @author Le Duc Son
+# @date 2026-10-19
+# @brief Walk the sample images read-only with a fixed command set and compare
+#        the output with the expected one
+# Usage: regress.sh <application> <image dir> <expected output>
+
+app=$1
+images=$2
+expected=$3
+
+# The images are walked as copies, the index files a mount writes stay out of the tree
+scratch=$(mktemp -d) || exit 1
+trap 'rm -rf "$scratch"' EXIT
+
+run() {
+    image=$1
+    shift
+    cp "$images/$image" "$scratch/$image" || return 1
+    echo "=== $image"
+    { for command in "$@"; do echo "$command"; done; echo exit; } |
+        timeout 60 "$app" "$scratch/$image" read-only 2>&1 |
+        sed -e 's/\x1b\[[0-9;]*m//g' -e 's/DEESOL@[a-z]*: [^$]*\$> /\n> /g' |
+        grep -v -E "Cache |^Mode:|^Mount Index|$scratch"
+}
+
+{
+    run floppy.img evidence ls "cd doc" ls "cd /" "cat sample.txt" "cd app" ls
+    run FAT16_Output.img evidence ls "cd doc16" ls "cd /" "cat s16.txt"
+    run badfloppy1.img evidence ls "cd drafts" ls "cd /" "cat rfc2736.txt"
+    run badfloppy2.img evidence ls "cd drafts" ls "cd /" "cat rfc2736.txt"
+} > "$scratch/regress.txt"
+
+if ! diff -u "$expected" "$scratch/regress.txt"; then
+    echo "regress: FAILED"
+    exit 1
+fi
+echo "regress: OK"
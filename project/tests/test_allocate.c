@@ -0,0 +1,123 @@
+/**
+ * @file test_allocate.c
+ * @author Le Duc Son
+ * @date 2026-10-19
+ * @brief Cluster allocation and its rollback when a FAT write fails
+ * @details Linked with --wrap=block_cache_write_bytes: the n-th FAT write of
+ *          an allocation can be made to fail, on the cluster being marked or
+ *          on the link from the previous one.
+ */
+
+#include "test_common.h"
+#include "../src/fat_driver/fat_driver_private.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Write that fails, counted from the arming, 0 for none
+ */
+static int write_calls;
+static int write_fail_at;
+
+int __real_block_cache_write_bytes(BlockCache* cache, HAL* volume, uint32_t sector,
+                                   uint32_t offset, const void* buffer, uint32_t length);
+
+int __wrap_block_cache_write_bytes(BlockCache* cache, HAL* volume, uint32_t sector,
+                                   uint32_t offset, const void* buffer, uint32_t length) {
+    if (write_fail_at && ++write_calls == write_fail_at) return -1;
+    return __real_block_cache_write_bytes(cache, volume, sector, offset, buffer, length);
+}
+
+/** Free space of a mounted driver in bytes */
+static uint64_t free_bytes(FATDriver* driver) {
+    uint64_t total = 0, free_size = 0;
+    fat_driver_get_filesystem_info(driver, &total, &free_size);
+    return free_size;
+}
+
+/**
+ * Allocate 3 clusters with the fail_at-th FAT write failing, optionally after
+ * a one-cluster chain, and check that nothing stays allocated
+ */
+static void allocate_failing(const char* image, bool after_chain, int fail_at) {
+    FATDriver driver;
+    if (test_make_image(image, 8 * 1024 * 1024) != 0 || test_mount(&driver, image, MODE_READ_WRITE, 1) != 0) {
+        TEST_ASSERT(!"image");
+        return;
+    }
+
+    uint32_t previous = 0;
+    if (after_chain) TEST_ASSERT(fat_driver_allocate_clusters(&driver, 1, 0, &previous) == 0);
+    uint64_t before = free_bytes(&driver);
+
+    uint32_t first = 1;
+    write_calls = 0;
+    write_fail_at = fail_at;
+    int result = fat_driver_allocate_clusters(&driver, 3, previous, &first);
+    write_fail_at = 0;
+
+    TEST_ASSERT(result == -1);
+    TEST_ASSERT(first == 0);
+    TEST_ASSERT(free_bytes(&driver) == before);
+    if (previous) {
+        TEST_ASSERT(fat_driver_get_fat_entry(&driver, previous) >= 0xFFF8);
+        TEST_ASSERT(fat_driver_free_chain(&driver, previous) == 0);
+    }
+    TEST_ASSERT(fat_driver_sync(&driver) == 0);
+    test_unmount(&driver);
+
+    FatCheckReport report;
+    TEST_ASSERT(test_check_image(image, &report) == 0);
+    TEST_ASSERT(report.finding_count == 0);
+    TEST_ASSERT(report.lost_clusters == 0);
+    fat_driver_check_free(&report);
+}
+
+/** A successful allocation is one chain ending in end-of-chain */
+static void allocate_chain(const char* image) {
+    FATDriver driver;
+    if (test_make_image(image, 8 * 1024 * 1024) != 0 || test_mount(&driver, image, MODE_READ_WRITE, 1) != 0) {
+        TEST_ASSERT(!"image");
+        return;
+    }
+
+    uint64_t before = free_bytes(&driver);
+    uint32_t first = 0;
+    TEST_ASSERT(fat_driver_allocate_clusters(&driver, 3, 0, &first) == 0);
+    TEST_ASSERT(before - free_bytes(&driver) == 3 * (uint64_t)driver.boot_sector.sectors_per_cluster * 512);
+
+    uint32_t cluster = first;
+    for (int i = 0; i < 2; i++) {
+        cluster = fat_driver_get_fat_entry(&driver, cluster);
+        TEST_ASSERT(cluster >= 2 && cluster < 0xFFF8);
+    }
+    TEST_ASSERT(fat_driver_get_fat_entry(&driver, cluster) >= 0xFFF8);
+
+    TEST_ASSERT(fat_driver_free_chain(&driver, first) == 0);
+    TEST_ASSERT(free_bytes(&driver) == before);
+    test_unmount(&driver);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) return 2;
+
+    char image[512];
+    test_path(image, argv[1], "allocate.img");
+
+    allocate_chain(image);
+
+    /* Write 3 links the second cluster to the first */
+    allocate_failing(image, false, 3);
+
+    /* Write 2 links the first cluster to the existing chain */
+    allocate_failing(image, true, 2);
+
+    /* Write 4 links the second cluster */
+    allocate_failing(image, true, 4);
+
+    /* Write 1 marks the first cluster */
+    allocate_failing(image, false, 1);
+
+    remove(image);
+    return test_finish("test_allocate");
+}
@@ -0,0 +1,96 @@
+/**
+ * @file test_block_cache.c
+ * @author Le Duc Son
+ * @date 2026-10-19
+ * @brief Write-back of the block cache: flush runs and ranges marked clean
+ */
+
+#include "test_common.h"
+#include "../src/block_cache/block_cache.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Cache slots, more than one flush run holds
+ */
+#define CACHE_SLOTS 200
+
+/** Byte a test writes at the start of a sector */
+static uint8_t sector_mark(uint32_t sector, uint8_t round) {
+    return (uint8_t)(sector * 7 + round);
+}
+
+/** First byte of a sector as stored in the image */
+static uint8_t disk_byte(HAL* hal, uint32_t sector) {
+    uint8_t buffer[512];
+    if (hal_read_sectors(hal, sector, 1, buffer) != (int)sizeof(buffer)) return 0;
+    return buffer[0];
+}
+
+/** Dirty sectors, adjacent beyond a flush run and scattered, all reach the image */
+static void flush_runs(BlockCache* cache, HAL* hal) {
+    for (uint32_t sector = 10; sector < 160; sector++) {
+        uint8_t mark = sector_mark(sector, 1);
+        TEST_ASSERT(block_cache_write_bytes(cache, hal, sector, 0, &mark, 1) == 0);
+    }
+    for (uint32_t sector = 300; sector < 340; sector += 3) {
+        uint8_t mark = sector_mark(sector, 1);
+        TEST_ASSERT(block_cache_write_bytes(cache, hal, sector, 0, &mark, 1) == 0);
+    }
+
+    TEST_ASSERT(block_cache_flush(cache, hal) == 0);
+
+    uint32_t wrong = 0;
+    for (uint32_t sector = 10; sector < 160; sector++) {
+        if (disk_byte(hal, sector) != sector_mark(sector, 1)) wrong++;
+    }
+    for (uint32_t sector = 300; sector < 340; sector += 3) {
+        if (disk_byte(hal, sector) != sector_mark(sector, 1)) wrong++;
+    }
+    TEST_ASSERT(wrong == 0);
+
+    /* Nothing is left dirty */
+    TEST_ASSERT(block_cache_flush(cache, hal) == 0);
+}
+
+/** Sectors marked clean are not written back by a later flush */
+static void mark_clean(BlockCache* cache, HAL* hal) {
+    for (uint32_t sector = 20; sector < 30; sector++) {
+        uint8_t mark = sector_mark(sector, 2);
+        TEST_ASSERT(block_cache_write_bytes(cache, hal, sector, 0, &mark, 1) == 0);
+    }
+
+    /* A small range goes through the hash, one larger than the cache through the slots */
+    block_cache_mark_clean(cache, hal, 20, 3);
+    block_cache_mark_clean(cache, hal, 26, CACHE_SLOTS * 2);
+    TEST_ASSERT(block_cache_flush(cache, hal) == 0);
+
+    for (uint32_t sector = 20; sector < 30; sector++) {
+        bool cleaned = sector < 23 || sector >= 26;
+        uint8_t expected = sector_mark(sector, cleaned ? 1 : 2);
+        TEST_ASSERT(disk_byte(hal, sector) == expected);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) return 2;
+
+    char image[512];
+    test_path(image, argv[1], "block_cache.img");
+
+    HAL hal;
+    BlockCache cache;
+    if (hal_create(&hal, image, SECTOR_SIZE_512, 1024 * 1024) != 0) {
+        TEST_ASSERT(!"image");
+        return test_finish("test_block_cache");
+    }
+    TEST_ASSERT(block_cache_init(&cache, CACHE_SLOTS, 512) == 0);
+
+    flush_runs(&cache, &hal);
+    mark_clean(&cache, &hal);
+
+    block_cache_deinit(&cache);
+    hal_deinit(&hal);
+    remove(image);
+    return test_finish("test_block_cache");
+}
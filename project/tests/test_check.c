@@ -0,0 +1,92 @@
+/**
+ * @file test_check.c
+ * @author Le Duc Son
+ * @date 2026-10-19
+ * @brief Volume check on clean, changed and shared-pool mounts
+ */
+
+#include "test_common.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Files in the test image, more than one chain walk task holds
+ */
+#define CHECK_FILES 100
+
+/** A freshly imported volume checks clean */
+static void check_clean(const char* image) {
+    FatCheckReport report;
+    TEST_ASSERT(test_check_image(image, &report) == 0);
+    TEST_ASSERT(report.finding_count == 0);
+    TEST_ASSERT(report.lost_clusters == 0);
+    TEST_ASSERT(report.files == CHECK_FILES + 1);
+    fat_driver_check_free(&report);
+}
+
+/** A read-write mount is checked with its unsynced changes */
+static void check_unsynced_delete(const char* image) {
+    FATDriver driver;
+    if (test_mount(&driver, image, MODE_READ_WRITE, 1) != 0) {
+        TEST_ASSERT(!"mount");
+        return;
+    }
+
+    FileNode* big = fat_driver_find_path(&driver, "/f100.dat");
+    TEST_ASSERT(big != NULL);
+    if (big) TEST_ASSERT(fat_driver_delete_entry(&driver, big) == 0);
+
+    FatCheckReport report;
+    memset(&report, 0, sizeof(report));
+    TEST_ASSERT(fat_driver_check(&driver, &report) == 0);
+    TEST_ASSERT(report.finding_count == 0);
+    TEST_ASSERT(report.lost_clusters == 0);
+    TEST_ASSERT(report.files == CHECK_FILES);
+    fat_driver_check_free(&report);
+
+    test_unmount(&driver);
+}
+
+/** A check waits for its own tasks, not for other work on the driver pool */
+static void check_shared_pool(const char* image) {
+    FATDriver driver;
+    if (test_mount(&driver, image, MODE_READ_ONLY, 2) != 0) {
+        TEST_ASSERT(!"mount");
+        return;
+    }
+
+    test_block_worker(driver.pool);
+
+    FatCheckReport report;
+    memset(&report, 0, sizeof(report));
+    TEST_ASSERT(fat_driver_check(&driver, &report) == 0);
+    TEST_ASSERT(test_worker_blocked());
+    TEST_ASSERT(report.finding_count == 0);
+    fat_driver_check_free(&report);
+
+    test_release_worker();
+    test_unmount(&driver);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) return 2;
+
+    char image[512];
+    test_path(image, argv[1], "check.img");
+
+    FATDriver driver;
+    if (test_make_image(image, 8 * 1024 * 1024) != 0 || test_mount(&driver, image, MODE_READ_WRITE, 1) != 0) {
+        TEST_ASSERT(!"image");
+        return test_finish("test_check");
+    }
+    TEST_ASSERT(test_import_files(&driver, 0, CHECK_FILES, 1024) == 0);
+    TEST_ASSERT(test_import_files(&driver, CHECK_FILES, 1, 200 * 1024) == 0);
+    test_unmount(&driver);
+
+    check_clean(image);
+    check_shared_pool(image);
+    check_unsynced_delete(image);
+
+    remove(image);
+    return test_finish("test_check");
+}
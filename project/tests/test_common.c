@@ -0,0 +1,178 @@
+/**
+ * @file test_common.c
+ * @author Le Duc Son
+ * @date 2026-10-19
+ * @brief Helpers shared by the test programs
+ */
+
+#include "test_common.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+int test_failures = 0;
+
+/**
+ * State of the task started by test_block_worker()
+ */
+static pthread_mutex_t blocker_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t blocker_changed = PTHREAD_COND_INITIALIZER;
+static bool blocker_running = false;
+static bool blocker_released = false;
+
+/* Local functions */
+static int test_read_content(const FatImportEntry* entries, uint32_t index, uint32_t offset, void* buffer,
+                             uint32_t size, void* user_data);
+static void test_blocker_task(void* arg, uint32_t worker);
+
+/** Build the path of a file in the scratch directory */
+const char* test_path(char* buffer, const char* directory, const char* name) {
+    snprintf(buffer, 512, "%s/%s", directory, name);
+    return buffer;
+}
+
+/** Create an empty FAT16 image */
+int test_make_image(const char* path, uint64_t size) {
+    FatFormatOptions options = { size, FAT_TYPE_16, 0 };
+    return fat_driver_format(path, &options, NULL);
+}
+
+/** Initialize and mount a driver on an image */
+int test_mount(FATDriver* driver, const char* path, FileSystemMode mode, uint32_t workers) {
+    FileSystemConfig config = {
+        path, mode, FAT_TYPE_16, SECTOR_SIZE_512, CACHE_SIZE_128, DIR_NAME_LEN_8,
+        FAT_TABLE_PAGED, workers, false, false
+    };
+
+    if (fat_driver_init(driver, config) != 0) return -1;
+    if (fat_driver_mount(driver) != 0) {
+        fat_driver_deinit(driver);
+        return -1;
+    }
+    return 0;
+}
+
+/** Unmount and deinitialize a driver mounted with test_mount() */
+void test_unmount(FATDriver* driver) {
+    fat_driver_unmount(driver);
+    fat_driver_deinit(driver);
+}
+
+/** Byte at an offset of a test file */
+uint8_t test_content(uint32_t index, uint32_t offset) {
+    return (uint8_t)(index * 31 + offset / 7 + (offset >> 9));
+}
+
+/** Import regular files named F<index>.DAT into the root directory */
+int test_import_files(FATDriver* driver, uint32_t first, uint32_t count, uint32_t size) {
+    FatImportEntry* entries = calloc(count, sizeof(FatImportEntry));
+    char* names = malloc((size_t)count * 13);
+    if (!entries || !names) {
+        free(entries);
+        free(names);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        snprintf(names + (size_t)i * 13, 13, "F%u.DAT", first + i);
+        entries[i].name = names + (size_t)i * 13;
+        entries[i].type = FILE_TYPE_REGULAR;
+        entries[i].parent = FAT_IMPORT_TOP;
+        entries[i].size = size;
+    }
+
+    FatImportReport report;
+    int result = fat_driver_import(driver, fat_driver_get_root_directory(driver), entries, count,
+                                   test_read_content, &first, &report);
+    if (result == 0 && report.files != count) result = -1;
+
+    free(entries);
+    free(names);
+    return result;
+}
+
+/** Run a check of an image on a read-only mount */
+int test_check_image(const char* path, FatCheckReport* report) {
+    FATDriver driver;
+
+    memset(report, 0, sizeof(FatCheckReport));
+    if (test_mount(&driver, path, MODE_READ_ONLY, 1) != 0) return -1;
+    int result = fat_driver_check(&driver, report);
+    test_unmount(&driver);
+    return result;
+}
+
+/** Occupy one worker of a pool with a task of another caller */
+void test_block_worker(ThreadPool* pool) {
+    pthread_mutex_lock(&blocker_lock);
+    blocker_released = false;
+    if (threadpool_submit(pool, test_blocker_task, NULL)) {
+        while (!blocker_running) {
+            pthread_cond_wait(&blocker_changed, &blocker_lock);
+        }
+    }
+    pthread_mutex_unlock(&blocker_lock);
+}
+
+/** Tell whether the task of test_block_worker() is still running */
+bool test_worker_blocked(void) {
+    pthread_mutex_lock(&blocker_lock);
+    bool running = blocker_running;
+    pthread_mutex_unlock(&blocker_lock);
+    return running;
+}
+
+/** End the task of test_block_worker() and wait until it has returned */
+void test_release_worker(void) {
+    pthread_mutex_lock(&blocker_lock);
+    blocker_released = true;
+    pthread_cond_broadcast(&blocker_changed);
+    while (blocker_running) {
+        pthread_cond_wait(&blocker_changed, &blocker_lock);
+    }
+    pthread_mutex_unlock(&blocker_lock);
+}
+
+/** Print the outcome of a test program */
+int test_finish(const char* name) {
+    if (test_failures == 0) {
+        printf("%s: OK\n", name);
+        return 0;
+    }
+    printf("%s: %d assertion(s) failed\n", name, test_failures);
+    return 1;
+}
+
+/** Import callback: content of file first + index */
+static int test_read_content(const FatImportEntry* entries, uint32_t index, uint32_t offset, void* buffer,
+                             uint32_t size, void* user_data) {
+    (void)entries;
+    uint32_t first = *(const uint32_t*)user_data;
+    uint8_t* bytes = (uint8_t*)buffer;
+
+    for (uint32_t i = 0; i < size; i++) {
+        bytes[i] = test_content(first + index, offset + i);
+    }
+    return 0;
+}
+
+/** Task of test_block_worker(): wait for the release, at most 10 seconds */
+static void test_blocker_task(void* arg, uint32_t worker) {
+    (void)arg;
+    (void)worker;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 10;
+
+    pthread_mutex_lock(&blocker_lock);
+    blocker_running = true;
+    pthread_cond_broadcast(&blocker_changed);
+    while (!blocker_released) {
+        if (pthread_cond_timedwait(&blocker_changed, &blocker_lock, &deadline) != 0) break;
+    }
+    blocker_running = false;
+    pthread_cond_broadcast(&blocker_changed);
+    pthread_mutex_unlock(&blocker_lock);
+}
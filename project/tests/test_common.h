@@ -0,0 +1,124 @@
+/**
+ * @file test_common.h
+ * @author Le Duc Son
+ * @date 2026-10-19
+ * @brief Helpers shared by the test programs
+ * @details Each test program is built against every object of the project
+ *          except the application and run by "make test" with a scratch
+ *          directory as its only argument. Images are created in that
+ *          directory with fat_driver_format() and filled through the driver,
+ *          so no test depends on an image outside the tree. A program exits
+ *          with 0 when every TEST_ASSERT held.
+ */
+
+#ifndef TEST_COMMON_H
+#define TEST_COMMON_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "../src/fat_driver/fat_driver.h"
+#include "../src/utilities/threadpool/threadpool.h"
+
+/**
+ * Number of assertions that failed so far
+ */
+extern int test_failures;
+
+/**
+ * Record a failure, with its location, when a condition does not hold
+ */
+#define TEST_ASSERT(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #condition); \
+            test_failures++; \
+        } \
+    } while (0)
+
+/**
+ * Build the path of a file in the scratch directory
+ * @param buffer Buffer of at least 512 bytes
+ * @param directory Scratch directory given to the test
+ * @param name File name
+ * @return buffer
+ */
+const char* test_path(char* buffer, const char* directory, const char* name);
+
+/**
+ * Create an empty FAT16 image
+ * @param path Path of the image
+ * @param size Image size in bytes
+ * @return 0 if success, -1 if failed
+ */
+int test_make_image(const char* path, uint64_t size);
+
+/**
+ * Initialize and mount a driver on an image
+ * @param driver Driver to mount
+ * @param path Path of the image
+ * @param mode MODE_READ_ONLY or MODE_READ_WRITE
+ * @param workers Worker threads of the driver pool
+ * @return 0 if success, -1 if failed
+ */
+int test_mount(FATDriver* driver, const char* path, FileSystemMode mode, uint32_t workers);
+
+/**
+ * Unmount and deinitialize a driver mounted with test_mount()
+ * @param driver Driver to release
+ */
+void test_unmount(FATDriver* driver);
+
+/**
+ * Byte at an offset of a test file, so content can be checked after it moved
+ * @param index Index of the file
+ * @param offset Offset in the file
+ * @return Content byte
+ */
+uint8_t test_content(uint32_t index, uint32_t offset);
+
+/**
+ * Import regular files named F<index>.DAT into the root directory, holding
+ * test_content() bytes
+ * @param driver Read-write mounted driver
+ * @param first Index of the first file
+ * @param count Number of files
+ * @param size Size of each file in bytes
+ * @return 0 if success, -1 if failed
+ */
+int test_import_files(FATDriver* driver, uint32_t first, uint32_t count, uint32_t size);
+
+/**
+ * Run a check of an image on a read-only mount
+ * @param path Path of the image
+ * @param report Report to fill, free with fat_driver_check_free()
+ * @return 0 if the check ran, -1 if failed
+ */
+int test_check_image(const char* path, FatCheckReport* report);
+
+/**
+ * Occupy one worker of a pool with a task of another caller, until
+ * test_release_worker() or 10 seconds have passed. Returns once the task runs.
+ * @param pool Pool to occupy
+ */
+void test_block_worker(ThreadPool* pool);
+
+/**
+ * Tell whether the task of test_block_worker() is still running
+ * @return true while the worker is occupied
+ */
+bool test_worker_blocked(void);
+
+/**
+ * End the task of test_block_worker() and wait until it has returned
+ */
+void test_release_worker(void);
+
+/**
+ * Print the outcome of a test program
+ * @param name Name of the test program
+ * @return Exit status, 0 if no assertion failed
+ */
+int test_finish(const char* name);
+
+#endif /* TEST_COMMON_H */
@@ -0,0 +1,156 @@
+/**
+ * @file test_defrag.c
+ * @author Le Duc Son
+ * @date 2026-10-19
+ * @brief Defragmentation, complete and stopped part way
+ * @details Linked with --wrap=hal_write_sectors, so the data copy of a move
+ *          can be made to fail after earlier moves went through.
+ */
+
+#include "test_common.h"
+#include "../src/fat_driver/fat_driver_private.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Sectors of the target runs loaded into the cache before a defrag
+ */
+#define DEFRAG_PRELOAD_SECTORS 48
+
+/**
+ * Data area write that fails, counted from the arming, 0 for none
+ */
+static uint32_t data_start;
+static int data_writes;
+static int data_fail_at;
+
+int __real_hal_write_sectors(HAL* hal, uint32_t sector_number, uint32_t count, const void* buffer);
+
+int __wrap_hal_write_sectors(HAL* hal, uint32_t sector_number, uint32_t count, const void* buffer) {
+    if (data_fail_at && sector_number >= data_start && ++data_writes == data_fail_at) return -1;
+    return __real_hal_write_sectors(hal, sector_number, count, buffer);
+}
+
+/**
+ * Build a volume of four one-cluster files where F0 and F1 then grow by two
+ * clusters each, placed after F3: both end up in two extents
+ */
+static int make_fragmented(const char* image) {
+    FATDriver driver;
+    if (test_make_image(image, 8 * 1024 * 1024) != 0 || test_mount(&driver, image, MODE_READ_WRITE, 1) != 0) {
+        return -1;
+    }
+
+    uint32_t cluster_size = driver.boot_sector.sectors_per_cluster * 512;
+    int result = test_import_files(&driver, 0, 4, cluster_size);
+
+    for (uint32_t i = 0; result == 0 && i < 2; i++) {
+        char path[16];
+        snprintf(path, sizeof(path), "/f%u.dat", i);
+        FileNode* file = fat_driver_find_path(&driver, path);
+        uint32_t added = 0;
+        if (!file || fat_driver_allocate_clusters(&driver, 2, file->first_cluster, &added) != 0) {
+            result = -1;
+            break;
+        }
+        file->size = 3 * cluster_size;
+        result = fat_driver_update_entry(&driver, file);
+    }
+
+    if (result == 0) result = fat_driver_sync(&driver);
+    test_unmount(&driver);
+    return result;
+}
+
+/** First cluster of a file is still test_content() after a move */
+static bool content_kept(FATDriver* driver, const char* path, uint32_t index) {
+    FileNode* file = fat_driver_find_path(driver, path);
+    if (!file) return false;
+
+    uint8_t* buffer = malloc(file->size);
+    bool kept = buffer && fat_driver_read_file(driver, file, buffer, file->size) == (int)file->size &&
+                buffer[0] == test_content(index, 0) && buffer[100] == test_content(index, 100);
+    free(buffer);
+    return kept;
+}
+
+/** Both fragmented files end up contiguous, content and volume intact */
+static void defrag_all(const char* image) {
+    FATDriver driver;
+    if (make_fragmented(image) != 0 || test_mount(&driver, image, MODE_READ_WRITE, 1) != 0) {
+        TEST_ASSERT(!"image");
+        return;
+    }
+
+    FatDefragReport report;
+    TEST_ASSERT(fat_driver_defrag(&driver, &report) == 0);
+    TEST_ASSERT(report.fragmented_before == 2);
+    TEST_ASSERT(report.fragmented_after == 0);
+    TEST_ASSERT(report.moved == 2);
+    TEST_ASSERT(content_kept(&driver, "/f0.dat", 0));
+    TEST_ASSERT(content_kept(&driver, "/f1.dat", 1));
+    test_unmount(&driver);
+
+    FatCheckReport check;
+    TEST_ASSERT(test_check_image(image, &check) == 0);
+    TEST_ASSERT(check.finding_count == 0);
+    fat_driver_check_free(&check);
+}
+
+/**
+ * A defrag that fails on its second move leaves no cached sector with the
+ * content the first move wrote over behind the cache
+ */
+static void defrag_stopped(const char* image) {
+    FATDriver driver;
+    if (make_fragmented(image) != 0 || test_mount(&driver, image, MODE_READ_WRITE, 1) != 0) {
+        TEST_ASSERT(!"image");
+        return;
+    }
+
+    /* The moves go to the lowest free clusters, cache them as they are now */
+    uint32_t free_cluster = 2;
+    while (fat_driver_get_fat_entry(&driver, free_cluster) != 0) {
+        free_cluster++;
+    }
+    uint32_t first_sector = fat_driver_cluster_to_sector(&driver, free_cluster);
+    uint8_t sector[512];
+    for (uint32_t i = 0; i < DEFRAG_PRELOAD_SECTORS; i++) {
+        block_cache_read(driver.cache, driver.hal, first_sector + i, sector);
+    }
+
+    data_start = driver.first_data_sector;
+    data_writes = 0;
+    data_fail_at = 2;
+    FatDefragReport report;
+    int result = fat_driver_defrag(&driver, &report);
+    data_fail_at = 0;
+
+    TEST_ASSERT(result == -1);
+    TEST_ASSERT(report.moved == 1);
+
+    uint32_t stale = 0;
+    for (uint32_t i = 0; i < DEFRAG_PRELOAD_SECTORS; i++) {
+        uint8_t on_disk[512];
+        block_cache_read(driver.cache, driver.hal, first_sector + i, sector);
+        hal_read_sectors(driver.hal, first_sector + i, 1, on_disk);
+        if (memcmp(sector, on_disk, sizeof(sector)) != 0) stale++;
+    }
+    TEST_ASSERT(stale == 0);
+    TEST_ASSERT(content_kept(&driver, "/f0.dat", 0));
+    TEST_ASSERT(content_kept(&driver, "/f1.dat", 1));
+    test_unmount(&driver);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) return 2;
+
+    char image[512];
+    test_path(image, argv[1], "defrag.img");
+
+    defrag_all(image);
+    defrag_stopped(image);
+
+    remove(image);
+    return test_finish("test_defrag");
+}
@@ -0,0 +1,126 @@
+/**
+ * @file test_import.c
+ * @author Le Duc Son
+ * @date 2026-10-19
+ * @brief Tree import, and its rollback when linking or the final sync fails
+ * @details Linked with --wrap=fat_driver_set_fat_entry and
+ *          --wrap=fat_driver_sync_unlocked, so either can be made to fail
+ *          part way through an import.
+ */
+
+#include "test_common.h"
+#include "../src/fat_driver/fat_driver_private.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Call that fails, counted from the arming, 0 for none
+ */
+static int set_calls;
+static int set_fail_at;
+static int sync_calls;
+static int sync_fail_at;
+
+int __real_fat_driver_set_fat_entry(FATDriver* driver, uint32_t cluster, uint32_t value);
+int __real_fat_driver_sync_unlocked(FATDriver* driver);
+
+int __wrap_fat_driver_set_fat_entry(FATDriver* driver, uint32_t cluster, uint32_t value) {
+    if (set_fail_at && ++set_calls == set_fail_at) return -1;
+    return __real_fat_driver_set_fat_entry(driver, cluster, value);
+}
+
+int __wrap_fat_driver_sync_unlocked(FATDriver* driver) {
+    if (sync_fail_at && ++sync_calls == sync_fail_at) return -1;
+    return __real_fat_driver_sync_unlocked(driver);
+}
+
+/** Import callback: test_content() of the entry index */
+static int read_content(const FatImportEntry* entries, uint32_t index, uint32_t offset, void* buffer,
+                        uint32_t size, void* user_data) {
+    (void)entries;
+    (void)user_data;
+    for (uint32_t i = 0; i < size; i++) {
+        ((uint8_t*)buffer)[i] = test_content(index, offset + i);
+    }
+    return 0;
+}
+
+/**
+ * Import IMP/A.TXT, B.TXT and C.TXT, with one call made to fail when
+ * set_fail_at or sync_fail_at is given, and check the volume afterwards
+ */
+static void import_tree(const char* image, int set_fail, int sync_fail) {
+    FATDriver driver;
+    if (test_make_image(image, 8 * 1024 * 1024) != 0 || test_mount(&driver, image, MODE_READ_WRITE, 1) != 0) {
+        TEST_ASSERT(!"image");
+        return;
+    }
+
+    uint64_t total = 0, free_before = 0, free_after = 0;
+    fat_driver_get_filesystem_info(&driver, &total, &free_before);
+
+    static const char* names[] = { "IMP", "A.TXT", "B.TXT", "C.TXT" };
+    FatImportEntry entries[4];
+    memset(entries, 0, sizeof(entries));
+    for (uint32_t i = 0; i < 4; i++) {
+        entries[i].name = names[i];
+        entries[i].type = i == 0 ? FILE_TYPE_DIRECTORY : FILE_TYPE_REGULAR;
+        entries[i].parent = i == 0 ? FAT_IMPORT_TOP : 0;
+        entries[i].size = i == 0 ? 0 : 5000;
+    }
+
+    set_calls = 0;
+    sync_calls = 0;
+    set_fail_at = set_fail;
+    sync_fail_at = sync_fail;
+    FatImportReport report;
+    int result = fat_driver_import(&driver, fat_driver_get_root_directory(&driver), entries, 4,
+                                   read_content, NULL, &report);
+    set_fail_at = 0;
+    sync_fail_at = 0;
+
+    bool failing = set_fail || sync_fail;
+    TEST_ASSERT(result == (failing ? -1 : 0));
+    TEST_ASSERT(fat_driver_sync(&driver) == 0);
+    fat_driver_get_filesystem_info(&driver, &total, &free_after);
+    if (failing) TEST_ASSERT(free_after == free_before);
+    test_unmount(&driver);
+
+    /* A failed import leaves nothing behind, a good one reads back */
+    TEST_ASSERT(test_mount(&driver, image, MODE_READ_ONLY, 1) == 0);
+    FileNode* file = fat_driver_find_path(&driver, "/imp/b.txt");
+    if (failing) {
+        TEST_ASSERT(fat_driver_find_path(&driver, "/imp") == NULL);
+    } else if (file) {
+        uint8_t buffer[5000];
+        TEST_ASSERT(fat_driver_read_file(&driver, file, buffer, sizeof(buffer)) == (int)sizeof(buffer));
+        TEST_ASSERT(buffer[0] == test_content(2, 0) && buffer[4999] == test_content(2, 4999));
+    } else {
+        TEST_ASSERT(!"imported file missing");
+    }
+    test_unmount(&driver);
+
+    FatCheckReport check;
+    TEST_ASSERT(test_check_image(image, &check) == 0);
+    TEST_ASSERT(check.finding_count == 0);
+    TEST_ASSERT(check.lost_clusters == 0);
+    fat_driver_check_free(&check);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) return 2;
+
+    char image[512];
+    test_path(image, argv[1], "import.img");
+
+    import_tree(image, 0, 0);
+
+    /* The 8th FAT write is while the planned chains are linked */
+    import_tree(image, 8, 0);
+
+    /* The 2nd sync is the final one, after the entries were written */
+    import_tree(image, 0, 2);
+
+    remove(image);
+    return test_finish("test_import");
+}
@@ -0,0 +1,148 @@
+/**
+ * @file test_middleware.c
+ * @author Le Duc Son
+ * @date 2026-10-19
+ * @brief Find, grep and export on a shared driver pool, and export of names
+ *        that are not one host component
+ */
+
+#include "test_common.h"
+#include "../src/middleware/middleware_find.h"
+#include "../src/middleware/middleware_grep.h"
+#include "../src/middleware/middleware_export.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/**
+ * Files in the test image
+ */
+#define MIDDLEWARE_FILES 100
+
+/** Find callback: count the matches */
+static void count_found(const FileNode* node, const char* path, void* user_data) {
+    (void)node;
+    (void)path;
+    (*(uint32_t*)user_data)++;
+}
+
+/** Grep callback: count the matches */
+static void count_matched(const GrepMatch* match, void* user_data) {
+    (void)match;
+    (*(uint32_t*)user_data)++;
+}
+
+/**
+ * Rename the directory entry of F5.DAT on disk to "../PWN.TXT", a name
+ * the driver lists as it is but no host directory may receive
+ */
+static int plant_unsafe_name(const char* image) {
+    FATDriver driver;
+    if (test_mount(&driver, image, MODE_READ_ONLY, 1) != 0) return -1;
+    uint32_t first = driver.first_root_dir_sector;
+    uint32_t count = driver.root_dir_sectors;
+    test_unmount(&driver);
+
+    HAL hal;
+    if (hal_init(&hal, image, SECTOR_SIZE_512) != 0) return -1;
+
+    int result = -1;
+    uint8_t sector[512];
+    for (uint32_t i = 0; result != 0 && i < count; i++) {
+        if (hal_read_sectors(&hal, first + i, 1, sector) != (int)sizeof(sector)) break;
+        for (uint32_t offset = 0; offset < sizeof(sector); offset += 32) {
+            if (memcmp(sector + offset, "F5      DAT", 11) != 0) continue;
+            memcpy(sector + offset, "../PWN  TXT", 11);
+            result = hal_write_sectors(&hal, first + i, 1, sector) == (int)sizeof(sector) ? 0 : -1;
+            break;
+        }
+    }
+
+    hal_deinit(&hal);
+    return result;
+}
+
+/** Find, grep and export wait for their own tasks, not for other work on the pool */
+static void shared_pool(const char* image, const char* scratch) {
+    FATDriver driver;
+    if (test_mount(&driver, image, MODE_READ_ONLY, 2) != 0) {
+        TEST_ASSERT(!"mount");
+        return;
+    }
+    FileNode* root = fat_driver_get_root_directory(&driver);
+
+    test_block_worker(driver.pool);
+
+    FindQuery query;
+    middleware_find_query_init(&query);
+    query.type = FIND_TYPE_FILE;
+    uint32_t found = 0;
+    TEST_ASSERT(middleware_find_run(&driver, root, &query, count_found, &found) == MIDDLEWARE_FILES);
+    TEST_ASSERT(found == MIDDLEWARE_FILES);
+    TEST_ASSERT(test_worker_blocked());
+
+    /* The first 7 bytes of F1.DAT are all test_content(1, 0) */
+    char pattern[8];
+    memset(pattern, test_content(1, 0), 7);
+    pattern[7] = '\0';
+    const char* patterns[] = { pattern };
+    uint32_t matched = 0;
+    TEST_ASSERT(middleware_grep_run(&driver, root, NULL, patterns, 1, count_matched, &matched) > 0);
+    TEST_ASSERT(matched > 0);
+    TEST_ASSERT(test_worker_blocked());
+
+    char host[512];
+    ExportStats stats;
+    TEST_ASSERT(middleware_export_run(&driver, root, test_path(host, scratch, "export_pool"), &stats) == 0);
+    TEST_ASSERT(stats.files == MIDDLEWARE_FILES);
+    TEST_ASSERT(test_worker_blocked());
+
+    test_release_worker();
+    test_unmount(&driver);
+}
+
+/** An entry whose name leaves the host directory is left out and reported */
+static void unsafe_name(const char* image, const char* scratch) {
+    char path[512];
+    struct stat status;
+
+    TEST_ASSERT(plant_unsafe_name(image) == 0);
+
+    FATDriver driver;
+    if (test_mount(&driver, image, MODE_READ_ONLY, 1) != 0) {
+        TEST_ASSERT(!"mount");
+        return;
+    }
+
+    ExportStats stats;
+    int result = middleware_export_run(&driver, fat_driver_get_root_directory(&driver),
+                                       test_path(path, scratch, "export_unsafe"), &stats);
+    TEST_ASSERT(result == -1);
+    TEST_ASSERT(stats.unsafe_names == 1);
+    TEST_ASSERT(stats.files == MIDDLEWARE_FILES - 1);
+    TEST_ASSERT(stat(test_path(path, scratch, "pwn.txt"), &status) != 0);
+    TEST_ASSERT(stat(test_path(path, scratch, "PWN.TXT"), &status) != 0);
+
+    test_unmount(&driver);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) return 2;
+
+    char image[512];
+    test_path(image, argv[1], "middleware.img");
+
+    FATDriver driver;
+    if (test_make_image(image, 8 * 1024 * 1024) != 0 || test_mount(&driver, image, MODE_READ_WRITE, 1) != 0) {
+        TEST_ASSERT(!"image");
+        return test_finish("test_middleware");
+    }
+    TEST_ASSERT(test_import_files(&driver, 0, MIDDLEWARE_FILES, 1024) == 0);
+    test_unmount(&driver);
+
+    shared_pool(image, argv[1]);
+    unsafe_name(image, argv[1]);
+
+    remove(image);
+    return test_finish("test_middleware");
+}
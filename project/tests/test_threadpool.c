@@ -0,0 +1,85 @@
+/**
+ * @file test_threadpool.c
+ * @author Le Duc Son
+ * @date 2026-10-19
+ * @brief Task groups of the thread pool
+ */
+
+#include "test_common.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+
+/**
+ * Depth of the task tree each root task spawns, 2^depth tasks per root
+ */
+#define TREE_DEPTH 6
+
+/**
+ * Task of the tree: submits two children to its group until the depth is reached
+ */
+typedef struct {
+    ThreadPool* pool;
+    ThreadPoolGroup* group;
+    atomic_uint* finished;
+    uint32_t depth;
+} TreeTask;
+
+/** Run one node of the tree, children inline when the pool refuses them */
+static void tree_task(void* arg, uint32_t worker) {
+    TreeTask* task = (TreeTask*)arg;
+
+    if (task->depth < TREE_DEPTH) {
+        for (int i = 0; i < 2; i++) {
+            TreeTask* child = malloc(sizeof(TreeTask));
+            if (!child) continue;
+            *child = *task;
+            child->depth = task->depth + 1;
+            if (!threadpool_submit_group(task->pool, task->group, tree_task, child)) {
+                tree_task(child, worker);
+            }
+        }
+    }
+
+    atomic_fetch_add(task->finished, 1);
+    free(task);
+}
+
+/**
+ * A group wait returns when the group's tasks and the tasks they submitted
+ * are done, while a task of another caller still occupies a worker
+ */
+static void group_wait(uint32_t workers) {
+    ThreadPool pool;
+    ThreadPoolGroup group;
+    TEST_ASSERT(threadpool_init(&pool, workers));
+    TEST_ASSERT(threadpool_group_init(&group));
+
+    test_block_worker(&pool);
+
+    atomic_uint finished;
+    atomic_init(&finished, 0);
+    for (int i = 0; i < 4; i++) {
+        TreeTask* root = malloc(sizeof(TreeTask));
+        if (!root) continue;
+        *root = (TreeTask){ &pool, &group, &finished, 0 };
+        if (!threadpool_submit_group(&pool, &group, tree_task, root)) tree_task(root, 0);
+    }
+    threadpool_group_wait(&group);
+
+    TEST_ASSERT(atomic_load(&finished) == 4 * ((1u << (TREE_DEPTH + 1)) - 1));
+    TEST_ASSERT(test_worker_blocked());
+
+    test_release_worker();
+    threadpool_group_deinit(&group);
+    threadpool_deinit(&pool);
+}
+
+int main(int argc, char* argv[]) {
+    (void)argc;
+    (void)argv;
+
+    group_wait(2);
+    group_wait(4);
+
+    return test_finish("test_threadpool");
+}